@@ -283,6 +283,19 @@ typedef struct CkMainInfo {
 				 * see comment in ckWindow.c. */
   double lastRefresh;		/* Delay computation for updates. */
   Tk_TimerToken refreshTimer;	/* Timer for delayed updates. */
+  double updateCost;		/* Average time in milliseconds spent for
+				 * a screen update, and ... */
+  double updateXmit;		/* ... average time in milliseconds needed
+				 * to transmit it at the terminal's baud
+				 * rate. Both drive refreshDelay when
+				 * CK_REFRESH_AUTO is set. */
+  int damageRows;		/* Number of screen lines covered by the
+				 * damageLeft/damageRight arrays. */
+  int *damageLeft, *damageRight;/* For each screen line the range of
+				 * columns [left, right) which must be
+				 * repainted on the next refresh; empty
+				 * if left >= right. Managed by
+				 * ckWindow.c. */
   int mouseData;                /* Value used by mouse handling code. */
   ClientData barcodeData;	/* Value used by bar code handling code. */
   int flags;			/* See definitions below. */
@@ -303,6 +316,7 @@ typedef struct CkMainInfo {
 #define CK_HAS_BARCODE     32
 #define CK_NOCLR_ON_EXIT   64
 #define CK_RESIZING       128  /* set by signal handler for SIGWINCH */
+#define CK_REFRESH_AUTO   256  /* refreshDelay adapts to update cost */
 /*
  * Ck keeps one of the following structures for each window.
  * This information is (mostly) managed by ckWindow.c.
@@ -622,8 +636,10 @@ EXTERN int	CkBarcodeCmd _ANSI_ARGS_((ClientData clientData,
 					  Tcl_Interp *interp, int argc, char **argv));
 EXTERN int	CkBarcodeCmdObj _ANSI_ARGS_((ClientData clientData,
 					     Tcl_Interp *interp, int objc, Tcl_Obj* CONST objv[]));
-EXTERN void	CkBindEventProc _ANSI_ARGS_((CkWindow *winPtr,
+EXTERN int	CkBindEventProc _ANSI_ARGS_((CkWindow *winPtr,
 					     CkEvent *eventPtr));
+EXTERN int	CkColorPairStats _ANSI_ARGS_((Tcl_Interp *interp));
+EXTERN void	CkColorPairsShown _ANSI_ARGS_((void));
 EXTERN int	CkCopyAndGlobalEval _ANSI_ARGS_((Tcl_Interp *interp,
 						 char *string));
 EXTERN void	CkDisplayChars _ANSI_ARGS_((CkMainInfo *mainPtr,
@@ -634,6 +650,8 @@ EXTERN void	CkFreeBindingTags _ANSI_ARGS_((CkWindow *winPtr));
 EXTERN char *	CkGetBarcodeData _ANSI_ARGS_((CkMainInfo *mainPtr));
 
 EXTERN void	CkHandleInput _ANSI_ARGS_((ClientData clientData, int mask));
+EXTERN int	CkInputPending _ANSI_ARGS_((void));
+EXTERN void	CkQueueInput _ANSI_ARGS_((void));
 
 EXTERN int	CkInitFrame _ANSI_ARGS_((Tcl_Interp *interp, CkWindow *winPtr,
 					 int argc, char **argv));
@@ -665,6 +683,8 @@ EXTERN void	CkUnderlineChars _ANSI_ARGS_((CkMainInfo *mainPtr,
 
 void CkpStartMouse();
 void CkpEndMouse();
+void CkpStartPaste();
+void CkpEndPaste();
 
 /*
  * Exported procedures.
@@ -672,7 +692,7 @@ void CkpEndMouse();
 
 EXTERN void     Ck_AddOption _ANSI_ARGS_((CkWindow *winPtr, char *name,
 					  char *value, int priority));
-EXTERN void	Ck_BindEvent _ANSI_ARGS_((Ck_BindingTable bindingTable,
+EXTERN int	Ck_BindEvent _ANSI_ARGS_((Ck_BindingTable bindingTable,
 					  CkEvent *eventPtr, CkWindow *winPtr, int numObjects,
 					  ClientData *objectPtr));
 EXTERN void     Ck_ClearToBot _ANSI_ARGS_((CkWindow *winPtr, int x, int y));
@@ -759,6 +779,7 @@ EXTERN void     Ck_QueueVirtualEvent _ANSI_ARGS_((struct CkWindow *windowPtr,
 						  char *detail));
 EXTERN void     Ck_QueueFullResizeEvent _ANSI_ARGS_((struct CkWindow *windowPtr));
 EXTERN int	Ck_Init _ANSI_ARGS_((Tcl_Interp *interp));
+EXTERN int	Ckemulator_Init _ANSI_ARGS_((Tcl_Interp *interp));
 EXTERN void	Ck_Main _ANSI_ARGS_((int argc, char **argv,
 				     int (*appInitProc)()));
 EXTERN void	Ck_MainLoop _ANSI_ARGS_((void));
@@ -795,6 +816,7 @@ EXTERN void	Ck_SetWindowAttr _ANSI_ARGS_((CkWindow *winPtr, int fg,
 EXTERN void	Ck_UnmaintainGeometry _ANSI_ARGS_((CkWindow *slave,
 						   CkWindow *master));
 EXTERN void	Ck_UnmapWindow _ANSI_ARGS_((CkWindow *winPtr));
+EXTERN int	Ck_UpdateScreen _ANSI_ARGS_((CkMainInfo *mainPtr));
 
 
 /*
@@ -902,6 +924,8 @@ EXTERN int	Ck_TreeCmd _ANSI_ARGS_((ClientData clientData,
 					Tcl_Interp *interp, int argc, char **argv));
 EXTERN int	Ck_TerminalCmd _ANSI_ARGS_((ClientData clientData,
 					    Tcl_Interp *interp, int argc, char **argv));
+EXTERN int	Ck_EmulatorCmd _ANSI_ARGS_((ClientData clientData,
+					    Tcl_Interp *interp, int argc, char **argv));
 EXTERN int	Ck_ProgressCmd _ANSI_ARGS_((ClientData clientData,
 					    Tcl_Interp *interp, int argc, char **argv));
 EXTERN int	Ck_PlaycardCmd _ANSI_ARGS_((ClientData clientData,
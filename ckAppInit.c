@@ -82,6 +82,8 @@ Tcl_AppInit(interp)
     }
 
     Tcl_StaticPackage(interp, "Ck", Ck_Init, (Tcl_PackageInitProc *) NULL);
+    Tcl_StaticPackage(interp, "Ckemulator", Ckemulator_Init,
+	    (Tcl_PackageInitProc *) NULL);
 
     /*
      * Call the init procedures for included packages.  Each call should
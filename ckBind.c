@@ -194,11 +194,13 @@ static EventInfo eventArray[CK_MAX_EV] =
    
    /* The following are virtual events.
     * At present they are only used by the terminal widget
-    * which use them to report commands that have been detected. 
+    * which use them to report commands that have been detected,
+    * and by the text widget to report changes of its modified flag.
     *
     * Will be improved to allow adding of new virtual events types.
     */
    {"<Exited>",        CK_EV_VIRTUAL,          CK_EV_VIRTUAL},  /* Subprocess exited */
+   {"<Replayed>",      CK_EV_VIRTUAL,          CK_EV_VIRTUAL},  /* Replay finished */
    {"<New>",           CK_EV_VIRTUAL,          CK_EV_VIRTUAL},  /* Open a new terminal */
    {"<Close>",         CK_EV_VIRTUAL,          CK_EV_VIRTUAL},  /* Close terminal */
    {"<Next>",          CK_EV_VIRTUAL,          CK_EV_VIRTUAL},  /* Move to next terminal */
@@ -210,6 +212,7 @@ static EventInfo eventArray[CK_MAX_EV] =
    {"<SplitV>",        CK_EV_VIRTUAL,          CK_EV_VIRTUAL},  /* vertical split */
    {"<Copy>",          CK_EV_VIRTUAL,          CK_EV_VIRTUAL},  /* copy text */
    {"<Paste>",         CK_EV_VIRTUAL,          CK_EV_VIRTUAL},  /* paste text */
+   {"<Modified>",      CK_EV_VIRTUAL,          CK_EV_VIRTUAL},  /* text modified flag changed */
    {(char *) NULL,      0,                      0}
 };
 static Tcl_HashTable eventTable;
@@ -831,7 +834,7 @@ Ck_DeleteAllBindings(bindingTable, object)
  *      objects are skipped.
  *
  * Results:
- *      None.
+ *      The number of objects with a binding matching the event.
  *
  * Side effects:
  *      Depends on the command associated with the matching
@@ -840,7 +843,7 @@ Ck_DeleteAllBindings(bindingTable, object)
  *--------------------------------------------------------------
  */
 
-void
+int
 Ck_BindEvent(bindingTable, eventPtr, winPtr, numObjects, objectPtr)
      Ck_BindingTable bindingTable;      /* Table in which to look for
                                          * bindings. */
@@ -856,7 +859,7 @@ Ck_BindEvent(bindingTable, eventPtr, winPtr, numObjects, objectPtr)
   PatSeq *matchPtr;
   PatternTableKey key;
   Tcl_HashEntry *hPtr;
-  int detail, code;
+  int detail, code, matched = 0;
   Tcl_Interp *interp;
   Tcl_DString scripts, savedResult;
   char *p, *end;
@@ -948,6 +951,7 @@ Ck_BindEvent(bindingTable, eventPtr, winPtr, numObjects, objectPtr)
       ExpandPercents(winPtr, matchPtr->command, eventPtr,
                      (KeySym) detail, &scripts);
       Tcl_DStringAppend(&scripts, "", 1);
+      matched++;
     }
   }
 
@@ -1005,6 +1009,7 @@ Ck_BindEvent(bindingTable, eventPtr, winPtr, numObjects, objectPtr)
   }
   Tcl_DStringResult(interp, &savedResult);
   Tcl_DStringFree(&scripts);
+  return matched;
 }
 
 /*
@@ -1834,6 +1839,12 @@ ExpandPercents(winPtr, before, eventPtr, keySym, dsPtr)
           numStorage[0] = '\0';
           string = numStorage;
         }
+      } else if (eventPtr->type == CK_EV_VIRTUAL) {
+        string = eventPtr->virt.detail;
+        if (string == NULL) {
+          numStorage[0] = '\0';
+          string = numStorage;
+        }
       }
       goto doString;
     case 'K':
@@ -114,6 +114,7 @@ Ck_ExitCmdObj(clientData, interp, objc, objv)
       Ck_DestroyWindow((CkWindow *) clientData);
     }
     CkpEndMouse();
+    CkpEndPaste();
     endwin();	/* just in case */
     Tcl_Exit(value);
     /* NOTREACHED */
@@ -372,6 +373,13 @@ Ck_CursesCmd(clientData, interp, argc, argv)
 	sprintf(buf, "%d", baudrate());
 	Tcl_AppendResult(interp, buf, (char *) NULL);
 	return TCL_OK;
+    } else if ((c == 'c') && (strncmp(argv[1], "colorpairs", length) == 0)) {
+	if (argc != 2) {
+	    Tcl_AppendResult(interp, "wrong # args: must be \"", argv[0],
+		" ", argv[1], "\"", (char *) NULL);
+	    return TCL_ERROR;
+        }
+	return CkColorPairStats(interp);
     } else if ((c == 'e') && (strncmp(argv[1], "encoding", length) == 0)) {
 	if (argc == 2)
 	    return Ck_GetEncoding(interp);
@@ -435,12 +443,42 @@ Ck_CursesCmd(clientData, interp, argc, argv)
 	    if (Tcl_GetInt(interp, argv[2], &delay) != TCL_OK)
 		return TCL_ERROR;
 	    mainPtr->refreshDelay = delay < 0 ? 0 : delay;
+	    mainPtr->flags &= ~CK_REFRESH_AUTO;
 	    return TCL_OK;
 	} else {
 	    Tcl_AppendResult(interp, "wrong # args: must be \"", argv[0],
 		" ", argv[1], " ?milliseconds?\"", (char *) NULL);
 	    return TCL_ERROR;
 	}
+    } else if ((c == 'r') && (strncmp(argv[1], "refreshrate", length) == 0)
+	&& (length > 7)) {
+	if (argc == 2) {
+	    char buf[32];
+
+	    if (mainPtr->flags & CK_REFRESH_AUTO)
+		strcpy(buf, "auto");
+	    else
+		sprintf(buf, "%d", mainPtr->refreshDelay > 0 ?
+		    1000 / mainPtr->refreshDelay : 0);
+	    Tcl_AppendResult(interp, buf, (char *) NULL);
+	    return TCL_OK;
+	} else if (argc == 3) {
+	    int rate;
+
+	    if (strcmp(argv[2], "auto") == 0) {
+		mainPtr->flags |= CK_REFRESH_AUTO;
+		return TCL_OK;
+	    }
+	    if (Tcl_GetInt(interp, argv[2], &rate) != TCL_OK)
+		return TCL_ERROR;
+	    mainPtr->refreshDelay = rate <= 0 ? 0 : 1000 / rate;
+	    mainPtr->flags &= ~CK_REFRESH_AUTO;
+	    return TCL_OK;
+	} else {
+	    Tcl_AppendResult(interp, "wrong # args: must be \"", argv[0],
+		" ", argv[1], " ?auto|framesPerSecond?\"", (char *) NULL);
+	    return TCL_ERROR;
+	}
     } else if ((c == 'r') && (strncmp(argv[1], "reversekludge", length)
         == 0)) {
 	int onoff;
@@ -504,8 +542,8 @@ Ck_CursesCmd(clientData, interp, argc, argv)
 #endif
     } else {
 	Tcl_AppendResult(interp, "bad option \"", argv[1],
-	    "\": must be barcode, baudrate, encoding, gchar, haskey, ",
-	    "purgeinput, refreshdelay, reversekludge, screendump or suspend",
+	    "\": must be barcode, baudrate, colorpairs, encoding, gchar, haskey, ",
+	    "purgeinput, refreshdelay, refreshrate, reversekludge, screendump or suspend",
 	    (char *) NULL);
 	return TCL_ERROR;
     }
@@ -541,11 +579,13 @@ Ck_CursesCmdObj(clientData, interp, objc, objv)
     {
      "barcode",
      "baudrate",
+     "colorpairs",
      "encoding",
      "gchar",
      "haskey",
      "purgeinput",
      "refreshdelay",
+     "refreshrate",
      "reversekludge",
      "screendump",
      "suspend",
@@ -555,11 +595,13 @@ Ck_CursesCmdObj(clientData, interp, objc, objv)
   {
    CMD_BARCODE,
    CMD_BAUDRATE,
+   CMD_COLORPAIRS,
    CMD_ENCODING,
    CMD_GCHAR,
    CMD_HASKEY,
    CMD_PURGEINPUT,
    CMD_REFRESHDELAY,
+   CMD_REFRESHRATE,
    CMD_REVERSEKLUDGE,
    CMD_SCREENDUMP,
    CMD_SUSPEND
@@ -592,6 +634,15 @@ Ck_CursesCmdObj(clientData, interp, objc, objv)
       return TCL_OK;
     }
     break;
+  case CMD_COLORPAIRS:
+    {
+      if (objc != 2) {
+	Tcl_WrongNumArgs(interp, 2, objv, "");
+	return TCL_ERROR;
+      }
+      return CkColorPairStats(interp);
+    }
+    break;
   case CMD_ENCODING:
     {
       if (objc == 2) {
@@ -670,6 +721,7 @@ Ck_CursesCmdObj(clientData, interp, objc, objv)
 		return TCL_ERROR;
 	    }
 	    mainPtr->refreshDelay = delay < 0 ? 0 : delay;
+	    mainPtr->flags &= ~CK_REFRESH_AUTO;
 	    return TCL_OK;
 	}
 	else {
@@ -678,6 +730,38 @@ Ck_CursesCmdObj(clientData, interp, objc, objv)
 	}
     }
     break;
+  case CMD_REFRESHRATE:
+    {
+	if (objc == 2) {
+	  if (mainPtr->flags & CK_REFRESH_AUTO) {
+	    Tcl_SetObjResult( interp, Tcl_NewStringObj("auto", -1));
+	  }
+	  else {
+	    Tcl_SetObjResult( interp, Tcl_NewIntObj(mainPtr->refreshDelay > 0 ?
+						    1000 / mainPtr->refreshDelay : 0));
+	  }
+	  return TCL_OK;
+	}
+	else if (objc == 3) {
+	    int rate;
+
+	    if (strcmp(Tcl_GetString(objv[2]), "auto") == 0) {
+		mainPtr->flags |= CK_REFRESH_AUTO;
+		return TCL_OK;
+	    }
+	    if (Tcl_GetIntFromObj(interp, objv[2], &rate) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    mainPtr->refreshDelay = rate <= 0 ? 0 : 1000 / rate;
+	    mainPtr->flags &= ~CK_REFRESH_AUTO;
+	    return TCL_OK;
+	}
+	else {
+	  Tcl_WrongNumArgs( interp, 2, objv, "?auto|framesPerSecond?");
+	  return TCL_ERROR;
+	}
+    }
+    break;
   case CMD_REVERSEKLUDGE:
     {
 	int onoff;
@@ -751,8 +835,9 @@ Ck_CursesCmdObj(clientData, interp, objc, objv)
     {
       /* -- should never be reached -- */
       Tcl_AppendResult(interp, "bad option \"", Tcl_GetString(objv[1]),
-		       "\": must be barcode, baudrate, encoding, gchar, haskey, ",
-		       "purgeinput, refreshdelay, reversekludge, screendump or suspend",
+		       "\": must be barcode, baudrate, colorpairs, encoding, gchar, haskey, ",
+		       "purgeinput, refreshdelay, refreshrate, reversekludge, ",
+		       "screendump or suspend",
 		       (char *) NULL);
       return TCL_ERROR;
     }
@@ -1331,7 +1416,8 @@ Ck_BindCmdObj(clientData, interp, objc, objv)
  *	causes any appropriate bindings for that event to be invoked.
  *
  * Results:
- *	None.
+ *	The number of binding tags of the window with a binding
+ *	for the event.
  *
  * Side effects:
  *	Depends on what bindings have been established with the "bind"
@@ -1340,7 +1426,7 @@ Ck_BindCmdObj(clientData, interp, objc, objv)
  *----------------------------------------------------------------------
  */
 
-void
+int
 CkBindEventProc(winPtr, eventPtr)
     CkWindow *winPtr;			/* Pointer to info about window. */
     CkEvent *eventPtr;			/* Information about event. */
@@ -1348,13 +1434,13 @@ CkBindEventProc(winPtr, eventPtr)
 #define MAX_OBJS 20
     ClientData objects[MAX_OBJS], *objPtr;
     static Ck_Uid allUid = NULL;
-    int i, count;
+    int i, count, matched;
     char *p;
     Tcl_HashEntry *hPtr;
     CkWindow *topLevPtr;
 
     if ((winPtr->mainPtr == NULL) || (winPtr->mainPtr->bindingTable == NULL)) {
-	return;
+	return 0;
     }
 
     objPtr = objects;
@@ -1399,11 +1485,12 @@ CkBindEventProc(winPtr, eventPtr)
 	}
 	objPtr[count - 1] = (ClientData) allUid;
     }
-    Ck_BindEvent(winPtr->mainPtr->bindingTable, eventPtr, winPtr,
+    matched = Ck_BindEvent(winPtr->mainPtr->bindingTable, eventPtr, winPtr,
 	    count, objPtr);
     if (objPtr != objects) {
 	ckfree((char *) objPtr);
     }
+    return matched;
 }
 
 /*
@@ -59,6 +59,12 @@ static char *           FormatConfigValue _ANSI_ARGS_((Tcl_Interp *interp,
  *	from argc/argv.  Old information in widgRec's fields
  *	gets recycled.
  *
+ *	WinPtr may be NULL for a record that belongs to no window,
+ *	such as an emulator created without a main window: the
+ *	option database isn't consulted and the color options
+ *	are used.  Ck_ConfigureInfo and Ck_ConfigureValue accept
+ *	a NULL winPtr the same way.
+ *
  *--------------------------------------------------------------
  */
 
@@ -85,7 +91,7 @@ Ck_ConfigureWidget(interp, winPtr, specs, argc, argv, widgRec, flags)
 				 * not considered. */
 
     needFlags = flags & ~(CK_CONFIG_USER_BIT - 1);
-    if (!(winPtr->mainPtr->flags & CK_HAS_COLOR)) {
+    if ((winPtr != NULL) && !(winPtr->mainPtr->flags & CK_HAS_COLOR)) {
 	hateFlags = CK_CONFIG_COLOR_ONLY;
     } else {
 	hateFlags = CK_CONFIG_MONO_ONLY;
@@ -163,7 +169,7 @@ Ck_ConfigureWidget(interp, winPtr, specs, argc, argv, widgRec, flags)
 		continue;
 	    }
 	    value = NULL;
-	    if (specPtr->dbName != NULL) {
+	    if ((winPtr != NULL) && (specPtr->dbName != NULL)) {
 		value = Ck_GetOption(winPtr, specPtr->dbName,
 		    specPtr->dbClass);
 	    }
@@ -188,8 +194,8 @@ Ck_ConfigureWidget(interp, winPtr, specs, argc, argv, widgRec, flags)
 	
 			sprintf(msg,
 				"\n    (%s \"%.50s\" in widget \"%.50s\")",
-				"default value for",
-				specPtr->dbName, winPtr->pathName);
+				"default value for", specPtr->dbName,
+				(winPtr != NULL) ? winPtr->pathName : "");
 			Tcl_AddErrorInfo(interp, msg);
 			return TCL_ERROR;
 		    }
@@ -508,7 +514,7 @@ Ck_ConfigureInfo(interp, winPtr, specs, widgRec, argvName, flags)
     char *leader = "{";
 
     needFlags = flags & ~(CK_CONFIG_USER_BIT - 1);
-    if (!(winPtr->mainPtr->flags & CK_HAS_COLOR)) {
+    if ((winPtr != NULL) && !(winPtr->mainPtr->flags & CK_HAS_COLOR)) {
 	hateFlags = CK_CONFIG_COLOR_ONLY;
     } else {
 	hateFlags = CK_CONFIG_MONO_ONLY;
@@ -593,7 +599,7 @@ Ck_ConfigureValue(interp, winPtr, specs, widgRec, argvName, flags)
     char buf[256];
 
     needFlags = flags & ~(CK_CONFIG_USER_BIT - 1);
-    if (winPtr->mainPtr->flags & CK_HAS_COLOR)
+    if ((winPtr == NULL) || (winPtr->mainPtr->flags & CK_HAS_COLOR))
         hateFlags = CK_CONFIG_MONO_ONLY;
     else
         hateFlags = CK_CONFIG_COLOR_ONLY;
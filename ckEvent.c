@@ -30,6 +30,62 @@ typedef struct {
 
 static int	Ck_HandleQEvent _ANSI_ARGS_((Tcl_Event *evPtr, int flags));
 
+/*
+ * Keyboard and mouse events read by CkHandleInput are collected in
+ * the following ring buffer. All events read in one go are delivered
+ * by a single queued Tcl event, instead of allocating and queueing
+ * one Tcl event per keystroke. The ring's storage is kept and reused;
+ * it only grows if a large burst of input (e.g. a paste) doesn't fit.
+ */
+
+#define INPUT_RING_SIZE 256
+
+typedef struct {
+    CkEvent *events;		/* Ring of events, malloc'ed. */
+    int size;			/* Number of slots in events. */
+    int head;			/* Index of next event to deliver. */
+    int count;			/* Number of events waiting in ring. */
+    int queued;			/* 1 means a Tcl event for delivering the
+				 * ring is queued and not yet processed. */
+    CkMainInfo *mainPtr;	/* Pointer to Ck main info. */
+} InputRing;
+
+static InputRing inputRing = { NULL, 0, 0, 0, 0, NULL };
+
+static void	PutInputEvent _ANSI_ARGS_((CkMainInfo *mainPtr,
+		    CkEvent *eventPtr));
+static int	HandleInputEvents _ANSI_ARGS_((Tcl_Event *evPtr, int flags));
+
+/*
+ * Bracketed paste: after "\033[?2004h" has been sent to the terminal
+ * (see CkpStartPaste), pasted text arrives enclosed in ESC[200~ and
+ * ESC[201~. CkHandleInput collects the text in the following buffer,
+ * which may span several calls, and delivers it as one <<Paste>>
+ * virtual event instead of one KeyPress event per character.
+ */
+
+#define PASTE_START	"[200~"
+#define PASTE_END	"\033[201~"
+
+/*
+ * Milliseconds to wait for the rest of a start marker which didn't
+ * arrive in one read:
+ */
+
+#define PASTE_DELAY	50
+
+typedef struct {
+    int active;			/* 1 means ESC[200~ was seen and the
+				 * paste end marker is not yet read. */
+    Tcl_DString text;		/* Pasted text collected so far, UTF-8. */
+} PasteInfo;
+
+static PasteInfo pasteInfo = { 0 };
+
+static int	PasteInput _ANSI_ARGS_((CkMainInfo *mainPtr, int rc,
+		    wint_t w));
+static void	PasteAsKeys _ANSI_ARGS_((CkMainInfo *mainPtr, char *text));
+
 /*
  * There's a potential problem if a handler is deleted while it's
  * current (i.e. its procedure is executing), since Ck_HandleEvent
@@ -360,6 +416,7 @@ Ck_HandleEvent(mainPtr, eventPtr)
     GenericHandler *genPrevPtr;
     CkWindow *winPtr;
     InProgress ip;
+    int handled = 0;
 
     /* 
      * Invoke all the generic event handlers (those that are
@@ -423,6 +480,7 @@ Ck_HandleEvent(mainPtr, eventPtr)
 	    ip.nextHandler = handlerPtr->nextPtr;
 	    (*(handlerPtr->proc))(handlerPtr->clientData, eventPtr);
 	    handlerPtr = ip.nextHandler;
+	    handled = 1;
 	} else {
 	    handlerPtr = handlerPtr->nextPtr;
 	}
@@ -432,9 +490,22 @@ Ck_HandleEvent(mainPtr, eventPtr)
      * Pass the event to the "bind" command mechanism.
      */
 
-    CkBindEventProc(winPtr, eventPtr);
+    if (CkBindEventProc(winPtr, eventPtr) > 0) {
+	handled = 1;
+    }
 
     pendingPtr = ip.nextPtr;
+
+    /*
+     * A paste which neither a handler nor a binding of the window
+     * takes is typed in instead, as without bracketed paste.
+     */
+
+    if (!handled && (eventPtr->type == CK_EV_VIRTUAL)
+	    && (eventPtr->virt.detail != NULL)
+	    && (strcmp(eventPtr->virt.evtype, "<Paste>") == 0)) {
+	PasteAsKeys(mainPtr, eventPtr->virt.detail);
+    }
 }
 
 /*
@@ -549,7 +620,6 @@ CkHandleInput(clientData, mask)
                                  * current state of file. */
 {
     CkEvent event;
-    CkQEvt *qev;
     CkMainInfo *mainPtr = (CkMainInfo *) clientData;
     int code = 0;
     static int buttonpressed = 0;
@@ -586,6 +656,10 @@ CkHandleInput(clientData, mask)
       /* -- this should never happen -- */
       return;
     }
+
+    if (PasteInput(mainPtr, rc, w)) {
+	goto readagain;
+    }
     
 
     /*
@@ -889,14 +963,342 @@ keyEvent:
 #endif
     
 mkEvent:
-    qev = (CkQEvt *) ckalloc(sizeof (CkQEvt));
-    qev->header.proc = Ck_HandleQEvent;
-    qev->event = event;
-    qev->mainPtr = mainPtr;
-    Tcl_QueueEvent(&qev->header, TCL_QUEUE_TAIL);
+    PutInputEvent(mainPtr, &event);
     goto readagain;
 }
 
+/*
+ *--------------------------------------------------------------
+ *
+ * PasteInput --
+ *
+ *	Called by CkHandleInput for each character read in order
+ *	to recognize bracketed paste. An ESC followed by "[200~"
+ *	starts a paste; all characters up to the final ESC[201~
+ *	are collected and then delivered as a single <<Paste>>
+ *	virtual event to the focus window, with the text as detail.
+ *	Carriage returns in the text are turned into newlines.
+ *
+ * Results:
+ *	1 if the character was consumed, 0 if it is to be processed
+ *	as ordinary input.
+ *
+ * Side effects:
+ *	Reads ahead from curses, waiting up to PASTE_DELAY ms for
+ *	each character of a start marker which isn't there yet;
+ *	characters not belonging to a paste start marker are pushed
+ *	back. A <<Paste>> event may be appended to the input ring
+ *	buffer.
+ *
+ *--------------------------------------------------------------
+ */
+
+static int
+PasteInput(mainPtr, rc, w)
+    CkMainInfo *mainPtr;	/* Pointer to main info. */
+    int rc;			/* Result of get_wch. */
+    wint_t w;			/* Character read. */
+{
+    CkEvent event;
+    char buf[TCL_UTF_MAX + 1], *p, *q, *end;
+    int i, len, n = sizeof (PASTE_END) - 1;
+
+    if (!pasteInfo.active) {
+	int rcs[sizeof (PASTE_START) - 1];
+	wint_t ws[sizeof (PASTE_START) - 1];
+
+	if (rc != OK || w != 0x1b) {
+	    return 0;
+	}
+	for (i = 0; PASTE_START[i] != '\0'; i++) {
+	    rcs[i] = get_wch(&ws[i]);
+	    if (rcs[i] == ERR) {
+		/*
+		 * The terminal may have written the marker in two
+		 * pieces: give the rest a moment to arrive.
+		 */
+		wtimeout(stdscr, PASTE_DELAY);
+		rcs[i] = get_wch(&ws[i]);
+		nodelay(stdscr, TRUE);
+	    }
+	    if (rcs[i] != OK || ws[i] != (wint_t) PASTE_START[i]) {
+		/*
+		 * No paste, push back what was read in reverse order.
+		 */
+		if (rcs[i] == ERR) {
+		    i--;
+		}
+		for (; i >= 0; i--) {
+		    if (rcs[i] == KEY_CODE_YES) {
+			ungetch(ws[i]);
+		    } else {
+			unget_wch(ws[i]);
+		    }
+		}
+		return 0;
+	    }
+	}
+	pasteInfo.active = 1;
+	Tcl_DStringInit(&pasteInfo.text);
+	return 1;
+    }
+
+    if (rc != OK) {
+	/*
+	 * Function keys can't be part of pasted text.
+	 */
+	return 1;
+    }
+    if (w < 0x100 && mainPtr->isoEncoding != NULL) {
+	char c = w;
+	Tcl_DString ds;
+
+	Tcl_ExternalToUtfDString(mainPtr->isoEncoding, &c, 1, &ds);
+	Tcl_DStringAppend(&pasteInfo.text, Tcl_DStringValue(&ds),
+	    Tcl_DStringLength(&ds));
+	Tcl_DStringFree(&ds);
+    } else {
+	len = Tcl_UniCharToUtf((Tcl_UniChar) w, buf);
+	Tcl_DStringAppend(&pasteInfo.text, buf, len);
+    }
+    len = Tcl_DStringLength(&pasteInfo.text);
+    p = Tcl_DStringValue(&pasteInfo.text);
+    if (len < n || strcmp(p + len - n, PASTE_END) != 0) {
+	return 1;
+    }
+
+    /*
+     * End marker seen: strip it, convert CR and CR/LF to LF
+     * and deliver the text.
+     */
+
+    end = p + len - n;
+    for (q = p; p < end; p++) {
+	if (*p == '\r') {
+	    if (p + 1 < end && p[1] == '\n') {
+		continue;
+	    }
+	    *q++ = '\n';
+	} else {
+	    *q++ = *p;
+	}
+    }
+    *q = '\0';
+    pasteInfo.active = 0;
+    event.virt.type = CK_EV_VIRTUAL;
+    event.virt.winPtr = mainPtr->focusPtr;
+    event.virt.evtype = strdup("<Paste>");
+    event.virt.detail = strdup(Tcl_DStringValue(&pasteInfo.text));
+    Tcl_DStringFree(&pasteInfo.text);
+    PutInputEvent(mainPtr, &event);
+    return 1;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * PasteAsKeys --
+ *
+ *	Called by Ck_HandleEvent for a <<Paste>> event which no
+ *	handler or binding took, e.g. in a listbox or an entry with
+ *	its own key bindings, to deliver the text as KeyPress
+ *	events, one per character, as if it was typed.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Depends on the bindings of the focus window, which may
+ *	change from one character to the next like when typing.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+PasteAsKeys(mainPtr, text)
+    CkMainInfo *mainPtr;	/* Pointer to main info. */
+    char *text;			/* Pasted text, UTF-8. */
+{
+    extern CkMainInfo *ckMainInfo;
+    CkEvent event;
+    Tcl_UniChar ch;
+    char *p;
+
+    for (p = text; *p != '\0'; ) {
+	p += Tcl_UtfToUniChar(p, &ch);
+	if (ckMainInfo != mainPtr || mainPtr->focusPtr == NULL) {
+	    return;
+	}
+
+	/*
+	 * Newlines were carriage returns, as the Return key is
+	 * read with nonl().
+	 */
+
+	if (ch == '\n') {
+	    ch = '\r';
+	}
+	memset(&event, 0, sizeof (event));
+	event.key.type = CK_EV_KEYPRESS;
+	event.key.winPtr = mainPtr->focusPtr;
+	event.key.curses_rc = OK;
+	event.key.curses_w = ch;
+	event.key.keycode = ch;
+	event.key.uch = ch;
+	event.key.is_uch = (ch >= 0x20);
+	if (ch > 0x100 || (ch >= 0x80 && mainPtr->isoEncoding != NULL)) {
+	    event.key.keycode = 0;
+	}
+	Ck_HandleEvent(mainPtr, &event);
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * PutInputEvent --
+ *
+ *	Append an input event to the input ring buffer and make
+ *	sure a Tcl event is queued for delivering the ring.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The ring buffer may grow. A Tcl event may be queued.
+ *
+ *--------------------------------------------------------------
+ */
+
+static void
+PutInputEvent(mainPtr, eventPtr)
+    CkMainInfo *mainPtr;	/* Pointer to main info. */
+    CkEvent *eventPtr;		/* Event to append. */
+{
+    if (inputRing.count >= inputRing.size) {
+	CkEvent *events;
+	int i, size;
+
+	size = inputRing.size ? inputRing.size * 2 : INPUT_RING_SIZE;
+	events = (CkEvent *) ckalloc(size * sizeof (CkEvent));
+	for (i = 0; i < inputRing.count; i++) {
+	    events[i] = inputRing.events[(inputRing.head + i) %
+		inputRing.size];
+	}
+	if (inputRing.events != NULL) {
+	    ckfree((char *) inputRing.events);
+	}
+	inputRing.events = events;
+	inputRing.size = size;
+	inputRing.head = 0;
+    }
+    inputRing.events[(inputRing.head + inputRing.count) % inputRing.size] =
+	*eventPtr;
+    inputRing.count++;
+    inputRing.mainPtr = mainPtr;
+    CkQueueInput();
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * CkInputPending, CkQueueInput --
+ *
+ *	CkInputPending checks if the input ring buffer holds events
+ *	for which no Tcl event is queued. This happens when an
+ *	event handler enters a nested event loop (e.g. "update"),
+ *	which the event source in ckWindow.c detects and calls
+ *	CkQueueInput in order to continue delivering the ring.
+ *
+ * Results:
+ *	CkInputPending returns 1 if events are pending, else 0.
+ *
+ * Side effects:
+ *	CkQueueInput may queue a Tcl event.
+ *
+ *--------------------------------------------------------------
+ */
+
+int
+CkInputPending()
+{
+    return inputRing.count > 0 && !inputRing.queued;
+}
+
+void
+CkQueueInput()
+{
+    Tcl_Event *evPtr;
+
+    if (CkInputPending()) {
+	evPtr = (Tcl_Event *) ckalloc(sizeof (Tcl_Event));
+	evPtr->proc = HandleInputEvents;
+	Tcl_QueueEvent(evPtr, TCL_QUEUE_TAIL);
+	inputRing.queued = 1;
+    }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * HandleInputEvents --
+ *
+ *	Deliver all events waiting in the input ring buffer.
+ *	If an event handler enters a nested event loop, the
+ *	remaining events are delivered by another queued Tcl
+ *	event (see CkQueueInput), which continues with the same
+ *	ring, so that the order of events is preserved.
+ *
+ * Results:
+ *	1 if the event was handled, 0 if window events are
+ *	not to be processed now.
+ *
+ * Side effects:
+ *	Arbitrary;  depends on handlers for events.
+ *
+ *--------------------------------------------------------------
+ */
+
+static int
+HandleInputEvents(evPtr, flags)
+    Tcl_Event *evPtr;
+    int flags;
+{
+    extern CkMainInfo *ckMainInfo;
+    CkEvent event;
+
+    if (!(flags & TCL_WINDOW_EVENTS)) {
+	return 0;
+    }
+    inputRing.queued = 0;
+    while (inputRing.count > 0) {
+	if (ckMainInfo == NULL || ckMainInfo != inputRing.mainPtr) {
+	    /*
+	     * Main window is gone, drop remaining input.
+	     */
+	    while (inputRing.count > 0) {
+		event = inputRing.events[inputRing.head];
+		inputRing.head = (inputRing.head + 1) % inputRing.size;
+		inputRing.count--;
+		if (event.any.type == CK_EV_VIRTUAL) {
+		    free(event.virt.evtype);
+		    free(event.virt.detail);
+		}
+	    }
+	    break;
+	}
+	event = inputRing.events[inputRing.head];
+	inputRing.head = (inputRing.head + 1) % inputRing.size;
+	inputRing.count--;
+	Ck_HandleEvent(inputRing.mainPtr, &event);
+	if (event.any.type == CK_EV_VIRTUAL) {
+	    free(event.virt.evtype);
+	    free(event.virt.detail);
+	}
+    }
+    return 1;
+}
+
 static int
 Ck_HandleQEvent(evPtr, flags)
     Tcl_Event *evPtr;
@@ -949,7 +1351,6 @@ CkHandleGPMInput(clientData, mask)
 {
     Gpm_Event gpmEvent;
     CkEvent event;
-    CkQEvt *qev;
     CkMainInfo *mainPtr = (CkMainInfo *) clientData;
     int ret, type;
 
@@ -982,11 +1383,7 @@ CkHandleGPMInput(clientData, mask)
 	event.mouse.y = event.mouse.rooty = gpmEvent.y - 1;
 	event.mouse.winPtr = Ck_GetWindowXY(mainPtr, &event.mouse.x,
 	    &event.mouse.y, 1);
-	qev = (CkQEvt *) ckalloc(sizeof (CkQEvt));
-	qev->header.proc = Ck_HandleQEvent;
-	qev->event = event;
-	qev->mainPtr = mainPtr;
-	Tcl_QueueEvent(&qev->header, TCL_QUEUE_TAIL);
+	PutInputEvent(mainPtr, &event);
     }
 }
 #endif /* HAVE_GPM */
@@ -15,12 +15,64 @@
 #include "ckPort.h"
 #include "ck.h"
 
+/*
+ * Color pairs are allocated on demand by Ck_GetPair.  The hash table
+ * pairTable maps a (fg,bg) combination to its pair number.  Once all
+ * pairs are allocated, only a spare pair may be redefined:  one which
+ * was found neither on the screen nor in a mapped window, and which
+ * wasn't looked up since the screen was last updated, when the cells
+ * were last scanned.  A spare pair stays spare until it is looked up
+ * again, since cells only get a pair from Ck_GetPair, so the cells are
+ * scanned again only when no spare pair is left, and at most once per
+ * screen update.  Spare pairs are taken in the order of their last
+ * lookup, the pair drawn longest ago first.
+ */
+
 typedef struct {
     short fg, bg;
+    unsigned long lastUse;	/* Value of pairClock when pair was last
+				 * looked up. */
+    int newer, older;		/* Neighbours in the list of pairs by last
+				 * lookup, 0 at either end. */
+    int spare;			/* Non-zero means pair may be redefined. */
+    Tcl_HashEntry *hPtr;	/* Entry of pair in pairTable. */
 } CPair;
 
 static CPair *cPairs = NULL;
-static int numPairs, newPair;
+static int numPairs;		/* Pairs 1 .. numPairs-1 are allocated. */
+static int maxPairs;		/* Number of usable pairs, including 0. */
+static int newestPair;		/* Pair looked up last, 0 if none. */
+static int oldestPair;		/* Pair looked up first, 0 if none. */
+static unsigned long pairClock;	/* Counts lookups. */
+static unsigned long shownClock;/* Value of pairClock when the screen
+				 * was last updated. */
+static int numSpare;		/* Number of spare pairs. */
+static unsigned long numUpdates;/* Counts screen updates. */
+static unsigned long scanUpdates;/* Value of numUpdates after the last
+				 * scan which found no spare pair. */
+static Tcl_HashTable pairTable;
+
+/*
+ * Statistics reported by "curses colorpairs".
+ */
+
+static struct {
+    long hits;			/* Lookups of an allocated pair. */
+    long misses;		/* Lookups which allocated a pair. */
+    long evictions;		/* Pairs redefined for a new combination. */
+    long forced;		/* Lookups which got pair 0 because all
+				 * pairs were displayed. */
+    long scans;			/* Scans of the cells for spare pairs. */
+} pairStats;
+
+#define PAIR_KEY(fg, bg) \
+	((char *) (long) ((((fg) & 0xffff) << 16) | ((bg) & 0xffff)))
+
+static void	UnlinkPair _ANSI_ARGS_((int i));
+static void	LinkPair _ANSI_ARGS_((int i));
+static void	FindSparePairs _ANSI_ARGS_((CkMainInfo *mainPtr));
+static void	MarkWindowPairs _ANSI_ARGS_((CkWindow *winPtr, char *used));
+static void	MarkPairs _ANSI_ARGS_((WINDOW *window, char *used));
 
 /*
  * The hash table below is used to keep track of all the Ck_Uids created
@@ -45,6 +97,7 @@ static int initialized = 0;
 static int color_threshold = 50;
 
 static Tcl_HashTable colorTable;
+static int colorTableInit = 0;
 
 /*
  * Definition os X11 colors
@@ -365,6 +418,10 @@ resetCells()
  *
  *	Initialize the color table. The initialisation depends
  *      on the number of available colors reported by ncurses.
+ *      Before curses is started, e.g. for an emulator loaded
+ *      without a main window, only the 16 system colors get
+ *      their names; the table is completed when called again
+ *      once curses is started.
  *
  * Results:
  *      None
@@ -383,7 +440,10 @@ Ck_InitColor()
   resetCells();
 
   /* start creation of color hashtable */
-  Tcl_InitHashTable( &colorTable, TCL_STRING_KEYS );
+  if ( !colorTableInit ) {
+    Tcl_InitHashTable( &colorTable, TCL_STRING_KEYS );
+    colorTableInit = 1;
+  }
 
   /* force system entries */
   for ( i = 0; i < 16; ++i ) {
@@ -681,18 +741,18 @@ Ck_NameOfAttr(attr)
 /*
  *------------------------------------------------------------------------
  *
- * Ck_GetColorPair --
+ * Ck_GetPair --
  *
  *	Given background/foreground curses colors, a color pair
  *	is allocated and returned.
  *
  * Results:
- *	TCL_OK if color found, curses color in *colorPtr.
- *	TCL_ERROR if color not found; interp->result contains an
- *	error message.
+ *	The video attribute for the color pair, i.e. COLOR_PAIR(n).
+ *	COLOR_PAIR(0) if all pairs are displayed.
  *
  * Side effects:
- *	None.
+ *	A new color pair may be defined, possibly redefining the least
+ *	recently used one which is not shown anywhere.
  *
  *------------------------------------------------------------------------
  */
@@ -702,28 +762,309 @@ Ck_GetPair(winPtr, fg, bg)
     CkWindow *winPtr;
     int fg, bg;
 {
-    int i;
+    Tcl_HashEntry *hPtr;
+    int i, new;
 
     if (!(winPtr->mainPtr->flags & CK_HAS_COLOR))
 	return COLOR_PAIR(0);
     if (cPairs == NULL) {
-	cPairs = (CPair *) ckalloc(sizeof (CPair) * (COLOR_PAIRS + 2));
-	numPairs = 0;
-	newPair = 1;
+	/*
+	 * COLOR_PAIR(n) only has room for 256 pairs in a chtype.
+	 */
+	maxPairs = COLOR_PAIRS > 256 ? 256 : COLOR_PAIRS;
+	cPairs = (CPair *) ckalloc(sizeof (CPair) * maxPairs);
+	numPairs = 1;
+	newestPair = oldestPair = 0;
+	numSpare = 0;
+	scanUpdates = numUpdates - 1;
+	Tcl_InitHashTable(&pairTable, TCL_ONE_WORD_KEYS);
+    }
+    hPtr = Tcl_CreateHashEntry(&pairTable, PAIR_KEY(fg, bg), &new);
+    if (!new) {
+	i = (int) (long) Tcl_GetHashValue(hPtr);
+	cPairs[i].lastUse = ++pairClock;
+	if (cPairs[i].spare) {
+	    cPairs[i].spare = 0;
+	    numSpare--;
+	}
+	if (i != newestPair) {
+	    UnlinkPair(i);
+	    LinkPair(i);
+	}
+	pairStats.hits++;
+	return COLOR_PAIR(i);
+    }
+    pairStats.misses++;
+    if (numPairs < maxPairs) {
+	i = numPairs++;
+    } else if (maxPairs > 1) {
+	/*
+	 * Redefine the spare pair drawn longest ago.  Without one,
+	 * all pairs are displayed and pair 0 has to do.
+	 */
+
+	if ((numSpare == 0) && (scanUpdates != numUpdates)) {
+	    FindSparePairs(winPtr->mainPtr);
+	    if (numSpare == 0) {
+		scanUpdates = numUpdates;
+	    }
+	}
+	if (numSpare == 0) {
+	    pairStats.forced++;
+	    Tcl_DeleteHashEntry(hPtr);
+	    return COLOR_PAIR(0);
+	}
+	for (i = oldestPair; !cPairs[i].spare; i = cPairs[i].newer) {
+	    /* Empty loop body. */
+	}
+	cPairs[i].spare = 0;
+	numSpare--;
+	pairStats.evictions++;
+	UnlinkPair(i);
+	Tcl_DeleteHashEntry(cPairs[i].hPtr);
+    } else {
+	Tcl_DeleteHashEntry(hPtr);
+	return COLOR_PAIR(0);
     }
-    for (i = 1; i < numPairs; i++)
-	if (cPairs[i].fg == fg && cPairs[i].bg == bg)
-	    return COLOR_PAIR(i);
-    i = newPair;
     cPairs[i].fg = fg;
     cPairs[i].bg = bg;
+    cPairs[i].lastUse = ++pairClock;
+    cPairs[i].spare = 0;
+    cPairs[i].hPtr = hPtr;
+    LinkPair(i);
+    Tcl_SetHashValue(hPtr, (ClientData) (long) i);
     init_pair((short) i, (short) fg, (short) bg);
-    if (++newPair >= COLOR_PAIRS)
-	newPair = 1;
-    else
-	numPairs = newPair;
     return COLOR_PAIR(i);
 }
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * UnlinkPair, LinkPair --
+ *
+ *	Remove a pair from the list of pairs by last lookup, or
+ *	put it at the newest end.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The neighbours of the pair and the ends of the list change.
+ *
+ *------------------------------------------------------------------------
+ */
+
+static void
+UnlinkPair(i)
+    int i;
+{
+    if (cPairs[i].newer) {
+	cPairs[cPairs[i].newer].older = cPairs[i].older;
+    } else {
+	newestPair = cPairs[i].older;
+    }
+    if (cPairs[i].older) {
+	cPairs[cPairs[i].older].newer = cPairs[i].newer;
+    } else {
+	oldestPair = cPairs[i].newer;
+    }
+}
+
+static void
+LinkPair(i)
+    int i;
+{
+    cPairs[i].newer = 0;
+    cPairs[i].older = newestPair;
+    if (newestPair) {
+	cPairs[newestPair].newer = i;
+    } else {
+	oldestPair = i;
+    }
+    newestPair = i;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * FindSparePairs --
+ *
+ *	Called by Ck_GetPair when all color pairs are allocated and
+ *	none is spare.  Pairs found in the cells of the screen or of
+ *	mapped windows are still in use, since redefining them would
+ *	change colors of displayed text, and so are the pairs looked
+ *	up since the screen was last updated, which are being drawn.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The other pairs are made spare.
+ *
+ *------------------------------------------------------------------------
+ */
+
+static void
+FindSparePairs(mainPtr)
+    CkMainInfo *mainPtr;
+{
+    char *used;
+    int i;
+
+    used = ckalloc(maxPairs);
+    memset(used, 0, maxPairs);
+    MarkPairs(curscr, used);
+    MarkWindowPairs(mainPtr->winPtr, used);
+    for (i = 1; i < numPairs; i++) {
+	if (!used[i] && !cPairs[i].spare && (cPairs[i].lastUse <= shownClock)) {
+	    cPairs[i].spare = 1;
+	    numSpare++;
+	}
+    }
+    ckfree(used);
+    pairStats.scans++;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * MarkWindowPairs --
+ *
+ *	Mark the color pairs found in a window and its descendants,
+ *	if mapped.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Entries in used are set to 1.
+ *
+ *------------------------------------------------------------------------
+ */
+
+static void
+MarkWindowPairs(winPtr, used)
+    CkWindow *winPtr;
+    char *used;
+{
+    CkWindow *childPtr;
+
+    if (winPtr == NULL || !(winPtr->flags & CK_MAPPED)) {
+	return;
+    }
+    if (winPtr->window != NULL) {
+	MarkPairs(winPtr->window, used);
+    }
+    for (childPtr = winPtr->childList; childPtr != NULL;
+	 childPtr = childPtr->nextPtr) {
+	MarkWindowPairs(childPtr, used);
+    }
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * MarkPairs --
+ *
+ *	Mark the color pairs found in the cells of a curses window.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Entries in used are set to 1.  The cursor position of the
+ *	window is restored after reading its cells.
+ *
+ *------------------------------------------------------------------------
+ */
+
+static void
+MarkPairs(window, used)
+    WINDOW *window;
+    char *used;
+{
+    chtype *line;
+    int x, y, width, height, curX, curY, n, pair;
+
+    getmaxyx(window, height, width);
+    getyx(window, curY, curX);
+    line = (chtype *) ckalloc((width + 1) * sizeof (chtype));
+    for (y = 0; y < height; y++) {
+	n = mvwinchnstr(window, y, 0, line, width);
+	for (x = 0; x < n; x++) {
+	    pair = PAIR_NUMBER(line[x]);
+	    if (pair > 0 && pair < maxPairs) {
+		used[pair] = 1;
+	    }
+	}
+    }
+    ckfree((char *) line);
+    wmove(window, curY, curX);
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * CkColorPairsShown --
+ *
+ *	Called after the screen was updated: the pairs looked up so
+ *	far have been displayed.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The cells may be scanned again for spare pairs.
+ *
+ *------------------------------------------------------------------------
+ */
+
+void
+CkColorPairsShown()
+{
+    shownClock = pairClock;
+    numUpdates++;
+}
+
+/*
+ *------------------------------------------------------------------------
+ *
+ * CkColorPairStats --
+ *
+ *	Report usage of color pairs by Ck_GetPair, for the
+ *	"curses colorpairs" command.
+ *
+ * Results:
+ *	Always TCL_OK, the interpreter's result holds a list of
+ *	names and values.
+ *
+ * Side effects:
+ *	None.
+ *
+ *------------------------------------------------------------------------
+ */
+
+int
+CkColorPairStats(interp)
+    Tcl_Interp *interp;
+{
+    Tcl_Obj *listPtr = Tcl_NewListObj(0, NULL);
+
+#define STAT(name, value) \
+    Tcl_ListObjAppendElement(NULL, listPtr, Tcl_NewStringObj(name, -1)); \
+    Tcl_ListObjAppendElement(NULL, listPtr, Tcl_NewLongObj(value))
+
+    STAT("size", cPairs == NULL ? 0 : maxPairs - 1);
+    STAT("used", cPairs == NULL ? 0 : numPairs - 1);
+    STAT("hits", pairStats.hits);
+    STAT("misses", pairStats.misses);
+    STAT("evictions", pairStats.evictions);
+    STAT("forced", pairStats.forced);
+    STAT("scans", pairStats.scans);
+#undef STAT
+    Tcl_SetObjResult(interp, listPtr);
+    return TCL_OK;
+}
 
 /*
  *--------------------------------------------------------------
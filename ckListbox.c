@@ -28,8 +28,6 @@ typedef struct Element {
     				 * characters. */
     int selected;		/* 1 means this item is selected, 0 means
 				 * it isn't. */
-    struct Element *nextPtr;	/* Next in list of all elements of this
-				 * listbox, or NULL for last element. */
     char text[4];		/* Characters of this element, NULL-
 				 * terminated.  The actual space allocated
 				 * here will be as large as needed (> 4,
@@ -40,6 +38,30 @@ typedef struct Element {
 #define ElementSize(stringLength) \
 	(sizeof(Element) - 3 + stringLength)
 
+/*
+ * A virtual listbox (see the -datacommand option) keeps the rows it
+ * got from its data command in a small cache of the following records.
+ * Row i is kept in slot i modulo the cache size.
+ */
+
+typedef struct RowCache {
+    int index;			/* Index of row in this slot, -1 if slot
+				 * is empty. */
+    Element *elPtr;		/* Contents of row, malloc'ed. */
+} RowCache;
+
+/*
+ * The selection of a virtual listbox is kept as a sorted array of
+ * the following records, ranges of selected rows that neither
+ * overlap nor touch, so that selecting millions of rows costs one
+ * record.
+ */
+
+typedef struct SelRange {
+    int first;			/* Index of first selected row. */
+    int last;			/* Index of last selected row. */
+} SelRange;
+
 /*
  * A data structure of the following type is kept for each listbox
  * widget managed by this file:
@@ -53,10 +75,24 @@ typedef struct {
     Tcl_Interp *interp;		/* Interpreter associated with listbox. */
     Tcl_Command widgetCmd;      /* Token for listbox's widget command. */
     int numElements;		/* Total number of elements in this listbox. */
-    Element *firstPtr;		/* First in list of elements (NULL if no
-				 * elements). */
-    Element *lastPtr;		/* Last in list of elements (NULL if no
-				 * elements). */
+    Element **elements;		/* Array of pointers to the elements, in
+				 * order, so that an element is found by
+				 * its index directly.  Malloc'ed, NULL if
+				 * no space allocated yet. */
+    int elementSpace;		/* Number of slots in elements. */
+    int count;			/* Number of rows of a virtual listbox
+				 * (-count option). */
+    char *dataCmd;		/* Command prefix invoked to get the rows of
+				 * a virtual listbox (-datacommand option).
+				 * If not NULL, the listbox holds no
+				 * elements itself.  Malloc'ed. */
+    RowCache *rowCache;		/* Rows of virtual listbox fetched by
+				 * dataCmd.  Malloc'ed, may be NULL. */
+    int cacheSize;		/* Number of slots in rowCache. */
+    SelRange *selRanges;	/* Selected rows of a virtual listbox, in
+				 * order.  Malloc'ed, may be NULL. */
+    int numRanges;		/* Number of ranges in selRanges. */
+    int rangeSpace;		/* Number of slots in selRanges. */
 
     /*
      * Information used when displaying widget:
@@ -85,6 +121,11 @@ typedef struct {
      */
 
     int maxWidth;		/* Width of widest string in listbox. */
+    int *widthCount;		/* widthCount[w] is the number of elements
+				 * of width w, for w < widthSpace.  Used to
+				 * keep maxWidth up to date without looking
+				 * at all elements.  Malloc'ed, may be NULL. */
+    int widthSpace;		/* Number of slots in widthCount. */
     int xOffset;		/* The left edge of each string in the
 				 * listbox is offset to the left by this
 				 * many chars (0 means no offset, positive
@@ -121,6 +162,21 @@ typedef struct {
 				 * definitions. */
 } Listbox;
 
+/*
+ * Initial number of slots in the elements array of a listbox. The
+ * array is doubled in size whenever it fills up.
+ */
+
+#define ELEMENT_SPACE		64
+
+/*
+ * Minimum number of slots in the row cache of a virtual listbox,
+ * and number of rows fetched at once when a row is missing.
+ */
+
+#define ROW_CACHE_SIZE		128
+#define ROW_FETCH		32
+
 /*
  * Flag bits for listboxes:
  *
@@ -133,12 +189,15 @@ typedef struct {
  *				to be updated.
  * GOT_FOCUS:			Non-zero means this widget currently
  *				has the input focus.
+ * VIRTUAL_MODE:		Non-zero means this listbox gets its
+ *				rows from the -datacommand.
  */
 
 #define REDRAW_PENDING		1
 #define UPDATE_V_SCROLLBAR	2
 #define UPDATE_H_SCROLLBAR	4
 #define GOT_FOCUS		8
+#define VIRTUAL_MODE		16
 
 /*
  * Information used for argv parsing:
@@ -173,6 +232,11 @@ static Ck_ConfigSpec configSpecs[] = {
 	CK_CONFIG_MONO_ONLY},
     {CK_CONFIG_SYNONYM, "-bd", "borderWidth", (char *) NULL,
 	(char *) NULL, 0, 0},
+    {CK_CONFIG_INT, "-count", "count", "Count",
+	DEF_LISTBOX_COUNT, Ck_Offset(Listbox, count), 0},
+    {CK_CONFIG_STRING, "-datacommand", "dataCommand", "DataCommand",
+	DEF_LISTBOX_DATA_COMMAND, Ck_Offset(Listbox, dataCmd),
+	CK_CONFIG_NULL_OK},
     {CK_CONFIG_SYNONYM, "-bg", "background", (char *) NULL,
 	(char *) NULL, 0, 0},
     {CK_CONFIG_SYNONYM, "-fg", "foreground", (char *) NULL,
@@ -222,6 +286,23 @@ static Ck_ConfigSpec configSpecs[] = {
 
 static void		ChangeListboxOffset _ANSI_ARGS_((Listbox *listPtr,
 			    int offset));
+static void		CountWidth _ANSI_ARGS_((Listbox *listPtr,
+			    int width, int incr));
+static int		FetchRows _ANSI_ARGS_((Listbox *listPtr,
+			    int first, int last));
+static void		FlushRows _ANSI_ARGS_((Listbox *listPtr));
+static Element *	GetElement _ANSI_ARGS_((Listbox *listPtr,
+			    int index));
+static int		IsSelected _ANSI_ARGS_((Listbox *listPtr,
+			    int index));
+static Element *	NewElement _ANSI_ARGS_((char *string));
+static int		FindRange _ANSI_ARGS_((Listbox *listPtr,
+			    int index));
+static int		RangeOverlap _ANSI_ARGS_((SelRange *rangePtr,
+			    int first, int last));
+static int		SelectRange _ANSI_ARGS_((Listbox *listPtr,
+			    int first, int last, int select));
+static void		SetVirtualMode _ANSI_ARGS_((Listbox *listPtr));
 static void		ChangeListboxView _ANSI_ARGS_((Listbox *listPtr,
 			    int index));
 static int		ConfigureListbox _ANSI_ARGS_((Tcl_Interp *interp,
@@ -305,8 +386,15 @@ Ck_ListboxCmd(clientData, interp, argc, argv)
     listPtr->widgetCmd = Tcl_CreateCommand(interp, listPtr->winPtr->pathName,
         ListboxWidgetCmd, (ClientData) listPtr, ListboxCmdDeletedProc);
     listPtr->numElements = 0;
-    listPtr->firstPtr = NULL;
-    listPtr->lastPtr = NULL;
+    listPtr->elements = NULL;
+    listPtr->elementSpace = 0;
+    listPtr->count = 0;
+    listPtr->dataCmd = NULL;
+    listPtr->rowCache = NULL;
+    listPtr->cacheSize = 0;
+    listPtr->selRanges = NULL;
+    listPtr->numRanges = 0;
+    listPtr->rangeSpace = 0;
     listPtr->normalBg = 0;
     listPtr->normalFg = 0;
     listPtr->normalAttr = 0;
@@ -321,6 +409,8 @@ Ck_ListboxCmd(clientData, interp, argc, argv)
     listPtr->topIndex = 0;
     listPtr->fullLines = 1;
     listPtr->maxWidth = 0;
+    listPtr->widthCount = NULL;
+    listPtr->widthSpace = 0;
     listPtr->xOffset = 0;
     listPtr->selectMode = NULL;
     listPtr->numSelected = 0;
@@ -428,7 +518,6 @@ ListboxWidgetCmd(clientData, interp, argc, argv)
 	    && (length >= 2)) {
 	int i, count;
 	char index[20];
-	Element *elPtr;
 
 	if (argc != 2) {
 	    Tcl_AppendResult(interp, "wrong # args: should be \"",
@@ -437,12 +526,24 @@ ListboxWidgetCmd(clientData, interp, argc, argv)
 	    goto error;
 	}
 	count = 0;
-	for (i = 0, elPtr = listPtr->firstPtr; elPtr != NULL;
-		i++, elPtr = elPtr->nextPtr) {
-	    if (elPtr->selected) {
-		sprintf(index, "%d", i);
-		Tcl_AppendElement(interp, index);
-		count++;
+	if (listPtr->flags & VIRTUAL_MODE) {
+	    int r;
+
+	    for (r = 0; r < listPtr->numRanges; r++) {
+		for (i = listPtr->selRanges[r].first;
+			i <= listPtr->selRanges[r].last; i++) {
+		    sprintf(index, "%d", i);
+		    Tcl_AppendElement(interp, index);
+		    count++;
+		}
+	    }
+	} else {
+	    for (i = 0; i < listPtr->numElements; i++) {
+		if (listPtr->elements[i]->selected) {
+		    sprintf(index, "%d", i);
+		    Tcl_AppendElement(interp, index);
+		    count++;
+		}
 	    }
 	}
 	if (count != listPtr->numSelected) {
@@ -457,6 +558,9 @@ ListboxWidgetCmd(clientData, interp, argc, argv)
 		    (char *) NULL);
 	    goto error;
 	}
+	if (listPtr->flags & VIRTUAL_MODE) {
+	    goto virtualError;
+	}
 	if (GetListboxIndex(interp, listPtr, argv[2], 0, &first) != TCL_OK) {
 	    goto error;
 	}
@@ -470,7 +574,6 @@ ListboxWidgetCmd(clientData, interp, argc, argv)
 	DeleteEls(listPtr, first, last);
     } else if ((c == 'g') && (strncmp(argv[1], "get", length) == 0)) {
 	int first, last, i;
-	Element *elPtr;
 
 	if ((argc != 3) && (argc != 4)) {
 	    Tcl_AppendResult(interp, "wrong # args: should be \"",
@@ -484,17 +587,28 @@ ListboxWidgetCmd(clientData, interp, argc, argv)
 		0, &last) != TCL_OK)) {
 	    goto error;
 	}
-	for (elPtr = listPtr->firstPtr, i = 0; i < first;
-		i++, elPtr = elPtr->nextPtr) {
-	    /* Empty loop body. */
-	}
-	if (elPtr != NULL) {
+	if ((first >= 0) && (first < listPtr->numElements)) {
+	    Element *elPtr;
+
 	    if (argc == 3) {
-	      Tcl_SetObjResult(interp, Tcl_NewStringObj(elPtr->text,-1));
+		elPtr = GetElement(listPtr, first);
+		if (elPtr == NULL) {
+		    goto error;
+		}
+		Tcl_SetObjResult(interp, Tcl_NewStringObj(elPtr->text,-1));
 	    } else {
-		for (  ; i <= last; i++, elPtr = elPtr->nextPtr) {
-		    Tcl_AppendElement(interp, elPtr->text);
+		Tcl_DString ds;
+
+		Tcl_DStringInit(&ds);
+		for (i = first; i <= last; i++) {
+		    elPtr = GetElement(listPtr, i);
+		    if (elPtr == NULL) {
+			Tcl_DStringFree(&ds);
+			goto error;
+		    }
+		    Tcl_DStringAppendElement(&ds, elPtr->text);
 		}
+		Tcl_DStringResult(interp, &ds);
 	    }
 	}
     } else if ((c == 'i') && (strncmp(argv[1], "index", length) == 0)
@@ -522,6 +636,9 @@ ListboxWidgetCmd(clientData, interp, argc, argv)
 		    (char *) NULL);
 	    goto error;
 	}
+	if (listPtr->flags & VIRTUAL_MODE) {
+	    goto virtualError;
+	}
 	if (GetListboxIndex(interp, listPtr, argv[2], 1, &index)
 		!= TCL_OK) {
 	    goto error;
@@ -603,19 +720,13 @@ ListboxWidgetCmd(clientData, interp, argc, argv)
 	} else if ((c == 'c') && (strncmp(argv[2], "clear", length) == 0)) {
 	    ListboxSelect(listPtr, first, last, 0);
 	} else if ((c == 'i') && (strncmp(argv[2], "includes", length) == 0)) {
-	    int i;
-	    Element *elPtr;
-    
 	    if (argc != 4) {
 		Tcl_AppendResult(interp, "wrong # args: should be \"",
 			argv[0], " selection includes index\"", (char *) NULL);
 		goto error;
 	    }
-	    for (elPtr = listPtr->firstPtr, i = 0; i < first;
-		    i++, elPtr = elPtr->nextPtr) {
-		/* Empty loop body. */
-	    }
-	    if ((elPtr != NULL) && (elPtr->selected)) {
+	    if ((first >= 0) && (first < listPtr->numElements)
+		    && IsSelected(listPtr, first)) {
 	      Tcl_SetObjResult(interp, Tcl_NewStringObj("1",-1));
 	    } else {
 	      Tcl_SetObjResult(interp, Tcl_NewStringObj("0",-1));
@@ -736,6 +847,10 @@ ListboxWidgetCmd(clientData, interp, argc, argv)
     Ck_Release((ClientData) listPtr);
     return result;
 
+    virtualError:
+    Tcl_AppendResult(interp, "can't ", argv[1], " elements of listbox \"",
+	    argv[0], "\": rows come from -datacommand", (char *) NULL);
+
     error:
     Ck_Release((ClientData) listPtr);
     return TCL_ERROR;
@@ -764,16 +879,27 @@ DestroyListbox(clientData)
     ClientData clientData;	/* Info about listbox widget. */
 {
     register Listbox *listPtr = (Listbox *) clientData;
-    register Element *elPtr, *nextPtr;
+    int i;
 
     /*
      * Free up all of the list elements.
      */
 
-    for (elPtr = listPtr->firstPtr; elPtr != NULL; ) {
-	nextPtr = elPtr->nextPtr;
-	ckfree((char *) elPtr);
-	elPtr = nextPtr;
+    for (i = 0; i < listPtr->numElements; i++) {
+	ckfree((char *) listPtr->elements[i]);
+    }
+    if (listPtr->elements != NULL) {
+	ckfree((char *) listPtr->elements);
+    }
+    if (listPtr->widthCount != NULL) {
+	ckfree((char *) listPtr->widthCount);
+    }
+    FlushRows(listPtr);
+    if (listPtr->rowCache != NULL) {
+	ckfree((char *) listPtr->rowCache);
+    }
+    if (listPtr->selRanges != NULL) {
+	ckfree((char *) listPtr->selRanges);
     }
 
     Ck_FreeOptions(configSpecs, (char *) listPtr, 0);
@@ -852,6 +978,7 @@ ConfigureListbox(interp, listPtr, argc, argv, flags)
 	    argc, argv, (char *) listPtr, flags) != TCL_OK) {
 	return TCL_ERROR;
     }
+    SetVirtualMode(listPtr);
 
     /*
      * Register the desired geometry for the window and arrange for
@@ -887,9 +1014,34 @@ DisplayListbox(clientData)
     Listbox *listPtr = (Listbox *) clientData;
     CkWindow *winPtr = listPtr->winPtr;
     Element *elPtr;
-    int i, limit, y, width, cursorY;
+    int i, limit, y, width, cursorY, selected;
 
     listPtr->flags &= ~REDRAW_PENDING;
+
+    /*
+     * Get the visible rows of a virtual listbox first, since
+     * this may change the width for the horizontal scrollbar.
+     */
+
+    limit = listPtr->topIndex + listPtr->fullLines;
+    if (limit > listPtr->numElements) {
+	limit = listPtr->numElements;
+    }
+    if ((listPtr->flags & VIRTUAL_MODE) && (winPtr != NULL)
+	    && (winPtr->flags & CK_MAPPED) && (listPtr->topIndex < limit)) {
+	Ck_Preserve((ClientData) listPtr);
+	if (FetchRows(listPtr, listPtr->topIndex, limit - 1) != TCL_OK) {
+	    Tcl_AddErrorInfo(listPtr->interp,
+		    "\n    (data command executed by listbox)");
+	    Tk_BackgroundError(listPtr->interp);
+	}
+	if (listPtr->winPtr == NULL) {
+	    Ck_Release((ClientData) listPtr);
+	    return;
+	}
+	Ck_Release((ClientData) listPtr);
+    }
+
     if (listPtr->flags & UPDATE_V_SCROLLBAR) {
 	ListboxUpdateVScrollbar(listPtr);
     }
@@ -915,18 +1067,26 @@ DisplayListbox(clientData)
 	limit = listPtr->numElements;
     }
     width = listPtr->xOffset + winPtr->width;
-    for (elPtr = listPtr->firstPtr, i = 0, y = cursorY = 0;
-            (elPtr != NULL) && (i < limit);
-	    elPtr = elPtr->nextPtr, i++) {
-	if (i < listPtr->topIndex) {
-	    continue;
+    for (i = listPtr->topIndex, y = cursorY = 0; i < limit; i++) {
+	if (listPtr->flags & VIRTUAL_MODE) {
+	    RowCache *rowPtr = &listPtr->rowCache[i % listPtr->cacheSize];
+
+	    if (rowPtr->index != i) {
+		/* Data command failed or changed the listbox. */
+		y++;
+		continue;
+	    }
+	    elPtr = rowPtr->elPtr;
+	} else {
+	    elPtr = listPtr->elements[i];
 	}
+	selected = IsSelected(listPtr, i);
 	if (i == listPtr->active && (listPtr->flags & GOT_FOCUS)) {
 	    cursorY = y;
 	    Ck_SetWindowAttr(winPtr, listPtr->activeFg, listPtr->activeBg,
         	listPtr->activeAttr |
-        	(elPtr->selected ? listPtr->selAttr : 0));
-	} else if (elPtr->selected) {
+        	(selected ? listPtr->selAttr : 0));
+	} else if (selected) {
 	    Ck_SetWindowAttr(winPtr, listPtr->selFg, listPtr->selBg,
         	listPtr->selAttr);
         } else {
@@ -1023,12 +1183,8 @@ InsertEls(listPtr, index, argc, argv)
     int argc;			/* Number of new elements to add. */
     char **argv;		/* New elements (one per entry). */
 {
-    register Element *prevPtr, *newPtr;
-    int length, i, oldMaxWidth;
-
-    /*
-     * Find the element before which the new ones will be inserted.
-     */
+    register Element *newPtr;
+    int i, oldMaxWidth;
 
     if (index <= 0) {
 	index = 0;
@@ -1036,46 +1192,45 @@ InsertEls(listPtr, index, argc, argv)
     if (index > listPtr->numElements) {
 	index = listPtr->numElements;
     }
-    if (index == 0) {
-	prevPtr = NULL;
-    } else if (index == listPtr->numElements) {
-          prevPtr = listPtr->lastPtr;
-    } else {
-	for (prevPtr = listPtr->firstPtr, i = index - 1; i > 0; i--) {
-	    prevPtr = prevPtr->nextPtr;
-	}
-    }
 
     /*
-     * For each new element, create a record, initialize it, and link
-     * it into the list of elements.
+     * Make room in the elements array and open a gap of argc slots
+     * at index.
      */
 
-    oldMaxWidth = listPtr->maxWidth;
-    for (i = argc ; i > 0; i--, argv++, prevPtr = newPtr) {
-	length = strlen(*argv);
-	newPtr = (Element *) ckalloc(ElementSize(length));
-	newPtr->textLength = length;
-	strcpy(newPtr->text, *argv);
-#if CK_USE_UTF
-	newPtr->textWidth = Tcl_NumUtfChars(*argv, length);
-#else
-	newPtr->textWidth = newPtr->textLength;
-#endif
-	if (newPtr->textWidth > listPtr->maxWidth) {
-	    listPtr->maxWidth = newPtr->textWidth;
+    if (listPtr->numElements + argc > listPtr->elementSpace) {
+	int space = listPtr->elementSpace ? listPtr->elementSpace :
+	    ELEMENT_SPACE;
+
+	while (space < listPtr->numElements + argc) {
+	    space *= 2;
 	}
-	newPtr->selected = 0;
-	if (prevPtr == NULL) {
-	    newPtr->nextPtr = listPtr->firstPtr;
-	    listPtr->firstPtr = newPtr;
+	if (listPtr->elements == NULL) {
+	    listPtr->elements = (Element **)
+		ckalloc(space * sizeof (Element *));
 	} else {
-	    newPtr->nextPtr = prevPtr->nextPtr;
-	    prevPtr->nextPtr = newPtr;
+	    listPtr->elements = (Element **)
+		ckrealloc((char *) listPtr->elements,
+		    space * sizeof (Element *));
 	}
+	listPtr->elementSpace = space;
     }
-    if ((prevPtr != NULL) && (prevPtr->nextPtr == NULL)) {
-	listPtr->lastPtr = prevPtr;
+    if (index < listPtr->numElements) {
+	memmove((VOID *) (listPtr->elements + index + argc),
+	    (VOID *) (listPtr->elements + index),
+	    (listPtr->numElements - index) * sizeof (Element *));
+    }
+
+    /*
+     * For each new element, create a record, initialize it, and
+     * store it in the gap.
+     */
+
+    oldMaxWidth = listPtr->maxWidth;
+    for (i = 0; i < argc; i++, argv++) {
+	newPtr = NewElement(*argv);
+	CountWidth(listPtr, newPtr->textWidth, 1);
+	listPtr->elements[index + i] = newPtr;
     }
     listPtr->numElements += argc;
 
@@ -1106,6 +1261,551 @@ InsertEls(listPtr, index, argc, argv)
     ListboxRedrawRange(listPtr, index, listPtr->numElements-1);
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * NewElement --
+ *
+ *	Create a new listbox element holding a copy of a string.
+ *
+ * Results:
+ *	The return value is a pointer to the new, unselected element.
+ *
+ * Side effects:
+ *	Memory is allocated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Element *
+NewElement(string)
+    char *string;		/* Contents of the element. */
+{
+    Element *elPtr;
+    int length;
+
+    length = strlen(string);
+    elPtr = (Element *) ckalloc(ElementSize(length));
+    elPtr->textLength = length;
+    strcpy(elPtr->text, string);
+#if CK_USE_UTF
+    elPtr->textWidth = Tcl_NumUtfChars(string, length);
+#else
+    elPtr->textWidth = elPtr->textLength;
+#endif
+    elPtr->selected = 0;
+    return elPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetVirtualMode --
+ *
+ *	Called after the listbox has been configured in order to
+ *	switch between normal and virtual mode and to apply the
+ *	-count option.  When entering virtual mode, all elements are
+ *	deleted.  In virtual mode the cached rows are discarded, so
+ *	that changed data gets fetched again.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Elements, rows or selected indices may be freed, the view
+ *	of the listbox may change.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SetVirtualMode(listPtr)
+    register Listbox *listPtr;	/* Information about widget. */
+{
+    if (listPtr->dataCmd == NULL) {
+	if (listPtr->flags & VIRTUAL_MODE) {
+	    FlushRows(listPtr);
+	    listPtr->numRanges = 0;
+	    listPtr->flags &= ~VIRTUAL_MODE;
+	    listPtr->numElements = 0;
+	    listPtr->numSelected = 0;
+	    listPtr->maxWidth = 0;
+	    listPtr->topIndex = listPtr->xOffset = 0;
+	    listPtr->active = listPtr->selectAnchor = 0;
+	}
+	return;
+    }
+    if (!(listPtr->flags & VIRTUAL_MODE)) {
+	DeleteEls(listPtr, 0, listPtr->numElements-1);
+	listPtr->flags |= VIRTUAL_MODE;
+	listPtr->maxWidth = 0;
+    }
+    FlushRows(listPtr);
+    if (listPtr->count < 0) {
+	listPtr->count = 0;
+    }
+    listPtr->numElements = listPtr->count;
+
+    /*
+     * Forget selected rows beyond the new end and keep the view
+     * and indices within the rows.
+     */
+
+    listPtr->numSelected -= SelectRange(listPtr, listPtr->numElements,
+	    INT_MAX, 0);
+    if (listPtr->topIndex > (listPtr->numElements - listPtr->fullLines)) {
+	listPtr->topIndex = listPtr->numElements - listPtr->fullLines;
+	if (listPtr->topIndex < 0) {
+	    listPtr->topIndex = 0;
+	}
+    }
+    if (listPtr->active >= listPtr->numElements) {
+	listPtr->active = listPtr->numElements > 0 ?
+	    listPtr->numElements-1 : 0;
+    }
+    if (listPtr->selectAnchor >= listPtr->numElements) {
+	listPtr->selectAnchor = listPtr->numElements > 0 ?
+	    listPtr->numElements-1 : 0;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FetchRows --
+ *
+ *	Make sure that the rows first to last of a virtual listbox
+ *	are in its row cache.  If any of them is missing, the data
+ *	command is invoked once with first and last appended; it
+ *	must return a list with the contents of these rows.  Missing
+ *	list elements are taken as empty rows.
+ *
+ * Results:
+ *	A standard Tcl result.  If TCL_ERROR is returned, an error
+ *	message is left in the interpreter's result.
+ *
+ * Side effects:
+ *	The data command is invoked, which may do anything.  The row
+ *	cache is modified, maxWidth may grow.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+FetchRows(listPtr, first, last)
+    register Listbox *listPtr;	/* Information about widget. */
+    int first;			/* Index of first row needed. */
+    int last;			/* Index of last row needed. */
+{
+    RowCache *rowPtr;
+    Element *elPtr;
+    char string[100], **argv;
+    int i, argc, size;
+
+    if (first < 0) {
+	first = 0;
+    }
+    if (last >= listPtr->numElements) {
+	last = listPtr->numElements-1;
+    }
+    if (last < first || listPtr->dataCmd == NULL) {
+	return TCL_OK;
+    }
+
+    /*
+     * The cache must be large enough to hold all visible rows and
+     * any single request.
+     */
+
+    size = ROW_CACHE_SIZE;
+    while (size < 2 * listPtr->fullLines || size <= last - first) {
+	size *= 2;
+    }
+    if (size > listPtr->cacheSize) {
+	FlushRows(listPtr);
+	if (listPtr->rowCache != NULL) {
+	    ckfree((char *) listPtr->rowCache);
+	}
+	listPtr->rowCache = (RowCache *) ckalloc(size * sizeof (RowCache));
+	for (i = 0; i < size; i++) {
+	    listPtr->rowCache[i].index = -1;
+	    listPtr->rowCache[i].elPtr = NULL;
+	}
+	listPtr->cacheSize = size;
+    }
+
+    for (i = first; i <= last; i++) {
+	if (listPtr->rowCache[i % listPtr->cacheSize].index != i) {
+	    break;
+	}
+    }
+    if (i > last) {
+	return TCL_OK;
+    }
+    first = i;
+
+    sprintf(string, " %d %d", first, last);
+    if (Tcl_VarEval(listPtr->interp, listPtr->dataCmd, string,
+	    (char *) NULL) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    if (Tcl_SplitList(listPtr->interp, Tcl_GetStringResult(listPtr->interp),
+	    &argc, &argv) != TCL_OK) {
+	return TCL_ERROR;
+    }
+
+    /*
+     * The data command may have changed the listbox.
+     */
+
+    if (listPtr->rowCache == NULL || last >= listPtr->numElements ||
+	    last - first >= listPtr->cacheSize) {
+	ckfree((char *) argv);
+	Tcl_ResetResult(listPtr->interp);
+	return TCL_OK;
+    }
+    for (i = first; i <= last; i++) {
+	elPtr = NewElement((i - first < argc) ? argv[i - first] : "");
+	if (elPtr->textWidth > listPtr->maxWidth) {
+	    listPtr->maxWidth = elPtr->textWidth;
+	    listPtr->flags |= UPDATE_H_SCROLLBAR;
+	}
+	rowPtr = &listPtr->rowCache[i % listPtr->cacheSize];
+	if (rowPtr->elPtr != NULL) {
+	    ckfree((char *) rowPtr->elPtr);
+	}
+	rowPtr->index = i;
+	rowPtr->elPtr = elPtr;
+    }
+    ckfree((char *) argv);
+    Tcl_ResetResult(listPtr->interp);
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FlushRows --
+ *
+ *	Discard all rows in the row cache of a virtual listbox.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Memory is freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FlushRows(listPtr)
+    register Listbox *listPtr;	/* Information about widget. */
+{
+    int i;
+
+    for (i = 0; i < listPtr->cacheSize; i++) {
+	if (listPtr->rowCache[i].elPtr != NULL) {
+	    ckfree((char *) listPtr->rowCache[i].elPtr);
+	    listPtr->rowCache[i].elPtr = NULL;
+	}
+	listPtr->rowCache[i].index = -1;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetElement --
+ *
+ *	Return the element at a given index.  For a virtual listbox
+ *	the row is taken from the row cache; if it is missing, it is
+ *	fetched along with some of the following rows.
+ *
+ * Results:
+ *	A pointer to the element, which is valid until the listbox
+ *	is modified or (for a virtual listbox) the next rows are
+ *	fetched.  NULL is returned and an error message is left in
+ *	the interpreter's result if the data command failed.
+ *
+ * Side effects:
+ *	The data command may be invoked.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Element *
+GetElement(listPtr, index)
+    register Listbox *listPtr;	/* Information about widget. */
+    int index;			/* Index of element, must be valid. */
+{
+    RowCache *rowPtr;
+
+    if (!(listPtr->flags & VIRTUAL_MODE)) {
+	return listPtr->elements[index];
+    }
+    if ((listPtr->cacheSize == 0) ||
+	    (listPtr->rowCache[index % listPtr->cacheSize].index != index)) {
+	if (FetchRows(listPtr, index, index + ROW_FETCH - 1) != TCL_OK) {
+	    return NULL;
+	}
+    }
+    rowPtr = &listPtr->rowCache[index % listPtr->cacheSize];
+    if (rowPtr->index != index) {
+	Tcl_AppendResult(listPtr->interp, "listbox \"",
+	    listPtr->winPtr->pathName, "\" was changed by its data command",
+	    (char *) NULL);
+	return NULL;
+    }
+    return rowPtr->elPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * IsSelected --
+ *
+ *	Tell whether the element at a given index is selected.
+ *
+ * Results:
+ *	1 if the element is selected, 0 otherwise.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+IsSelected(listPtr, index)
+    register Listbox *listPtr;	/* Information about widget. */
+    int index;			/* Index of element, must be valid. */
+{
+    if (listPtr->flags & VIRTUAL_MODE) {
+	int r = FindRange(listPtr, index);
+
+	return (r < listPtr->numRanges)
+		&& (listPtr->selRanges[r].first <= index);
+    }
+    return listPtr->elements[index]->selected;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FindRange --
+ *
+ *	Find where an index falls among the selected ranges of a
+ *	virtual listbox.
+ *
+ * Results:
+ *	The position of the first range ending at or after index,
+ *	numRanges if there is none.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+FindRange(listPtr, index)
+    register Listbox *listPtr;	/* Information about widget. */
+    int index;			/* Index of a row. */
+{
+    int lo = 0, hi = listPtr->numRanges, mid;
+
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (listPtr->selRanges[mid].last < index) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+    return lo;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RangeOverlap --
+ *
+ *	Count the rows of a selected range that are between first
+ *	and last.
+ *
+ * Results:
+ *	The number of rows, 0 if the range is outside.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+RangeOverlap(rangePtr, first, last)
+    SelRange *rangePtr;		/* Selected range. */
+    int first, last;		/* Rows to compare with. */
+{
+    if (rangePtr->first > first) {
+	first = rangePtr->first;
+    }
+    if (rangePtr->last < last) {
+	last = rangePtr->last;
+    }
+    return (last >= first) ? last - first + 1 : 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SelectRange --
+ *
+ *	Add rows first through last to the selected ranges of a
+ *	virtual listbox, or remove them.  The ranges covered are
+ *	replaced by at most two, so the cost does not depend on the
+ *	number of rows.
+ *
+ * Results:
+ *	The number of rows whose state changed.
+ *
+ * Side effects:
+ *	The selRanges array may be grown.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SelectRange(listPtr, first, last, select)
+    register Listbox *listPtr;	/* Information about widget. */
+    int first, last;		/* Rows to select or deselect, first
+				 * <= last. */
+    int select;			/* 1 means select rows, 0 means
+				 * deselect them. */
+{
+    SelRange *r, new[2];
+    int lo, hi, i, numNew = 0, changed;
+
+    /*
+     * Ranges lo to hi - 1 are replaced: when selecting, those that
+     * overlap or touch the rows, which are merged with them; when
+     * deselecting, those that overlap, less the rows.
+     */
+
+    if (select) {
+	lo = FindRange(listPtr, (first > 0) ? first - 1 : first);
+	for (hi = lo; (hi < listPtr->numRanges)
+		&& (listPtr->selRanges[hi].first <= last + 1); hi++) {
+	    /* empty loop body */
+	}
+	new[0].first = first;
+	new[0].last = last;
+	changed = last - first + 1;
+	for (i = lo; i < hi; i++) {
+	    r = &listPtr->selRanges[i];
+	    changed -= RangeOverlap(r, first, last);
+	    if (r->first < new[0].first) {
+		new[0].first = r->first;
+	    }
+	    if (r->last > new[0].last) {
+		new[0].last = r->last;
+	    }
+	}
+	numNew = 1;
+    } else {
+	lo = FindRange(listPtr, first);
+	for (hi = lo; (hi < listPtr->numRanges)
+		&& (listPtr->selRanges[hi].first <= last); hi++) {
+	    /* empty loop body */
+	}
+	if (lo == hi) {
+	    return 0;
+	}
+	changed = 0;
+	for (i = lo; i < hi; i++) {
+	    changed += RangeOverlap(&listPtr->selRanges[i], first, last);
+	}
+	if (listPtr->selRanges[lo].first < first) {
+	    new[numNew].first = listPtr->selRanges[lo].first;
+	    new[numNew++].last = first - 1;
+	}
+	if (listPtr->selRanges[hi - 1].last > last) {
+	    new[numNew].first = last + 1;
+	    new[numNew++].last = listPtr->selRanges[hi - 1].last;
+	}
+    }
+
+    i = listPtr->numRanges - (hi - lo) + numNew;
+    if (i > listPtr->rangeSpace) {
+	listPtr->rangeSpace = (listPtr->rangeSpace > 0) ?
+		2 * listPtr->rangeSpace : 8;
+	listPtr->selRanges = (SelRange *) ckrealloc(
+		(char *) listPtr->selRanges,
+		listPtr->rangeSpace * sizeof (SelRange));
+    }
+    memmove(listPtr->selRanges + lo + numNew, listPtr->selRanges + hi,
+	    (listPtr->numRanges - hi) * sizeof (SelRange));
+    memcpy(listPtr->selRanges + lo, new, numNew * sizeof (SelRange));
+    listPtr->numRanges = i;
+    return changed;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CountWidth --
+ *
+ *	Account for an element of the given width being added to or
+ *	removed from a listbox, and keep the listbox's maxWidth up
+ *	to date.  Since the number of elements of each width is kept,
+ *	removing the widest element only needs to look for the next
+ *	smaller width in use, not at all elements.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The widthCount array of listPtr may grow, maxWidth may change.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CountWidth(listPtr, width, incr)
+    register Listbox *listPtr;	/* Listbox widget to modify. */
+    int width;			/* Width of element. */
+    int incr;			/* 1 for added element, -1 for removed
+				 * element. */
+{
+    if (width >= listPtr->widthSpace) {
+	int i, space = listPtr->widthSpace ? listPtr->widthSpace : 128;
+
+	while (space <= width) {
+	    space *= 2;
+	}
+	if (listPtr->widthCount == NULL) {
+	    listPtr->widthCount = (int *) ckalloc(space * sizeof (int));
+	} else {
+	    listPtr->widthCount = (int *)
+		ckrealloc((char *) listPtr->widthCount, space * sizeof (int));
+	}
+	for (i = listPtr->widthSpace; i < space; i++) {
+	    listPtr->widthCount[i] = 0;
+	}
+	listPtr->widthSpace = space;
+    }
+    listPtr->widthCount[width] += incr;
+    if (width > listPtr->maxWidth && incr > 0) {
+	listPtr->maxWidth = width;
+    } else if (width == listPtr->maxWidth) {
+	while (listPtr->maxWidth > 0 &&
+		listPtr->widthCount[listPtr->maxWidth] == 0) {
+	    listPtr->maxWidth--;
+	}
+    }
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1129,8 +1829,8 @@ DeleteEls(listPtr, first, last)
     int first;			/* Index of first element to delete. */
     int last;			/* Index of last element to delete. */
 {
-    register Element *prevPtr, *elPtr;
-    int count, i, widthChanged;
+    register Element *elPtr;
+    int count, i, oldMaxWidth;
 
     /*
      * Adjust the range to fit within the existing elements of the
@@ -1149,44 +1849,24 @@ DeleteEls(listPtr, first, last)
     }
 
     /*
-     * Find the element just before the ones to delete.
-     */
-
-    if (first == 0) {
-	prevPtr = NULL;
-    } else {
-	for (i = first-1, prevPtr = listPtr->firstPtr; i > 0; i--) {
-	    prevPtr = prevPtr->nextPtr;
-	}
-    }
-
-    /*
-     * Delete the requested number of elements.
+     * Delete the requested number of elements and close the gap
+     * in the elements array.
      */
 
-    widthChanged = 0;
-    for (i = count; i > 0; i--) {
-	if (prevPtr == NULL) {
-	    elPtr = listPtr->firstPtr;
-	    listPtr->firstPtr = elPtr->nextPtr;
-	    if (listPtr->firstPtr == NULL) {
-		listPtr->lastPtr = NULL;
-	    }
-	} else {
-	    elPtr = prevPtr->nextPtr;
-	    prevPtr->nextPtr = elPtr->nextPtr;
-	    if (prevPtr->nextPtr == NULL) {
-		listPtr->lastPtr = prevPtr;
-	    }
-	}
-	if (elPtr->textWidth == listPtr->maxWidth) {
-	    widthChanged = 1;
-	}
+    oldMaxWidth = listPtr->maxWidth;
+    for (i = first; i <= last; i++) {
+	elPtr = listPtr->elements[i];
+	CountWidth(listPtr, elPtr->textWidth, -1);
 	if (elPtr->selected) {
 	    listPtr->numSelected -= 1;
 	}
 	ckfree((char *) elPtr);
     }
+    if (last + 1 < listPtr->numElements) {
+	memmove((VOID *) (listPtr->elements + first),
+	    (VOID *) (listPtr->elements + last + 1),
+	    (listPtr->numElements - last - 1) * sizeof (Element *));
+    }
     listPtr->numElements -= count;
 
     /*
@@ -1224,20 +1904,12 @@ DeleteEls(listPtr, first, last)
     }
     listPtr->flags |= UPDATE_V_SCROLLBAR;
     ListboxComputeGeometry(listPtr);
-    if (widthChanged) {
-	int maxWidth = 0;
-
-	for (elPtr = listPtr->firstPtr; elPtr != NULL; elPtr = elPtr->nextPtr)
-	    if (elPtr->textWidth > maxWidth)
-		maxWidth = elPtr->textWidth;
-	if (maxWidth != listPtr->maxWidth) {
-	    listPtr->maxWidth = maxWidth;
-	    listPtr->flags |= UPDATE_H_SCROLLBAR;
-	    if (listPtr->xOffset + listPtr->width >= listPtr->maxWidth)
-		listPtr->xOffset = listPtr->maxWidth - listPtr->width;
-	    if (listPtr->xOffset < 0)
-		listPtr->xOffset = 0;
-	}
+    if (listPtr->maxWidth != oldMaxWidth) {
+	listPtr->flags |= UPDATE_H_SCROLLBAR;
+	if (listPtr->xOffset + listPtr->width >= listPtr->maxWidth)
+	    listPtr->xOffset = listPtr->maxWidth - listPtr->width;
+	if (listPtr->xOffset < 0)
+	    listPtr->xOffset = 0;
     }
     ListboxRedrawRange(listPtr, first, listPtr->numElements-1);
 }
@@ -1550,14 +2222,25 @@ ListboxSelect(listPtr, first, last, select)
     if (first >= listPtr->numElements) {
 	return;
     }
+    if (first < 0) {
+	first = 0;
+    }
+    if (last >= listPtr->numElements) {
+	last = listPtr->numElements-1;
+    }
     oldCount = listPtr->numSelected;
     firstRedisplay = -1;
     increment = select ? 1 : -1;
-    for (i = 0, elPtr = listPtr->firstPtr; i < first;
-	    i++, elPtr = elPtr->nextPtr) {
-	/* Empty loop body. */
+    if (listPtr->flags & VIRTUAL_MODE) {
+	i = SelectRange(listPtr, first, last, select);
+	if (i > 0) {
+	    listPtr->numSelected += select ? i : -i;
+	    ListboxRedrawRange(listPtr, first, last);
+	}
+	return;
     }
-    for ( ; i <= last; i++, elPtr = elPtr->nextPtr) {
+    for (i = first; i <= last; i++) {
+	elPtr = listPtr->elements[i];
 	if (elPtr->selected == select) {
 	    continue;
 	}
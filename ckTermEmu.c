@@ -0,0 +1,2392 @@
+/*
+ * ckTermEmu.c --
+ *
+ *	This file implements the emulator behind the terminal widget
+ *	and the emulator command: the escape sequence parser, the
+ *	screens kept in memory cell by cell, the lines saved off the
+ *	primary screen and the program run on a pty.  Nothing here
+ *	draws or needs the curses screen; a terminal showing a node
+ *	draws its cells in ckTerminal.c.
+ *
+ * Copyright (c) 2019 VCA
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ */
+
+#include "ckPort.h"
+#include "ck.h"
+#include "ckTerminal.h"
+
+extern int setenv (const char *__string, const char *__value, int __overwrite);
+
+/*
+ * Code below is taken form MTM
+ */
+
+/* Copyright 2017 - 2019 Rob King <jking@deadpixi.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <locale.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <wchar.h>
+#include <wctype.h>
+/* Includes needed to make forkpty(3) work. */
+#ifndef FORKPTY_INCLUDE_H
+#if defined(__APPLE__)
+#define FORKPTY_INCLUDE_H <util.h>
+#elif defined(__FreeBSD__)
+#define FORKPTY_INCLUDE_H <libutil.h>
+#else
+#define FORKPTY_INCLUDE_H <pty.h>
+#endif
+#endif
+#include FORKPTY_INCLUDE_H
+
+/* You probably don't need to alter these much, but if you do,
+ * here is where you can define alternate character sets.
+ *
+ * Note that if your system's wide-character implementation
+ * maps directly to Unicode, the preferred Unicode characters
+ * will be used automatically if your system declares such
+ * support. If it doesn't declare it, define WCHAR_IS_UNICODE to
+ * force Unicode to be used.
+ */
+#define MAXMAP 0x7f
+  static wchar_t CSET_US[MAXMAP]; /* "USASCII"...really just the null table */
+
+#if defined(__STDC_ISO_10646__) || defined(WCHAR_IS_UNICODE)
+static wchar_t CSET_UK[MAXMAP] ={ /* "United Kingdom"...really just Pound Sterling */
+				 [L'#'] = 0x00a3
+};
+
+static wchar_t CSET_GRAPH[MAXMAP] =
+  { /* Graphics Set One */
+   [L'-'] = 0x2191,
+   [L'}'] = 0x00a3,
+   [L'~'] = 0x00b7,
+   [L'{'] = 0x03c0,
+   [L','] = 0x2190,
+   [L'+'] = 0x2192,
+   [L'.'] = 0x2193,
+   [L'|'] = 0x2260,
+   [L'>'] = 0x2265,
+   [L'`'] = 0x25c6,
+   [L'a'] = 0x2592,
+   [L'b'] = 0x2409,
+   [L'c'] = 0x240c,
+   [L'd'] = 0x240d,
+   [L'e'] = 0x240a,
+   [L'f'] = 0x00b0,
+   [L'g'] = 0x00b1,
+   [L'h'] = 0x2592,
+   [L'i'] = 0x2603,
+   [L'j'] = 0x2518,
+   [L'k'] = 0x2510,
+   [L'l'] = 0x250c,
+   [L'm'] = 0x2514,
+   [L'n'] = 0x253c,
+   [L'o'] = 0x23ba,
+   [L'p'] = 0x23bb,
+   [L'q'] = 0x2500,
+   [L'r'] = 0x23bc,
+   [L's'] = 0x23bd,
+   [L't'] = 0x251c,
+   [L'u'] = 0x2524,
+   [L'v'] = 0x2534,
+   [L'w'] = 0x252c,
+   [L'x'] = 0x2502,
+   [L'y'] = 0x2264,
+   [L'z'] = 0x2265,
+   [L'_'] = L' ',
+   [L'0'] = 0x25ae
+  };
+
+#else /* wchar_t doesn't map to Unicode... */
+
+static wchar_t CSET_UK[] =
+  { /* "United Kingdom"...really just Pound Sterling */
+   [L'#'] = L'&'
+  };
+
+static wchar_t CSET_GRAPH[] =
+  { /* Graphics Set One */
+   [L'-'] = '^',
+   [L'}'] = L'&',
+   [L'~'] = L'o',
+   [L'{'] = L'p',
+   [L','] = L'<',
+   [L'+'] = L'>',
+   [L'.'] = L'v',
+   [L'|'] = L'!',
+   [L'>'] = L'>',
+   [L'`'] = L'+',
+   [L'a'] = L':',
+   [L'b'] = L' ',
+   [L'c'] = L' ',
+   [L'd'] = L' ',
+   [L'e'] = L' ',
+   [L'f'] = L'\'',
+   [L'g'] = L'#',
+   [L'h'] = L'#',
+   [L'i'] = L'i',
+   [L'j'] = L'+',
+   [L'k'] = L'+',
+   [L'l'] = L'+',
+   [L'm'] = L'+',
+   [L'n'] = '+',
+   [L'o'] = L'-',
+   [L'p'] = L'-',
+   [L'q'] = L'-',
+   [L'r'] = L'-',
+   [L's'] = L'_',
+   [L't'] = L'+',
+   [L'u'] = L'+',
+   [L'v'] = L'+',
+   [L'w'] = L'+',
+   [L'x'] = L'|',
+   [L'y'] = L'<',
+   [L'z'] = L'>',
+   [L'_'] = L' ',
+   [L'0'] = L'#',
+  };
+#endif
+
+/*** GLOBALS AND PROTOTYPES */
+static void setupevents(NODE *n);
+static void savelines(NODE *n, int count);
+static void histclear(NODE *n);
+
+int
+vtsafewrite(int fd, const char *b, size_t n) /* Write, checking for errors. */
+{
+  size_t w = 0;
+  if ( fd<0 ) return 0;
+  while (w < n){
+    ssize_t s = write(fd, b + w, n - w);
+    if (s < 0 && errno != EINTR)
+      return w;
+    else if (s < 0)
+      s = 0;
+    w += (size_t)s;
+  }
+  return w;
+}
+
+
+/*** SCREEN CELLS
+ * These functions change the cells of a screen for the handlers below,
+ * marking the rows they change as dirty. The cursor always stays on the
+ * screen, blanks take the current colors, and a double width character
+ * that an operation cuts in two is blanked whole.
+ */
+static void
+blankcell(SCRN *s, CELL *c) /* Make c a blank of the current colors. */
+{
+  memset(c->ch, 0, sizeof(c->ch));
+  c->ch[0] = L' ';
+  c->attr = A_NORMAL;
+  c->fg = s->fg;
+  c->bg = s->bg;
+}
+
+static void
+splitwide(SCRN *s, int y, int x) /* Blank a double width character
+				  * lying on columns x - 1 and x. */
+{
+  if (x > 0 && x < s->cols && CELLAT(s, y, x)->ch[0] == 0) {
+    blankcell(s, CELLAT(s, y, x - 1));
+    blankcell(s, CELLAT(s, y, x));
+  }
+}
+
+static void
+clearcells(SCRN *s, int y, int from, int to) /* Blank columns from to
+					       * to - 1 of row y. */
+{
+  from = MAX(from, 0);
+  to = MIN(to, s->cols);
+  if (y < 0 || y >= s->rows || from >= to)
+    return;
+  splitwide(s, y, from);
+  splitwide(s, y, to);
+  for (int x = from; x < to; x++)
+    blankcell(s, CELLAT(s, y, x));
+  s->dirty[y] = true;
+}
+
+static void
+clearrows(SCRN *s, int from, int to) /* Blank rows from to to - 1. */
+{
+  for (int y = MAX(from, 0); y < MIN(to, s->rows); y++)
+    clearcells(s, y, 0, s->cols);
+}
+
+static void
+clearbelow(SCRN *s, int y, int x) /* Blank the screen from y, x on. */
+{
+  clearcells(s, y, x, s->cols);
+  clearrows(s, y + 1, s->rows);
+}
+
+static void
+movecursor(SCRN *s, int y, int x) /* Move the cursor, staying on the screen. */
+{
+  s->cy = MIN(MAX(y, 0), s->rows - 1);
+  s->cx = MIN(MAX(x, 0), s->cols - 1);
+}
+
+static bool
+setregion(SCRN *s, int top, int bot) /* Scroll rows top to bot. */
+{
+  if (top < 0 || top > bot || bot >= s->rows)
+    return false;
+  s->top = top;
+  s->bot = bot;
+  return true;
+}
+
+static void
+scrollcells(SCRN *s, int count) /* Scroll the region up count rows, down
+				 * if count < 0. */
+{
+  int len = s->bot - s->top + 1, k = MIN(abs(count), len);
+  CELL *top = CELLAT(s, s->top, 0);
+
+  if (count > 0) {
+    memmove(top, top + k * s->cols, (len - k) * s->cols * sizeof(CELL));
+    clearrows(s, s->bot + 1 - k, s->bot + 1);
+  } else if (count < 0) {
+    memmove(top + k * s->cols, top, (len - k) * s->cols * sizeof(CELL));
+    clearrows(s, s->top, s->top + k);
+  }
+  for (int y = s->top; y <= s->bot; y++)
+    s->dirty[y] = true;
+}
+
+static void
+putcell(SCRN *s, int y, int x, wchar_t w, int wd) /* Write a character of
+						   * width wd at y, x. */
+{
+  CELL *c;
+
+  if (x + wd > s->cols)
+    w = L' ', wd = 1; /* a double width character that can't fit */
+  splitwide(s, y, x);
+  splitwide(s, y, x + wd);
+  c = CELLAT(s, y, x);
+  memset(c->ch, 0, sizeof(c->ch));
+  c->ch[0] = w;
+  c->attr = s->attr;
+  c->fg = s->fg;
+  c->bg = s->bg;
+  if (wd > 1) {
+    c[1] = c[0];
+    c[1].ch[0] = 0;
+  }
+  s->dirty[y] = true;
+}
+
+static void
+combinecell(SCRN *s, int y, int x, wchar_t w) /* Add a combining character
+					       * to the cell at y, x. */
+{
+  CELL *c;
+  int i;
+
+  if (x > 0 && CELLAT(s, y, x)->ch[0] == 0)
+    x--;
+  if (x < 0)
+    return;
+  c = CELLAT(s, y, x);
+  for (i = 1; i < CCHARW_MAX && c->ch[i]; i++)
+    ;
+  if (i < CCHARW_MAX)
+    c->ch[i] = w;
+  s->dirty[y] = true;
+}
+
+static void
+insertcell(SCRN *s, int y, int x) /* Insert a blank at y, x, the rest of
+				   * the row moves right. */
+{
+  CELL *c = CELLAT(s, y, x);
+
+  splitwide(s, y, x);
+  splitwide(s, y, s->cols - 1);
+  memmove(c + 1, c, (s->cols - x - 1) * sizeof(CELL));
+  blankcell(s, c);
+  s->dirty[y] = true;
+}
+
+static void
+deletecell(SCRN *s, int y, int x) /* Delete the cell at y, x, the rest of
+				   * the row moves left. */
+{
+  CELL *c = CELLAT(s, y, x);
+
+  splitwide(s, y, x);
+  splitwide(s, y, x + 1);
+  memmove(c, c + 1, (s->cols - x - 1) * sizeof(CELL));
+  blankcell(s, CELLAT(s, y, s->cols - 1));
+  s->dirty[y] = true;
+}
+
+static bool
+resizecells(SCRN *s, int rows, int cols) /* Resize a screen, keeping the
+					  * cells at its top left. */
+{
+  CELL *cells = malloc(rows * cols * sizeof(CELL));
+  bool *dirty = malloc(rows * sizeof(bool));
+
+  if (!cells || !dirty)
+    return free(cells), free(dirty), false;
+  for (int y = 0; y < rows; y++) {
+    for (int x = 0; x < cols; x++) {
+      CELL *c = cells + y * cols + x;
+
+      if (y < s->rows && x < s->cols)
+	*c = *CELLAT(s, y, x);
+      else
+	blankcell(s, c);
+    }
+    /* the right half of a double width character was cut off */
+    if (y < s->rows && cols < s->cols && CELLAT(s, y, cols)->ch[0] == 0)
+      blankcell(s, cells + y * cols + cols - 1);
+    dirty[y] = true;
+  }
+  free(s->cells);
+  free(s->dirty);
+  s->cells = cells;
+  s->dirty = dirty;
+  s->rows = rows;
+  s->cols = cols;
+  s->top = 0;
+  s->bot = rows - 1;
+  movecursor(s, s->cy, s->cx);
+  return true;
+}
+
+static void
+regionscrl(NODE *n, SCRN *s, int count) /* Scroll the region of a screen
+					 * and its wrap flags. */
+{
+  if (s == &n->pri && n->wrapped) {
+    int top = s->top, bot = MIN(s->bot, n->nwrapped - 1), len;
+
+    len = bot - top + 1;
+    if (len > 0 && abs(count) >= len) {
+      memset(n->wrapped + top, 0, len);
+    } else if (len > 0 && count > 0) {
+      memmove(n->wrapped + top, n->wrapped + top + count, len - count);
+      memset(n->wrapped + bot + 1 - count, 0, count);
+    } else if (len > 0 && count < 0) {
+      memmove(n->wrapped + top - count, n->wrapped + top, len + count);
+      memset(n->wrapped + top, 0, -count);
+    }
+  }
+  scrollcells(s, count);
+}
+
+static void
+unwrap(NODE *n, SCRN *s, int from, int to) /* Clear wrap flags of rows
+					    * being erased. */
+{
+  if (s == &n->pri && n->wrapped) {
+    for (int i = MAX(from, 0); i < MIN(to, n->nwrapped); i++)
+      n->wrapped[i] = 0;
+  }
+  /* the newest saved line no longer goes on on the first row */
+  if (s == &n->pri && from <= 0)
+    n->hist.open = false;
+}
+
+/*** TERMINAL EMULATION HANDLERS
+ * These functions implement the various terminal commands activated by
+ * escape sequences and printing to the terminal. Large amounts of boilerplate
+ * code is shared among all these functions, and is factored out into the
+ * macros below:
+ *      PD(n, d)       - Parameter n, with default d.
+ *      P0(n)          - Parameter n, default 0.
+ *      P1(n)          - Parameter n, default 1.
+ *      CALL(h)        - Call handler h with no arguments.
+ *      SENDN(n, s, c) - Write string c bytes of s to n.
+ *      SEND(n, s)     - Write string s to node n's host.
+ *      (END)HANDLER   - Declare/end a handler function
+ *      COMMONVARS     - All of the common variables for a handler.
+ *                       x, y     - cursor position
+ *                       mx, my   - max possible values for x and y
+ *                       n        - the current node
+ *                       top, bot - the scrolling region, bot excluded
+ *                       s        - the current SCRN buffer
+ * The funny names for handlers are from their ANSI/ECMA/DEC mnemonics.
+ */
+#define PD(x, d) (argc < (x) || !argv? (d) : argv[(x)])
+#define P0(x) PD(x, 0)
+#define P1(x) (!P0(x)? 1 : P0(x))
+#define CALL(x) (x)(v, n, 0, 0, 0, NULL, NULL)
+#define COMMONVARS						\
+  NODE *n = (NODE *)p;						\
+  SCRN *s = n->s;						\
+  int y = s->cy, x = s->cx, my = s->rows, mx = s->cols;		\
+  int top = s->top, bot = s->bot + 1;				\
+  (void)v; (void)p; (void)w; (void)iw; (void)argc; (void)argv;	\
+  (void)y; (void)x; (void)my; (void)mx; (void)osc;		\
+  (void)top; (void)bot;					\
+
+#define HANDLER(name)                                   \
+  static void						\
+  name (VTPARSER *v, void *p, wchar_t w, wchar_t iw,	\
+	int argc, int *argv, const wchar_t *osc)	\
+  { COMMONVARS
+#define ENDHANDLER n->repc = 0; } /* control sequences aren't repeated */
+
+/* 
+ *--------------------------------------------------------------------------
+ * Terminal bell.
+ *--------------------------------------------------------------------------
+ */
+HANDLER(bell) { 
+  if (n->clientData != NULL) /* only an emulator shown by a terminal rings */
+    beep();
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * Application/Numeric Keypad Mode
+ *--------------------------------------------------------------------------
+ */
+HANDLER(numkp) { 
+  n->pnm = (w == L'=');
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * Cursor visibility
+ *--------------------------------------------------------------------------
+ */
+HANDLER(vis) { 
+  s->vis = iw == L'6'? 0 : 1;
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * CUP - Cursor Position
+ *--------------------------------------------------------------------------
+ */
+HANDLER(cup) { 
+  s->xenl = false;
+  movecursor(s, (n->decom? top : 0) + P1(0) - 1, P1(1) - 1);
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * DCH - Delete Character
+ *--------------------------------------------------------------------------
+ */
+HANDLER(dch) { 
+  for (int i = 0; i < MIN(P1(0), mx - x); i++) {
+    deletecell(s, y, x);
+  }
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * ICH - Insert Character
+ *--------------------------------------------------------------------------
+ */
+HANDLER(ich) { 
+  for (int i = 0; i < MIN(P1(0), mx - x); i++) {
+    insertcell(s, y, x);
+  }
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * CUU - Cursor Up
+ *--------------------------------------------------------------------------
+ */
+HANDLER(cuu) { 
+  movecursor(s, MAX(y - P1(0), top), x);
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * CUD - Cursor Down
+ *--------------------------------------------------------------------------
+ */
+HANDLER(cud) { 
+  movecursor(s, MIN(y + P1(0), bot - 1), x);
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * CUF - Cursor Forward
+ *--------------------------------------------------------------------------
+ */
+HANDLER(cuf) { 
+  movecursor(s, y, MIN(x + P1(0), mx - 1));
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * ACK - Acknowledge Enquiry
+ *--------------------------------------------------------------------------
+ */
+HANDLER(ack) { 
+  SEND(n, "\006");
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * HTS - Horizontal Tab Set
+ *--------------------------------------------------------------------------
+ */
+HANDLER(hts) { 
+  if (x < n->ntabs && x > 0)
+    n->tabs[x] = true;
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * RI - Reverse Index
+ *--------------------------------------------------------------------------
+ */
+HANDLER(ri) { 
+  if (y == top)
+    regionscrl(n, s, -1);
+  else
+    movecursor(s, y - 1, x);
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * DECID - Send Terminal Identification
+ *--------------------------------------------------------------------------
+ */
+HANDLER(decid) { 
+  if (w == L'c') {
+    SEND(n, iw == L'>'? "\033[>1;10;0c" : "\033[?1;2c");
+  } else if (w == L'Z') {
+    SEND(n, "\033[?6c");
+  }
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * HPA - Cursor Horizontal Absolute
+ *--------------------------------------------------------------------------
+ */
+HANDLER(hpa) {
+  movecursor(s, y, MIN(P1(0) - 1, mx - 1));
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * HPR - Cursor Horizontal Relative
+ *--------------------------------------------------------------------------
+ */
+HANDLER(hpr) { 
+  movecursor(s, y, MIN(x + P1(0), mx - 1));
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * VPA - Cursor Vertical Absolute
+ *--------------------------------------------------------------------------
+ */
+HANDLER(vpa) { 
+  movecursor(s, MIN(bot - 1, MAX(top, P1(0) - 1)), x);
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * VPR - Cursor Vertical Relative
+ *--------------------------------------------------------------------------
+ */
+HANDLER(vpr) { 
+  movecursor(s, MIN(bot - 1, MAX(top, y + P1(0))), x);
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * CBT - Cursor Backwards Tab
+ *--------------------------------------------------------------------------
+ */
+HANDLER(cbt) { 
+  for (int i = x - 1; i < n->ntabs && i >= 0; i--) {
+    if (n->tabs[i]) {
+      movecursor(s, y, i);
+      vtfixcursor(n);
+      return;
+    }
+  }
+  movecursor(s, y, 0);
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * HT - Horizontal Tab
+ *--------------------------------------------------------------------------
+ */
+HANDLER(ht) { 
+  for (int i = x + 1; i < n->w && i < n->ntabs; i++) {
+    if (n->tabs[i]) {
+      movecursor(s, y, i);
+      vtfixcursor(n);
+      return;
+    }
+  }
+  movecursor(s, y, mx - 1);
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * Tab forwards or backwards
+ *--------------------------------------------------------------------------
+ */
+HANDLER(tab) {
+  for (int i = 0; i < P1(0); i++) {
+    switch (w) {
+    case L'I':  CALL(ht);  break;
+    case L'\t': CALL(ht);  break;
+    case L'Z':  CALL(cbt); break;
+    }
+  }
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * DECALN - Screen Alignment Test
+ *--------------------------------------------------------------------------
+ */
+HANDLER(decaln) { 
+  for (int r = 0; r < my; r++) {
+    for (int c = 0; c < mx; c++) {
+      CELL *e = CELLAT(s, r, c);
+
+      memset(e->ch, 0, sizeof(e->ch));
+      e->ch[0] = L'E';
+      e->attr = A_NORMAL;
+      e->fg = e->bg = -1;
+    }
+    s->dirty[r] = true;
+  }
+  unwrap(n, s, 0, my);
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * SU - Scroll Up/Down
+ *--------------------------------------------------------------------------
+ */
+HANDLER(su) {
+  if (w != L'T' && w != L'^')
+    savelines(n, MIN(P1(0), bot - top));
+  regionscrl(n, s, (w == L'T' || w == L'^')? -P1(0) : P1(0));
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * SC - Save Cursor
+ *--------------------------------------------------------------------------
+ */
+HANDLER(sc) {
+  s->sx = x;                               /* save X position            */
+  s->sy = y;                               /* save Y position            */
+  s->sattr = s->attr;                      /* save attributes            */
+  s->sfg = s->fg;                          /* save foreground color      */
+  s->sbg = s->bg;                          /* save background color      */
+  s->oxenl = s->xenl;                      /* save xenl state            */
+  s->saved = true;                         /* save data is valid         */
+  n->sgc = n->gc; n->sgs = n->gs;          /* save character sets        */
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * RC - Restore Cursor
+ *--------------------------------------------------------------------------
+ */
+HANDLER(rc) { 
+  if (iw == L'#'){
+    CALL(decaln);
+    return;
+  }
+  if (!s->saved)
+    return;
+  movecursor(s, s->sy, s->sx);             /* get old position          */
+  s->attr = s->sattr;                      /* get attributes            */
+  s->fg = s->sfg;                          /* get foreground color      */
+  s->bg = s->sbg;                          /* get background color      */
+  s->xenl = s->oxenl;                      /* get xenl state            */
+  n->gc = n->sgc; n->gs = n->sgs;          /* save character sets        */
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * TBC - Tabulation Clear
+ *--------------------------------------------------------------------------
+ */
+HANDLER(tbc) {
+  switch (P0(0)){
+  case 0: n->tabs[x < n->ntabs? x : 0] = false;          break;
+  case 3: memset(n->tabs, 0, sizeof(bool) * (n->ntabs)); break;
+  }
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * CUB - Cursor Backward
+ *--------------------------------------------------------------------------
+ */
+HANDLER(cub) { 
+  s->xenl = false;
+  movecursor(s, y, MAX(x - P1(0), 0));
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * EL - Erase in Line
+ *--------------------------------------------------------------------------
+ */
+HANDLER(el) {
+  switch (P0(0)){
+  case 0: clearcells(s, y, x, mx);    break;
+  case 1: clearcells(s, y, 0, x + 1); break;
+  case 2: clearcells(s, y, 0, mx);    break;
+  }
+  if (P0(0) != 1)
+    unwrap(n, s, y, y + 1);
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * ED - Erase in Display
+ *--------------------------------------------------------------------------
+ */
+HANDLER(ed) { 
+  switch (P0(0)){
+  case 0: clearbelow(s, y, x); unwrap(n, s, y, my);               break;
+  case 3: clearbelow(s, 0, 0); histclear(n); unwrap(n, s, 0, my); break;
+  case 2: clearbelow(s, 0, 0); unwrap(n, s, 0, my);               break;
+  case 1:
+    unwrap(n, s, 0, y);
+    clearrows(s, 0, y);
+    clearcells(s, y, 0, x + 1);
+    break;
+  }
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * ECH - Erase Character
+ *--------------------------------------------------------------------------
+ */
+HANDLER(ech) {
+  clearcells(s, y, x, x + P1(0));
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * DSR - Device Status Report
+ *--------------------------------------------------------------------------
+ */
+HANDLER(dsr) { 
+  char buf[100] = {0};
+  if (P0(0) == 6)
+    snprintf(buf, sizeof(buf) - 1, "\033[%d;%dR",
+	     (n->decom? y - top : y) + 1, x + 1);
+  else
+    snprintf(buf, sizeof(buf) - 1, "\033[0n");
+  SEND(n, buf);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * IL or DL - Insert/Delete Line
+ *--------------------------------------------------------------------------
+ */
+HANDLER(idl) { 
+  /* we don't use insdelln here because it inserts above and not below,
+   * and has a few other edge cases... */
+  int otop = s->top, obot = s->bot, p1 = MIN(P1(0), (my - 1) - y);
+  setregion(s, y, obot);
+  regionscrl(n, s, w == L'L'? -p1 : p1);
+  setregion(s, otop, obot);
+  movecursor(s, y, 0);
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * CSR - Change Scrolling Region
+ *--------------------------------------------------------------------------
+ */
+HANDLER(csr) {
+  if (setregion(s, P1(0) - 1, PD(1, my) - 1))
+    CALL(cup);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * DECREQTPARM - Request Device Parameters
+ *--------------------------------------------------------------------------
+ */
+HANDLER(decreqtparm) {
+  SEND(n, P0(0)? "\033[3;1;2;120;1;0x" : "\033[2;1;2;120;128;1;0x");
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * Reset SGR to default
+ *--------------------------------------------------------------------------
+ */
+HANDLER(sgr0) {
+  s->attr = A_NORMAL;
+  s->fg = s->bg = -1;
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * Clear screen
+ *--------------------------------------------------------------------------
+ */
+HANDLER(cls) { 
+  CALL(cup);
+  clearbelow(s, s->cy, s->cx);
+  unwrap(n, s, 0, my);
+  CALL(cup);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * RIS - Reset to Initial State
+ *--------------------------------------------------------------------------
+ */
+HANDLER(ris) {
+  n->gs = n->gc = n->g0 = CSET_US; n->g1 = CSET_GRAPH;
+  n->g2 = CSET_US; n->g3 = CSET_GRAPH;
+  n->decom = s->insert = s->oxenl = s->xenl = n->lnm = false;
+  CALL(sgr0);
+  CALL(cls);
+  n->am = n->pnm = true;
+  n->pri.vis = n->alt.vis = 1;
+  n->s = &n->pri;
+  setregion(&n->pri, 0, n->pri.rows - 1);
+  setregion(&n->alt, 0, n->alt.rows - 1);
+  for (int i = 0; i < n->ntabs; i++)
+    n->tabs[i] = (i % 8 == 0);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * Set or Reset Mode
+ *--------------------------------------------------------------------------
+ */
+HANDLER(mode) {
+  bool set = (w == L'h');
+  int flg = 0;
+  for (int i = 0; i < argc; i++) switch (P0(i)){
+    case  1: n->pnm = set;              break;
+    case  3: CALL(cls);                 break;
+    case  4: s->insert = set;           break;
+    case  6: n->decom = set; CALL(cup); break;
+    case  7: n->am = set;               break;
+    case 20: n->lnm = set;              break;
+    case 25: s->vis = set? 1 : 0;       break;
+    case 34: s->vis = set? 1 : 2;       break;
+    case 1000:
+      flg = MOUSE_REPORT_1000; goto doflg;
+    case 1001:
+      /* @vca: unsupported */
+      break;
+    case 1002:
+      flg = MOUSE_REPORT_1002; goto doflg;
+    case 1003:
+      flg = MOUSE_REPORT_1003;
+      goto doflg;
+    case 2004:
+      flg = BRACKETED_PASTE;
+    doflg:
+      if (set) {
+	n->modes |= flg;
+      }
+      else {
+	n->modes &= ~flg;
+      }
+      break;
+    case 1048: CALL((set? sc : rc));    break;
+    case 1049:
+      CALL((set? sc : rc)); /* fall-through */
+    case 47: case 1047: if (set && n->s != &n->alt){
+	n->s = &n->alt;
+	CALL(cls);
+      } else if (!set && n->s != &n->pri)
+	n->s = &n->pri;
+      break;
+    }
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * SGR - Select Graphic Rendition
+ *--------------------------------------------------------------------------
+ */
+HANDLER(sgr) {
+  if (!argc)
+    CALL(sgr0);
+
+  short bg = s->bg, fg = s->fg;
+  
+  for (int i = 0; i < argc; i++) switch (P0(i)){
+    case  0:  CALL(sgr0); fg = bg = -1;                                break;
+    case  1:  s->attr |= A_BOLD;                                       break;
+    case  2:  s->attr |= A_DIM;                                        break;
+    case  4:  s->attr |= A_UNDERLINE;                                  break;
+    case  5:  s->attr |= A_BLINK;                                      break;
+    case  7:  s->attr |= A_REVERSE;                                    break;
+    case  8:  s->attr |= A_INVIS;                                      break;
+    case 21:  s->attr &= ~A_BOLD;                                      break;
+    case 22:  s->attr &= ~(A_DIM | A_BOLD);                            break;
+    case 24:  s->attr &= ~A_UNDERLINE;                                 break;
+    case 25:  s->attr &= ~A_BLINK;                                     break;
+    case 27:  s->attr &= ~A_REVERSE;                                   break;
+    case 30:  fg = COLOR_BLACK;                                        break;
+    case 31:  fg = COLOR_RED;                                          break;
+    case 32:  fg = COLOR_GREEN;                                        break;
+    case 33:  fg = COLOR_YELLOW;                                       break;
+    case 34:  fg = COLOR_BLUE;                                         break;
+    case 35:  fg = COLOR_MAGENTA;                                      break;
+    case 36:  fg = COLOR_CYAN;                                         break;
+    case 37:  fg = COLOR_WHITE;                                        break;
+    case 38:  fg = P0(i+1) == 5? P0(i+2) : s->fg; i += 2;              break;
+    case 39:  fg = -1;                                                 break;
+    case 40:  bg = COLOR_BLACK;                                        break;
+    case 41:  bg = COLOR_RED;                                          break;
+    case 42:  bg = COLOR_GREEN;                                        break;
+    case 43:  bg = COLOR_YELLOW;                                       break;
+    case 44:  bg = COLOR_BLUE;                                         break;
+    case 45:  bg = COLOR_MAGENTA;                                      break;
+    case 46:  bg = COLOR_CYAN;                                         break;
+    case 47:  bg = COLOR_WHITE;                                        break;
+    case 48:  bg = P0(i+1) == 5? P0(i+2) : s->bg; i += 2;              break;
+    case 49:  bg = -1;                                                 break;
+    case 90:  fg = COLOR_BLACK;                                        break;
+    case 91:  fg = COLOR_RED;                                          break;
+    case 92:  fg = COLOR_GREEN;                                        break;
+    case 93:  fg = COLOR_YELLOW;                                       break;
+    case 94:  fg = COLOR_BLUE;                                         break;
+    case 95:  fg = COLOR_MAGENTA;                                      break;
+    case 96:  fg = COLOR_CYAN;                                         break;
+    case 97:  fg = COLOR_WHITE;                                        break;
+    case 100: bg = COLOR_BLACK;                                        break;
+    case 101: bg = COLOR_RED;                                          break;
+    case 102: bg = COLOR_GREEN;                                        break;
+    case 103: bg = COLOR_YELLOW;                                       break;
+    case 104: bg = COLOR_BLUE;                                         break;
+    case 105: bg = COLOR_MAGENTA;                                      break;
+    case 106: bg = COLOR_CYAN;                                         break;
+    case 107: bg = COLOR_WHITE;                                        break;
+#if defined(A_ITALIC) && !defined(NO_ITALICS )
+    case  3:  s->attr |= A_ITALIC;                                     break;
+    case 23:  s->attr &= ~A_ITALIC;                                    break;
+#endif
+    }
+  /* the colors are kept whatever the display can show, the
+   * terminal maps them when it draws the screen */
+  s->fg = fg;
+  s->bg = bg;
+}}
+
+/* 
+ *--------------------------------------------------------------------------
+ * CR - Carriage Return
+ *--------------------------------------------------------------------------
+ */
+HANDLER(cr) { 
+  s->xenl = false;
+  movecursor(s, y, 0);
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * IND - Index
+ *--------------------------------------------------------------------------
+ */
+HANDLER(ind) { 
+  if (y == (bot - 1)) {
+    savelines(n, 1);
+    regionscrl(n, s, 1);
+  } else {
+    movecursor(s, y + 1, x);
+  }
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * NEL - Next Line
+ *--------------------------------------------------------------------------
+ */
+HANDLER(nel) { 
+  CALL(cr); CALL(ind);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * NL - Newline
+ *--------------------------------------------------------------------------
+ */
+HANDLER(pnl) { 
+  CALL((n->lnm? nel : ind));
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * CPL - Cursor Previous Line
+ *--------------------------------------------------------------------------
+ */
+HANDLER(cpl) { 
+  movecursor(s, MAX(top, y - P1(0)), 0);
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * CNL - Cursor Next Line
+ *--------------------------------------------------------------------------
+ */
+HANDLER(cnl) { 
+  movecursor(s, MIN(bot - 1, y + P1(0)), 0);
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * Print a character to the terminal
+ *--------------------------------------------------------------------------
+ */
+HANDLER(print) { 
+  if (wcwidth(w) < 0)
+    return;
+
+  /* a combining character goes in the cell of the character before */
+  if (wcwidth(w) == 0) {
+    combinecell(s, y, s->xenl? x : x - 1, w);
+    return;
+  }
+
+  if (s->insert)
+    CALL(ich);
+
+  if (s->xenl){
+    s->xenl = false;
+    if (n->am) {
+      if (s == &n->pri && y < n->nwrapped)
+	n->wrapped[y] = WRAPPED;
+      CALL(nel);
+    }
+    y = s->cy; x = s->cx;
+  }
+
+  if (w < MAXMAP && n->gc[w])
+    w = n->gc[w];
+  n->repc = w;
+
+  /* a double width character that does not fit in the last column
+   * goes to the next row, the last column is left blank */
+  if (x > mx - wcwidth(w) && x > 0 && n->am) {
+    clearcells(s, y, x, mx);
+    if (s == &n->pri && y < n->nwrapped)
+      n->wrapped[y] = PADDED;
+    CALL(nel);
+    y = s->cy; x = s->cx;
+  }
+
+  putcell(s, y, x, w, MAX(wcwidth(w), 1));
+  if (x == mx - wcwidth(w))
+    s->xenl = true;
+  else
+    movecursor(s, y, x + wcwidth(w));
+  n->gc = n->gs;
+  vtfixcursor(n);
+}} /* no ENDHANDLER because we don't want to reset repc */
+
+/* 
+ *--------------------------------------------------------------------------
+ * Print a run of argc characters (passed in osc) to the terminal.
+ * Characters that fit on the current line and need none of the
+ * special processing done by print are written in one pass.
+ *--------------------------------------------------------------------------
+ */
+HANDLER(printrun) { 
+  int i = 0, k;
+
+  while (i < argc) {
+    y = s->cy; x = s->cx;
+    k = 0;
+    if (!s->insert && !s->xenl && n->gc == n->gs) {
+      while (i + k < argc && k < MAXRUN && x + k < mx - 1) {
+	wchar_t c = osc[i + k];
+
+	if (c < MAXMAP && n->gc[c])
+	  c = n->gc[c];
+	if (wcwidth(c) != 1)
+	  break;
+	putcell(s, y, x + k++, c, 1);
+	n->repc = c;
+      }
+    }
+    if (k) {
+      movecursor(s, y, x + k);
+      i += k;
+    } else {
+      print(v, p, osc[i++], 0, 0, NULL, NULL);
+    }
+  }
+  vtfixcursor(n);
+}} /* no ENDHANDLER because we don't want to reset repc */
+
+/* 
+ *--------------------------------------------------------------------------
+ * REP - Repeat Character
+ *--------------------------------------------------------------------------
+ */
+HANDLER(rep) { 
+  for (int i = 0; i < P1(0) && n->repc; i++)
+    print(v, p, n->repc, 0, 0, NULL, NULL);
+  vtfixcursor(n);
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * Select Character Set
+ *--------------------------------------------------------------------------
+ */
+HANDLER(scs) { 
+  wchar_t **t = NULL;
+  switch (iw){
+  case L'(': t = &n->g0;  break;
+  case L')': t = &n->g1;  break;
+  case L'*': t = &n->g2;  break;
+  case L'+': t = &n->g3;  break;
+  default: return;        break;
+  }
+  switch (w){
+  case L'A': *t = CSET_UK;    break;
+  case L'B': *t = CSET_US;    break;
+  case L'0': *t = CSET_GRAPH; break;
+  case L'1': *t = CSET_US;    break;
+  case L'2': *t = CSET_GRAPH; break;
+  }
+
+  //@vca: When TERM=xterm or similar terminal
+  //      ncurses doesn't sent ShiftIn control sequence
+  //      to switch to alternate charset but only sends
+  //      iw='(' w='0' to ask for rendering acs.
+  //      These characters are needed for example by ckBorder.c
+  //      to draw nice looking borders.
+  //      The code below tries to cope with xterm
+  if ( (iw == L'(') && (w == L'0') ) {
+    n->gs = n->gc = n->g1; /* locking shift */;
+  }
+  if ( (iw == L'(') && (w == L'B') ) {
+    n->gs = n->gc = n->g0; /* locking shift */;
+  }
+  
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * Switch Out/In Character Set
+ *--------------------------------------------------------------------------
+ */
+HANDLER(so) { 
+  if (w == 0x0e)
+    n->gs = n->gc = n->g1; /* locking shift */
+  else if (w == 0xf)
+    n->gs = n->gc = n->g0; /* locking shift */
+  else if (w == L'n')
+    n->gs = n->gc = n->g2; /* locking shift */
+  else if (w == L'o')
+    n->gs = n->gc = n->g3; /* locking shift */
+  else if (w == L'N'){
+    n->gs = n->gc; /* non-locking shift */
+    n->gc = n->g2;
+  } else if (w == L'O'){
+    n->gs = n->gc; /* non-locking shift */
+    n->gc = n->g3;
+  }
+  ENDHANDLER;
+}
+
+/* 
+ *--------------------------------------------------------------------------
+ * 
+ *--------------------------------------------------------------------------
+ */
+static void
+setupevents(NODE *n)
+{
+  n->vp.p = n;
+  vtonevent(&n->vp, VTPARSER_CONTROL, 0x05, ack);
+  vtonevent(&n->vp, VTPARSER_CONTROL, 0x07, bell);
+  vtonevent(&n->vp, VTPARSER_CONTROL, 0x08, cub);
+  vtonevent(&n->vp, VTPARSER_CONTROL, 0x09, tab);
+  vtonevent(&n->vp, VTPARSER_CONTROL, 0x0a, pnl);
+  vtonevent(&n->vp, VTPARSER_CONTROL, 0x0b, pnl);
+  vtonevent(&n->vp, VTPARSER_CONTROL, 0x0c, pnl);
+  vtonevent(&n->vp, VTPARSER_CONTROL, 0x0d, cr);
+  vtonevent(&n->vp, VTPARSER_CONTROL, 0x0e, so);
+  vtonevent(&n->vp, VTPARSER_CONTROL, 0x0f, so);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'A', cuu);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'B', cud);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'C', cuf);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'D', cub);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'E', cnl);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'F', cpl);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'G', hpa);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'H', cup);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'I', tab);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'J', ed);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'K', el);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'L', idl);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'M', idl);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'P', dch);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'S', su);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'T', su);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'X', ech);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'Z', tab);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'`', hpa);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'^', su);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'@', ich);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'a', hpr);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'b', rep);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'c', decid);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'd', vpa);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'e', vpr);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'f', cup);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'g', tbc);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'h', mode);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'l', mode);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'm', sgr);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'n', dsr);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'r', csr);
+  vtonevent(&n->vp, VTPARSER_CSI,     L's', sc);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'u', rc);
+  vtonevent(&n->vp, VTPARSER_CSI,     L'x', decreqtparm);
+  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'0', scs);
+  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'1', scs);
+  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'2', scs);
+  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'7', sc);
+  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'8', rc);
+  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'A', scs);
+  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'B', scs);
+  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'D', ind);
+  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'E', nel);
+  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'H', hts);
+  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'M', ri);
+  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'Z', decid);
+  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'c', ris);
+  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'p', vis);
+  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'=', numkp);
+  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'>', numkp);
+  vtonevent(&n->vp, VTPARSER_PRINT,   0,    print);
+  vtonevent(&n->vp, VTPARSER_PRINTRUN, 0,   printrun);
+}
+
+/*** MTM FUNCTIONS
+ * These functions do the work of MTM that needs no display: creating
+ * nodes, saving the lines scrolled off, running programs on a pty.
+ */
+static bool *
+newtabs(int w, int ow, bool *oldtabs) /* Initialize default tabstops. */
+{
+  bool *tabs = calloc(w, sizeof(bool));
+  if (!tabs)
+    return NULL;
+  for (int i = 0; i < w; i++) /* keep old overlapping tabs */
+    tabs[i] = i < ow? oldtabs[i] : (i % 8 == 0);
+  return tabs;
+}
+
+static NODE *
+newnode(int h, int w) /* Create a new node. */
+{
+  NODE *n = calloc(1, sizeof(NODE));
+  bool *tabs = newtabs(w, 0, NULL);
+  if (!n || h < 2 || w < 2 || !tabs) {
+    return free(n), free(tabs), NULL;
+  }
+
+  n->pt = -1;
+  n->pid = -1;
+  n->modes = 0;
+  n->h = h;
+  n->w = w;
+  n->tabs = tabs;
+  n->ntabs = w;
+
+  n->scrollback = n->budget = 0;
+  n->replies = NULL;
+  n->clientData = NULL;
+  n->iosize = BUFSIZ;
+  n->iobuf = malloc(n->iosize);
+  if (!n->iobuf) {
+    return free(n), free(tabs), NULL;
+  }
+  
+  return n;
+}
+
+void
+vtfreenode(NODE *n) /* Free a node. */
+{
+  if (n){
+    free(n->pri.cells);
+    free(n->pri.dirty);
+    free(n->alt.cells);
+    free(n->alt.dirty);
+    if (n->pt >= 0){
+      close(n->pt);
+    }
+    histclear(n);
+    free(n->wrapped);
+    free(n->tabs);
+    free(n->iobuf);
+    free(n);
+  }
+}
+
+HLINE *
+vthistline(NODE *n, int i) /* Get saved line i, 0 being the oldest. */
+{
+  return n->hist.lines[(n->hist.first + i) % n->hist.space];
+}
+
+static int
+histdrop(NODE *n) /* Forget the oldest saved line, return its rows. */
+{
+  HIST *h = &n->hist;
+  HLINE *l = h->lines[h->first];
+  int rows = LINEROWS(l, h->width);
+
+  h->bytes -= l->size;
+  h->rows -= rows;
+  free(l);
+  h->first = (h->first + 1) % h->space;
+  h->count--;
+  h->base++;
+  if (h->count == 0)
+    h->open = false;
+  if (h->cline > 0) {
+    h->cline--;
+    h->crow -= rows;
+  } else {
+    h->crow = 0;
+  }
+  return rows;
+}
+
+static void
+histclear(NODE *n) /* Forget all saved lines. */
+{
+  HIST *h = &n->hist;
+
+  while (h->count)
+    histdrop(n);
+  free(h->lines);
+  h->lines = NULL;
+  h->space = h->first = h->rows = h->cline = h->crow = 0;
+  h->open = false;
+  n->pri.off = 0;
+}
+
+int
+vthistfind(NODE *n, int row, int *seg) /* Find the line shown on a row. */
+{
+  HIST *h = &n->hist;
+
+  /* walk from the last line found, views move by small steps */
+  if (h->cline >= h->count)
+    h->cline = h->crow = 0;
+  while (row < h->crow && h->cline > 0) {
+    h->cline--;
+    h->crow -= LINEROWS(vthistline(n, h->cline), h->width);
+  }
+  while (h->cline < h->count - 1
+	 && row >= h->crow + LINEROWS(vthistline(n, h->cline), h->width)) {
+    h->crow += LINEROWS(vthistline(n, h->cline), h->width);
+    h->cline++;
+  }
+  *seg = row - h->crow;
+  return h->cline;
+}
+
+int
+vtlinepos(HLINE *l, int w, int col) /* Offset of column col of a saved line
+				   * wrapped at width w, counting the cells
+				   * left blank before double width
+				   * characters moved to the next row. */
+{
+  char *q = (char *) (l + 1);
+  int pos = 0, off = 0, r, i, k;
+  HRUN run;
+
+#define RUNCHAR(i) \
+  (run.wide? ((wchar_t *) memcpy(&wc0, q + (i) * sizeof(wchar_t), sizeof(wchar_t)), wc0) \
+   : (wchar_t) (unsigned char) q[i])
+
+  /* group characters in cells the way histdraw does */
+  for (r = 0; r < l->nruns && pos < col; r++) {
+    wchar_t wc0;
+
+    memcpy(&run, q, sizeof(HRUN));
+    q += sizeof(HRUN);
+    for (i = 0; i < run.len && pos < col; ) {
+      int wd = MAX(wcwidth(RUNCHAR(i)), 1);
+
+      for (i++, k = 1; i < run.len && k < CCHARW_MAX && wcwidth(RUNCHAR(i)) == 0; k++)
+	i++;
+      if (wd > 1 && w > 1 && off % w + wd > w)
+	off += w - off % w;
+      off += wd;
+      pos += wd;
+    }
+    q += run.len * (run.wide? sizeof(wchar_t) : 1);
+  }
+#undef RUNCHAR
+
+  return off + (col - pos);
+}
+
+int
+vtlinerows(HLINE *l, int w) /* Number of rows of a saved line wrapped at
+			   * width w. */
+{
+  int off = vtlinepos(l, w, l->cols);
+
+  return off <= w? 1 : (off + w - 1) / w;
+}
+
+void
+vthistrewrap(NODE *n) /* Count the rows of the saved lines again when
+		     * the width changed. */
+{
+  HIST *h = &n->hist;
+
+  if (h->width != n->w) {
+    /*
+     * Only the lines shown are actually wrapped, when they are
+     * drawn. The view keeps the same line on top, or stays at the
+     * bottom.
+     */
+    int follow = (n->pri.off >= h->rows);
+    int top = 0, seg = 0, rows = 0;
+
+    if (!follow && h->count > 0 && h->width > 0)
+      top = vthistfind(n, n->pri.off, &seg);
+    h->width = n->w;
+    for (int i = 0; i < h->count; i++) {
+      if (i == top && !follow)
+	n->pri.off = rows + MIN(seg, LINEROWS(vthistline(n, i), h->width) - 1);
+      rows += LINEROWS(vthistline(n, i), h->width);
+    }
+    h->rows = rows;
+    h->cline = h->crow = 0;
+    if (follow || h->count == 0)
+      n->pri.off = rows;
+  }
+}
+
+static int
+histpush(NODE *n, int row) /* Save a row of the primary screen, return
+			    * the number of rows dropped. */
+{
+  HIST *h = &n->hist;
+  SCRN *s = &n->pri;
+  int cols = s->cols;
+  HRUN cell[cols];
+  int start[cols + 1], width[cols], runat[cols];
+  wchar_t text[cols * CCHARW_MAX];
+  int i, j, k, end, ncells = 0, ntext = 0, nruns = 0, size, dropped = 0;
+  int wrap = (row < n->nwrapped)? n->wrapped[row] : 0, wides = 0;
+  HLINE *l, *last = NULL;
+  char *q;
+
+  if (n->scrollback <= 0)
+    return 0;
+  vthistrewrap(n);
+
+  for (i = 0; i < cols; i++) {
+    CELL *c = CELLAT(s, row, i);
+
+    /* the right half of a double width character */
+    if (c->ch[0] == 0)
+      continue;
+    cell[ncells].attr = c->attr;
+    cell[ncells].fg = c->fg;
+    cell[ncells].bg = c->bg;
+    width[ncells] = MAX(wcwidth(c->ch[0]), 1);
+    start[ncells++] = ntext;
+    for (j = 0; j < CCHARW_MAX && c->ch[j]; j++)
+      text[ntext++] = c->ch[j];
+  }
+  start[ncells] = ntext;
+  if (ncells == 0) {
+    memset(&cell[0], 0, sizeof(HRUN));
+    width[0] = 1;
+    ncells = 1, start[1] = ntext = 1, text[0] = L' ';
+  }
+
+#define SAMEATTR(a, b) ((a).attr == (b).attr && (a).fg == (b).fg && (a).bg == (b).bg)
+
+  /* trailing blanks are not stored, only their attributes, unless
+   * the line goes on on the next row */
+  end = ncells;
+  while (!wrap && end > 0 && SAMEATTR(cell[end - 1], cell[ncells - 1])
+	 && start[end] - start[end - 1] == 1 && text[start[end - 1]] == L' ')
+    end--;
+
+  /* the blank left by a double width character moved to the next
+   * row is not stored either, the character stays whole when the
+   * line is wrapped again */
+  if (wrap == PADDED && end > 1 && width[end - 1] == 1
+      && start[end] - start[end - 1] == 1 && text[start[end - 1]] == L' ')
+    end--;
+
+  /* group characters in runs */
+  size = 0;
+  for (i = 0; i < end; i = j) {
+    for (j = i + 1; j < end && SAMEATTR(cell[j], cell[i])
+	   && start[j + 1] - start[i] <= 0xffff; j++)
+      ;
+    cell[i].len = start[j] - start[i];
+    cell[i].wide = 0;
+    for (k = start[i]; k < start[j]; k++)
+      if (text[k] >= 0x80)
+	cell[i].wide = 1;
+    size += sizeof(HRUN) + cell[i].len * (cell[i].wide? sizeof(wchar_t) : 1);
+    runat[nruns++] = i;
+  }
+#undef SAMEATTR
+
+  /* a row following an autowrap is appended to the newest line */
+  if (h->open && h->count > 0 && vthistline(n, h->count - 1)->cols < MAXLINECOLS)
+    last = vthistline(n, h->count - 1);
+  if (last) {
+    int orows = LINEROWS(last, h->width);
+
+    l = realloc(last, last->size + size);
+    if (l == NULL)
+      return 0;
+    h->lines[(h->first + h->count - 1) % h->space] = l;
+    q = (char *) l + l->size;
+    l->size += size;
+    l->nruns += nruns;
+    h->bytes += size;
+    h->rows -= orows;
+  } else {
+    l = malloc(sizeof(HLINE) + size);
+    if (l == NULL)
+      return 0;
+    l->size = sizeof(HLINE) + size;
+    l->nruns = nruns;
+    l->cols = 0;
+    l->wides = 0;
+    l->chars = 0;
+    q = (char *) (l + 1);
+  }
+  l->fill = cell[ncells - 1];
+  for (j = 0; j < nruns; j++) {
+    i = runat[j];
+    memcpy(q, &cell[i], sizeof(HRUN));
+    q += sizeof(HRUN);
+    for (k = start[i]; k < start[i] + cell[i].len; k++) {
+      if (cell[i].wide) {
+	memcpy(q, &text[k], sizeof(wchar_t));
+	q += sizeof(wchar_t);
+      } else {
+	*q++ = (char) text[k];
+      }
+    }
+  }
+  for (i = 0; i < end; i++) {
+    l->cols += width[i];
+    wides += (width[i] > 1);
+  }
+  l->wides += wides;
+  for (k = 0; k < start[end]; k++)
+    l->chars |= CHARBIT(text[k]);
+  h->open = (wrap != 0);
+
+  if (last) {
+    h->rows += LINEROWS(l, h->width);
+    return 0;
+  }
+
+  /* make room, within the limits in lines and bytes */
+  while (h->count > 0 && (h->count >= n->scrollback ||
+			  (n->budget > 0 &&
+			   h->bytes + l->size > (size_t) n->budget))) {
+    dropped += histdrop(n);
+  }
+  if (h->count == h->space) {
+    int space = h->space? 2 * h->space : 64;
+    HLINE **lines = malloc(space * sizeof(HLINE *));
+
+    if (lines == NULL)
+      return free(l), h->open = false, dropped;
+    for (i = 0; i < h->count; i++)
+      lines[i] = vthistline(n, i);
+    free(h->lines);
+    h->lines = lines;
+    h->space = space;
+    h->first = 0;
+  }
+  h->lines[(h->first + h->count) % h->space] = l;
+  h->count++;
+  h->bytes += l->size;
+  h->rows += LINEROWS(l, h->width);
+
+  return dropped;
+}
+
+static void
+histsave(NODE *n, int count) /* Save the count top rows of the primary screen. */
+{
+  int follow, dropped = 0;
+
+  vthistrewrap(n);
+  follow = (n->pri.off >= n->hist.rows);
+
+  for (int i = 0; i < count; i++)
+    dropped += histpush(n, i);
+  n->pri.off = follow? n->hist.rows : MAX(0, n->pri.off - dropped);
+}
+
+static void
+savelines(NODE *n, int count) /* Save lines about to scroll off the top. */
+{
+  /* only the primary screen, when scrolling from its first line */
+  if (n->s != &n->pri || count <= 0)
+    return;
+  if (n->pri.top == 0)
+    histsave(n, count);
+}
+
+
+static bool
+ltextroom(LTEXT *t, int len) /* Make room for len characters in t. */
+{
+  if (len + 1 > t->space) {
+    int space = MAX(2 * t->space, len + 1);
+    Tcl_UniChar *chars = realloc(t->chars, space * sizeof(Tcl_UniChar));
+    int *cols;
+
+    if (chars == NULL)
+      return false;
+    t->chars = chars;
+    cols = realloc(t->cols, space * sizeof(int));
+    if (cols == NULL)
+      return false;
+    t->cols = cols;
+    t->space = space;
+  }
+  return true;
+}
+
+static void
+ltextadd(LTEXT *t, wchar_t wc, int *col, int wd) /* Append a character. */
+{
+  if (sizeof(Tcl_UniChar) < sizeof(wchar_t) && wc > 0xffff)
+    wc = 0xfffd;
+  t->chars[t->len] = (Tcl_UniChar) wc;
+  t->cols[t->len++] = *col;
+  *col += wd;
+}
+
+bool
+vtlinetext(NODE *n, int i, LTEXT *t) /* Get the text of line i, the saved
+				    * lines being followed by the rows of
+				    * the active screen. */
+{
+  int col = 0, j, k;
+
+  t->len = 0;
+  if (!ltextroom(t, 0))
+    return false;
+  if (i < HISTLINES(n)) {
+    HLINE *l = vthistline(n, i);
+    char *q = (char *) (l + 1);
+    HRUN run;
+
+    /* group characters in cells the way histdraw does */
+    for (j = 0; j < l->nruns; j++) {
+      memcpy(&run, q, sizeof(HRUN));
+      q += sizeof(HRUN);
+      if (!ltextroom(t, t->len + run.len))
+	return false;
+      for (k = 0; k < run.len; k++) {
+	wchar_t wc;
+	int wd;
+
+	if (run.wide)
+	  memcpy(&wc, q + k * sizeof(wchar_t), sizeof(wchar_t));
+	else
+	  wc = (unsigned char) q[k];
+	wd = wcwidth(wc);
+	ltextadd(t, wc, &col, (k > 0 && wd == 0)? 0 : MAX(wd, 1));
+      }
+      q += run.len * (run.wide? sizeof(wchar_t) : 1);
+    }
+  } else {
+    SCRN *s = n->s;
+    CELL *c = CELLAT(s, i - HISTLINES(n), 0);
+
+    if (!ltextroom(t, s->cols * CCHARW_MAX))
+      return false;
+    for (j = 0; j < s->cols; j++, c++) {
+      if (c->ch[0] == 0)
+	continue;
+      for (k = 0; k < CCHARW_MAX && c->ch[k]; k++)
+	ltextadd(t, c->ch[k], &col, k? 0 : MAX(wcwidth(c->ch[0]), 1));
+    }
+    while (t->len > 0 && t->chars[t->len - 1] == ' ')
+      col = t->cols[--t->len];
+  }
+  t->cols[t->len] = col;
+  return true;
+}
+
+int
+vthistrow(NODE *n, int line) /* First row of saved line. */
+{
+  HIST *h = &n->hist;
+
+  if (h->cline >= h->count)
+    h->cline = h->crow = 0;
+  while (h->cline > line) {
+    h->cline--;
+    h->crow -= LINEROWS(vthistline(n, h->cline), h->width);
+  }
+  while (h->cline < line) {
+    h->crow += LINEROWS(vthistline(n, h->cline), h->width);
+    h->cline++;
+  }
+  return h->crow;
+}
+
+NODE *
+vtnewemu(int h, int w, int fg, int bg) /* Create the screens of a node, with
+				      * no view or host. */
+{
+  NODE *n = newnode(h, w);
+  if (!n) {
+    return NULL;
+  }
+
+  SCRN *pri = &n->pri, *alt = &n->alt;
+  pri->fg = pri->bg = alt->fg = alt->bg = -1;
+  n->wrapped = calloc(h, 1);
+  if (!resizecells(pri, h, w) || !resizecells(alt, h, w) || !n->wrapped) {
+    return vtfreenode(n), NULL;
+  }
+  n->nwrapped = h;
+  pri->off = 0;
+  n->s = pri;
+
+  pri->wfg = alt->wfg = fg;
+  pri->wbg = alt->wbg = bg;
+
+  setupevents(n);
+  ris(&n->vp, n, L'c', 0, 0, NULL, NULL);
+  return n;
+}
+
+bool
+vtspawn(NODE *n, const char *term, int argc, char **argv) /* Run a program
+							 * on a new pty. */
+{
+  struct winsize ws = {.ws_row = n->h, .ws_col = n->w};
+  pid_t pid = forkpty(&n->pt, NULL, NULL, &ws);
+  if (pid < 0) {
+    perror("forkpty");
+    n->pt = -1;
+    return false;
+
+  } else if (pid == 0) {
+    char *args[argc + 1];
+    char buf[100] = {0};
+    snprintf(buf, sizeof(buf) - 1, "%lu", (unsigned long)getppid());
+    setsid();
+    setenv("MTM", buf, 1);
+    setenv("TERM", term, 1);
+    signal(SIGCHLD, SIG_DFL);
+    memcpy(args, argv, argc * sizeof(char*));
+    args[argc] = NULL;
+    execv(args[0], args);
+    _exit(127);
+  }
+
+  n->pid = pid;
+  fcntl(n->pt, F_SETFL, O_NONBLOCK);
+  return true;
+}
+
+size_t
+vtptyread(NODE *n, size_t budget, bool *eof) /* Read the pty into iobuf until
+					    * it would block or budget
+					    * bytes were read. */
+{
+  ssize_t r = -1;
+  size_t len = 0;
+
+  /*
+   * Drain the pty until it would block or the read budget is
+   * exhausted, so that a fast producer costs one trip through
+   * the event loop and one redisplay per budget, not per read.
+   * If iobuf can't grow, keep what was read so far; the rest is
+   * read on the next wakeup.
+   */
+  errno = 0;
+  do {
+    if (n->iosize - len < BUFSIZ) {
+      char *buf = realloc(n->iobuf, 2 * n->iosize);
+      if (buf != NULL) {
+	n->iobuf = buf;
+	n->iosize *= 2;
+      } else if (len == n->iosize) {
+	errno = ENOMEM;
+	break;
+      }
+    }
+    r = read(n->pt, n->iobuf + len, MIN(n->iosize - len, budget - len));
+    if (r > 0) {
+      len += r;
+    }
+  } while (r > 0 && len < budget);
+
+  *eof = (r == 0 || (r < 0 && errno != EINTR && errno != EWOULDBLOCK
+		     && errno != EAGAIN && errno != ENOMEM));
+  return len;
+}
+
+void
+vthangup(NODE *n) /* Close the pty of a node and reap its program. */
+{
+  if (n->pt >= 0) {
+    Tcl_DeleteFileHandler(n->pt);
+    close(n->pt);
+    n->pt = -1;
+  }
+  if (n->pid > 0) {
+    Tcl_Pid pid = (Tcl_Pid) (long) n->pid;
+
+    Tcl_DetachPids(1, &pid);
+    n->pid = -1;
+    Tcl_ReapDetachedProcs();
+  }
+}
+
+static void
+reshapeview(NODE *n, int d, int ow) /* Reshape a view. */
+{
+  bool *tabs = newtabs(n->w, ow, n->tabs);
+  struct winsize ws = {.ws_row = n->h, .ws_col = n->w};
+  SCRN *s;
+
+  if (tabs) {
+    free(n->tabs);
+    n->tabs = tabs;
+    n->ntabs = n->w;
+  }
+
+  /*
+   * When the screen gets shorter, lines above the cursor scroll off
+   * (to the scrollback for the primary screen) so that the cursor
+   * line stays visible.
+   */
+  for (s = &n->pri; s; s = (s == &n->pri)? &n->alt : NULL) {
+    int k = s->cy - (n->h - 1);
+
+    if (d > 0 && k > 0) {
+      if (s == &n->pri)
+	histsave(n, k);
+      setregion(s, 0, s->rows - 1);
+      regionscrl(n, s, k);
+      movecursor(s, s->cy - k, s->cx);
+    }
+    resizecells(s, MAX(n->h, 2), MAX(n->w, 2));
+  }
+  if (n->nwrapped != n->h) {
+    char *wrapped = realloc(n->wrapped, n->h);
+
+    if (wrapped) {
+      for (int i = n->nwrapped; i < n->h; i++)
+	wrapped[i] = 0;
+      n->wrapped = wrapped;
+      n->nwrapped = n->h;
+    }
+  }
+
+  /* rows cut or widened by the new width no longer join */
+  if (n->w != ow)
+    unwrap(n, &n->pri, 0, n->nwrapped);
+  n->alt.off = 0;
+  vthistrewrap(n);
+  if (n->pri.off > n->hist.rows)
+    n->pri.off = n->hist.rows;
+  vtfixcursor(n);
+  ioctl(n->pt, TIOCSWINSZ, &ws);
+}
+
+void
+vtreshape(NODE *n, int h, int w) /* Resize the screens of a node. */
+{
+  if (n->h == h && n->w == w)
+    return;
+
+  int d = n->h - h;
+  int ow = n->w;
+  n->h = MAX(h, 1);
+  n->w = MAX(w, 1);
+
+  reshapeview(n, d, ow);
+}
+
+void
+vtreset(NODE *n) /* Reset the terminal, as ESC c does. */
+{
+  ris(&n->vp, n, L'c', 0, 0, NULL, NULL);
+}
+
+
+// vtparser.c
+
+/**** DATA TYPES */
+#define MAXACTIONS  128
+#define MAXLOOKUP   256
+
+typedef struct ACTION ACTION;
+struct ACTION {
+  wchar_t lo, hi;
+  void (*cb)(VTPARSER *p, wchar_t w);
+  STATE *next;
+};
+
+struct STATE{
+  void (*entry)(VTPARSER *v);
+  ACTION actions[MAXACTIONS];
+  ACTION *lookup[MAXLOOKUP]; /* action for each character below MAXLOOKUP,
+			      * built from actions by vtmaketables */
+};
+
+/**** GLOBALS */
+static STATE ground, escape, escape_intermediate, csi_entry,
+  csi_ignore, csi_param, csi_intermediate, osc_string;
+
+static void vtmaketables(void);
+
+/**** ACTION FUNCTIONS */
+static void
+reset(VTPARSER *v)
+{
+  v->inter = v->narg = v->nosc = 0;
+  memset(v->args, 0, sizeof(v->args));
+  memset(v->oscbuf, 0, sizeof(v->oscbuf));
+}
+
+static void
+ignore(VTPARSER *v, wchar_t w)
+{
+  (void)v; (void)w; /* avoid warnings */
+}
+
+static void
+collect(VTPARSER *v, wchar_t w)
+{
+  v->inter = v->inter? v->inter : (int)w;
+}
+
+static void
+collectosc(VTPARSER *v, wchar_t w)
+{
+  if (v->nosc < MAXOSC)
+    v->oscbuf[v->nosc++] = w;
+}
+
+static void
+param(VTPARSER *v, wchar_t w)
+{
+  v->narg = v->narg? v->narg : 1;
+
+  if (w == L';')
+    v->args[v->narg++] = 0;
+  else if (v->narg < MAXPARAM && v->args[v->narg - 1] < 9999)
+    v->args[v->narg - 1] = v->args[v->narg - 1] * 10 + (w - 0x30);
+}
+
+#define VTDO(k, t, f, n, a)                             \
+  static void						\
+  do ## k (VTPARSER *v, wchar_t w)			\
+       {						\
+	 if (t)						\
+	   f (v, v->p, w, v->inter, n, a, v->oscbuf);	\
+       }
+
+VTDO(control, w < MAXCALLBACK && v->cons[w], v->cons[w], 0, NULL);
+VTDO(escape,  w < MAXCALLBACK && v->escs[w], v->escs[w], v->inter > 0, &v->inter);
+VTDO(csi,     w < MAXCALLBACK && v->csis[w], v->csis[w], v->narg, v->args);
+VTDO(print,   v->print, v->print, 0, NULL);
+VTDO(osc,     v->osc, v->osc, v->nosc, NULL);
+
+/**** PUBLIC FUNCTIONS */
+VTCALLBACK
+vtonevent(VTPARSER *vp, VtEvent t, wchar_t w, VTCALLBACK cb)
+{
+  VTCALLBACK o = NULL;
+  vtmaketables();
+  if (w < MAXCALLBACK) {
+    switch (t) {
+    case VTPARSER_CONTROL: o = vp->cons[w]; vp->cons[w] = cb; break;
+    case VTPARSER_ESCAPE:  o = vp->escs[w]; vp->escs[w] = cb; break;
+    case VTPARSER_CSI:     o = vp->csis[w]; vp->csis[w] = cb; break;
+    case VTPARSER_PRINT:   o = vp->print;   vp->print   = cb; break;
+    case VTPARSER_PRINTRUN: o = vp->printrun; vp->printrun = cb; break;
+    case VTPARSER_OSC:     o = vp->osc;     vp->osc     = cb; break;
+    }
+  }
+
+  return o;
+}
+
+static ACTION *
+vtfindaction(STATE *s, wchar_t w)
+{
+  for (ACTION *a = s->actions; a->cb; a++) {
+    if (w >= a->lo && w <= a->hi) {
+      return a;
+    }
+  }
+  return NULL;
+}
+
+static void
+vtmaketables(void)
+{
+  static STATE *states[] = {
+    &ground, &escape, &escape_intermediate, &csi_entry,
+    &csi_ignore, &csi_param, &csi_intermediate, &osc_string, NULL
+  };
+  static int done = 0;
+
+  if (done)
+    return;
+  for (STATE **s = states; *s; s++) {
+    for (wchar_t w = 0; w < MAXLOOKUP; w++) {
+      (*s)->lookup[w] = vtfindaction(*s, w);
+    }
+  }
+  done = 1;
+}
+
+static void
+vthandlechar(VTPARSER *vp, wchar_t w)
+{
+  ACTION *a;
+
+  vp->s = vp->s ? vp->s : &ground;
+  a = (unsigned long) w < MAXLOOKUP ? vp->s->lookup[w] : vtfindaction(vp->s, w);
+  if (a != NULL) {
+    a->cb(vp, w);
+    if (a->next) {
+      vp->s = a->next;
+      if (a->next->entry) {
+	a->next->entry(vp);
+      }
+    }
+  }
+}
+
+/*
+ * NOTPRINT(x) is true if one of the bytes of the word x is below 0x20
+ * or above 0x7e, i.e. if x is not made only of printable ASCII.
+ */
+#define ONES (~0UL / 255)
+#define NOTPRINT(x) \
+  (((((x) - ONES * 0x20) & ~(x)) | ((x) + ONES) | (x)) & (ONES * 0x80))
+
+static size_t
+vtprintrun(VTPARSER *vp, const char *s, size_t n)
+{
+  wchar_t run[MAXRUN];
+  size_t i = 0, r;
+  int k = 0;
+
+  while (i < n && k < MAXRUN) {
+    unsigned char c = (unsigned char) s[i];
+
+    if (c < 0x20 || c == 0x7f)
+      break;
+
+    if (c >= 0x80) {
+      r = mbrtowc(&run[k], s + i, n - i, &vp->ms);
+      if (r == (size_t) -2) { /* incomplete, leave it to vtwrite */
+	memset(&vp->ms, 0, sizeof(vp->ms));
+	break;
+      }
+      if (r == (size_t) -1 || r == 0) {
+	memset(&vp->ms, 0, sizeof(vp->ms));
+	run[k] = VTPARSER_BAD_CHAR;
+	r = 1;
+      }
+      i += r;
+      k++;
+      continue;
+    }
+
+    /* plain ASCII, go a word at a time while it stays printable */
+    while (n - i >= sizeof(unsigned long) &&
+	   MAXRUN - k >= (int) sizeof(unsigned long)) {
+      unsigned long x;
+      int j;
+
+      memcpy(&x, s + i, sizeof(x));
+      if (NOTPRINT(x))
+	break;
+      for (j = 0; j < (int) sizeof(x); j++)
+	run[k++] = (unsigned char) s[i++];
+    }
+    if (i < n && k < MAXRUN) {
+      c = (unsigned char) s[i];
+      if (c >= 0x20 && c < 0x7f) {
+	run[k++] = c;
+	i++;
+      }
+    }
+  }
+
+  if (k)
+    vp->printrun(vp, vp->p, 0, 0, k, NULL, run);
+  return i;
+}
+
+void
+vtwrite(VTPARSER *vp, const char *s, size_t n)
+{
+  wchar_t w = 0;
+  while (n){
+    size_t r;
+
+    /*
+     * In the ground state, runs of printable characters are decoded
+     * in bulk and handed to the printrun callback in one call.
+     */
+    if (vp->printrun && (vp->s == NULL || vp->s == &ground) &&
+	mbsinit(&vp->ms)) {
+      r = vtprintrun(vp, s, n);
+      if (r) {
+	n -= r;
+	s += r;
+	continue;
+      }
+    }
+
+    r = mbrtowc(&w, s, n, &vp->ms);
+    switch (r){
+    case -2: /* incomplete character, try again */
+      return;
+
+    case -1: /* invalid character, skip it */
+      w = VTPARSER_BAD_CHAR;
+      r = 1;
+      break;
+
+    case 0: /* literal zero, write it but advance */
+      r = 1;
+      break;
+    }
+
+    n -= r;
+    s += r;
+    vthandlechar(vp, w);
+  }
+}
+
+/**** STATE DEFINITIONS
+ * This was built by consulting the excellent state chart created by
+ * Paul Flo Williams: http://vt100.net/emu/dec_ansi_parser
+ * Please note that Williams does not (AFAIK) endorse this work.
+ */
+#define MAKESTATE(name, onentry, ...)				\
+  static STATE name ={						\
+		      onentry ,					\
+		      {						\
+		       {0x00, 0x00, ignore,    NULL},		\
+		       {0x7f, 0x7f, ignore,    NULL},		\
+		       {0x18, 0x18, docontrol, &ground},	\
+		       {0x1a, 0x1a, docontrol, &ground},	\
+		       {0x1b, 0x1b, ignore,    &escape},	\
+		       {0x01, 0x06, docontrol, NULL},		\
+		       {0x08, 0x17, docontrol, NULL},		\
+		       {0x19, 0x19, docontrol, NULL},		\
+		       {0x1c, 0x1f, docontrol, NULL},		\
+		       __VA_ARGS__ ,				\
+		       {0x07, 0x07, docontrol, NULL},		\
+		       {0x00, 0x00, NULL,      NULL}		\
+		      },					\
+		      {NULL}					\
+  };
+
+MAKESTATE(ground, NULL,
+	  {0x20, WCHAR_MAX, doprint, NULL}
+	  );
+
+MAKESTATE(escape, reset,
+	  {0x21, 0x21, ignore,   &osc_string},
+	  {0x20, 0x2f, collect,  &escape_intermediate},
+	  {0x30, 0x4f, doescape, &ground},
+	  {0x51, 0x57, doescape, &ground},
+	  {0x59, 0x59, doescape, &ground},
+	  {0x5a, 0x5a, doescape, &ground},
+	  {0x5c, 0x5c, doescape, &ground},
+	  {0x6b, 0x6b, ignore,   &osc_string},
+	  {0x60, 0x7e, doescape, &ground},
+	  {0x5b, 0x5b, ignore,   &csi_entry},
+	  {0x5d, 0x5d, ignore,   &osc_string},
+	  {0x5e, 0x5e, ignore,   &osc_string},
+	  {0x50, 0x50, ignore,   &osc_string},
+	  {0x5f, 0x5f, ignore,   &osc_string}
+	  );
+
+MAKESTATE(escape_intermediate, NULL,
+	  {0x20, 0x2f, collect,  NULL},
+	  {0x30, 0x7e, doescape, &ground}
+	  );
+
+MAKESTATE(csi_entry, reset,
+	  {0x20, 0x2f, collect, &csi_intermediate},
+	  {0x3a, 0x3a, ignore,  &csi_ignore},
+	  {0x30, 0x39, param,   &csi_param},
+	  {0x3b, 0x3b, param,   &csi_param},
+	  {0x3c, 0x3f, collect, &csi_param},
+	  {0x40, 0x7e, docsi,   &ground}
+	  );
+
+MAKESTATE(csi_ignore, NULL,
+	  {0x20, 0x3f, ignore, NULL},
+	  {0x40, 0x7e, ignore, &ground}
+	  );
+
+MAKESTATE(csi_param, NULL,
+	  {0x30, 0x39, param,   NULL},
+	  {0x3b, 0x3b, param,   NULL},
+	  {0x3a, 0x3a, ignore,  &csi_ignore},
+	  {0x3c, 0x3f, ignore,  &csi_ignore},
+	  {0x20, 0x2f, collect, &csi_intermediate},
+	  {0x40, 0x7e, docsi,   &ground}
+	  );
+
+MAKESTATE(csi_intermediate, NULL,
+	  {0x20, 0x2f, collect, NULL},
+	  {0x30, 0x3f, ignore,  &csi_ignore},
+	  {0x40, 0x7e, docsi,   &ground}
+	  );
+
+MAKESTATE(osc_string, reset,
+	  {0x07, 0x07, doosc, &ground},
+	  {0x20, 0x7f, collectosc, NULL}
+	  );
+
+
@@ -19,8 +19,8 @@
 #include "ckPort.h"
 #include "ck.h"
 #include "default.h"
+#include "ckTerminal.h"
 
-extern int setenv (const char *__string, const char *__value, int __overwrite);
 
 /*
  * Code below is taken form MTM
@@ -58,61 +58,6 @@ extern int setenv (const char *__string, const char *__value, int __overwrite);
 #include <wchar.h>
 #include <wctype.h>
 
-/**** CONFIGURATION
- * VTPARSER_BAD_CHAR is the character that will be displayed when
- * an application sends an invalid multibyte sequence to the terminal.
- */
-#ifndef VTPARSER_BAD_CHAR
-#ifdef __STDC_ISO_10646__
-#define VTPARSER_BAD_CHAR ((wchar_t)0xfffd)
-#else
-#define VTPARSER_BAD_CHAR L'?'
-#endif
-#endif
-
-/**** DATA TYPES */
-#define MAXPARAM    16
-#define MAXCALLBACK 128
-#define MAXOSC      100
-#define MAXBUF      100
-
-typedef struct VTPARSER VTPARSER;
-typedef struct STATE STATE;
-typedef void (*VTCALLBACK)(VTPARSER *v, void *p, wchar_t w, wchar_t iw,
-                           int argc, int *argv, const wchar_t *osc);
-
-struct VTPARSER {
-  STATE *s;
-  int narg;
-  int nosc;
-  int args[MAXPARAM];
-  int inter;
-  wchar_t oscbuf[MAXOSC + 1];
-  mbstate_t ms;
-  void *p;
-  VTCALLBACK print;
-  VTCALLBACK osc;
-  VTCALLBACK cons[MAXCALLBACK];
-  VTCALLBACK escs[MAXCALLBACK];
-  VTCALLBACK csis[MAXCALLBACK];
-};
-
-typedef enum
-  {
-   VTPARSER_CONTROL,
-   VTPARSER_ESCAPE,
-   VTPARSER_CSI,
-   VTPARSER_OSC,
-   VTPARSER_PRINT
-  } VtEvent;
-
-/**** FUNCTIONS */
-VTCALLBACK
-vtonevent(VTPARSER *vp, VtEvent t, wchar_t w, VTCALLBACK cb);
-
-void
-vtwrite(VTPARSER *vp, const char *s, size_t n);
-
 
 /*** CONFIGURATION */
 /* mtm by default will advertise itself as a "screen-bce" terminal.
@@ -171,189 +116,31 @@ vtwrite(VTPARSER *vp, const char *s, size_t n);
 #define SCROLLDOWN CODE(KEY_NPAGE)
 #define RECENTER CODE(KEY_END)
 
-/* The path for the wide-character curses library. */
-#ifndef NCURSESW_INCLUDE_H
-#if defined(__APPLE__) || !defined(__linux__) || defined(__FreeBSD__)
-#define NCURSESW_INCLUDE_H <curses.h>
-#else
-#define NCURSESW_INCLUDE_H <ncursesw/curses.h>
-#endif
-#endif
-#include NCURSESW_INCLUDE_H
-
-/* Includes needed to make forkpty(3) work. */
-#ifndef FORKPTY_INCLUDE_H
-#if defined(__APPLE__)
-#define FORKPTY_INCLUDE_H <util.h>
-#elif defined(__FreeBSD__)
-#define FORKPTY_INCLUDE_H <libutil.h>
-#else
-#define FORKPTY_INCLUDE_H <pty.h>
-#endif
-#endif
-#include FORKPTY_INCLUDE_H
-
-/* You probably don't need to alter these much, but if you do,
- * here is where you can define alternate character sets.
- *
- * Note that if your system's wide-character implementation
- * maps directly to Unicode, the preferred Unicode characters
- * will be used automatically if your system declares such
- * support. If it doesn't declare it, define WCHAR_IS_UNICODE to
- * force Unicode to be used.
- */
-#define MAXMAP 0x7f
-  static wchar_t CSET_US[MAXMAP]; /* "USASCII"...really just the null table */
-
-#if defined(__STDC_ISO_10646__) || defined(WCHAR_IS_UNICODE)
-static wchar_t CSET_UK[MAXMAP] ={ /* "United Kingdom"...really just Pound Sterling */
-				 [L'#'] = 0x00a3
-};
-
-static wchar_t CSET_GRAPH[MAXMAP] =
-  { /* Graphics Set One */
-   [L'-'] = 0x2191,
-   [L'}'] = 0x00a3,
-   [L'~'] = 0x00b7,
-   [L'{'] = 0x03c0,
-   [L','] = 0x2190,
-   [L'+'] = 0x2192,
-   [L'.'] = 0x2193,
-   [L'|'] = 0x2260,
-   [L'>'] = 0x2265,
-   [L'`'] = 0x25c6,
-   [L'a'] = 0x2592,
-   [L'b'] = 0x2409,
-   [L'c'] = 0x240c,
-   [L'd'] = 0x240d,
-   [L'e'] = 0x240a,
-   [L'f'] = 0x00b0,
-   [L'g'] = 0x00b1,
-   [L'h'] = 0x2592,
-   [L'i'] = 0x2603,
-   [L'j'] = 0x2518,
-   [L'k'] = 0x2510,
-   [L'l'] = 0x250c,
-   [L'm'] = 0x2514,
-   [L'n'] = 0x253c,
-   [L'o'] = 0x23ba,
-   [L'p'] = 0x23bb,
-   [L'q'] = 0x2500,
-   [L'r'] = 0x23bc,
-   [L's'] = 0x23bd,
-   [L't'] = 0x251c,
-   [L'u'] = 0x2524,
-   [L'v'] = 0x2534,
-   [L'w'] = 0x252c,
-   [L'x'] = 0x2502,
-   [L'y'] = 0x2264,
-   [L'z'] = 0x2265,
-   [L'_'] = L' ',
-   [L'0'] = 0x25ae
-  };
-
-#else /* wchar_t doesn't map to Unicode... */
-
-static wchar_t CSET_UK[] =
-  { /* "United Kingdom"...really just Pound Sterling */
-   [L'#'] = L'&'
-  };
-
-static wchar_t CSET_GRAPH[] =
-  { /* Graphics Set One */
-   [L'-'] = '^',
-   [L'}'] = L'&',
-   [L'~'] = L'o',
-   [L'{'] = L'p',
-   [L','] = L'<',
-   [L'+'] = L'>',
-   [L'.'] = L'v',
-   [L'|'] = L'!',
-   [L'>'] = L'>',
-   [L'`'] = L'+',
-   [L'a'] = L':',
-   [L'b'] = L' ',
-   [L'c'] = L' ',
-   [L'd'] = L' ',
-   [L'e'] = L' ',
-   [L'f'] = L'\'',
-   [L'g'] = L'#',
-   [L'h'] = L'#',
-   [L'i'] = L'i',
-   [L'j'] = L'+',
-   [L'k'] = L'+',
-   [L'l'] = L'+',
-   [L'm'] = L'+',
-   [L'n'] = '+',
-   [L'o'] = L'-',
-   [L'p'] = L'-',
-   [L'q'] = L'-',
-   [L'r'] = L'-',
-   [L's'] = L'_',
-   [L't'] = L'+',
-   [L'u'] = L'+',
-   [L'v'] = L'+',
-   [L'w'] = L'+',
-   [L'x'] = L'|',
-   [L'y'] = L'<',
-   [L'z'] = L'>',
-   [L'_'] = L' ',
-   [L'0'] = L'#',
-  };
-#endif
-
-#define MIN(x, y) ((x) < (y)? (x) : (y))
-#define MAX(x, y) ((x) > (y)? (x) : (y))
 #define CTL(x) ((x) & 0x1f)
+// --------------------------------------------------------------------------
 
-/*** DATA TYPES */
-typedef struct SCRN SCRN;
-struct SCRN {
-  int sy;        /* saved cursor y position */
-  int sx;        /* saved cursor x position */
-  int vis;
-  int tos;        /* Top os screen */
-  int off;        /* Offset */
-  short wbg;      /* window background */
-  short wfg;      /* window foreground */
-  short fg;       /* current foreground color */
-  short bg;       /* current background color */
-  short sfg;      /* saved foreground */
-  short sbg;      /* saved background */
-  short sp;
-  bool insert;
-  bool oxenl;     /* saved xenl */
-  bool xenl;
-  bool saved;     /* if true saved cursor done */
-  attr_t sattr;   /* saved attributes */
-  WINDOW *win;    /* curses window - it is a pad */
-};
-
-typedef struct NODE NODE;
-struct NODE {
-  int h;        /* height of terminal */
-  int w;        /* width of terminal */
-  int pt;       /* Pseudo-TTY bound to subprocess (i.e. shell) */
-  int ntabs;    /* number of tabs */
-  bool *tabs;   /* dynamically allocated tab stops array */
-  bool pnm;
-  bool decom;
-  bool am;
-  bool lnm;
-  wchar_t repc;  /* char to repeat */
-  SCRN pri;      /* primary screen */
-  SCRN alt;      /* alternate screen */
-  SCRN *s;       /* active screen , points to pri or alt member */
-  wchar_t *g0, *g1, *g2, *g3, *gc, *gs, *sgc, *sgs;
-  VTPARSER vp;   /* used to parse input stream from bound pseudo-TTY */
-
-  char iobuf[BUFSIZ];  /* buffer for character input */
-  bool cmd;            /* true if in command mode */
-  
-  void *clientData;    /* pointer to extra data */
-};
+/*
+ * A recorded session being replayed: the output of its frames one
+ * after the other, and for each frame its time and where it ends.
+ */
 
-// --------------------------------------------------------------------------
+typedef struct REPLAY {
+  char *fileName;             /* file the session was read from */
+  Tcl_DString data;           /* output of the frames */
+  double *times;              /* time of each frame, in seconds */
+  int *ends;                  /* offset in data after each frame */
+  int nframes;                /* number of frames */
+  int space;                  /* number of frames allocated */
+  int next;                   /* next frame to output */
+  double speed;               /* speed factor, <= 0 means as fast
+			       * as possible */
+  int started;                /* non-zero once start is set */
+  Tcl_Time start;             /* time the first frame was output */
+  Tk_TimerToken timer;        /* output of the next frames */
+} REPLAY;
+
+#define RECORD_ASCIICAST 0
+#define RECORD_TTYREC    1
 
 /*
  * A data structure of the following type is kept for each
@@ -388,6 +175,8 @@ typedef struct Terminal_s {
   int    nexec;               /* number of elements in splitted version of exec */
   char **aexec;               /* splitted version of exec - used for process fork */
   int scrollback;             /* size of terminal scrollback buffer */
+  int scrollbackBudget;       /* bytes the scrollback may use, 0 means
+			       * no limit other than scrollback lines */
   char *yscrollcommand;       /* y-scroll command */
   int redisplayPolicy;        /* update display policy
                                * POLICY_NONE : widget will be updated once 
@@ -397,17 +186,57 @@ typedef struct Terminal_s {
 			       *               each time a newline is received.
 			       * number > 0  : widget is updated each time
                                *               this amount of bytes has been read
-                               *               from the pty channel. */
+                               *               from the pty channel.
+			       * POLICY_FRAME: widget is updated at most once
+			       *               per frameInterval. */
+  int frameInterval;          /* frame interval in ms for POLICY_FRAME */
+  Tcl_Time lastFrame;         /* time of the last POLICY_FRAME update */
+  Tk_TimerToken frameTimer;   /* pending update at the end of the frame */
 
   int count;                  /* received characters counter used for redisplay */
+  int readBudget;             /* maximum number of bytes read from the pty
+			       * each time it becomes readable */
   int yview;                  /* used while scrolling through the buffer */
   Tcl_Channel tee;            /* channel where pty input stream gets duplicated */
+  int teeBuffer;              /* bytes the tee channel may have waiting
+			       * to be written, 0 means no limit */
+  Ck_Uid teePolicyUid;        /* value of -teepolicy */
+  int teeBlock;               /* non-zero means stop reading the pty
+			       * while the tee channel is full, zero
+			       * means drop the input it can't take */
+  Tcl_WideInt teeBytes;       /* bytes written to the tee channel */
+  Tcl_WideInt teeDropped;     /* bytes dropped because it was full */
+  int teeDrops;               /* number of reads dropped */
+  int teeStalls;              /* number of times reading was stopped */
+
+  Tcl_Channel record;         /* channel the output is recorded to */
+  int recordFormat;           /* RECORD_ASCIICAST or RECORD_TTYREC */
+  Tcl_Time recordStart;       /* time the recording started */
+  char recordHeld[4];         /* incomplete UTF-8 character at the end */
+  int recordNheld;            /* of the last frame, for asciicast */
+  REPLAY *replay;             /* session being replayed, or NULL */
+  int pty;                    /* non-zero means run the slave program
+			       * on a pty, zero means output only comes
+			       * from replay */
 
   Ck_Uid bindings[0x7f];      /* binding table for terminal commands
                                * indexed by ASCII keycode, value id not 0
 			       * is the virtual event to emit. */
   
   NODE *node;                 /* pointer to terminal object */
+  struct Emulator *attached;  /* emulator displayed instead of the
+			       * terminal's own node, or NULL */
+  NODE *ownNode;              /* the terminal's own node while an
+			       * emulator is attached */
+
+  SCRN *drawnScrn;            /* screen, scroll offset and size of the */
+  int drawnOff;               /* last redisplay: when one of them changes */
+  int drawnWidth;             /* the whole widget is redrawn, otherwise */
+  int drawnHeight;            /* only the rows touched in the screen are. */
+  int drawnLines;             /* saved lines at last redisplay */
+
+  long matchLine;             /* line and columns of the search match */
+  int matchStart, matchEnd;   /* highlighted, matchLine < 0 if none */
   
 } Terminal;
 
@@ -420,6 +249,13 @@ typedef struct Terminal_s {
  *
  * DISCONNECTED:                Bound subprocess (shell) is finished
  *
+ * REDRAW_ALL:                  Non-zero means the whole widget must be
+ *                              redrawn at next redisplay, not only
+ *                              the rows that changed in the screen.
+ *
+ * TEE_STALLED:                 The pty is not read until the tee channel
+ *                              has written enough of its pending output.
+ *
  * MODE_INTERACT:               The user interacts with the terminal
  *                              using mouse and keyboard. Keys and mouse events
  *                              are sent to the subprocess (through opened pty)
@@ -438,12 +274,40 @@ typedef struct Terminal_s {
 #define HAS_FOCUS               16
 #define DISPLAY_BANNER          32
 #define DISPLAY_TRAILER         64
-#define MOUSE_REPORT_1000      128  /* if set mouse buttons events are forwarded */
-#define MOUSE_REPORT_1001      256  /* unsupported mouse mode */
-#define MOUSE_REPORT_1002      512  /* if set mouse motion & buttons events are forwarded */
-#define MOUSE_REPORT_1003      (MOUSE_REPORT_1000 | MOUSE_REPORT_1002)
+#define REDRAW_ALL            2048
+#define TEE_STALLED           4096
 
-#define MOUSE_REPORT (MOUSE_REPORT_1000 | MOUSE_REPORT_1002 | MOUSE_REPORT_1003)
+/*
+ * The node of a terminal running its own program, which goes on
+ * while an emulator is attached, and whether the displayed node has
+ * a program to send input to.
+ */
+
+#define OWNNODE(t) ((t)->attached != NULL ? (t)->ownNode : (t)->node)
+#define HOSTLESS(t) ((t)->node == NULL || (t)->node->pt < 0)
+
+/*
+ * A data structure of the following type is kept for each headless
+ * emulator, a terminal screen fed by scripts rather than by a pty and
+ * never drawn:
+ */
+
+typedef struct Emulator {
+  CkWindow *winPtr;           /* Main window, used for options, NULL
+			       * when loaded without one. */
+  Tcl_Interp *interp;         /* Interpreter associated with emulator. */
+  Tcl_Command cmd;            /* Token for emulator's command. */
+  int fg, bg;                 /* Foreground/background colors. */
+  int width, height;          /* Size of the screen in cells. */
+  int scrollback;             /* most lines kept off the screen */
+  int scrollbackBudget;       /* bytes they may use, 0 for no limit */
+  int readBudget;             /* most bytes read from the pty at once */
+  char *exec;                 /* program run on a pty, NULL for none */
+  char *term;                 /* TERM of the program */
+  NODE *node;                 /* screens and parser */
+  struct Terminal_s *attached; /* terminal displaying the emulator,
+			       * NULL while it only runs the parser */
+} Emulator;
 
 #define BINDING_IGNORE ((char*)0x01)
 
@@ -527,9 +391,24 @@ static Ck_ConfigSpec configSpecs[] = {
      DEF_TERMINAL_REDISPLAY, Ck_Offset(Terminal, redisplayPolicy),
      CK_CONFIG_NULL_OK, &RedisplayPolicyCustomOption },
     
+    {CK_CONFIG_BOOLEAN, "-pty", "pty", "Pty",
+     DEF_TERMINAL_PTY, Ck_Offset(Terminal, pty), 0},
+    
+    {CK_CONFIG_INT, "-readbudget", "readBudget", "ReadBudget",
+     DEF_TERMINAL_READBUDGET, Ck_Offset(Terminal, readBudget), 0},
+    
     {CK_CONFIG_INT, "-scrollback", "scrollback", "Scrollback",
      DEF_TERMINAL_SCROLLBACK, Ck_Offset(Terminal, scrollback), 0},
     
+    {CK_CONFIG_INT, "-scrollbackbudget", "scrollbackBudget", "ScrollbackBudget",
+     DEF_TERMINAL_SCROLLBACK_BUDGET, Ck_Offset(Terminal, scrollbackBudget), 0},
+    
+    {CK_CONFIG_INT, "-teebuffer", "teeBuffer", "TeeBuffer",
+     DEF_TERMINAL_TEEBUFFER, Ck_Offset(Terminal, teeBuffer), 0},
+    
+    {CK_CONFIG_UID, "-teepolicy", "teePolicy", "TeePolicy",
+     DEF_TERMINAL_TEEPOLICY, Ck_Offset(Terminal, teePolicyUid), 0},
+    
     {CK_CONFIG_STRING, "-yscrollcommand", "yscrollcommand", "YScrollCommand",
      (char*) NULL, Ck_Offset(Terminal, yscrollcommand), CK_CONFIG_NULL_OK},
     
@@ -543,6 +422,44 @@ static Ck_ConfigSpec configSpecs[] = {
         (char *) NULL, 0, 0}
 };
 
+static Ck_ConfigSpec emulatorConfigSpecs[] = {
+    {CK_CONFIG_COLOR, "-background", "background", "Background",
+     DEF_EMULATOR_BG, Ck_Offset(Emulator, bg), 0},
+    
+    {CK_CONFIG_SYNONYM, "-bg", "background", (char *) NULL,
+     (char *) NULL, 0, 0},
+    
+    {CK_CONFIG_COLOR, "-foreground", "foreground", "Foreground",
+     DEF_EMULATOR_FG, Ck_Offset(Emulator, fg), 0},
+    
+    {CK_CONFIG_SYNONYM, "-fg", "foreground", (char *) NULL,
+     (char *) NULL, 0, 0},
+    
+    {CK_CONFIG_INT, "-height", "height", "Height",
+     DEF_EMULATOR_HEIGHT, Ck_Offset(Emulator, height), 0},
+    
+    {CK_CONFIG_INT, "-width", "width", "Width",
+     DEF_EMULATOR_WIDTH, Ck_Offset(Emulator, width), 0},
+    
+    {CK_CONFIG_INT, "-scrollback", "scrollback", "Scrollback",
+     DEF_EMULATOR_SCROLLBACK, Ck_Offset(Emulator, scrollback), 0},
+    
+    {CK_CONFIG_INT, "-scrollbackbudget", "scrollbackBudget", "ScrollbackBudget",
+     DEF_EMULATOR_SCROLLBACK_BUDGET, Ck_Offset(Emulator, scrollbackBudget), 0},
+    
+    {CK_CONFIG_INT, "-readbudget", "readBudget", "ReadBudget",
+     DEF_EMULATOR_READBUDGET, Ck_Offset(Emulator, readBudget), 0},
+    
+    {CK_CONFIG_STRING, "-exec", "exec", "Exec",
+     DEF_EMULATOR_EXEC, Ck_Offset(Emulator, exec), CK_CONFIG_NULL_OK},
+    
+    {CK_CONFIG_STRING, "-term", "term", "Term",
+     DEF_EMULATOR_TERM, Ck_Offset(Emulator, term), CK_CONFIG_NULL_OK},
+    
+    {CK_CONFIG_END, (char *) NULL, (char *) NULL, (char *) NULL,
+        (char *) NULL, 0, 0}
+};
+
 /*
  * Forward declarations for procedures defined later in this file:
  */
@@ -552,10 +469,18 @@ static int      ConfigureTerminal _ANSI_ARGS_((Tcl_Interp *interp,
 static void     DestroyTerminal _ANSI_ARGS_((ClientData clientData));
 static void     TerminalCmdDeletedProc _ANSI_ARGS_((ClientData clientData));
 static void     DisplayTerminal _ANSI_ARGS_((ClientData clientData));
+static void     FrameRedisplay _ANSI_ARGS_((Terminal *terminalPtr));
+static void     FrameTimerProc _ANSI_ARGS_((ClientData clientData));
 static void     TerminalEventProc _ANSI_ARGS_((ClientData clientData,
                     CkEvent *eventPtr));
 static int      TerminalWidgetCmd _ANSI_ARGS_((ClientData clientData,
                     Tcl_Interp *interp, int argc, char **argv));
+static int      ConfigureEmulator _ANSI_ARGS_((Tcl_Interp *interp,
+                    Emulator *emuPtr, int argc, char **argv, int flags));
+static Tcl_Obj *EmulatorCell _ANSI_ARGS_((NODE *n, int row, int col));
+static int      EmulatorCmd _ANSI_ARGS_((ClientData clientData,
+                    Tcl_Interp *interp, int argc, char **argv));
+static void     EmulatorDeletedProc _ANSI_ARGS_((ClientData clientData));
 
 static void     TerminalKeyEventProc _ANSI_ARGS_((ClientData clientData,
 						  CkEvent *eventPtr));
@@ -563,1255 +488,360 @@ static void     TerminalMouseEventProc _ANSI_ARGS_((ClientData clientData,
 			  			    CkEvent *eventPtr));
 static void     TerminalPtyProc _ANSI_ARGS_((ClientData clientData, int flags));
 static void     SendToTerminal  _ANSI_ARGS_((Terminal *terminalPtr, char *text));
+static void     PasteToTerminal _ANSI_ARGS_((Terminal *terminalPtr, char *text));
 static void     TerminalPostRedisplay  _ANSI_ARGS_((Terminal *terminalPtr));
 static void     TerminalYScrollCommand  _ANSI_ARGS_((ClientData clientData));
 static int      TerminalYView _ANSI_ARGS_((Terminal *terminalPtr,
 					   int argc, char **argv));
+static int      TerminalSearch _ANSI_ARGS_((Terminal *terminalPtr,
+					    int argc, char **argv));
 static int      TerminalTee _ANSI_ARGS_((Terminal *terminalPtr,
 					 int argc, char **argv));
+static void     TeeOutput _ANSI_ARGS_((Terminal *terminalPtr,
+				       char *buf, int len));
+static void     TeeDetach _ANSI_ARGS_((Terminal *terminalPtr));
+static int      TeeRoom _ANSI_ARGS_((Terminal *terminalPtr, int budget));
+static void     TeeResume _ANSI_ARGS_((Terminal *terminalPtr));
+static void     TeeWritableProc _ANSI_ARGS_((ClientData clientData,
+					     int mask));
+static void     TeeCloseProc _ANSI_ARGS_((ClientData clientData));
+static void     TerminalOutput _ANSI_ARGS_((Terminal *terminalPtr,
+					    char *buf, int len));
+static int      TerminalRecord _ANSI_ARGS_((Terminal *terminalPtr,
+					    int argc, char **argv));
+static void     RecordOutput _ANSI_ARGS_((Terminal *terminalPtr,
+					  char *buf, int len));
+static void     RecordStop _ANSI_ARGS_((Terminal *terminalPtr));
+static int      TerminalReplay _ANSI_ARGS_((Terminal *terminalPtr,
+					    int argc, char **argv));
+static int      ReplayLoad _ANSI_ARGS_((Tcl_Interp *interp,
+					REPLAY *replayPtr));
+static char *   ReplayString _ANSI_ARGS_((char *p, char *end,
+					  Tcl_DString *dsPtr));
+static void     ReplayTimerProc _ANSI_ARGS_((ClientData clientData));
+static void     ReplayStop _ANSI_ARGS_((Terminal *terminalPtr));
+static int      TerminalNewView _ANSI_ARGS_((Terminal *terminalPtr,
+					     int height, int width));
+static void     TerminalReshape _ANSI_ARGS_((Terminal *terminalPtr));
+static void     TerminalWatch _ANSI_ARGS_((Terminal *terminalPtr));
+static int      TerminalAttach _ANSI_ARGS_((Terminal *terminalPtr,
+					    int argc, char **argv));
+static void     TerminalDetach _ANSI_ARGS_((Terminal *terminalPtr));
+static void     EmulatorPtyProc _ANSI_ARGS_((ClientData clientData,
+					     int flags));
 // --------------------------------------------------------------------------
 
 /*** GLOBALS AND PROTOTYPES */
-static void setupevents(NODE *n);
 static void reshape(NODE *n, int h, int w);
-static void draw(NODE *n);
-static void freenode(NODE *n);
-static void fixcursor(NODE *n);
-
-static int
-safewrite(int fd, const char *b, size_t n) /* Write, checking for errors. */
-{
-  size_t w = 0;
-  if ( fd<0 ) return 0;
-  while (w < n){
-    ssize_t s = write(fd, b + w, n - w);
-    if (s < 0 && errno != EINTR)
-      return w;
-    else if (s < 0)
-      s = 0;
-    w += (size_t)s;
-  }
-  return w;
-}
-
-
-/*** TERMINAL EMULATION HANDLERS
- * These functions implement the various terminal commands activated by
- * escape sequences and printing to the terminal. Large amounts of boilerplate
- * code is shared among all these functions, and is factored out into the
- * macros below:
- *      PD(n, d)       - Parameter n, with default d.
- *      P0(n)          - Parameter n, default 0.
- *      P1(n)          - Parameter n, default 1.
- *      CALL(h)        - Call handler h with no arguments.
- *      SENDN(n, s, c) - Write string c bytes of s to n.
- *      SEND(n, s)     - Write string s to node n's host.
- *      (END)HANDLER   - Declare/end a handler function
- *      COMMONVARS     - All of the common variables for a handler.
- *                       x, y     - cursor position
- *                       mx, my   - max possible values for x and y
- *                       px, py   - physical cursor position in scrollback
- *                       n        - the current node
- *                       win      - the current window
- *                       top, bot - the scrolling region
- *                       tos      - top of the screen in the pad
- *                       s        - the current SCRN buffer
- * The funny names for handlers are from their ANSI/ECMA/DEC mnemonics.
- */
-#define PD(x, d) (argc < (x) || !argv? (d) : argv[(x)])
-#define P0(x) PD(x, 0)
-#define P1(x) (!P0(x)? 1 : P0(x))
-#define CALL(x) (x)(v, n, 0, 0, 0, NULL, NULL)
-#define SENDN(n, s, c) safewrite(n->pt, s, c)
-#define SEND(n, s) SENDN(n, s, strlen(s))
-#define COMMONVARS						\
-  NODE *n = (NODE *)p;						\
-  SCRN *s = n->s;						\
-  WINDOW *win = s->win;						\
-  Terminal *term = (Terminal *) n->clientData;			\
-  WINDOW *winterm = term->winPtr->window;			\
-  int py, px, y, x, my, mx, top = 0, bot = 0, tos = s->tos;	\
-  (void)v; (void)p; (void)w; (void)iw; (void)argc; (void)argv;	\
-  (void)win; (void)y; (void)x; (void)my; (void)mx; (void)osc;	\
-  (void)tos;							\
-  getyx(win, py, px); y = py - s->tos; x = px;			\
-  getmaxyx(win, my, mx); my -= s->tos;				\
-  wgetscrreg(win, &top, &bot);					\
-  bot++; bot -= s->tos;						\
-  top = top <= tos? 0 : top - tos;				\
-
-#define HANDLER(name)                                   \
-  static void						\
-  name (VTPARSER *v, void *p, wchar_t w, wchar_t iw,	\
-	int argc, int *argv, const wchar_t *osc)	\
-  { COMMONVARS
-#define ENDHANDLER n->repc = 0; } /* control sequences aren't repeated */
-
-/* 
- *--------------------------------------------------------------------------
- * Terminal bell.
- *--------------------------------------------------------------------------
- */
-HANDLER(bell) { 
-  beep();
-  ENDHANDLER;
-}
+static void draw(NODE *n, int all);
 
-/* 
- *--------------------------------------------------------------------------
- * Application/Numeric Keypad Mode
- *--------------------------------------------------------------------------
+/*** MTM FUNCTIONS
+ * These functions do the user-visible work of MTM: drawing nodes in the
+ * terminal window, scrolling back, handling keys.
  */
-HANDLER(numkp) { 
-  n->pnm = (w == L'=');
-  ENDHANDLER;
+static short
+viewcolor(short c) /* A color as the display can show it. */
+{
+  if (c < COLORS)
+    return c;
+  return (c < 16 && COLORS >= 8)? c - 8 : -1;
 }
 
-/* 
- *--------------------------------------------------------------------------
- * Cursor visibility
- *--------------------------------------------------------------------------
- */
-HANDLER(vis) { 
-  s->vis = iw == L'6'? 0 : 1;
-  ENDHANDLER;
-}
+static void
+histdraw(NODE *n, int line, int seg, CkWindow *winPtr, int y, int x0, int cols)
+     /* Draw row seg of a saved line, wrapped at the width of the node. */
+{
+  WINDOW *win = winPtr->window;
+  HLINE *l = vthistline(n, line);
+  char *q = (char *) (l + 1);
+  int w = n->hist.width, from = seg * w, to = from + w;
+  int pos = 0, x = 0, i, r;
+  short pair;
+  HRUN run;
+  cchar_t cc, blank;
+
+#define RUNCHAR(i) \
+  (run.wide? ((wchar_t *) memcpy(&wc0, q + (i) * sizeof(wchar_t), sizeof(wchar_t)), wc0) \
+   : (wchar_t) (unsigned char) q[i])
+
+  to = MIN(to, from + cols);
+  wmove(win, y, x0);
+  for (r = 0; r < l->nruns && pos < to; r++) {
+    wchar_t wc0;
+
+    memcpy(&run, q, sizeof(HRUN));
+    q += sizeof(HRUN);
+    pair = PAIR_NUMBER(Ck_GetPair(winPtr, viewcolor(run.fg), viewcolor(run.bg)));
+    setcchar(&blank, L" ", run.attr, pair, NULL);
+    for (i = 0; i < run.len && pos < to; ) {
+      wchar_t wc[CCHARW_MAX + 1];
+      int k = 0, wd;
+
+      wc[k++] = RUNCHAR(i), i++;
+      while (i < run.len && k < CCHARW_MAX && wcwidth(RUNCHAR(i)) == 0)
+	wc[k++] = RUNCHAR(i), i++;
+      wc[k] = 0;
+      wd = MAX(wcwidth(wc[0]), 1);
+      if (wd > 1 && w > 1 && pos % w + wd > w) {
+	/* a double width character that does not fit goes whole to
+	 * the next row, as vtlinepos counts it */
+	for (k = MAX(pos, from); k < MIN(pos + w - pos % w, to); k++, x++)
+	  wadd_wch(win, &blank);
+	pos += w - pos % w;
+      }
+      if (pos >= from && pos + wd <= to) {
+	setcchar(&cc, wc, run.attr, pair, NULL);
+	wadd_wch(win, &cc);
+	x += wd;
+      } else {
+	/* a wide character cut by the edge of the view */
+	for (k = MAX(pos, from); k < MIN(pos + wd, to); k++, x++)
+	  wadd_wch(win, &blank);
+      }
+      pos += wd;
+    }
+    q += run.len * (run.wide? sizeof(wchar_t) : 1);
+  }
+#undef RUNCHAR
 
-/* 
- *--------------------------------------------------------------------------
- * CUP - Cursor Position
- *--------------------------------------------------------------------------
- */
-HANDLER(cup) { 
-  s->xenl = false;
-  wmove(win, tos + (n->decom? top : 0) + P1(0) - 1, P1(1) - 1);
-  fixcursor(n);
-  ENDHANDLER;
+  pair = PAIR_NUMBER(Ck_GetPair(winPtr, viewcolor(l->fill.fg),
+				viewcolor(l->fill.bg)));
+  setcchar(&cc, L" ", l->fill.attr, pair, NULL);
+  for (; x < cols; x++)
+    wadd_wch(win, &cc);
 }
 
-/* 
- *--------------------------------------------------------------------------
- * DCH - Delete Character
- *--------------------------------------------------------------------------
- */
-HANDLER(dch) { 
-  for (int i = 0; i < P1(0); i++) {
-    wdelch(win);
+static void
+rowdraw(NODE *n, int row, CkWindow *winPtr, int y, int x0, int cols)
+     /* Draw a row of the active screen. */
+{
+  SCRN *s = n->s;
+  CELL *c = CELLAT(s, row, 0);
+  short fg = -2, bg = -2, pair = 0;
+  int x, wd;
+
+  cols = MIN(cols, s->cols);
+  for (x = 0; x < cols; x++, c++) {
+    wchar_t wc[CCHARW_MAX + 1] = {0};
+    cchar_t cc;
+
+    /* the right half of a double width character */
+    if (c->ch[0] == 0)
+      continue;
+    if (c->fg != fg || c->bg != bg) {
+      fg = c->fg;
+      bg = c->bg;
+      pair = PAIR_NUMBER(Ck_GetPair(winPtr, viewcolor(fg), viewcolor(bg)));
+    }
+    wd = wcwidth(c->ch[0]);
+    if (wd > 1 && x + wd > cols)
+      wc[0] = L' '; /* cut by the edge of the view */
+    else
+      memcpy(wc, c->ch, sizeof(c->ch));
+    setcchar(&cc, wc, c->attr, pair, NULL);
+    mvwadd_wch(winPtr->window, y, x0 + x, &cc);
   }
-  fixcursor(n);
-  ENDHANDLER;
 }
+static void
+markmatch(NODE *n, int line, int seg, WINDOW *win, int y, int x0, int cols)
+     /* Highlight the search match on row seg of a line drawn on win. */
+{
+  Terminal *term = (Terminal *) n->clientData;
+  int from, to, x;
 
-/* 
- *--------------------------------------------------------------------------
- * ICH - Insert Character
- *--------------------------------------------------------------------------
- */
-HANDLER(ich) { 
-  for (int i = 0; i < P1(0); i++) {
-    wins_nwstr(win, L" ", 1);
+  if (term == NULL || term->matchLine < 0 || term->matchLine != n->hist.base + line)
+    return;
+  from = term->matchStart;
+  to = term->matchEnd;
+  if (line < HISTLINES(n)) {
+    /* saved lines are wrapped at the width of the scrollback */
+    HLINE *l = vthistline(n, line);
+
+    from = vtlinepos(l, n->hist.width, from) - seg * n->hist.width;
+    to = vtlinepos(l, n->hist.width, to) - seg * n->hist.width;
+  }
+  from = MAX(from, 0);
+  to = MIN(to, cols);
+  for (x = from; x < to; x++) {
+    cchar_t cc;
+    wchar_t wc[CCHARW_MAX + 1];
+    attr_t attr;
+    short pair;
+
+    mvwin_wch(win, y, x0 + x, &cc);
+    getcchar(&cc, wc, &attr, &pair, NULL);
+    mvwchgat(win, y, x0 + x, 1, (attr & ~A_COLOR) ^ A_REVERSE, pair, NULL);
   }
-  fixcursor(n);
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * CUU - Cursor Up
- *--------------------------------------------------------------------------
- */
-HANDLER(cuu) { 
-  wmove(win, MAX(py - P1(0), tos + top), x);
-  fixcursor(n);
-  ENDHANDLER;
 }
 
-/* 
- *--------------------------------------------------------------------------
- * CUD - Cursor Down
- *--------------------------------------------------------------------------
- */
-HANDLER(cud) { 
-  wmove(win, MIN(py + P1(0), tos + bot - 1), x);
-  fixcursor(n);
-  ENDHANDLER;
-}
+void
+vtfixcursor(NODE *n) /* Move the terminal cursor to the active view. */
+{
+  Terminal *terminalPtr = (Terminal*) n->clientData;
+  int y = n->s->cy, x = n->s->cx;
 
-/* 
- *--------------------------------------------------------------------------
- * CUF - Cursor Forward
- *--------------------------------------------------------------------------
- */
-HANDLER(cuf) { 
-  wmove(win, py, MIN(x + P1(0), mx - 1));
-  fixcursor(n);
-  ENDHANDLER;
+  if ( (terminalPtr != NULL) && (terminalPtr->winPtr->window != NULL) ) {
+    int offset = (terminalPtr->borderPtr != NULL) ? 1 : 0;
+    wmove(terminalPtr->winPtr->window, y + offset, x + offset);
+    if (n->s->off != HISTROWS(n)? 0 : n->s->vis) {
+      terminalPtr->winPtr->flags |= CK_SHOW_CURSOR;
+    }
+    else {
+      terminalPtr->winPtr->flags &= ~CK_SHOW_CURSOR;
+    }
+  }
 }
 
-/* 
- *--------------------------------------------------------------------------
- * ACK - Acknowledge Enquiry
- *--------------------------------------------------------------------------
- */
-HANDLER(ack) { 
-  SEND(n, "\006");
-  ENDHANDLER;
-}
+static NODE *
+newview(Terminal *term, int h, int w, int fg, int bg) /* Open a new view. */
+{
+  NODE *n = vtnewemu(h, w, fg, bg);
+  if (!n) {
+    return NULL;
+  }
+  n->clientData = term;
+  n->scrollback = term->scrollback;
+  n->budget = term->scrollbackBudget;
 
-/* 
- *--------------------------------------------------------------------------
- * HTS - Horizontal Tab Set
- *--------------------------------------------------------------------------
- */
-HANDLER(hts) { 
-  if (x < n->ntabs && x > 0)
-    n->tabs[x] = true;
-  ENDHANDLER;
-}
+  /* insert banner text in window */
+  if ( term->flags & DISPLAY_BANNER && term->banner != NULL ) {
+    term->flags &= ~DISPLAY_BANNER;
+    vtwrite(&n->vp, term->banner, strlen(term->banner));
+  }
 
-/* 
- *--------------------------------------------------------------------------
- * RI - Reverse Index
- *--------------------------------------------------------------------------
- */
-HANDLER(ri) { 
-  int otop = 0, obot = 0;
-  wgetscrreg(win, &otop, &obot);
-  wsetscrreg(win, otop >= tos? otop : tos, obot);
-  y == top? wscrl(win, -1) : wmove(win, MAX(tos, py - 1), x);
-  wsetscrreg(win, otop, obot);
-  fixcursor(n);
-  ENDHANDLER;
-}
+  /* without a pty, output only comes from replay */
+  if (!term->pty) {
+    return n;
+  }
 
-/* 
- *--------------------------------------------------------------------------
- * DECID - Send Terminal Identification
- *--------------------------------------------------------------------------
- */
-HANDLER(decid) { 
-  if (w == L'c') {
-    SEND(n, iw == L'>'? "\033[>1;10;0c" : "\033[?1;2c");
-  } else if (w == L'Z') {
-    SEND(n, "\033[?6c");
+  if ( term->term == NULL ) {
+    TermParseProc( NULL, term->interp, term->winPtr,
+		   NULL, (char*) term, Ck_Offset(Terminal, attr) );
   }
-  ENDHANDLER;
+  if (!vtspawn(n, term->term, term->nexec, term->aexec)) {
+    // @todo: Tk like error handling to do
+    return vtfreenode(n), NULL;
+  }
+  return n;
 }
 
-/* 
- *--------------------------------------------------------------------------
- * HPA - Cursor Horizontal Absolute
- *--------------------------------------------------------------------------
- */
-HANDLER(hpa) {
-  wmove(win, py, MIN(P1(0) - 1, mx - 1));
-  fixcursor(n);
-  ENDHANDLER;
-}
 
-/* 
- *--------------------------------------------------------------------------
- * HPR - Cursor Horizontal Relative
- *--------------------------------------------------------------------------
- */
-HANDLER(hpr) { 
-  wmove(win, py, MIN(px + P1(0), mx - 1));
-  fixcursor(n);
-  ENDHANDLER;
-}
+static void
+reshape(NODE *n, int h, int w) /* Reshape a node. */
+{
+  Terminal *terminalPtr = (Terminal*) n->clientData;
+  if (n->h == h && n->w == w)
+    return;
 
-/* 
- *--------------------------------------------------------------------------
- * VPA - Cursor Vertical Absolute
- *--------------------------------------------------------------------------
- */
-HANDLER(vpa) { 
-  wmove(win, MIN(tos + bot - 1, MAX(tos + top, tos + P1(0) - 1)), x);
-  fixcursor(n);
-  ENDHANDLER;
+  vtreshape(n, h, w);
+  if (terminalPtr != NULL)
+    TerminalPostRedisplay(terminalPtr);
 }
 
-/* 
- *--------------------------------------------------------------------------
- * VPR - Cursor Vertical Relative
- *--------------------------------------------------------------------------
- */
-HANDLER(vpr) { 
-  wmove(win, MIN(tos + bot - 1, MAX(tos + top, py + P1(0))), x);
-  fixcursor(n);
-  ENDHANDLER;
-}
+static void
+draw(NODE *n, int all) /* Draw a node, only its changed rows if !all. */
+{
+  Terminal *terminalPtr = (Terminal*) n->clientData;
+  
+  if ( (terminalPtr != NULL) &&  (terminalPtr->winPtr->window != NULL)) {
+    CkWindow *winPtr = terminalPtr->winPtr;
+    int offset = (terminalPtr->borderPtr != NULL) ? 1 : 0;
+    int poff, rows, first;
+    int y, x, i;
+    attr_t attr;
+    short pair;
+
+    vthistrewrap(n);
+    poff = n->s->off - HISTROWS(n); /* screen row at the top, < 0 when
+				     * saved lines are shown */
+    rows = MIN(winPtr->height - 2*offset, n->s->rows - poff);
+    first = MAX(0, MIN(-poff, rows));
+
+    /* save cursor position and attributes */
+    getyx(winPtr->window, y, x);
+    wattr_get(winPtr->window, &attr, &pair, NULL);
+    wattr_set(winPtr->window, A_NORMAL, 0, NULL);
 
-/* 
- *--------------------------------------------------------------------------
- * CBT - Cursor Backwards Tab
- *--------------------------------------------------------------------------
- */
-HANDLER(cbt) { 
-  for (int i = x - 1; i < n->ntabs && i >= 0; i--) {
-    if (n->tabs[i]) {
-      wmove(win, py, i);
-      fixcursor(n);
-      return;
-    }
-  }
-  wmove(win, py, 0);
-  fixcursor(n);
-  ENDHANDLER;
-}
+    if ( all ) {
+      for (i = 0; i < first; i++) {
+	int seg, line = vthistfind(n, n->s->off + i, &seg);
 
-/* 
- *--------------------------------------------------------------------------
- * HT - Horizontal Tab
- *--------------------------------------------------------------------------
- */
-HANDLER(ht) { 
-  for (int i = x + 1; i < n->w && i < n->ntabs; i++) {
-    if (n->tabs[i]) {
-      wmove(win, py, i);
-      fixcursor(n);
-      return;
+	histdraw(n, line, seg, winPtr,
+		 offset + i, offset, winPtr->width - 2*offset);
+	markmatch(n, line, seg, winPtr->window,
+		  offset + i, offset, winPtr->width - 2*offset);
+      }
     }
-  }
-  wmove(win, py, mx - 1);
-  fixcursor(n);
-  ENDHANDLER;
-}
 
-/* 
- *--------------------------------------------------------------------------
- * Tab forwards or backwards
- *--------------------------------------------------------------------------
- */
-HANDLER(tab) {
-  for (int i = 0; i < P1(0); i++) {
-    switch (w) {
-    case L'I':  CALL(ht);  break;
-    case L'\t': CALL(ht);  break;
-    case L'Z':  CALL(cbt); break;
+    /*
+     * The terminal handlers mark the rows they write, clear or
+     * scroll, only those are drawn again.
+     */
+    for (i = first; i < rows; i++) {
+      if (all || n->s->dirty[poff + i]) {
+	rowdraw(n, poff + i, winPtr,
+		offset + i, offset, winPtr->width - 2*offset);
+	markmatch(n, HISTLINES(n) + poff + i, 0, winPtr->window,
+		  offset + i, offset, winPtr->width - 2*offset);
+	n->s->dirty[poff + i] = false;
+      }
     }
-  }
-  ENDHANDLER;
-}
 
-/* 
- *--------------------------------------------------------------------------
- * DECALN - Screen Alignment Test
- *--------------------------------------------------------------------------
- */
-HANDLER(decaln) { 
-  chtype e[] = {COLOR_PAIR(0) | 'E', 0};
-  for (int r = 0; r < my; r++) {
-    for (int c = 0; c <= mx; c++) {
-      mvwaddchnstr(win, tos + r, c, e, 1);
+    /*
+    Ck_SetWindowAttr(winPtr, COLOR_RED, COLOR_BLACK, A_NORMAL);
+    if ( terminalPtr->flags & MODE_COMMAND ) {
+      mvwprintw( winPtr->window, 0, winPtr->width - 7, "COMMAND" );
     }
-  }
-  wmove(win, py, px);
-  fixcursor(n);
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * SU - Scroll Up/Down
- *--------------------------------------------------------------------------
- */
-HANDLER(su) {
-  wscrl(win, (w == L'T' || w == L'^')? -P1(0) : P1(0));
-  fixcursor(n);
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * SC - Save Cursor
- *--------------------------------------------------------------------------
- */
-HANDLER(sc) {
-  s->sx = px;                              /* save X position            */
-  s->sy = py;                              /* save Y position            */
-  wattr_get(win, &s->sattr, &s->sp, NULL); /* save attrs and color pair  */
-  s->sfg = s->fg;                          /* save foreground color      */
-  s->sbg = s->bg;                          /* save background color      */
-  s->oxenl = s->xenl;                      /* save xenl state            */
-  s->saved = true;                         /* save data is valid         */
-  n->sgc = n->gc; n->sgs = n->gs;          /* save character sets        */
-  ENDHANDLER;
-}
+    else {
+      mvwprintw( winPtr->window, 0, winPtr->width - 6, "NORMAL" );
+    }
+    */
 
-/* 
- *--------------------------------------------------------------------------
- * RC - Restore Cursor
- *--------------------------------------------------------------------------
- */
-HANDLER(rc) { 
-  if (iw == L'#'){
-    CALL(decaln);
-    return;
+    
+    /* restore cursor position and attributes */
+    wattr_set(winPtr->window, attr, pair, NULL);
+    wmove(winPtr->window, y, x);
   }
-  if (!s->saved)
-    return;
-  wmove(win, s->sy, s->sx);                /* get old position          */
-  wattr_set(win, s->sattr, s->sp, NULL);   /* get attrs and color pair  */
-  s->fg = s->sfg;                          /* get foreground color      */
-  s->bg = s->sbg;                          /* get background color      */
-  s->xenl = s->oxenl;                      /* get xenl state            */
-  n->gc = n->sgc; n->gs = n->sgs;          /* save character sets        */
-
-  /* restore colors */
-  int cp = Ck_GetPair(term->winPtr, s->fg, s->bg); cp = PAIR_NUMBER(cp);
-  wcolor_set(win, cp, NULL);
-  cchar_t c;
-  setcchar(&c, L" ", A_NORMAL, cp, NULL);
-  wbkgrndset(win, &c);
-
-  fixcursor(n);
-  ENDHANDLER;
 }
 
-/* 
- *--------------------------------------------------------------------------
- * TBC - Tabulation Clear
- *--------------------------------------------------------------------------
- */
-HANDLER(tbc) {
-  switch (P0(0)){
-  case 0: n->tabs[x < n->ntabs? x : 0] = false;          break;
-  case 3: memset(n->tabs, 0, sizeof(bool) * (n->ntabs)); break;
-  }
-  ENDHANDLER;
+static void
+scrollback(NODE *n)
+{
+  n->s->off = MAX(0, n->s->off - n->h / 2);
+  Tk_DoWhenIdle(TerminalYScrollCommand, n->clientData);
 }
 
-/* 
- *--------------------------------------------------------------------------
- * CUB - Cursor Backward
- *--------------------------------------------------------------------------
- */
-HANDLER(cub) { 
-  s->xenl = false;
-  wmove(win, py, MAX(x - P1(0), 0));
-  fixcursor(n);
-  ENDHANDLER;
+static void
+scrollforward(NODE *n)
+{
+  n->s->off = MIN(HISTROWS(n), n->s->off + n->h / 2);
+  Tk_DoWhenIdle(TerminalYScrollCommand, n->clientData);
 }
 
-/* 
- *--------------------------------------------------------------------------
- * EL - Erase in Line
- *--------------------------------------------------------------------------
- */
-HANDLER(el) {
-  cchar_t b;
-  int p = Ck_GetPair(term->winPtr, s->fg, s->bg); p = PAIR_NUMBER(p);
-  setcchar(&b, L" ", A_NORMAL, p, NULL);
-  switch (P0(0)){
-  case 0: wclrtoeol(win);                                                 break;
-  case 1: for (int i = 0; i <= x; i++) mvwadd_wchnstr(win, py, i, &b, 1); break;
-  case 2: wmove(win, py, 0); wclrtoeol(win);                              break;
-  }
-  wmove(win, py, x);
-  fixcursor(n);
-  ENDHANDLER;
+static void
+scrollbackx(NODE *n, int nl)
+{
+  n->s->off = MAX(0, n->s->off - nl);
+  Tk_DoWhenIdle(TerminalYScrollCommand, n->clientData);
 }
 
-/* 
- *--------------------------------------------------------------------------
- * ED - Erase in Display
- *--------------------------------------------------------------------------
- */
-HANDLER(ed) { 
-  int o = 1;
-  switch (P0(0)){
-  case 0: wclrtobot(win);                     break;
-  case 3: werase(win);                        break;
-  case 2: wmove(win, tos, 0); wclrtobot(win); break;
-  case 1:
-    for (int i = tos; i < py; i++){
-      wmove(win, i, 0);
-      wclrtoeol(win);
-    }
-    wmove(win, py, x);
-    el(v, p, w, iw, 1, &o, NULL);
-    break;
-  }
-  wmove(win, py, px);
-  fixcursor(n);
-  ENDHANDLER;
+static void
+scrollforwardx(NODE *n, int nl)
+{
+  n->s->off = MIN(HISTROWS(n), n->s->off + nl);
+  Tk_DoWhenIdle(TerminalYScrollCommand, n->clientData);
 }
 
-/* 
- *--------------------------------------------------------------------------
- * ECH - Erase Character
- *--------------------------------------------------------------------------
- */
-HANDLER(ech) {
-  cchar_t c;
-  int p = Ck_GetPair(term->winPtr, s->fg, s->bg); p = PAIR_NUMBER(p);
-  setcchar(&c, L" ", A_NORMAL, p, NULL);
-  for (int i = 0; i < P1(0); i++)
-    mvwadd_wchnstr(win, py, x + i, &c, 1);
-  wmove(win, py, px);
-  fixcursor(n);
-  ENDHANDLER;
+static void
+scrollbottom(NODE *n)
+{
+  n->s->off = HISTROWS(n);
+  Tk_DoWhenIdle(TerminalYScrollCommand, n->clientData);
 }
 
-/* 
- *--------------------------------------------------------------------------
- * DSR - Device Status Report
- *--------------------------------------------------------------------------
- */
-HANDLER(dsr) { 
-  char buf[100] = {0};
-  if (P0(0) == 6)
-    snprintf(buf, sizeof(buf) - 1, "\033[%d;%dR",
-	     (n->decom? y - top : y) + 1, x + 1);
-  else
-    snprintf(buf, sizeof(buf) - 1, "\033[0n");
-  SEND(n, buf);
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * IL or DL - Insert/Delete Line
- *--------------------------------------------------------------------------
- */
-HANDLER(idl) { 
-  /* we don't use insdelln here because it inserts above and not below,
-   * and has a few other edge cases... */
-  int otop = 0, obot = 0, p1 = MIN(P1(0), (my - 1) - y);
-  wgetscrreg(win, &otop, &obot);
-  wsetscrreg(win, py, obot);
-  wscrl(win, w == L'L'? -p1 : p1);
-  wsetscrreg(win, otop, obot);
-  wmove(win, py, 0);
-  fixcursor(n);
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * CSR - Change Scrolling Region
- *--------------------------------------------------------------------------
- */
-HANDLER(csr) {
-  if (wsetscrreg(win, tos + P1(0) - 1, tos + PD(1, my) - 1) == OK)
-    CALL(cup);
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * DECREQTPARM - Request Device Parameters
- *--------------------------------------------------------------------------
- */
-HANDLER(decreqtparm) {
-  SEND(n, P0(0)? "\033[3;1;2;120;1;0x" : "\033[2;1;2;120;128;1;0x");
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * Reset SGR to default
- *--------------------------------------------------------------------------
- */
-HANDLER(sgr0) {
-  //#if 0
-  wattrset(win, A_NORMAL);
-  wcolor_set(win, 0, NULL);
-  s->fg = s->bg = -1;
-  wbkgdset(win, COLOR_PAIR(0) | ' ');
-  //#endif
-
-#if 0
-  //@vca : try to tune background
-  int p;
-  wattrset(win, A_NORMAL);
-  p = Ck_GetPair(term->winPtr, s->wfg, s->wbg); p = PAIR_NUMBER(p);
-  wcolor_set(win, p, NULL);
-  wbkgdset(win, COLOR_PAIR(p) | ' ' );
-  s->fg = s->bg = -1;
-#endif
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * Clear screen
- *--------------------------------------------------------------------------
- */
-HANDLER(cls) { 
-  CALL(cup);
-  wclrtobot(win);
-  CALL(cup);
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * RIS - Reset to Initial State
- *--------------------------------------------------------------------------
- */
-HANDLER(ris) {
-  n->gs = n->gc = n->g0 = CSET_US; n->g1 = CSET_GRAPH;
-  n->g2 = CSET_US; n->g3 = CSET_GRAPH;
-  n->decom = s->insert = s->oxenl = s->xenl = n->lnm = false;
-  CALL(sgr0);
-  CALL(cls);
-  n->am = n->pnm = true;
-  n->pri.vis = n->alt.vis = 1;
-  n->s = &n->pri;
-  wsetscrreg(n->pri.win, 0, MAX(term->scrollback, n->h) - 1);
-  wsetscrreg(n->alt.win, 0, n->h - 1);
-  for (int i = 0; i < n->ntabs; i++)
-    n->tabs[i] = (i % 8 == 0);
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * Set or Reset Mode
- *--------------------------------------------------------------------------
- */
-HANDLER(mode) {
-  bool set = (w == L'h');
-  int flg = 0;
-  for (int i = 0; i < argc; i++) switch (P0(i)){
-    case  1: n->pnm = set;              break;
-    case  3: CALL(cls);                 break;
-    case  4: s->insert = set;           break;
-    case  6: n->decom = set; CALL(cup); break;
-    case  7: n->am = set;               break;
-    case 20: n->lnm = set;              break;
-    case 25: s->vis = set? 1 : 0;       break;
-    case 34: s->vis = set? 1 : 2;       break;
-    case 1000:
-      flg = MOUSE_REPORT_1000; goto doflg;
-    case 1001:
-      /* @vca: unsupported */
-      break;
-    case 1002:
-      flg = MOUSE_REPORT_1002; goto doflg;
-    case 1003:
-      flg = MOUSE_REPORT_1003;
-    doflg:
-      if (set) {
-	term->flags |= flg;
-      }
-      else {
-	term->flags &= ~flg;
-      }
-      break;
-    case 1048: CALL((set? sc : rc));    break;
-    case 1049:
-      CALL((set? sc : rc)); /* fall-through */
-    case 47: case 1047: if (set && n->s != &n->alt){
-	n->s = &n->alt;
-	CALL(cls);
-      } else if (!set && n->s != &n->pri)
-	n->s = &n->pri;
-      break;
-    }
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * SGR - Select Graphic Rendition
- * @todo a reprendre car change le background de la fenetre
- *       ce nest pas ce quil faut faire
- *--------------------------------------------------------------------------
- */
-HANDLER(sgr) {
-  bool doc = false, do8 = COLORS >= 8, do16 = COLORS >= 16, do256 = COLORS >= 256;
-  if (!argc)
-    CALL(sgr0);
-
-  short bg = s->bg, fg = s->fg;
-  
-  for (int i = 0; i < argc; i++) switch (P0(i)){
-    case  0:  CALL(sgr0);                                              break;
-    case  1:  wattron(win,  A_BOLD);                                   break;
-    case  2:  wattron(win,  A_DIM);                                    break;
-    case  4:  wattron(win,  A_UNDERLINE);                              break;
-    case  5:  wattron(win,  A_BLINK);                                  break;
-    case  7:  wattron(win,  A_REVERSE);                                break;
-    case  8:  wattron(win,  A_INVIS);                                  break;
-    case 21:  wattroff(win, A_BOLD);                                   break;
-    case 22:  wattroff(win, A_DIM); wattroff(win, A_BOLD);             break;
-    case 24:  wattroff(win, A_UNDERLINE);                              break;
-    case 25:  wattroff(win, A_BLINK);                                  break;
-    case 27:  wattroff(win, A_REVERSE);                                break;
-    case 30:  fg = COLOR_BLACK;                           doc = do8;   break;
-    case 31:  fg = COLOR_RED;                             doc = do8;   break;
-    case 32:  fg = COLOR_GREEN;                           doc = do8;   break;
-    case 33:  fg = COLOR_YELLOW;                          doc = do8;   break;
-    case 34:  fg = COLOR_BLUE;                            doc = do8;   break;
-    case 35:  fg = COLOR_MAGENTA;                         doc = do8;   break;
-    case 36:  fg = COLOR_CYAN;                            doc = do8;   break;
-    case 37:  fg = COLOR_WHITE;                           doc = do8;   break;
-    case 38:  fg = P0(i+1) == 5? P0(i+2) : s->fg; i += 2; doc = do256; break;
-    case 39:  fg = -1;                                    doc = true;  break;
-    case 40:  bg = COLOR_BLACK;                           doc = do8;   break;
-    case 41:  bg = COLOR_RED;                             doc = do8;   break;
-    case 42:  bg = COLOR_GREEN;                           doc = do8;   break;
-    case 43:  bg = COLOR_YELLOW;                          doc = do8;   break;
-    case 44:  bg = COLOR_BLUE;                            doc = do8;   break;
-    case 45:  bg = COLOR_MAGENTA;                         doc = do8;   break;
-    case 46:  bg = COLOR_CYAN;                            doc = do8;   break;
-    case 47:  bg = COLOR_WHITE;                           doc = do8;   break;
-    case 48:  bg = P0(i+1) == 5? P0(i+2) : s->bg; i += 2; doc = do256; break;
-    case 49:  bg = -1;                                    doc = true;  break;
-    case 90:  fg = COLOR_BLACK;                           doc = do16;  break;
-    case 91:  fg = COLOR_RED;                             doc = do16;  break;
-    case 92:  fg = COLOR_GREEN;                           doc = do16;  break;
-    case 93:  fg = COLOR_YELLOW;                          doc = do16;  break;
-    case 94:  fg = COLOR_BLUE;                            doc = do16;  break;
-    case 95:  fg = COLOR_MAGENTA;                         doc = do16;  break;
-    case 96:  fg = COLOR_CYAN;                            doc = do16;  break;
-    case 97:  fg = COLOR_WHITE;                           doc = do16;  break;
-    case 100: bg = COLOR_BLACK;                           doc = do16;  break;
-    case 101: bg = COLOR_RED;                             doc = do16;  break;
-    case 102: bg = COLOR_GREEN;                           doc = do16;  break;
-    case 103: bg = COLOR_YELLOW;                          doc = do16;  break;
-    case 104: bg = COLOR_BLUE;                            doc = do16;  break;
-    case 105: bg = COLOR_MAGENTA;                         doc = do16;  break;
-    case 106: bg = COLOR_CYAN;                            doc = do16;  break;
-    case 107: bg = COLOR_WHITE;                           doc = do16;  break;
-#if defined(A_ITALIC) && !defined(NO_ITALICS )
-    case  3:  wattron(win,  A_ITALIC);                    break;
-    case 23:  wattroff(win, A_ITALIC);                    break;
-#endif
-    }
-  if (doc){
-    int p = Ck_GetPair(term->winPtr, s->fg = fg, s->bg = bg); p = PAIR_NUMBER(p);
-    wcolor_set(win, p, NULL);
-    cchar_t c;
-    setcchar(&c, L" ", A_NORMAL, p, NULL);
-    wbkgrndset(win, &c);
-  }
-#if 0
-  if (doc) {
-    attr_t attr; short pair;
-    wattr_get(win, &attr, &pair, NULL);
-    pair = Ck_GetPair(term->winPtr, s->fg = fg, s->bg = bg);
-    wattrset(win, attr | pair);
-    pair = PAIR_NUMBER(pair);
-    wcolor_set(win, pair, NULL);
-  }
-#endif
-}}
-
-/* 
- *--------------------------------------------------------------------------
- * CR - Carriage Return
- *--------------------------------------------------------------------------
- */
-HANDLER(cr) { 
-  s->xenl = false;
-  wmove(win, py, 0);
-  fixcursor(n);
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * IND - Index
- *--------------------------------------------------------------------------
- */
-HANDLER(ind) { 
-  y == (bot - 1)? scroll(win) : wmove(win, py + 1, x);
-  fixcursor(n);
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * NEL - Next Line
- *--------------------------------------------------------------------------
- */
-HANDLER(nel) { 
-  CALL(cr); CALL(ind);
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * NL - Newline
- *--------------------------------------------------------------------------
- */
-HANDLER(pnl) { 
-  CALL((n->lnm? nel : ind));
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * CPL - Cursor Previous Line
- *--------------------------------------------------------------------------
- */
-HANDLER(cpl) { 
-  wmove(win, MAX(tos + top, py - P1(0)), 0);
-  fixcursor(n);
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * CNL - Cursor Next Line
- *--------------------------------------------------------------------------
- */
-HANDLER(cnl) { 
-  wmove(win, MIN(tos + bot - 1, py + P1(0)), 0);
-  fixcursor(n);
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * Print a character to the terminal
- *--------------------------------------------------------------------------
- */
-HANDLER(print) { 
-  if (wcwidth(w) < 0)
-    return;
-
-  if (s->insert)
-    CALL(ich);
-
-  if (s->xenl){
-    s->xenl = false;
-    if (n->am)
-      CALL(nel);
-    getyx(win, y, x);
-    y -= tos;
-  }
-
-  if (w < MAXMAP && n->gc[w])
-    w = n->gc[w];
-  n->repc = w;
-
-  if (x == mx - wcwidth(w)){
-    s->xenl = true;
-    wins_nwstr(win, &w, 1);
-  } else {
-    waddnwstr(win, &w, 1);
-  }
-  n->gc = n->gs;
-  fixcursor(n);
-}} /* no ENDHANDLER because we don't want to reset repc */
-
-/* 
- *--------------------------------------------------------------------------
- * REP - Repeat Character
- *--------------------------------------------------------------------------
- */
-HANDLER(rep) { 
-  for (int i = 0; i < P1(0) && n->repc; i++)
-    print(v, p, n->repc, 0, 0, NULL, NULL);
-  fixcursor(n);
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * Select Character Set
- *--------------------------------------------------------------------------
- */
-HANDLER(scs) { 
-  wchar_t **t = NULL;
-  switch (iw){
-  case L'(': t = &n->g0;  break;
-  case L')': t = &n->g1;  break;
-  case L'*': t = &n->g2;  break;
-  case L'+': t = &n->g3;  break;
-  default: return;        break;
-  }
-  switch (w){
-  case L'A': *t = CSET_UK;    break;
-  case L'B': *t = CSET_US;    break;
-  case L'0': *t = CSET_GRAPH; break;
-  case L'1': *t = CSET_US;    break;
-  case L'2': *t = CSET_GRAPH; break;
-  }
-
-  //@vca: When TERM=xterm or similar terminal
-  //      ncurses doesn't sent ShiftIn control sequence
-  //      to switch to alternate charset but only sends
-  //      iw='(' w='0' to ask for rendering acs.
-  //      These characters are needed for example by ckBorder.c
-  //      to draw nice looking borders.
-  //      The code below tries to cope with xterm
-  if ( (iw == L'(') && (w == L'0') ) {
-    n->gs = n->gc = n->g1; /* locking shift */;
-  }
-  if ( (iw == L'(') && (w == L'B') ) {
-    n->gs = n->gc = n->g0; /* locking shift */;
-  }
-  
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * Switch Out/In Character Set
- *--------------------------------------------------------------------------
- */
-HANDLER(so) { 
-  if (w == 0x0e)
-    n->gs = n->gc = n->g1; /* locking shift */
-  else if (w == 0xf)
-    n->gs = n->gc = n->g0; /* locking shift */
-  else if (w == L'n')
-    n->gs = n->gc = n->g2; /* locking shift */
-  else if (w == L'o')
-    n->gs = n->gc = n->g3; /* locking shift */
-  else if (w == L'N'){
-    n->gs = n->gc; /* non-locking shift */
-    n->gc = n->g2;
-  } else if (w == L'O'){
-    n->gs = n->gc; /* non-locking shift */
-    n->gc = n->g3;
-  }
-  ENDHANDLER;
-}
-
-/* 
- *--------------------------------------------------------------------------
- * 
- *--------------------------------------------------------------------------
- */
-static void
-setupevents(NODE *n)
-{
-  n->vp.p = n;
-  vtonevent(&n->vp, VTPARSER_CONTROL, 0x05, ack);
-  vtonevent(&n->vp, VTPARSER_CONTROL, 0x07, bell);
-  vtonevent(&n->vp, VTPARSER_CONTROL, 0x08, cub);
-  vtonevent(&n->vp, VTPARSER_CONTROL, 0x09, tab);
-  vtonevent(&n->vp, VTPARSER_CONTROL, 0x0a, pnl);
-  vtonevent(&n->vp, VTPARSER_CONTROL, 0x0b, pnl);
-  vtonevent(&n->vp, VTPARSER_CONTROL, 0x0c, pnl);
-  vtonevent(&n->vp, VTPARSER_CONTROL, 0x0d, cr);
-  vtonevent(&n->vp, VTPARSER_CONTROL, 0x0e, so);
-  vtonevent(&n->vp, VTPARSER_CONTROL, 0x0f, so);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'A', cuu);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'B', cud);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'C', cuf);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'D', cub);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'E', cnl);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'F', cpl);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'G', hpa);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'H', cup);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'I', tab);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'J', ed);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'K', el);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'L', idl);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'M', idl);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'P', dch);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'S', su);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'T', su);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'X', ech);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'Z', tab);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'`', hpa);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'^', su);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'@', ich);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'a', hpr);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'b', rep);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'c', decid);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'd', vpa);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'e', vpr);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'f', cup);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'g', tbc);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'h', mode);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'l', mode);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'm', sgr);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'n', dsr);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'r', csr);
-  vtonevent(&n->vp, VTPARSER_CSI,     L's', sc);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'u', rc);
-  vtonevent(&n->vp, VTPARSER_CSI,     L'x', decreqtparm);
-  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'0', scs);
-  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'1', scs);
-  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'2', scs);
-  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'7', sc);
-  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'8', rc);
-  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'A', scs);
-  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'B', scs);
-  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'D', ind);
-  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'E', nel);
-  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'H', hts);
-  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'M', ri);
-  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'Z', decid);
-  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'c', ris);
-  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'p', vis);
-  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'=', numkp);
-  vtonevent(&n->vp, VTPARSER_ESCAPE,  L'>', numkp);
-  vtonevent(&n->vp, VTPARSER_PRINT,   0,    print);
-}
-
-/*** MTM FUNCTIONS
- * These functions do the user-visible work of MTM: creating nodes in the
- * tree, updating the display, and so on.
- */
-static bool *
-newtabs(int w, int ow, bool *oldtabs) /* Initialize default tabstops. */
-{
-  bool *tabs = calloc(w, sizeof(bool));
-  if (!tabs)
-    return NULL;
-  for (int i = 0; i < w; i++) /* keep old overlapping tabs */
-    tabs[i] = i < ow? oldtabs[i] : (i % 8 == 0);
-  return tabs;
-}
-
-static NODE *
-newnode(int h, int w) /* Create a new node. */
-{
-  NODE *n = calloc(1, sizeof(NODE));
-  bool *tabs = newtabs(w, 0, NULL);
-  if (!n || h < 2 || w < 2 || !tabs) {
-    return free(n), free(tabs), NULL;
-  }
-
-  n->pt = -1;
-  n->h = h;
-  n->w = w;
-  n->tabs = tabs;
-  n->ntabs = w;
-
-  n->clientData = NULL;
-  memset(n->iobuf, 0, sizeof(n->iobuf));
-  
-  return n;
-}
-
-static void
-freenode(NODE *n) /* Free a node. */
-{
-  if (n){
-    if (n->pri.win)
-      delwin(n->pri.win);
-    if (n->alt.win)
-      delwin(n->alt.win);
-    if (n->pt >= 0){
-      close(n->pt);
-    }
-    free(n->tabs);
-    free(n);
-  }
-}
-
-static void
-fixcursor(NODE *n) /* Move the terminal cursor to the active view. */
-{
-  Terminal *terminalPtr = (Terminal*) n->clientData;
-  int y, x;
-  
-  getyx(n->s->win, y, x);
-  y = MIN(MAX(y, n->s->tos), n->s->tos + n->h - 1);
-  wmove(n->s->win, y, x);
-
-  if ( (terminalPtr != NULL) && (terminalPtr->winPtr->window != NULL) ) {
-    int offset = (terminalPtr->borderPtr != NULL) ? 1 : 0;
-    wmove(terminalPtr->winPtr->window, y - n->s->tos + offset, x + offset);
-    if (n->s->off != n->s->tos? 0 : n->s->vis) {
-      terminalPtr->winPtr->flags |= CK_SHOW_CURSOR;
-    }
-    else {
-      terminalPtr->winPtr->flags &= ~CK_SHOW_CURSOR;
-    }
-  }
-}
-
-static NODE *
-newview(Terminal *term, int scrollback, int h, int w, int fg, int bg) /* Open a new view. */
-{
-  struct winsize ws = {.ws_row = h, .ws_col = w};
-  NODE *n = newnode(h, w);
-  if (!n) {
-    return NULL;
-  }
-  n->clientData = term;
-
-  SCRN *pri = &n->pri, *alt = &n->alt;
-  pri->win = newpad(MAX(h, scrollback), w);
-  alt->win = newpad(h, w);
-  if (!pri->win || !alt->win) {
-    return freenode(n), NULL;
-  }
-  pri->tos = pri->off = MAX(0, scrollback - h);
-  n->s = pri;
-
-  pri->wfg = alt->wfg = fg;
-  pri->wbg = alt->wbg = bg;
-
-  nodelay(pri->win, TRUE); nodelay(alt->win, TRUE);
-  scrollok(pri->win, TRUE); scrollok(alt->win, TRUE);
-  keypad(pri->win, TRUE); keypad(alt->win, TRUE);
-
-  setupevents(n);
-  ris(&n->vp, n, L'c', 0, 0, NULL, NULL);
-
-  /* insert banner text in window */
-  if ( term->flags & DISPLAY_BANNER && term->banner != NULL ) {
-    term->flags &= ~DISPLAY_BANNER;
-    vtwrite(&n->vp, term->banner, strlen(term->banner));
-  }
-  
-  pid_t pid = forkpty(&n->pt, NULL, NULL, &ws);
-  if (pid < 0) {
-    // @todo: Tk like error handling to do
-    perror("forkpty");
-    return freenode(n), NULL;
-    
-  } else if (pid == 0) {
-    char *argv[term->nexec + 1];
-    char buf[100] = {0};
-    snprintf(buf, sizeof(buf) - 1, "%lu", (unsigned long)getppid());
-    setsid();
-    setenv("MTM", buf, 1);
-
-    if ( term->term == NULL ) {
-      int res;
-      res = TermParseProc( NULL, term->interp, term->winPtr,
-			   NULL, (char*) term, Ck_Offset(Terminal, attr) );
-    }
-    
-    setenv("TERM", term->term, 1);
-    signal(SIGCHLD, SIG_DFL);
-    memcpy( argv, term->aexec, term->nexec * sizeof(char*));
-    argv[term->nexec] = NULL;
-    execv( argv[0], argv );
-    return NULL;
-  }
-
-  fcntl(n->pt, F_SETFL, O_NONBLOCK);
-  
-  return n;
-}
-
-static void
-deletenode(NODE *n) /* Delete a node. */
-{
-  freenode(n);
-}
-
-static void
-reshapeview(NODE *n, int d, int ow) /* Reshape a view. */
-{
-  int oy, ox;
-  Terminal *term = (Terminal *) n->clientData;
-  bool *tabs = newtabs(n->w, ow, n->tabs);
-  struct winsize ws = {.ws_row = n->h, .ws_col = n->w};
-
-  if (tabs) {
-    free(n->tabs);
-    n->tabs = tabs;
-    n->ntabs = n->w;
-  }
-
-  getyx(n->s->win, oy, ox);
-  wresize(n->pri.win, MAX(n->h, term->scrollback), MAX(n->w, 2));
-  wresize(n->alt.win, MAX(n->h, 2), MAX(n->w, 2));
-  n->pri.tos = n->pri.off = MAX(0, term->scrollback - n->h);
-  n->alt.tos = n->alt.off = 0;
-  wsetscrreg(n->pri.win, 0, MAX(term->scrollback, n->h) - 1);
-  wsetscrreg(n->alt.win, 0, n->h - 1);
-  if (d > 0) { /* make sure the new top line syncs up after reshape */
-    wmove(n->s->win, oy + d, ox);
-    wscrl(n->s->win, -d);
-  }
-  fixcursor(n);
-  ioctl(n->pt, TIOCSWINSZ, &ws);
-}
-
-
-static void
-reshape(NODE *n, int h, int w) /* Reshape a node. */
-{
-  Terminal *terminalPtr = (Terminal*) n->clientData;
-  if (n->h == h && n->w == w)
-    return;
-
-  int d = n->h - h;
-  int ow = n->w;
-  n->h = MAX(h, 1);
-  n->w = MAX(w, 1);
-
-  reshapeview(n, d, ow);
-  TerminalPostRedisplay(terminalPtr);
-}
-
-static void
-draw(NODE *n) /* Draw a node. */
-{
-  Terminal *terminalPtr = (Terminal*) n->clientData;
-  
-  if ( (terminalPtr != NULL) &&  (terminalPtr->winPtr->window != NULL)) {
-    CkWindow *winPtr = terminalPtr->winPtr;
-    int offset = (terminalPtr->borderPtr != NULL) ? 1 : 0;
-    int y, x;
-
-    /* save cursor position */
-    getyx(winPtr->window, y, x);
-
-    copywin( n->s->win, winPtr->window,
-	     n->s->off, 0, offset, offset, winPtr->height-1-offset, winPtr->width-1-offset, 0);
-
-    /*
-    Ck_SetWindowAttr(winPtr, COLOR_RED, COLOR_BLACK, A_NORMAL);
-    if ( terminalPtr->flags & MODE_COMMAND ) {
-      mvwprintw( winPtr->window, 0, winPtr->width - 7, "COMMAND" );
-    }
-    else {
-      mvwprintw( winPtr->window, 0, winPtr->width - 6, "NORMAL" );
-    }
-    */
-
-    
-    /* restore cursor position */
-    wmove(winPtr->window, y, x);
-  }
-}
-
-static void
-scrollback(NODE *n)
-{
-  n->s->off = MAX(0, n->s->off - n->h / 2);
-  Tk_DoWhenIdle(TerminalYScrollCommand, n->clientData);
-}
-
-static void
-scrollforward(NODE *n)
-{
-  n->s->off = MIN(n->s->tos, n->s->off + n->h / 2);
-  Tk_DoWhenIdle(TerminalYScrollCommand, n->clientData);
-}
-
-static void
-scrollbackx(NODE *n, int nl)
-{
-  n->s->off = MAX(0, n->s->off - nl);
-  Tk_DoWhenIdle(TerminalYScrollCommand, n->clientData);
-}
-
-static void
-scrollforwardx(NODE *n, int nl)
-{
-  n->s->off = MIN(n->s->tos, n->s->off + nl);
-  Tk_DoWhenIdle(TerminalYScrollCommand, n->clientData);
-}
-
-static void
-scrollbottom(NODE *n)
-{
-  n->s->off = n->s->tos;
-  Tk_DoWhenIdle(TerminalYScrollCommand, n->clientData);
-}
-
-static void
-sendarrow(const NODE *n, const char *k)
-{
+static void
+sendarrow(const NODE *n, const char *k)
+{
   char buf[100] = {0};
   snprintf(buf, sizeof(buf) - 1, "\033%s%s", n->pnm? "O" : "[", k);
   SEND(n, buf);
@@ -1845,7 +875,7 @@ handlechar(NODE *n, int r, int k) /* Handle a single input character. */
 #define KERR(i) (r == ERR && (i) == k)
 #define KEY(i)  (r == OK  && (i) == k)
 #define CODE(i) (r == KEY_CODE_YES && (i) == k)
-#define INSCR (n->s->tos != n->s->off)
+#define INSCR (HISTROWS(n) != n->s->off)
 #define SB scrollbottom(n)
 #define DO(s, t, a)						\
   if (s == n->cmd && (t)) { a ; setCommandMode(terminalPtr, false); return true; }
@@ -1956,234 +986,12 @@ handlechar(NODE *n, int r, int k) /* Handle a single input character. */
   return setCommandMode(terminalPtr,false), true;
 }
 
-
-// vtparser.c
-
-/**** DATA TYPES */
-#define MAXACTIONS  128
-
-typedef struct ACTION ACTION;
-struct ACTION {
-  wchar_t lo, hi;
-  void (*cb)(VTPARSER *p, wchar_t w);
-  STATE *next;
-};
-
-struct STATE{
-  void (*entry)(VTPARSER *v);
-  ACTION actions[MAXACTIONS];
-};
-
-/**** GLOBALS */
-static STATE ground, escape, escape_intermediate, csi_entry,
-  csi_ignore, csi_param, csi_intermediate, osc_string;
-
-/**** ACTION FUNCTIONS */
-static void
-reset(VTPARSER *v)
-{
-  v->inter = v->narg = v->nosc = 0;
-  memset(v->args, 0, sizeof(v->args));
-  memset(v->oscbuf, 0, sizeof(v->oscbuf));
-}
-
-static void
-ignore(VTPARSER *v, wchar_t w)
-{
-  (void)v; (void)w; /* avoid warnings */
-}
-
-static void
-collect(VTPARSER *v, wchar_t w)
-{
-  v->inter = v->inter? v->inter : (int)w;
-}
-
-static void
-collectosc(VTPARSER *v, wchar_t w)
-{
-  if (v->nosc < MAXOSC)
-    v->oscbuf[v->nosc++] = w;
-}
-
-static void
-param(VTPARSER *v, wchar_t w)
-{
-  v->narg = v->narg? v->narg : 1;
-
-  if (w == L';')
-    v->args[v->narg++] = 0;
-  else if (v->narg < MAXPARAM && v->args[v->narg - 1] < 9999)
-    v->args[v->narg - 1] = v->args[v->narg - 1] * 10 + (w - 0x30);
-}
-
-#define VTDO(k, t, f, n, a)                             \
-  static void						\
-  do ## k (VTPARSER *v, wchar_t w)			\
-       {						\
-	 if (t)						\
-	   f (v, v->p, w, v->inter, n, a, v->oscbuf);	\
-       }
-
-VTDO(control, w < MAXCALLBACK && v->cons[w], v->cons[w], 0, NULL);
-VTDO(escape,  w < MAXCALLBACK && v->escs[w], v->escs[w], v->inter > 0, &v->inter);
-VTDO(csi,     w < MAXCALLBACK && v->csis[w], v->csis[w], v->narg, v->args);
-VTDO(print,   v->print, v->print, 0, NULL);
-VTDO(osc,     v->osc, v->osc, v->nosc, NULL);
-
-/**** PUBLIC FUNCTIONS */
-VTCALLBACK
-vtonevent(VTPARSER *vp, VtEvent t, wchar_t w, VTCALLBACK cb)
-{
-  VTCALLBACK o = NULL;
-  if (w < MAXCALLBACK) {
-    switch (t) {
-    case VTPARSER_CONTROL: o = vp->cons[w]; vp->cons[w] = cb; break;
-    case VTPARSER_ESCAPE:  o = vp->escs[w]; vp->escs[w] = cb; break;
-    case VTPARSER_CSI:     o = vp->csis[w]; vp->csis[w] = cb; break;
-    case VTPARSER_PRINT:   o = vp->print;   vp->print   = cb; break;
-    case VTPARSER_OSC:     o = vp->osc;     vp->osc     = cb; break;
-    }
-  }
-
-  return o;
-}
-
-static void
-vthandlechar(VTPARSER *vp, wchar_t w)
-{
-  vp->s = vp->s ? vp->s : &ground;
-  for (ACTION *a = vp->s->actions; a->cb; a++) {
-    if (w >= a->lo && w <= a->hi) {
-      a->cb(vp, w);
-      if (a->next) {
-	vp->s = a->next;
-	if (a->next->entry) {
-	  a->next->entry(vp);
-	}
-      }
-      return;
-    }
-  }
-}
-
-void
-vtwrite(VTPARSER *vp, const char *s, size_t n)
-{
-  wchar_t w = 0;
-  while (n){
-    size_t r = mbrtowc(&w, s, n, &vp->ms);
-    switch (r){
-    case -2: /* incomplete character, try again */
-      return;
-
-    case -1: /* invalid character, skip it */
-      w = VTPARSER_BAD_CHAR;
-      r = 1;
-      break;
-
-    case 0: /* literal zero, write it but advance */
-      r = 1;
-      break;
-    }
-
-    n -= r;
-    s += r;
-    vthandlechar(vp, w);
-  }
-}
-
-/**** STATE DEFINITIONS
- * This was built by consulting the excellent state chart created by
- * Paul Flo Williams: http://vt100.net/emu/dec_ansi_parser
- * Please note that Williams does not (AFAIK) endorse this work.
- */
-#define MAKESTATE(name, onentry, ...)				\
-  static STATE name ={						\
-		      onentry ,					\
-		      {						\
-		       {0x00, 0x00, ignore,    NULL},		\
-		       {0x7f, 0x7f, ignore,    NULL},		\
-		       {0x18, 0x18, docontrol, &ground},	\
-		       {0x1a, 0x1a, docontrol, &ground},	\
-		       {0x1b, 0x1b, ignore,    &escape},	\
-		       {0x01, 0x06, docontrol, NULL},		\
-		       {0x08, 0x17, docontrol, NULL},		\
-		       {0x19, 0x19, docontrol, NULL},		\
-		       {0x1c, 0x1f, docontrol, NULL},		\
-		       __VA_ARGS__ ,				\
-		       {0x07, 0x07, docontrol, NULL},		\
-		       {0x00, 0x00, NULL,      NULL}		\
-		      }						\
-  };
-
-MAKESTATE(ground, NULL,
-	  {0x20, WCHAR_MAX, doprint, NULL}
-	  );
-
-MAKESTATE(escape, reset,
-	  {0x21, 0x21, ignore,   &osc_string},
-	  {0x20, 0x2f, collect,  &escape_intermediate},
-	  {0x30, 0x4f, doescape, &ground},
-	  {0x51, 0x57, doescape, &ground},
-	  {0x59, 0x59, doescape, &ground},
-	  {0x5a, 0x5a, doescape, &ground},
-	  {0x5c, 0x5c, doescape, &ground},
-	  {0x6b, 0x6b, ignore,   &osc_string},
-	  {0x60, 0x7e, doescape, &ground},
-	  {0x5b, 0x5b, ignore,   &csi_entry},
-	  {0x5d, 0x5d, ignore,   &osc_string},
-	  {0x5e, 0x5e, ignore,   &osc_string},
-	  {0x50, 0x50, ignore,   &osc_string},
-	  {0x5f, 0x5f, ignore,   &osc_string}
-	  );
-
-MAKESTATE(escape_intermediate, NULL,
-	  {0x20, 0x2f, collect,  NULL},
-	  {0x30, 0x7e, doescape, &ground}
-	  );
-
-MAKESTATE(csi_entry, reset,
-	  {0x20, 0x2f, collect, &csi_intermediate},
-	  {0x3a, 0x3a, ignore,  &csi_ignore},
-	  {0x30, 0x39, param,   &csi_param},
-	  {0x3b, 0x3b, param,   &csi_param},
-	  {0x3c, 0x3f, collect, &csi_param},
-	  {0x40, 0x7e, docsi,   &ground}
-	  );
-
-MAKESTATE(csi_ignore, NULL,
-	  {0x20, 0x3f, ignore, NULL},
-	  {0x40, 0x7e, ignore, &ground}
-	  );
-
-MAKESTATE(csi_param, NULL,
-	  {0x30, 0x39, param,   NULL},
-	  {0x3b, 0x3b, param,   NULL},
-	  {0x3a, 0x3a, ignore,  &csi_ignore},
-	  {0x3c, 0x3f, ignore,  &csi_ignore},
-	  {0x20, 0x2f, collect, &csi_intermediate},
-	  {0x40, 0x7e, docsi,   &ground}
-	  );
-
-MAKESTATE(csi_intermediate, NULL,
-	  {0x20, 0x2f, collect, NULL},
-	  {0x30, 0x3f, ignore,  &csi_ignore},
-	  {0x40, 0x7e, docsi,   &ground}
-	  );
-
-MAKESTATE(osc_string, reset,
-	  {0x07, 0x07, doosc, &ground},
-	  {0x20, 0x7f, collectosc, NULL}
-	  );
-
-
-
-/*
- * These constants define the update policy of terminal
- */
-#define POLICY_LINE (-1)
-#define POLICY_NONE (0)
+/*
+ * These constants define the update policy of terminal
+ */
+#define POLICY_FRAME (-2)
+#define POLICY_LINE (-1)
+#define POLICY_NONE (0)
 
 
 /*
@@ -2233,13 +1041,34 @@ CkInitTerminal(interp, winPtr, argc, argv)
     terminalPtr->takeFocus = NULL;
     terminalPtr->flags = DISPLAY_BANNER; 
     terminalPtr->node = NULL;
+    terminalPtr->attached = NULL;
+    terminalPtr->ownNode = NULL;
+    terminalPtr->drawnScrn = NULL;
+    terminalPtr->drawnOff = terminalPtr->drawnWidth = terminalPtr->drawnHeight = -1;
+    terminalPtr->drawnLines = 0;
+    terminalPtr->matchLine = -1;
+    terminalPtr->matchStart = terminalPtr->matchEnd = 0;
     terminalPtr->scrollback = 0;
     terminalPtr->yscrollcommand = NULL;
     terminalPtr->redisplayPolicy = POLICY_LINE;
+    terminalPtr->frameInterval = 0;
+    terminalPtr->lastFrame.sec = terminalPtr->lastFrame.usec = 0;
+    terminalPtr->frameTimer = (Tk_TimerToken) NULL;
     terminalPtr->count = 0;
+    terminalPtr->readBudget = 0;
     terminalPtr->exec = NULL;
     terminalPtr->aexec = NULL;
     terminalPtr->tee = NULL;
+    terminalPtr->teeBuffer = 0;
+    terminalPtr->teePolicyUid = NULL;
+    terminalPtr->teeBlock = 1;
+    terminalPtr->teeBytes = terminalPtr->teeDropped = 0;
+    terminalPtr->teeDrops = terminalPtr->teeStalls = 0;
+    terminalPtr->record = NULL;
+    terminalPtr->recordFormat = RECORD_ASCIICAST;
+    terminalPtr->recordNheld = 0;
+    terminalPtr->replay = NULL;
+    terminalPtr->pty = 1;
     terminalPtr->commandkey = NULL;
     terminalPtr->banner = NULL;
 
@@ -2265,7 +1094,7 @@ CkInitTerminal(interp, winPtr, argc, argv)
 	    CK_EV_FOCUSIN | CK_EV_FOCUSOUT,
             TerminalEventProc, (ClientData) terminalPtr);
     Ck_CreateEventHandler(terminalPtr->winPtr,
-            CK_EV_KEYPRESS,
+            CK_EV_KEYPRESS | CK_EV_VIRTUAL,
             TerminalKeyEventProc, (ClientData) terminalPtr);
     Ck_CreateEventHandler(terminalPtr->winPtr,
 	    CK_EV_MOUSE_DOWN | CK_EV_MOUSE_UP | CK_EV_MOUSE_MOVE,
@@ -2396,7 +1225,10 @@ TerminalWidgetCmd(clientData, interp, argc, argv)
     Ck_Preserve((ClientData) terminalPtr);
     c = argv[1][0];
     length = strlen(argv[1]);
-    if ((c == 'b') && (strncmp(argv[1], "bind", length) == 0)) {
+    if ((c == 'a') && (strncmp(argv[1], "attach", length) == 0)) {
+      result = TerminalAttach( terminalPtr, argc, argv);
+    }
+    else if ((c == 'b') && (strncmp(argv[1], "bind", length) == 0)) {
       if (argc == 2) {
 	// @todo: return current binding table
       }
@@ -2430,6 +1262,22 @@ TerminalWidgetCmd(clientData, interp, argc, argv)
                     CK_CONFIG_ARGV_ONLY);
         }
     }
+    else if ((c == 'd') && (strncmp(argv[1], "detach", length) == 0)) {
+      if (argc != 2) {
+	Tcl_AppendResult(interp, "wrong # args: should be \"",
+			 argv[0], " detach\"", (char *) NULL);
+	goto error;
+      }
+      TerminalDetach( terminalPtr);
+    }
+    else if ((c == 'r') && (strncmp(argv[1], "record", length) == 0)
+	&& (length >= 3)) {
+      result = TerminalRecord( terminalPtr, argc, argv);
+    }
+    else if ((c == 'r') && (strncmp(argv[1], "replay", length) == 0)
+	&& (length >= 3)) {
+      result = TerminalReplay( terminalPtr, argc, argv);
+    }
     else if ((c == 's') && (strncmp(argv[1], "scrollback", length) == 0)) {
       if (argc == 2) {
 	if ( terminalPtr->node != NULL ) {
@@ -2474,6 +1322,10 @@ TerminalWidgetCmd(clientData, interp, argc, argv)
 	goto error;
       }
     }
+    else if ((c == 's') && (strncmp(argv[1], "search", length) == 0)
+	&& (length >= 3)) {
+      result = TerminalSearch( terminalPtr, argc, argv);
+    }
     else if ((c == 't') && (strncmp(argv[1], "tee", length) == 0)) {
       return TerminalTee( terminalPtr, argc, argv);
       
@@ -2519,13 +1371,20 @@ DestroyTerminal(clientData)
 {
     Terminal *terminalPtr = (Terminal *) clientData;
 
+    TerminalDetach(terminalPtr);
+    TeeDetach(terminalPtr);
+    RecordStop(terminalPtr);
+    ReplayStop(terminalPtr);
     Ck_FreeOptions(configSpecs, (char *) terminalPtr, 0);
 
     terminalPtr->flags &= ~REDRAW_PENDING;
+    if ( terminalPtr->frameTimer != NULL ) {
+      Tk_DeleteTimerHandler( terminalPtr->frameTimer );
+      terminalPtr->frameTimer = (Tk_TimerToken) NULL;
+    }
     if ( (terminalPtr->flags & DISCONNECTED) == 0 ) {
       if ( terminalPtr->node != NULL ) {
-	Tcl_DeleteFileHandler( terminalPtr->node->pt );
-	close ( terminalPtr->node->pt );
+	vthangup( terminalPtr->node );
       }
       terminalPtr->flags |= DISCONNECTED;
     }
@@ -2541,7 +1400,7 @@ DestroyTerminal(clientData)
     }
 
     if ( terminalPtr->node != NULL ) {
-      deletenode( terminalPtr->node );
+      vtfreenode( terminalPtr->node );
       terminalPtr->node = NULL;
     }
     
@@ -2757,6 +1616,9 @@ RedisplayPolicyPrintProc(clientData, winPtr, widgRec, offset, freeProcPtr)
   case POLICY_LINE:
     strcpy( buffer, "line" );
     break;
+  case POLICY_FRAME:
+    sprintf( buffer, "%dms", terminalPtr->frameInterval );
+    break;
   default:
     sprintf( buffer, "%d", terminalPtr->redisplayPolicy );
     break;
@@ -2795,6 +1657,19 @@ RedisplayPolicyParseProc( clientData, interp, winPtr, value, widgetRec, offset)
   else if ( !strcmp( value, "none" ) ) {
     terminalPtr->redisplayPolicy = POLICY_NONE;
   }
+  else if ( strlen( value ) > 2 && !strcmp( value + strlen( value ) - 2, "ms" ) ) {
+    int interval;
+    char *end;
+
+    interval = strtol( value, &end, 10 );
+    if ( end != value + strlen( value ) - 2 || interval <= 0 || interval > 10000 ) {
+      Tcl_AppendResult( interp, "bad frame interval '", value,
+			"': must be 1ms to 10000ms", NULL );
+      return TCL_ERROR;
+    }
+    terminalPtr->redisplayPolicy = POLICY_FRAME;
+    terminalPtr->frameInterval = interval;
+  }
   else {
     int policy;
     if ( TCL_OK != Tcl_GetInt( interp, value, &policy )) {
@@ -2841,10 +1716,43 @@ ConfigureTerminal(interp, terminalPtr, argc, argv, flags)
      char **argv;                /* Arguments. */
      int flags;                  /* Flags to pass to Tk_ConfigureWidget. */
 {
+    size_t length;
+    int readBudget = terminalPtr->readBudget;
+
     if (Ck_ConfigureWidget(interp, terminalPtr->winPtr, configSpecs,
             argc, argv, (char *) terminalPtr, flags) != TCL_OK) {
         return TCL_ERROR;
     }
+    if (terminalPtr->readBudget <= 0) {
+        char buf[TCL_INTEGER_SPACE];
+
+        sprintf(buf, "%d", terminalPtr->readBudget);
+        Tcl_AppendResult(interp, "bad read budget \"", buf,
+                "\": must be positive", (char *) NULL);
+        terminalPtr->readBudget = readBudget;
+        return TCL_ERROR;
+    }
+
+    length = strlen(terminalPtr->teePolicyUid);
+    if ((length > 0)
+	&& (strncmp(terminalPtr->teePolicyUid, "block", length) == 0)) {
+	terminalPtr->teeBlock = 1;
+    } else if ((length > 0)
+	&& (strncmp(terminalPtr->teePolicyUid, "drop", length) == 0)) {
+	terminalPtr->teeBlock = 0;
+    } else {
+	Tcl_AppendResult(interp, "bad tee policy \"",
+		terminalPtr->teePolicyUid, "\": must be block or drop",
+		(char *) NULL);
+	return TCL_ERROR;
+    }
+    if ((terminalPtr->flags & TEE_STALLED) && !terminalPtr->teeBlock) {
+	TeeResume(terminalPtr);
+    }
+    if (OWNNODE(terminalPtr) != NULL) {
+	OWNNODE(terminalPtr)->scrollback = terminalPtr->scrollback;
+	OWNNODE(terminalPtr)->budget = terminalPtr->scrollbackBudget;
+    }
 
     Ck_SetWindowAttr(terminalPtr->winPtr, terminalPtr->fg, terminalPtr->bg,
 		     terminalPtr->attr);
@@ -2854,6 +1762,7 @@ ConfigureTerminal(interp, terminalPtr, argc, argv, flags)
     if ((terminalPtr->width > 0) || (terminalPtr->height > 0)) {
         Ck_GeometryRequest(terminalPtr->winPtr, terminalPtr->width, terminalPtr->height);
     }
+    terminalPtr->flags |= REDRAW_ALL;
     if ((terminalPtr->winPtr->flags & CK_MAPPED)
             && !(terminalPtr->flags & REDRAW_PENDING)) {
         Tk_DoWhenIdle(DisplayTerminal, (ClientData) terminalPtr);
@@ -2885,15 +1794,41 @@ DisplayTerminal(clientData)
 {
     Terminal *terminalPtr = (Terminal *) clientData;
     CkWindow *winPtr = terminalPtr->winPtr;
+    NODE *n = terminalPtr->node;
+    int all;
 
     terminalPtr->flags &= ~REDRAW_PENDING;
-    if ((winPtr == NULL) || !(winPtr->flags & CK_MAPPED)) {
+    if ((winPtr == NULL) || !(winPtr->flags & CK_MAPPED) || (n == NULL)) {
         return;
     }
+    vthistrewrap(n);
+
+    /*
+     * Output from the pty only damages rows of the screen, anything
+     * else (scrolling through the buffer, switching screens, resizing,
+     * exposure, configuration) needs a full redraw.
+     */
+    all = (terminalPtr->flags & REDRAW_ALL) || (n->s != terminalPtr->drawnScrn)
+      || (n->s->off - HISTROWS(n) != terminalPtr->drawnOff)
+      || (winPtr->width != terminalPtr->drawnWidth)
+      || (winPtr->height != terminalPtr->drawnHeight);
+    terminalPtr->flags &= ~REDRAW_ALL;
+    terminalPtr->drawnScrn = n->s;
+    terminalPtr->drawnOff = n->s->off - HISTROWS(n);
+    terminalPtr->drawnWidth = winPtr->width;
+    terminalPtr->drawnHeight = winPtr->height;
+    if ( HISTROWS(n) != terminalPtr->drawnLines ) {
+      terminalPtr->drawnLines = HISTROWS(n);
+      if ( terminalPtr->yscrollcommand != NULL ) {
+	Tk_DoWhenIdle( TerminalYScrollCommand, (ClientData) terminalPtr );
+      }
+    }
 
-    Ck_ClearToBot(winPtr, 0, 0);
+    if ( all ) {
+      Ck_ClearToBot(winPtr, 0, 0);
+    }
     
-    if (terminalPtr->borderPtr != NULL) {
+    if (all && terminalPtr->borderPtr != NULL) {
       int y, x, attr;
       
       getyx(winPtr->window, y, x);
@@ -2908,8 +1843,8 @@ DisplayTerminal(clientData)
       wmove(winPtr->window, y, x);
     }
 
-    draw( terminalPtr->node );
-    fixcursor( terminalPtr->node );
+    draw( n, all );
+    vtfixcursor( n );
 
     Ck_EventuallyRefresh(winPtr);
 }
@@ -2939,6 +1874,9 @@ TerminalEventProc(clientData, eventPtr)
 {
     Terminal *terminalPtr = (Terminal *) clientData;
 
+    if (eventPtr->type == CK_EV_EXPOSE || eventPtr->type == CK_EV_MAP) {
+      terminalPtr->flags |= REDRAW_ALL;
+    }
     if ((eventPtr->type == CK_EV_EXPOSE || eventPtr->type == CK_EV_MAP) && terminalPtr->winPtr != NULL &&
         !(terminalPtr->flags & REDRAW_PENDING)) {
       int width  = terminalPtr->winPtr->width;
@@ -2950,16 +1888,10 @@ TerminalEventProc(clientData, eventPtr)
       }
 
       if ( terminalPtr->node == NULL ) {
-	terminalPtr->node =
-	  newview( terminalPtr, terminalPtr->scrollback,
-		   height, width,
-		   terminalPtr->fg, terminalPtr->bg);
-	if (terminalPtr->node == NULL ) {
+	if ( TerminalNewView( terminalPtr, height, width) != TCL_OK ) {
 	  Ck_DestroyWindow(terminalPtr->winPtr);
 	  return;
 	}
-	Tcl_CreateFileHandler( terminalPtr->node->pt, TCL_READABLE, TerminalPtyProc,
-			      (ClientData) terminalPtr);
 
 	terminalPtr->winPtr->flags |= CK_MAPPED;
 	
@@ -2982,7 +1914,7 @@ TerminalEventProc(clientData, eventPtr)
 	
     } else if (eventPtr->type == CK_EV_FOCUSIN || eventPtr->type == CK_EV_FOCUSOUT ) {
       if ( (eventPtr->type == CK_EV_FOCUSIN) && !(terminalPtr->flags & HAS_FOCUS) ) {
-	terminalPtr->flags |= HAS_FOCUS;
+	terminalPtr->flags |= HAS_FOCUS | REDRAW_ALL;
         if (!(terminalPtr->flags & REDRAW_PENDING)) {
 	  Tk_DoWhenIdle(DisplayTerminal, (ClientData) terminalPtr);
 	  terminalPtr->flags |= REDRAW_PENDING;
@@ -2990,6 +1922,7 @@ TerminalEventProc(clientData, eventPtr)
       }
       if ( (eventPtr->type == CK_EV_FOCUSOUT) && (terminalPtr->flags & HAS_FOCUS) ) {
 	terminalPtr->flags &= ~HAS_FOCUS;
+	terminalPtr->flags |= REDRAW_ALL;
         if (!(terminalPtr->flags & REDRAW_PENDING)) {
 	  Tk_DoWhenIdle(DisplayTerminal, (ClientData) terminalPtr);
 	  terminalPtr->flags |= REDRAW_PENDING;
@@ -3025,7 +1958,7 @@ TerminalKeyEventProc(clientData, eventPtr)
 
     /* do not handle more keypress
      * if the terminal is disconnected */
-    if ( (terminalPtr->flags & DISCONNECTED) != 0 ) {
+    if ( HOSTLESS(terminalPtr) ) {
       return;
     }
     
@@ -3040,6 +1973,13 @@ TerminalKeyEventProc(clientData, eventPtr)
         terminalPtr->flags |= REDRAW_PENDING;
       }
     }
+    else if (eventPtr->type == CK_EV_VIRTUAL && eventPtr->virt.detail != NULL
+	     && !strcmp(eventPtr->virt.evtype, "<Paste>")) {
+      /* bracketed paste from the outer terminal: the whole text
+       * is sent to the pty at once */
+      PasteToTerminal(terminalPtr, eventPtr->virt.detail);
+      TerminalPostRedisplay(terminalPtr);
+    }
 }
 
 /*
@@ -3072,12 +2012,12 @@ TerminalMouseEventProc(clientData, eventPtr)
     
     /* do not handle more keypress
      * if the terminal is disconnected */
-    if ( (terminalPtr->flags & DISCONNECTED) != 0 ) {
+    if ( HOSTLESS(terminalPtr) ) {
       return;
     }
 
     /* if the terminal doesn't report mouse skip */
-    if (!(terminalPtr->flags & MOUSE_REPORT)) {
+    if (!(nodePtr->modes & MOUSE_REPORT)) {
       return;
     }
 
@@ -3085,7 +2025,7 @@ TerminalMouseEventProc(clientData, eventPtr)
     if (terminalPtr->flags & MODE_COMMAND) {
       return;
     }
-    if (terminalPtr->node->s->tos != terminalPtr->node->s->off) {
+    if (HISTROWS(terminalPtr->node) != terminalPtr->node->s->off) {
       return;
     }
         
@@ -3108,7 +2048,7 @@ TerminalMouseEventProc(clientData, eventPtr)
     }
 
     
-    if ((terminalPtr->flags == MOUSE_REPORT_1003)) {
+    if ((nodePtr->modes & MOUSE_REPORT_1003) == MOUSE_REPORT_1003) {
       if ( eventPtr->mouse.type == CK_EV_MOUSE_MOVE ) {
 	if ( !eventPtr->mouse.button ) {
 	  snd = 1;
@@ -3118,7 +2058,7 @@ TerminalMouseEventProc(clientData, eventPtr)
       }
     }
 
-    if ((terminalPtr->flags & MOUSE_REPORT_1002)) {
+    if ((nodePtr->modes & MOUSE_REPORT_1002)) {
       if ( eventPtr->mouse.type == CK_EV_MOUSE_MOVE ) {
 	if ( eventPtr->mouse.button ) {
 	  b = 32;
@@ -3127,7 +2067,7 @@ TerminalMouseEventProc(clientData, eventPtr)
       }
     }
     
-    if ((terminalPtr->flags & MOUSE_REPORT_1000)) {
+    if ((nodePtr->modes & MOUSE_REPORT_1000)) {
       if ( eventPtr->mouse.type == CK_EV_MOUSE_DOWN ) {
       encodeButton:
 	snd = 1;
@@ -3180,66 +2120,25 @@ TerminalPtyProc( clientData, flags)
 {
   if ( flags & TCL_READABLE ) {
     Terminal *terminalPtr = (Terminal *) clientData;
-    NODE *nodePtr = terminalPtr->node;
-    ssize_t r;
-    int needupdate = 0;
-    int ocounter = terminalPtr->count;
-    int chunck;
-    
-    r = read( nodePtr->pt, nodePtr->iobuf, sizeof(nodePtr->iobuf));
-    if (r > 0) {
-      
-      /* forward input to tee channel */
-      if ( terminalPtr->tee != NULL ) {
-	int w = Tcl_WriteChars( terminalPtr->tee, nodePtr->iobuf, r);
-	if ( w != r ) {
-	  /* @todo : background error ? */
-	}
-      }
-
-      vtwrite(&nodePtr->vp, nodePtr->iobuf, r);
-      
-      /* update character counter */
-      /* we must be more clever and ignore escape sequences */
-      /* and treat multibytes characters */
-      terminalPtr->count += r;
-      
-      switch( terminalPtr->redisplayPolicy ) {
-      case POLICY_LINE:
-	chunck = terminalPtr->winPtr->width;
-	goto compute;
-      case POLICY_NONE:
-	/* do nothing */
-	break;
-      default:
-	chunck = terminalPtr->redisplayPolicy;
-      compute:
-	/* check if we have read anough bytes to trigger a display update */
-	if ((ocounter / terminalPtr->redisplayPolicy) != (terminalPtr->count / terminalPtr->redisplayPolicy)) {
-	  needupdate = 1;
-	}
-      }
+    NODE *nodePtr = OWNNODE(terminalPtr);
+    size_t len;
+    bool eof;
 
-      /* force a synchronous redisplay */
-      if ( needupdate && (terminalPtr->winPtr->flags & CK_MAPPED)) {
-	DisplayTerminal( terminalPtr );
-	wnoutrefresh( terminalPtr->winPtr->window );
-	doupdate();
+    len = vtptyread( nodePtr,
+		   (size_t) TeeRoom( terminalPtr, terminalPtr->readBudget),
+		   &eof);
 
-	/* cancel pending IDLE call to DisplayTerminal */
-	Tk_CancelIdleCall(DisplayTerminal, (ClientData) terminalPtr);
-      }
-      /* schedule redisplay */
-      else if ( !(terminalPtr->flags & REDRAW_PENDING)) {
-        Tk_DoWhenIdle(DisplayTerminal, (ClientData) terminalPtr);
-        terminalPtr->flags |= REDRAW_PENDING;
-      }
+    /* while an emulator is attached, only keep the screens up to date */
+    if (len > 0 && terminalPtr->attached != NULL) {
+      vtwrite(&nodePtr->vp, nodePtr->iobuf, len);
+    }
+    else if (len > 0) {
+      TerminalOutput( terminalPtr, nodePtr->iobuf, (int) len);
     }
 
     /* disconnection */
-    if (r <= 0 && errno != EINTR && errno != EWOULDBLOCK) {
-      Tcl_DeleteFileHandler( nodePtr->pt );
-      close ( nodePtr->pt );
+    if (eof) {
+      vthangup( nodePtr );
       terminalPtr->flags &= ~REDRAW_PENDING;
       terminalPtr->flags |= DISCONNECTED;
 
@@ -3249,6 +2148,167 @@ TerminalPtyProc( clientData, flags)
   }
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * TerminalOutput --
+ *
+ *      This procedure is invoked with output from the slave program,
+ *      read from the pty or replayed from a recorded session.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The output is copied to the tee channel and recorded, if
+ *      any, then interpreted. The terminal is redisplayed, or a
+ *      redisplay scheduled, according to its redisplay policy.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+TerminalOutput(terminalPtr, buf, len)
+     Terminal *terminalPtr;      /* Info about terminal widget. */
+     char *buf;                  /* Output of the slave program. */
+     int len;                    /* Number of bytes in buf. */
+{
+  NODE *nodePtr = terminalPtr->node;
+  int needupdate = 0;
+  int ocounter = terminalPtr->count;
+  int chunck;
+
+  /* forward input to tee channel */
+  if ( terminalPtr->tee != NULL ) {
+    TeeOutput( terminalPtr, buf, len);
+  }
+  if ( terminalPtr->record != NULL ) {
+    RecordOutput( terminalPtr, buf, len);
+  }
+
+  vtwrite(&nodePtr->vp, buf, len);
+      
+  /* update character counter */
+  /* we must be more clever and ignore escape sequences */
+  /* and treat multibytes characters */
+  terminalPtr->count += len;
+      
+  switch( terminalPtr->redisplayPolicy ) {
+  case POLICY_FRAME:
+    FrameRedisplay( terminalPtr );
+    break;
+  case POLICY_LINE:
+    chunck = terminalPtr->winPtr->width;
+    goto compute;
+  case POLICY_NONE:
+    /* do nothing */
+    break;
+  default:
+    chunck = terminalPtr->redisplayPolicy;
+  compute:
+    if (chunck <= 0) {
+      chunck = 1;
+    }
+    /* check if we have read anough bytes to trigger a display update */
+    if ((ocounter / chunck) != (terminalPtr->count / chunck)) {
+      needupdate = 1;
+    }
+  }
+
+  /* force a synchronous redisplay */
+  if ( needupdate && (terminalPtr->winPtr->flags & CK_MAPPED)) {
+    DisplayTerminal( terminalPtr );
+    Ck_UpdateScreen( terminalPtr->winPtr->mainPtr );
+
+    /* cancel pending IDLE call to DisplayTerminal */
+    Tk_CancelIdleCall(DisplayTerminal, (ClientData) terminalPtr);
+  }
+  /* schedule redisplay */
+  else if ( (terminalPtr->redisplayPolicy != POLICY_FRAME)
+	    && !(terminalPtr->flags & REDRAW_PENDING)) {
+    Tk_DoWhenIdle(DisplayTerminal, (ClientData) terminalPtr);
+    terminalPtr->flags |= REDRAW_PENDING;
+  }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FrameRedisplay --
+ *
+ *      This procedure is invoked after output from the pty has been
+ *      processed when the redisplay policy is a frame interval.
+ *      The screen is updated right away if the last update is
+ *      older than one frame, otherwise an update is scheduled
+ *      at the end of the current frame.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The terminal may be redisplayed, or a timer handler created.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FrameRedisplay(terminalPtr)
+     Terminal *terminalPtr;      /* Info about terminal widget. */
+{
+  Tcl_Time now;
+  long elapsed;
+
+  if ( terminalPtr->frameTimer != NULL ) {
+    /* an update is already due at the end of the frame */
+    return;
+  }
+
+  Tcl_GetTime( &now );
+  elapsed = (now.sec - terminalPtr->lastFrame.sec) * 1000 +
+    (now.usec - terminalPtr->lastFrame.usec) / 1000;
+
+  if ( elapsed >= 0 && elapsed < terminalPtr->frameInterval ) {
+    terminalPtr->frameTimer =
+      Tk_CreateTimerHandler( terminalPtr->frameInterval - elapsed,
+			     FrameTimerProc, (ClientData) terminalPtr );
+  } else {
+    FrameTimerProc( (ClientData) terminalPtr );
+  }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FrameTimerProc --
+ *
+ *      Timer procedure updating the screen at the end of a frame.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The terminal is redisplayed and the screen refreshed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FrameTimerProc(clientData)
+     ClientData clientData;      /* Info about terminal widget. */
+{
+  Terminal *terminalPtr = (Terminal *) clientData;
+
+  terminalPtr->frameTimer = (Tk_TimerToken) NULL;
+  Tcl_GetTime( &terminalPtr->lastFrame );
+  if ( (terminalPtr->winPtr != NULL) && (terminalPtr->winPtr->flags & CK_MAPPED) ) {
+    if ( terminalPtr->flags & REDRAW_PENDING ) {
+      Tk_CancelIdleCall(DisplayTerminal, (ClientData) terminalPtr);
+    }
+    DisplayTerminal( terminalPtr );
+    Ck_UpdateScreen( terminalPtr->winPtr->mainPtr );
+  }
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -3271,7 +2331,7 @@ SendToTerminal(terminalPtr, text)
     Terminal *terminalPtr;      /* Info about terminal widget. */
     char *text;                 /* Texte */
 {
-  if ( (terminalPtr->flags & DISCONNECTED) == 0 ) {
+  if ( !HOSTLESS(terminalPtr) ) {
     int i;
     for (i = 0; text[i]; ++i ) {
       handlechar(terminalPtr->node, OK, text[i]);
@@ -3279,6 +2339,52 @@ SendToTerminal(terminalPtr, text)
   }
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * PasteToTerminal --
+ *
+ *      This procedure sends pasted text to the pty in a single write.
+ *      Newlines are sent as carriage returns, like typed in. If the
+ *      application running in the terminal asked for bracketed paste,
+ *      the text is enclosed in ESC[200~ and ESC[201~.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Data written to the pty, terminal scrolled to the bottom.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PasteToTerminal(terminalPtr, text)
+    Terminal *terminalPtr;      /* Info about terminal widget. */
+    char *text;                 /* Pasted text, UTF-8 */
+{
+  NODE *n = terminalPtr->node;
+  Tcl_DString ds;
+  char *p;
+
+  if ( HOSTLESS(terminalPtr) ) {
+    return;
+  }
+  Tcl_DStringInit(&ds);
+  if ( n->modes & BRACKETED_PASTE ) {
+    Tcl_DStringAppend(&ds, "\033[200~", -1);
+  }
+  for (p = text; *p; ++p) {
+    Tcl_DStringAppend(&ds, (*p == '\n') ? "\r" : p, 1);
+  }
+  if ( n->modes & BRACKETED_PASTE ) {
+    Tcl_DStringAppend(&ds, "\033[201~", -1);
+  }
+  SENDN(n, Tcl_DStringValue(&ds), Tcl_DStringLength(&ds));
+  Tcl_DStringFree(&ds);
+  scrollbottom(n);
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -3300,6 +2406,7 @@ static void
 TerminalPostRedisplay(terminalPtr)
      Terminal *terminalPtr;      /* Info about terminal widget. */
 {
+      terminalPtr->flags |= REDRAW_ALL;
       if ((terminalPtr->winPtr->flags & CK_MAPPED)
             && !(terminalPtr->flags & REDRAW_PENDING)) {
         Tk_DoWhenIdle(DisplayTerminal, (ClientData) terminalPtr);
@@ -3331,6 +2438,7 @@ TerminalYView(terminalPtr, argc, argv)
 {
   struct NODE *nodePtr = terminalPtr->node;
   int offset = 0;
+  int total = HISTROWS(nodePtr) + nodePtr->h;
   char c;
   
   switch(argc) {
@@ -3341,27 +2449,26 @@ TerminalYView(terminalPtr, argc, argv)
       double  limit;
       Tcl_Obj *objv[2];
 
-      limit = (double)(nodePtr->s->off) / (double)(terminalPtr->scrollback);
+      limit = (double)(nodePtr->s->off) / (double)(total);
       objv[0] = Tcl_NewDoubleObj(limit);
-      limit = limit + (double)(nodePtr->h) / (double)(terminalPtr->scrollback);
+      limit = limit + (double)(nodePtr->h) / (double)(total);
       objv[1] = Tcl_NewDoubleObj(limit);
       
       Tcl_SetObjResult( terminalPtr->interp, Tcl_NewListObj(2, objv));
       return TCL_OK;
     }
   case 3:
-    if ( TCL_OK != Tcl_GetInt( terminalPtr->interp, argv[3], &offset) ) {
+    if ( TCL_OK != Tcl_GetInt( terminalPtr->interp, argv[2], &offset) ) {
       return TCL_ERROR;
     }
   moveto:
     /* move offset into allowed range, do not throw an error */
     if ( offset < 0 ) { offset = 0; }
-    if ( offset > terminalPtr->scrollback ) { offset = terminalPtr->scrollback; }
-    if ( offset > nodePtr->s->tos ) { offset = nodePtr->s->tos; }
+    if ( offset > HISTROWS(nodePtr) ) { offset = HISTROWS(nodePtr); }
 
     if ( offset != nodePtr->s->off ) {
       nodePtr->s->off = offset;
-      nodePtr->cmd = (nodePtr->s->off != nodePtr->s->tos);
+      nodePtr->cmd = (nodePtr->s->off != HISTROWS(nodePtr));
       Tk_DoWhenIdle( DisplayTerminal, (ClientData) terminalPtr);
       Tk_DoWhenIdle( TerminalYScrollCommand, (ClientData) terminalPtr );
     }
@@ -3374,7 +2481,7 @@ TerminalYView(terminalPtr, argc, argv)
       if ( TCL_OK != Tcl_GetDouble( terminalPtr->interp, argv[3], &d) ) {
 	return TCL_ERROR;
       }
-      offset = (int) ( d * (double) terminalPtr->scrollback );
+      offset = (int) ( d * (double) total );
     }
     goto moveto;
   case 5:
@@ -3392,6 +2499,7 @@ TerminalYView(terminalPtr, argc, argv)
       if ( !strcmp( argv[4], "pages") ) {
 	offset = offset * nodePtr->h;
       }
+      offset += nodePtr->s->off;
     }
     goto moveto;
   default:
@@ -3425,9 +2533,12 @@ TerminalYView(terminalPtr, argc, argv)
  *      If the command receives the name of a valid TCL channel.
  *      The channel will start receiving all bytes received on the pty.
  *      If another channel was previously connected it gets disconnected,
- *      as "<terminal window> tee {}" does. The channel is not configured
- *      by this command, it must be set to non-blocking binary mode
- *      if required by the client code.
+ *      as "<terminal window> tee {}" does. The channel is set to
+ *      non-blocking mode so that a slow channel doesn't stall the
+ *      terminal, its translation is not changed.
+ *
+ *      "<terminal window> tee stats" returns the counters of the
+ *      bytes written, dropped and of the times reading was stopped.
  *
  * Results:
  *      The name of the channel.
@@ -3465,6 +2576,25 @@ TerminalTee(terminalPtr, argc, argv)
     break;
     
   case 3:
+    if ( !strcmp(argv[2], "stats") ) {
+      /* we are in a call like ".t tee stats" */
+      Tcl_Obj *objv[10];
+
+      objv[0] = Tcl_NewStringObj( "bytes", -1);
+      objv[1] = Tcl_NewWideIntObj( terminalPtr->teeBytes );
+      objv[2] = Tcl_NewStringObj( "dropped", -1);
+      objv[3] = Tcl_NewWideIntObj( terminalPtr->teeDropped );
+      objv[4] = Tcl_NewStringObj( "drops", -1);
+      objv[5] = Tcl_NewIntObj( terminalPtr->teeDrops );
+      objv[6] = Tcl_NewStringObj( "stalls", -1);
+      objv[7] = Tcl_NewIntObj( terminalPtr->teeStalls );
+      objv[8] = Tcl_NewStringObj( "pending", -1);
+      objv[9] = Tcl_NewIntObj( (terminalPtr->tee != NULL) ?
+			       Tcl_OutputBuffered(terminalPtr->tee) : 0 );
+      Tcl_SetObjResult( terminalPtr->interp, Tcl_NewListObj(10, objv));
+      return TCL_OK;
+    }
+
     /* we are in a call like ".t tee {}" or ".t tee chan" */
     channel = Tcl_GetChannel( terminalPtr->interp, argv[2], &mode );
     if ( channel != NULL ) {
@@ -3473,21 +2603,32 @@ TerminalTee(terminalPtr, argc, argv)
 			 argv[2], "\" is not writable", (char *) NULL);
 	return TCL_ERROR;
       }
+      if ( Tcl_SetChannelOption( terminalPtr->interp, channel,
+				 "-blocking", "0") != TCL_OK ) {
+	return TCL_ERROR;
+      }
 
+      TeeDetach( terminalPtr );
       terminalPtr->tee = channel;
+      Tcl_CreateCloseHandler( channel, TeeCloseProc, (ClientData) terminalPtr);
       goto getresult;
     }
     else {
       /* it is not a channel, check if it is the empty list */
       int i;
+      Tcl_ResetResult( terminalPtr->interp );
       for ( i = 0; (argv[2][i]) && isspace(argv[2][i]); ++i );
+      if ( argv[2][i] == '\0' ) {
+	TeeDetach( terminalPtr );
+	goto getresult;
+      }
       if ( argv[2][i] != '{' ) goto noSuchChannel;
       for ( i++;  (argv[2][i]) && isspace(argv[2][i]); ++i );
       if ( argv[2][i] != '}' ) goto noSuchChannel;      
       for ( i++;  (argv[2][i]) && isspace(argv[2][i]); ++i );
       if ( argv[2][i] != '\0' ) goto noSuchChannel;
 
-      terminalPtr->tee = NULL;
+      TeeDetach( terminalPtr );
       goto getresult;
       
     noSuchChannel:
@@ -3500,52 +2641,2033 @@ TerminalTee(terminalPtr, argc, argv)
   default:
     {
       Tcl_AppendResult(terminalPtr->interp, "wrong # args: should be \"",
-		       argv[0], " tee ?channel|{}?\"", (char *) NULL);
+		       argv[0], " tee ?channel|{}|stats?\"", (char *) NULL);
     }
   }
+  return TCL_ERROR;
 }
-
+
 /*
  *----------------------------------------------------------------------
  *
- * TerminalYScrollCommand --
+ * TeeOutput --
  *
- *      This procedure is invoked to evaluate yscrollcommand
+ *      This procedure copies bytes read from the pty to the tee
+ *      channel, without any encoding conversion. The channel is
+ *      non-blocking: output it can't write at once waits in its
+ *      buffers and is written in the background.
+ *
+ *      When the bytes would make more than -teebuffer bytes wait,
+ *      they are dropped under the drop policy. Under the block policy
+ *      reads are limited by TeeRoom so that they fit; bytes that
+ *      don't, e.g. after -teebuffer was lowered, are still written.
+ *      Once the buffer is full, the pty is not read anymore until
+ *      half of the waiting bytes are written, which in turn blocks
+ *      the subprocess.
  *
  * Results:
  *      None.
  *
  * Side effects:
- *      Push idle events to event queue.
+ *      May stop reading the pty.
  *
  *----------------------------------------------------------------------
  */
 
 static void
-TerminalYScrollCommand(clientData)
-     ClientData clientData;
+TeeOutput(terminalPtr, buf, len)
+     Terminal *terminalPtr;      /* Info about terminal widget. */
+     char *buf;                  /* Bytes read from the pty. */
+     int len;                    /* Number of bytes in buf. */
 {
-  Terminal *terminalPtr = (Terminal*) clientData;
-  if ( terminalPtr->yscrollcommand != NULL ) {
-    struct NODE *nodePtr = terminalPtr->node;
-    char stdbl[TCL_DOUBLE_SPACE];
-    Tcl_DString ds;
-    double start, end;
-    char *script;
-    
-    start = (double)(nodePtr->s->off) / (double)(terminalPtr->scrollback);
-    end = start + (double)(nodePtr->h) / (double)(terminalPtr->scrollback);
-
-    Tcl_DStringInit(&ds);
-    Tcl_DStringAppend(&ds, terminalPtr->yscrollcommand, -1 );
-    Tcl_PrintDouble( terminalPtr->interp, start, stdbl);
-    Tcl_DStringAppendElement(&ds, stdbl );
-    Tcl_PrintDouble( terminalPtr->interp, end, stdbl);
-    Tcl_DStringAppendElement(&ds, stdbl );
-
-    script = Tcl_DStringValue(&ds);
-    Tcl_Eval( terminalPtr->interp, script );
+  Tcl_Channel channel = terminalPtr->tee;
+  int limit = terminalPtr->teeBuffer;
+  int full = (limit > 0) && (Tcl_OutputBuffered(channel) + len > limit);
 
-    Tcl_DStringFree(&ds);
+  if ( full && !terminalPtr->teeBlock ) {
+    terminalPtr->teeDropped += len;
+    terminalPtr->teeDrops++;
+    return;
+  }
+  if ( (Tcl_Write( channel, buf, len) < 0) || (Tcl_Flush( channel ) != TCL_OK) ) {
+    terminalPtr->teeDropped += len;
+    terminalPtr->teeDrops++;
+    return;
+  }
+  terminalPtr->teeBytes += len;
+
+  if ( (limit > 0) && terminalPtr->teeBlock
+       && !(terminalPtr->flags & TEE_STALLED)
+       && (full || (Tcl_OutputBuffered(channel) >= limit)) ) {
+    terminalPtr->flags |= TEE_STALLED;
+    terminalPtr->teeStalls++;
+    Tcl_DeleteFileHandler( terminalPtr->node->pt );
+    Tcl_CreateChannelHandler( channel, TCL_WRITABLE, TeeWritableProc,
+			      (ClientData) terminalPtr);
   }
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TeeRoom --
+ *
+ *      This procedure limits a read budget to the bytes the tee
+ *      channel may still take under the block policy, so that what
+ *      is read next does not overflow -teebuffer.
+ *
+ * Results:
+ *      The budget, at least 1.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+TeeRoom(terminalPtr, budget)
+     Terminal *terminalPtr;      /* Info about terminal widget. */
+     int budget;                 /* Bytes that may be read. */
+{
+  int limit = terminalPtr->teeBuffer;
+
+  if ( (terminalPtr->tee != NULL) && terminalPtr->teeBlock && (limit > 0) ) {
+    budget = MIN(budget, limit - Tcl_OutputBuffered(terminalPtr->tee));
+  }
+  return MAX(budget, 1);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TeeWritableProc --
+ *
+ *      This procedure is invoked when the tee channel can be written
+ *      while reading the pty is stopped. Reading starts again once
+ *      the channel has written half of its waiting bytes.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      May read the pty again.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+TeeWritableProc(clientData, mask)
+     ClientData clientData;      /* Info about terminal widget. */
+     int mask;                   /* Not used. */
+{
+  Terminal *terminalPtr = (Terminal *) clientData;
+
+  if ( Tcl_OutputBuffered(terminalPtr->tee) <= terminalPtr->teeBuffer / 2 ) {
+    TeeResume( terminalPtr );
+  }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TeeResume --
+ *
+ *      This procedure reads the pty again after it was stopped
+ *      because the tee channel was full.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The pty file handler is created again.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+TeeResume(terminalPtr)
+     Terminal *terminalPtr;      /* Info about terminal widget. */
+{
+  if ( terminalPtr->flags & TEE_STALLED ) {
+    terminalPtr->flags &= ~TEE_STALLED;
+    Tcl_DeleteChannelHandler( terminalPtr->tee, TeeWritableProc,
+			      (ClientData) terminalPtr);
+    TerminalWatch( terminalPtr );
+  }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TeeDetach --
+ *
+ *      This procedure disconnects the tee channel, if any.
+ *      The channel is not closed.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Reading the pty starts again if it was stopped.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+TeeDetach(terminalPtr)
+     Terminal *terminalPtr;      /* Info about terminal widget. */
+{
+  if ( terminalPtr->tee != NULL ) {
+    TeeResume( terminalPtr );
+    Tcl_DeleteCloseHandler( terminalPtr->tee, TeeCloseProc,
+			    (ClientData) terminalPtr);
+    terminalPtr->tee = NULL;
+  }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TeeCloseProc --
+ *
+ *      This procedure is invoked when the tee channel is closed.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The channel is disconnected from the terminal.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+TeeCloseProc(clientData)
+     ClientData clientData;      /* Info about terminal widget. */
+{
+  TeeDetach( (Terminal *) clientData );
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TerminalRecord --
+ *
+ *      This procedure handles the record widget subcommand.
+ *
+ *      With no arguments it returns the channel the output of the
+ *      slave program is recorded to.
+ *
+ *      With a file name, it starts recording the output to the file,
+ *      as timestamped frames in asciicast v2 format, or in ttyrec
+ *      format with "-format ttyrec". Any previous recording is
+ *      stopped first. With the empty list, it stops recording.
+ *
+ * Results:
+ *      A standard Tcl result.
+ *
+ * Side effects:
+ *      The file is created or truncated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+TerminalRecord(terminalPtr, argc, argv)
+     Terminal *terminalPtr;      /* Info about terminal widget. */
+     int argc;                   /* Number of arguments */
+     char **argv;                /* arguments */
+{
+  Tcl_Interp *interp = terminalPtr->interp;
+  Tcl_Channel channel;
+  int format = RECORD_ASCIICAST;
+  int i = 2;
+
+  if ( (argc > 3) && !strcmp(argv[2], "-format") ) {
+    if ( !strcmp(argv[3], "asciicast") ) {
+      format = RECORD_ASCIICAST;
+    } else if ( !strcmp(argv[3], "ttyrec") ) {
+      format = RECORD_TTYREC;
+    } else {
+      Tcl_AppendResult(interp, "bad format \"", argv[3],
+		       "\": must be asciicast or ttyrec", (char *) NULL);
+      return TCL_ERROR;
+    }
+    i = 4;
+  }
+  if ( argc > i + 1 ) {
+    Tcl_AppendResult(interp, "wrong # args: should be \"",
+		     argv[0], " record ?-format format? ?fileName|{}?\"",
+		     (char *) NULL);
+    return TCL_ERROR;
+  }
+
+  if ( argc == i + 1 ) {
+    RecordStop( terminalPtr );
+    if ( argv[i][0] != '\0' ) {
+      channel = Tcl_OpenFileChannel( interp, argv[i], "w", 0666 );
+      if ( channel == NULL ) {
+	return TCL_ERROR;
+      }
+      Tcl_SetChannelOption( interp, channel, "-translation", "binary");
+      terminalPtr->record = channel;
+      terminalPtr->recordFormat = format;
+      terminalPtr->recordNheld = 0;
+      Tcl_GetTime( &terminalPtr->recordStart );
+
+      if ( format == RECORD_ASCIICAST ) {
+	char header[200];
+	NODE *n = terminalPtr->node;
+
+	snprintf( header, sizeof(header),
+		  "{\"version\": 2, \"width\": %d, \"height\": %d, "
+		  "\"timestamp\": %ld}\n",
+		  (n != NULL) ? n->w : terminalPtr->width,
+		  (n != NULL) ? n->h : terminalPtr->height,
+		  (long) terminalPtr->recordStart.sec );
+	Tcl_Write( channel, header, -1 );
+      }
+    }
+  }
+
+  if ( terminalPtr->record != NULL ) {
+    Tcl_SetResult( interp, (char *) Tcl_GetChannelName(terminalPtr->record),
+		   TCL_VOLATILE );
+  }
+  return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RecordOutput --
+ *
+ *      This procedure writes output of the slave program to the
+ *      recording as one frame.
+ *
+ *      An asciicast frame is a JSON array holding its time in
+ *      seconds since the recording started, "o" and the output as a
+ *      string. JSON strings are UTF-8 text: a character cut at the
+ *      end of the output is held for the next frame and the bytes
+ *      that aren't UTF-8 are written as U+FFFD.
+ *
+ *      A ttyrec frame is a header of three little endian 32 bit
+ *      integers, the time in seconds and microseconds and the
+ *      length of the output, followed by the output.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Recording stops when the file can't be written.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RecordOutput(terminalPtr, buf, len)
+     Terminal *terminalPtr;      /* Info about terminal widget. */
+     char *buf;                  /* Output of the slave program. */
+     int len;                    /* Number of bytes in buf. */
+{
+  Tcl_Channel channel = terminalPtr->record;
+  Tcl_Time now;
+  int result;
+
+  Tcl_GetTime( &now );
+  if ( terminalPtr->recordFormat == RECORD_TTYREC ) {
+    unsigned char header[12];
+    unsigned long value[3];
+    int i;
+
+    value[0] = now.sec;
+    value[1] = now.usec;
+    value[2] = len;
+    for ( i = 0; i < 12; i++ ) {
+      header[i] = (value[i / 4] >> (8 * (i % 4))) & 0xff;
+    }
+    result = Tcl_Write( channel, (char *) header, 12 );
+    if ( result >= 0 ) {
+      result = Tcl_Write( channel, buf, len );
+    }
+  } else {
+    Tcl_DString frame, joined;
+    unsigned char *p;
+    char esc[64];
+    int i, k, need;
+
+    /* complete the character held from the last frame */
+    Tcl_DStringInit( &joined );
+    if ( terminalPtr->recordNheld > 0 ) {
+      Tcl_DStringAppend( &joined, terminalPtr->recordHeld,
+			 terminalPtr->recordNheld );
+      Tcl_DStringAppend( &joined, buf, len );
+      buf = Tcl_DStringValue( &joined );
+      len = Tcl_DStringLength( &joined );
+      terminalPtr->recordNheld = 0;
+    }
+
+    Tcl_DStringInit( &frame );
+    snprintf( esc, sizeof(esc), "[%.6f, \"o\", \"",
+	      (now.sec - terminalPtr->recordStart.sec)
+	      + (now.usec - terminalPtr->recordStart.usec) / 1e6 );
+    Tcl_DStringAppend( &frame, esc, -1 );
+    p = (unsigned char *) buf;
+    for ( i = 0; i < len; ) {
+      if ( p[i] < 0x80 ) {
+	switch ( p[i] ) {
+	case '"':  Tcl_DStringAppend( &frame, "\\\"", 2 ); break;
+	case '\\': Tcl_DStringAppend( &frame, "\\\\", 2 ); break;
+	case '\n': Tcl_DStringAppend( &frame, "\\n", 2 ); break;
+	case '\r': Tcl_DStringAppend( &frame, "\\r", 2 ); break;
+	case '\t': Tcl_DStringAppend( &frame, "\\t", 2 ); break;
+	default:
+	  if ( p[i] < 0x20 || p[i] == 0x7f ) {
+	    snprintf( esc, sizeof(esc), "\\u%04x", p[i] );
+	    Tcl_DStringAppend( &frame, esc, -1 );
+	  } else {
+	    Tcl_DStringAppend( &frame, (char *) p + i, 1 );
+	  }
+	}
+	i++;
+	continue;
+      }
+      need = (p[i] >= 0xf8) ? 0 : (p[i] >= 0xf0) ? 4 :
+	(p[i] >= 0xe0) ? 3 : (p[i] >= 0xc0) ? 2 : 0;
+      for ( k = 1; k < need && i + k < len && (p[i + k] & 0xc0) == 0x80; k++ )
+	;
+      if ( need > 0 && k == need ) {
+	Tcl_DStringAppend( &frame, (char *) p + i, need );
+	i += need;
+      } else if ( need > 0 && i + k == len ) {
+	/* cut at the end of the output */
+	memcpy( terminalPtr->recordHeld, p + i, k );
+	terminalPtr->recordNheld = k;
+	break;
+      } else {
+	Tcl_DStringAppend( &frame, "\\ufffd", 6 );
+	i++;
+      }
+    }
+    Tcl_DStringAppend( &frame, "\"]\n", 3 );
+    result = Tcl_Write( channel, Tcl_DStringValue(&frame),
+			Tcl_DStringLength(&frame) );
+    Tcl_DStringFree( &frame );
+    Tcl_DStringFree( &joined );
+  }
+
+  if ( result < 0 ) {
+    RecordStop( terminalPtr );
+  }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RecordStop --
+ *
+ *      This procedure stops recording, if the terminal is.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The recording file is closed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RecordStop(terminalPtr)
+     Terminal *terminalPtr;      /* Info about terminal widget. */
+{
+  if ( terminalPtr->record != NULL ) {
+    Tcl_Close( (Tcl_Interp *) NULL, terminalPtr->record );
+    terminalPtr->record = NULL;
+  }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TerminalReplay --
+ *
+ *      This procedure handles the replay widget subcommand.
+ *
+ *      With no arguments it returns the name of the file being
+ *      replayed.
+ *
+ *      With a file name, it reads a session recorded in asciicast v2
+ *      or ttyrec format and outputs its frames to the terminal, as if
+ *      they came from the slave program, at the pace they were
+ *      recorded multiplied by the -speed factor. A factor of 0 outputs
+ *      them as fast as possible, a read budget at a time. The virtual
+ *      event <Replayed> is sent to the terminal at the end. With the
+ *      empty list, it stops replaying.
+ *
+ * Results:
+ *      A standard Tcl result.
+ *
+ * Side effects:
+ *      A timer handler is created.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+TerminalReplay(terminalPtr, argc, argv)
+     Terminal *terminalPtr;      /* Info about terminal widget. */
+     int argc;                   /* Number of arguments */
+     char **argv;                /* arguments */
+{
+  Tcl_Interp *interp = terminalPtr->interp;
+  REPLAY *replayPtr;
+  double speed = 1.0;
+
+  if ( (argc == 5) && !strcmp(argv[3], "-speed") ) {
+    if ( Tcl_GetDouble( interp, argv[4], &speed ) != TCL_OK ) {
+      return TCL_ERROR;
+    }
+  } else if ( argc > 3 ) {
+    Tcl_AppendResult(interp, "wrong # args: should be \"",
+		     argv[0], " replay ?fileName|{}? ?-speed factor?\"",
+		     (char *) NULL);
+    return TCL_ERROR;
+  }
+
+  if ( argc >= 3 ) {
+    ReplayStop( terminalPtr );
+    if ( argv[2][0] != '\0' ) {
+      replayPtr = (REPLAY *) ckalloc(sizeof(REPLAY));
+      memset( replayPtr, 0, sizeof(REPLAY) );
+      Tcl_DStringInit( &replayPtr->data );
+      replayPtr->fileName = ckalloc( strlen(argv[2]) + 1 );
+      strcpy( replayPtr->fileName, argv[2] );
+      replayPtr->speed = speed;
+      terminalPtr->replay = replayPtr;
+      if ( ReplayLoad( interp, replayPtr ) != TCL_OK ) {
+	ReplayStop( terminalPtr );
+	return TCL_ERROR;
+      }
+      replayPtr->timer = Tk_CreateTimerHandler( 0, ReplayTimerProc,
+						(ClientData) terminalPtr );
+    }
+  }
+
+  if ( terminalPtr->replay != NULL ) {
+    Tcl_SetResult( interp, terminalPtr->replay->fileName, TCL_VOLATILE );
+  }
+  return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ReplayLoad --
+ *
+ *      This procedure reads the frames of a recorded session. A file
+ *      starting with "{" is read as asciicast v2, its header line
+ *      being followed by one JSON array per frame, only the "o"
+ *      frames are kept. Any other file is read as ttyrec.
+ *
+ * Results:
+ *      A standard Tcl result, an error message is left in interp
+ *      when the file can't be read or is not a recorded session.
+ *
+ * Side effects:
+ *      The frames are stored in replayPtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+ReplayLoad(interp, replayPtr)
+     Tcl_Interp *interp;         /* Used for error reporting. */
+     REPLAY *replayPtr;          /* Session to load. */
+{
+  Tcl_Channel channel;
+  Tcl_DString file, type;
+  char buf[8192];
+  char *p, *end, *q;
+  unsigned char *u;
+  double t0 = 0.0, t;
+  int n, line = 1, result = TCL_OK;
+
+  channel = Tcl_OpenFileChannel( interp, replayPtr->fileName, "r", 0 );
+  if ( channel == NULL ) {
+    return TCL_ERROR;
+  }
+  Tcl_SetChannelOption( interp, channel, "-translation", "binary");
+  Tcl_DStringInit( &file );
+  while ( (n = Tcl_Read( channel, buf, sizeof(buf) )) > 0 ) {
+    Tcl_DStringAppend( &file, buf, n );
+  }
+  Tcl_Close( (Tcl_Interp *) NULL, channel );
+  if ( n < 0 ) {
+    Tcl_AppendResult(interp, "error reading \"", replayPtr->fileName,
+		     "\": ", Tcl_PosixError(interp), (char *) NULL);
+    Tcl_DStringFree( &file );
+    return TCL_ERROR;
+  }
+
+  p = Tcl_DStringValue( &file );
+  end = p + Tcl_DStringLength( &file );
+  Tcl_DStringInit( &type );
+
+#define SKIPSPACE(p) while ((p) < end && (*(p) == ' ' || *(p) == '\t')) (p)++
+#define ADDFRAME(t)							\
+  do {									\
+    if ( replayPtr->nframes == replayPtr->space ) {			\
+      replayPtr->space = replayPtr->space ? 2 * replayPtr->space : 256; \
+      replayPtr->times = (double *) ckrealloc( (char *) replayPtr->times, \
+			   replayPtr->space * sizeof(double) );		\
+      replayPtr->ends = (int *) ckrealloc( (char *) replayPtr->ends,	\
+			   replayPtr->space * sizeof(int) );		\
+    }									\
+    replayPtr->times[replayPtr->nframes] = (t);				\
+    replayPtr->ends[replayPtr->nframes++] =				\
+      Tcl_DStringLength( &replayPtr->data );				\
+  } while (0)
+
+  if ( p < end && *p == '{' ) {
+    /* header, the version must be 2 */
+    q = memchr( p, '\n', end - p );
+    if ( q == NULL ) {
+      q = end;
+    }
+    *q = '\0';
+    p = strstr( p, "\"version\"" );
+    if ( p != NULL ) {
+      p += 9;
+      SKIPSPACE(p);
+    }
+    if ( p == NULL || *p != ':' || strtol( p + 1, NULL, 10 ) != 2 ) {
+      Tcl_AppendResult(interp, "\"", replayPtr->fileName,
+		       "\" is not an asciicast v2 file", (char *) NULL);
+      result = TCL_ERROR;
+      goto done;
+    }
+
+    for ( p = q + 1; p < end; p = q + 1 ) {
+      line++;
+      q = memchr( p, '\n', end - p );
+      if ( q == NULL ) {
+	q = end;
+      }
+      SKIPSPACE(p);
+      if ( p == q || (p + 1 == q && *p == '\r') ) {
+	continue;
+      }
+      if ( *p++ != '[' ) {
+	goto badFrame;
+      }
+      t = strtod( p, &p );
+      SKIPSPACE(p);
+      if ( *p++ != ',' ) {
+	goto badFrame;
+      }
+      SKIPSPACE(p);
+      Tcl_DStringSetLength( &type, 0 );
+      if ( (p = ReplayString( p, q, &type )) == NULL ) {
+	goto badFrame;
+      }
+      SKIPSPACE(p);
+      if ( *p++ != ',' ) {
+	goto badFrame;
+      }
+      SKIPSPACE(p);
+      n = Tcl_DStringLength( &replayPtr->data );
+      if ( (p = ReplayString( p, q, &replayPtr->data )) == NULL ) {
+	goto badFrame;
+      }
+      if ( strcmp( Tcl_DStringValue(&type), "o" ) != 0 ) {
+	Tcl_DStringSetLength( &replayPtr->data, n );
+	continue;
+      }
+      ADDFRAME(t);
+    }
+  } else {
+    while ( p < end ) {
+      unsigned long value[3] = {0, 0, 0};
+      int i;
+
+      if ( end - p < 12 ) {
+	goto badTtyrec;
+      }
+      u = (unsigned char *) p;
+      for ( i = 0; i < 12; i++ ) {
+	value[i / 4] |= (unsigned long) u[i] << (8 * (i % 4));
+      }
+      p += 12;
+      if ( value[2] > (unsigned long) (end - p) ) {
+	goto badTtyrec;
+      }
+      t = value[0] + value[1] / 1e6;
+      if ( replayPtr->nframes == 0 ) {
+	t0 = t;
+      }
+      Tcl_DStringAppend( &replayPtr->data, p, (int) value[2] );
+      p += value[2];
+      ADDFRAME(t - t0);
+    }
+  }
+#undef SKIPSPACE
+#undef ADDFRAME
+
+done:
+  Tcl_DStringFree( &type );
+  Tcl_DStringFree( &file );
+  return result;
+
+badFrame:
+  sprintf( buf, "%d", line );
+  Tcl_AppendResult(interp, "bad asciicast frame at line ", buf,
+		   " of \"", replayPtr->fileName, "\"", (char *) NULL);
+  result = TCL_ERROR;
+  goto done;
+
+badTtyrec:
+  Tcl_AppendResult(interp, "\"", replayPtr->fileName,
+		   "\" is not a ttyrec or asciicast file", (char *) NULL);
+  result = TCL_ERROR;
+  goto done;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ReplayString --
+ *
+ *      This procedure decodes a JSON string starting at p and ending
+ *      before end.
+ *
+ * Results:
+ *      A pointer after the closing quote, or NULL if there is no
+ *      JSON string at p.
+ *
+ * Side effects:
+ *      The characters of the string are appended to dsPtr in UTF-8.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static char *
+ReplayString(p, end, dsPtr)
+     char *p;                    /* Start of the string. */
+     char *end;                  /* End of the line holding it. */
+     Tcl_DString *dsPtr;         /* Where to put its characters. */
+{
+  char *start;
+
+  if ( p >= end || *p++ != '"' ) {
+    return NULL;
+  }
+  while ( p < end && *p != '"' ) {
+    unsigned long c;
+    char utf[4];
+    int k, n;
+
+    for ( start = p; p < end && *p != '"' && *p != '\\'; p++ )
+      ;
+    Tcl_DStringAppend( dsPtr, start, p - start );
+    if ( p >= end || *p == '"' ) {
+      break;
+    }
+    if ( ++p >= end ) {
+      return NULL;
+    }
+    switch ( *p++ ) {
+    case 'b': c = '\b'; break;
+    case 'f': c = '\f'; break;
+    case 'n': c = '\n'; break;
+    case 'r': c = '\r'; break;
+    case 't': c = '\t'; break;
+    case 'u':
+      if ( end - p < 4 ) {
+	return NULL;
+      }
+      for ( c = 0, k = 0; k < 4; k++, p++ ) {
+	if ( !isxdigit( (unsigned char) *p ) ) {
+	  return NULL;
+	}
+	c = c * 16 + (isdigit( (unsigned char) *p ) ? *p - '0'
+		      : tolower( (unsigned char) *p ) - 'a' + 10);
+      }
+      /* a surrogate pair */
+      if ( c >= 0xd800 && c < 0xdc00 && end - p >= 6
+	   && p[0] == '\\' && p[1] == 'u' ) {
+	unsigned long lo = strtoul( p + 2, NULL, 16 );
+
+	if ( lo >= 0xdc00 && lo < 0xe000 ) {
+	  c = 0x10000 + ((c - 0xd800) << 10) + (lo - 0xdc00);
+	  p += 6;
+	}
+      }
+      break;
+    default:
+      c = (unsigned char) p[-1];
+      break;
+    }
+
+    /* encode in UTF-8 */
+    if ( c < 0x80 ) {
+      utf[0] = c, n = 1;
+    } else if ( c < 0x800 ) {
+      utf[0] = 0xc0 | (c >> 6), n = 2;
+    } else if ( c < 0x10000 ) {
+      utf[0] = 0xe0 | (c >> 12), n = 3;
+    } else {
+      utf[0] = 0xf0 | (c >> 18), n = 4;
+    }
+    for ( k = n - 1; k > 0; k--, c >>= 6 ) {
+      utf[k] = 0x80 | (c & 0x3f);
+    }
+    Tcl_DStringAppend( dsPtr, utf, n );
+  }
+  if ( p >= end ) {
+    return NULL;
+  }
+  return p + 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ReplayTimerProc --
+ *
+ *      This procedure is invoked by a timer handler to output the
+ *      frames of a replayed session that are due.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The frames are output to the terminal, a timer handler is
+ *      created for the next ones, or <Replayed> sent at the end.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ReplayTimerProc(clientData)
+     ClientData clientData;      /* Info about terminal widget. */
+{
+  Terminal *terminalPtr = (Terminal *) clientData;
+  REPLAY *replayPtr = terminalPtr->replay;
+  int budget;
+  int begin, end, ms = 0;
+  double elapsed;
+  Tcl_Time now;
+
+  replayPtr->timer = (Tk_TimerToken) NULL;
+  if ( (terminalPtr->node == NULL) || (terminalPtr->flags & TEE_STALLED) ) {
+    /* wait until the terminal is mapped, or the tee channel drained */
+    replayPtr->timer = Tk_CreateTimerHandler( 10, ReplayTimerProc, clientData );
+    return;
+  }
+  budget = TeeRoom( terminalPtr, terminalPtr->readBudget );
+  if ( (replayPtr->next < replayPtr->nframes)
+       && (budget < terminalPtr->readBudget) && (budget < terminalPtr->teeBuffer)
+       && (replayPtr->ends[replayPtr->next] - ((replayPtr->next > 0) ?
+	   replayPtr->ends[replayPtr->next - 1] : 0) > budget) ) {
+    /* the next frame doesn't fit in the tee channel yet */
+    replayPtr->timer = Tk_CreateTimerHandler( 10, ReplayTimerProc, clientData );
+    return;
+  }
+
+  Tcl_GetTime( &now );
+  if ( !replayPtr->started ) {
+    replayPtr->start = now;
+    replayPtr->started = 1;
+  }
+  elapsed = (now.sec - replayPtr->start.sec)
+    + (now.usec - replayPtr->start.usec) / 1e6;
+  if ( replayPtr->speed > 0 ) {
+    elapsed *= replayPtr->speed;
+  }
+
+  /* output the frames that are due, a read budget at a time, unless
+   * a single frame is larger */
+  begin = end = (replayPtr->next > 0) ? replayPtr->ends[replayPtr->next - 1] : 0;
+  while ( (replayPtr->next < replayPtr->nframes)
+	  && ((end == begin) || (replayPtr->ends[replayPtr->next] - begin <= budget))
+	  && ((replayPtr->speed <= 0)
+	      || (replayPtr->times[replayPtr->next] <= elapsed)) ) {
+    end = replayPtr->ends[replayPtr->next++];
+  }
+  if ( end > begin ) {
+    TerminalOutput( terminalPtr, Tcl_DStringValue(&replayPtr->data) + begin,
+		    end - begin );
+  }
+
+  if ( replayPtr->next >= replayPtr->nframes ) {
+    ReplayStop( terminalPtr );
+    Ck_QueueVirtualEvent( terminalPtr->winPtr, Ck_GetUid("<Replayed>"), NULL );
+    return;
+  }
+  if ( (replayPtr->speed > 0)
+       && (replayPtr->times[replayPtr->next] > elapsed) ) {
+    ms = (int) ((replayPtr->times[replayPtr->next] - elapsed)
+		/ replayPtr->speed * 1000.0);
+  }
+  replayPtr->timer = Tk_CreateTimerHandler( ms, ReplayTimerProc, clientData );
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ReplayStop --
+ *
+ *      This procedure stops replaying a session, if the terminal is.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The session is freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ReplayStop(terminalPtr)
+     Terminal *terminalPtr;      /* Info about terminal widget. */
+{
+  REPLAY *replayPtr = terminalPtr->replay;
+
+  if ( replayPtr != NULL ) {
+    if ( replayPtr->timer != NULL ) {
+      Tk_DeleteTimerHandler( replayPtr->timer );
+    }
+    Tcl_DStringFree( &replayPtr->data );
+    ckfree( (char *) replayPtr->times );
+    ckfree( (char *) replayPtr->ends );
+    ckfree( replayPtr->fileName );
+    ckfree( (char *) replayPtr );
+    terminalPtr->replay = NULL;
+  }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TerminalSearch --
+ *
+ *      This procedure handles the search widget subcommand. The
+ *      saved lines are searched where they are stored, one line at
+ *      a time, lines missing a character of an exact pattern are
+ *      skipped without being decoded. The rows of the screen follow
+ *      the saved lines.
+ *
+ *      Lines are numbered from the first line the terminal ever
+ *      saved, so that the numbers returned stay valid while the
+ *      oldest lines are dropped. Columns count cells from the start
+ *      of the line.
+ *
+ * Results:
+ *      A standard Tcl result. The match found is returned as a list
+ *      holding its line, its first column and the column after its
+ *      last, or the list of all the matches with -all.
+ *
+ * Side effects:
+ *      With -highlight the first match is shown in reverse video and
+ *      the view scrolls to make it visible.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+TerminalSearch(terminalPtr, argc, argv)
+     Terminal *terminalPtr;      /* Info about terminal widget. */
+     int argc;                   /* Number of arguments */
+     char **argv;                /* arguments */
+{
+  Tcl_Interp *interp = terminalPtr->interp;
+  NODE *n = terminalPtr->node;
+  int backwards = 0, exact = 1, noCase = 0, all = 0, highlight = 0;
+  int i, c, nlines, line, startLine, col, offset;
+  int code = TCL_OK;
+  size_t length;
+  long from;
+  unsigned long mask = 0;
+  char *arg, *end;
+  Tcl_Obj *patObj, *lineObj, *resultObj, *matchObj = NULL;
+  Tcl_RegExp regexp;
+  Tcl_RegExpInfo info;
+  LTEXT text = {NULL, NULL, 0, 0};
+
+  for (i = 2; i < argc; i++) {
+    arg = argv[i];
+    if (arg[0] != '-') {
+      break;
+    }
+    length = strlen(arg);
+    if (length < 2) {
+    badSwitch:
+      Tcl_AppendResult(interp, "bad switch \"", arg,
+		       "\": must be -forwards, -backwards, -exact, -regexp, ",
+		       "-nocase, -all, -highlight, or --", (char *) NULL);
+      return TCL_ERROR;
+    }
+    c = arg[1];
+    if ((c == 'a') && (strncmp(arg, "-all", length) == 0)) {
+      all = 1;
+    } else if ((c == 'b') && (strncmp(arg, "-backwards", length) == 0)) {
+      backwards = 1;
+    } else if ((c == 'e') && (strncmp(arg, "-exact", length) == 0)) {
+      exact = 1;
+    } else if ((c == 'f') && (strncmp(arg, "-forwards", length) == 0)) {
+      backwards = 0;
+    } else if ((c == 'h') && (strncmp(arg, "-highlight", length) == 0)) {
+      highlight = 1;
+    } else if ((c == 'n') && (strncmp(arg, "-nocase", length) == 0)) {
+      noCase = 1;
+    } else if ((c == 'r') && (strncmp(arg, "-regexp", length) == 0)) {
+      exact = 0;
+    } else if ((c == '-') && (strncmp(arg, "--", length) == 0)) {
+      i++;
+      break;
+    } else {
+      goto badSwitch;
+    }
+  }
+  if ((argc - i != 1) && (argc - i != 2)) {
+    Tcl_AppendResult(interp, "wrong # args: should be \"",
+		     argv[0], " search ?switches? pattern ?index?\"",
+		     (char *) NULL);
+    return TCL_ERROR;
+  }
+  if (n == NULL) {
+    return TCL_OK;
+  }
+
+  /*
+   * The starting index is "end" or a line number, optionally
+   * followed by a dot and a column. Searching forwards starts at
+   * the first line by default, backwards at the end.
+   */
+
+  nlines = HISTLINES(n) + n->s->rows;
+  line = backwards? nlines - 1 : 0;
+  col = backwards? INT_MAX : 0;
+  if ((argc - i == 2) && (strcmp(argv[i+1], "end") != 0)) {
+    from = strtol(argv[i+1], &end, 10);
+    if (end != argv[i+1] && *end == '.') {
+      arg = end + 1;
+      col = strtol(arg, &end, 10);
+      if (end == arg || col < 0) {
+	end = arg - 1;
+      }
+    }
+    if (end == argv[i+1] || *end != '\0') {
+      Tcl_AppendResult(interp, "bad terminal index \"", argv[i+1],
+		       "\"", (char *) NULL);
+      return TCL_ERROR;
+    }
+    if (from < n->hist.base) {
+      line = backwards? -1 : 0;
+      col = 0;
+    } else if (from - n->hist.base >= nlines) {
+      line = backwards? nlines - 1 : nlines;
+      col = INT_MAX;
+    } else {
+      line = (int) (from - n->hist.base);
+    }
+  }
+  startLine = line;
+
+  if (argv[i][0] == '\0') {
+    /* an empty pattern matches nothing */
+    line = -1;
+  }
+  patObj = Tcl_NewStringObj(argv[i], -1);
+  Tcl_IncrRefCount(patObj);
+  regexp = Tcl_GetRegExpFromObj(interp, patObj,
+			(exact? TCL_REG_QUOTE : TCL_REG_ADVANCED)
+			| (noCase? TCL_REG_NOCASE : 0));
+  if (regexp == NULL) {
+    Tcl_DecrRefCount(patObj);
+    return TCL_ERROR;
+  }
+  if (exact) {
+    Tcl_UniChar ch;
+
+    for (arg = argv[i]; *arg != '\0'; ) {
+      arg += Tcl_UtfToUniChar(arg, &ch);
+      mask |= CHARBIT(ch);
+    }
+  }
+
+  lineObj = Tcl_NewObj();
+  Tcl_IncrRefCount(lineObj);
+  resultObj = Tcl_NewListObj(0, NULL);
+  Tcl_IncrRefCount(resultObj);
+  for (; line >= 0 && line < nlines && (all || matchObj == NULL);
+       line += backwards? -1 : 1) {
+    Tcl_Obj *lineMatches = NULL, **objv;
+    int objc;
+
+    if (exact && line < HISTLINES(n)
+	&& (vthistline(n, line)->chars & mask) != mask) {
+      continue;
+    }
+    if (!vtlinetext(n, line, &text)) {
+      Tcl_SetResult(interp, "not enough memory to search", TCL_STATIC);
+      code = TCL_ERROR;
+      break;
+    }
+    Tcl_SetUnicodeObj(lineObj, text.chars, text.len);
+
+    /*
+     * Find the matches of the line in order, past the starting column
+     * on the first line searched forwards, before it searching
+     * backwards.
+     */
+
+    offset = 0;
+    if (!backwards && line == startLine) {
+      while (offset < text.len && text.cols[offset] < col) {
+	offset++;
+      }
+    }
+    while (offset <= text.len) {
+      Tcl_Obj *objs[3];
+      int match = Tcl_RegExpExecObj(interp, regexp, lineObj, offset, 1,
+				    (offset > 0)? TCL_REG_NOTBOL : 0);
+      int mstart, mend;
+
+      if (match < 0) {
+	code = TCL_ERROR;
+	break;
+      }
+      if (match == 0) {
+	break;
+      }
+      Tcl_RegExpGetInfo(regexp, &info);
+      mstart = offset + info.matches[0].start;
+      mend = offset + info.matches[0].end;
+      if (backwards && line == startLine && text.cols[mstart] >= col) {
+	break;
+      }
+      objs[0] = Tcl_NewLongObj(n->hist.base + line);
+      objs[1] = Tcl_NewIntObj(text.cols[mstart]);
+      objs[2] = Tcl_NewIntObj(text.cols[mend]);
+      if (lineMatches == NULL) {
+	lineMatches = Tcl_NewListObj(0, NULL);
+	Tcl_IncrRefCount(lineMatches);
+      }
+      Tcl_ListObjAppendElement(NULL, lineMatches, Tcl_NewListObj(3, objs));
+      if (!backwards && !all) {
+	break;
+      }
+      offset = (mend > mstart)? mend : mend + 1;
+    }
+    if (lineMatches != NULL) {
+      Tcl_ListObjGetElements(NULL, lineMatches, &objc, &objv);
+      for (c = 0; c < objc && (all || matchObj == NULL); c++) {
+	Tcl_Obj *objPtr = objv[backwards? objc - 1 - c : c];
+
+	if (matchObj == NULL) {
+	  matchObj = objPtr;
+	  Tcl_IncrRefCount(matchObj);
+	}
+	Tcl_ListObjAppendElement(NULL, resultObj, objPtr);
+      }
+      Tcl_DecrRefCount(lineMatches);
+    }
+    if (code != TCL_OK) {
+      break;
+    }
+  }
+  Tcl_DecrRefCount(lineObj);
+  Tcl_DecrRefCount(patObj);
+  free(text.chars);
+  free(text.cols);
+
+  if (code != TCL_OK) {
+    Tcl_DecrRefCount(resultObj);
+    if (matchObj != NULL) {
+      Tcl_DecrRefCount(matchObj);
+    }
+    return code;
+  }
+
+  /*
+   * Highlight the first match and scroll the view to it, a search
+   * finding nothing removes the highlight.
+   */
+
+  if (highlight) {
+    vthistrewrap(n);
+    terminalPtr->matchLine = -1;
+    if (matchObj != NULL) {
+      Tcl_Obj **objv;
+      int objc, row;
+
+      Tcl_ListObjGetElements(NULL, matchObj, &objc, &objv);
+      Tcl_GetLongFromObj(NULL, objv[0], &terminalPtr->matchLine);
+      Tcl_GetIntFromObj(NULL, objv[1], &terminalPtr->matchStart);
+      Tcl_GetIntFromObj(NULL, objv[2], &terminalPtr->matchEnd);
+      line = (int) (terminalPtr->matchLine - n->hist.base);
+      if (line < HISTLINES(n)) {
+	row = vthistrow(n, line) + vtlinepos(vthistline(n, line), n->hist.width,
+					 terminalPtr->matchStart) / n->hist.width;
+      } else {
+	row = HISTROWS(n) + line - HISTLINES(n);
+      }
+      if (row < n->s->off || row >= n->s->off + n->h) {
+	n->s->off = MIN(MAX(row - n->h / 2, 0), HISTROWS(n));
+	n->cmd = (n->s->off != HISTROWS(n));
+	Tk_DoWhenIdle(TerminalYScrollCommand, (ClientData) terminalPtr);
+      }
+    }
+    TerminalPostRedisplay(terminalPtr);
+  }
+
+  if (all) {
+    Tcl_SetObjResult(interp, resultObj);
+  } else if (matchObj != NULL) {
+    Tcl_SetObjResult(interp, matchObj);
+  }
+  Tcl_DecrRefCount(resultObj);
+  if (matchObj != NULL) {
+    Tcl_DecrRefCount(matchObj);
+  }
+  return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TerminalYScrollCommand --
+ *
+ *      This procedure is invoked to evaluate yscrollcommand
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Push idle events to event queue.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+TerminalYScrollCommand(clientData)
+     ClientData clientData;
+{
+  Terminal *terminalPtr = (Terminal*) clientData;
+  if ( terminalPtr->yscrollcommand != NULL ) {
+    struct NODE *nodePtr = terminalPtr->node;
+    char stdbl[TCL_DOUBLE_SPACE];
+    Tcl_DString ds;
+    double start, end;
+    char *script;
+    
+    int total = HISTROWS(nodePtr) + nodePtr->h;
+
+    start = (double)(nodePtr->s->off) / (double)(total);
+    end = start + (double)(nodePtr->h) / (double)(total);
+
+    Tcl_DStringInit(&ds);
+    Tcl_DStringAppend(&ds, terminalPtr->yscrollcommand, -1 );
+    Tcl_PrintDouble( terminalPtr->interp, start, stdbl);
+    Tcl_DStringAppendElement(&ds, stdbl );
+    Tcl_PrintDouble( terminalPtr->interp, end, stdbl);
+    Tcl_DStringAppendElement(&ds, stdbl );
+
+    script = Tcl_DStringValue(&ds);
+    Tcl_Eval( terminalPtr->interp, script );
+
+    Tcl_DStringFree(&ds);
+  }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TerminalNewView --
+ *
+ *      This procedure creates the terminal's own node, and starts
+ *      its program unless -pty is off.
+ *
+ * Results:
+ *      TCL_ERROR if the node could not be created.
+ *
+ * Side effects:
+ *      A program may be run on a new pty, which is read from then on.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+TerminalNewView(terminalPtr, height, width)
+     Terminal *terminalPtr;      /* Info about terminal widget. */
+     int height, width;          /* Size of the screens. */
+{
+  terminalPtr->node = newview( terminalPtr, height, width,
+			       terminalPtr->fg, terminalPtr->bg);
+  if ( terminalPtr->node == NULL ) {
+    return TCL_ERROR;
+  }
+  if ( terminalPtr->node->pt >= 0 ) {
+    Tcl_CreateFileHandler( terminalPtr->node->pt, TCL_READABLE,
+			   TerminalPtyProc, (ClientData) terminalPtr);
+  } else {
+    terminalPtr->flags |= DISCONNECTED;
+  }
+  return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TerminalReshape --
+ *
+ *      This procedure fits the node displayed by a mapped terminal
+ *      to its window, after it was attached or detached.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The node is resized, or created if the terminal had none yet.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+TerminalReshape(terminalPtr)
+     Terminal *terminalPtr;      /* Info about terminal widget. */
+{
+  CkWindow *winPtr = terminalPtr->winPtr;
+  int offset = (terminalPtr->borderPtr != NULL) ? 1 : 0;
+
+  if ( (winPtr == NULL) || !(winPtr->flags & CK_MAPPED) ) {
+    return;
+  }
+  if ( terminalPtr->node == NULL ) {
+    TerminalNewView( terminalPtr, winPtr->height - 2*offset,
+		     winPtr->width - 2*offset);
+  } else {
+    reshape( terminalPtr->node, winPtr->height - 2*offset,
+	     winPtr->width - 2*offset);
+  }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TerminalWatch --
+ *
+ *      This procedure reads the pty of the node displayed by a
+ *      terminal again, after it was stopped by the tee channel.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      A file handler is created.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+TerminalWatch(terminalPtr)
+     Terminal *terminalPtr;      /* Info about terminal widget. */
+{
+  NODE *n = terminalPtr->node;
+
+  if ( terminalPtr->attached != NULL ) {
+    if ( n->pt >= 0 ) {
+      Tcl_CreateFileHandler( n->pt, TCL_READABLE, EmulatorPtyProc,
+			     (ClientData) terminalPtr->attached);
+    }
+  } else if ( ((terminalPtr->flags & DISCONNECTED) == 0) && (n->pt >= 0) ) {
+    Tcl_CreateFileHandler( n->pt, TCL_READABLE, TerminalPtyProc,
+			   (ClientData) terminalPtr);
+  }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TerminalAttach --
+ *
+ *      This procedure is invoked to process the "attach" option of
+ *      the widget command: the terminal displays an emulator and
+ *      sends it its input, while its own program goes on unseen.
+ *
+ * Results:
+ *      A standard Tcl result, the name of the emulator attached if
+ *      none is given.
+ *
+ * Side effects:
+ *      The emulator is resized to the terminal.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+TerminalAttach(terminalPtr, argc, argv)
+     Terminal *terminalPtr;      /* Info about terminal widget. */
+     int argc;                   /* Number of arguments. */
+     char **argv;                /* Argument strings. */
+{
+  Tcl_Interp *interp = terminalPtr->interp;
+  Emulator *emuPtr;
+  Tcl_CmdInfo info;
+
+  if (argc > 3) {
+    Tcl_AppendResult(interp, "wrong # args: should be \"",
+		     argv[0], " attach ?emulator?\"", (char *) NULL);
+    return TCL_ERROR;
+  }
+  if (argc == 2) {
+    if (terminalPtr->attached != NULL) {
+      Tcl_SetResult(interp, Tcl_GetCommandName(interp,
+		      terminalPtr->attached->cmd), TCL_VOLATILE);
+    }
+    return TCL_OK;
+  }
+
+  if (!Tcl_GetCommandInfo(interp, argv[2], &info)
+      || (info.proc != EmulatorCmd)) {
+    Tcl_AppendResult(interp, "\"", argv[2], "\" isn't an emulator",
+		     (char *) NULL);
+    return TCL_ERROR;
+  }
+  emuPtr = (Emulator *) info.clientData;
+  if (emuPtr->attached == terminalPtr) {
+    return TCL_OK;
+  }
+  if (emuPtr->attached != NULL) {
+    Tcl_AppendResult(interp, "emulator \"", argv[2],
+		     "\" is already attached to ",
+		     emuPtr->attached->winPtr->pathName, (char *) NULL);
+    return TCL_ERROR;
+  }
+
+  TerminalDetach(terminalPtr);
+  TeeResume(terminalPtr);
+  if (terminalPtr->node != NULL) {
+    terminalPtr->node->clientData = NULL;
+  }
+  terminalPtr->ownNode = terminalPtr->node;
+  terminalPtr->attached = emuPtr;
+  terminalPtr->node = emuPtr->node;
+  terminalPtr->node->clientData = terminalPtr;
+  terminalPtr->matchLine = -1;
+  emuPtr->attached = terminalPtr;
+
+  TerminalReshape(terminalPtr);
+  TerminalPostRedisplay(terminalPtr);
+  Tk_DoWhenIdle(TerminalYScrollCommand, (ClientData) terminalPtr);
+  return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TerminalDetach --
+ *
+ *      This procedure detaches the emulator displayed by a terminal,
+ *      if any: the emulator only runs its parser from then on, and
+ *      the terminal displays its own node again.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The terminal's own node is resized, or created if the terminal
+ *      was attached before being mapped.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+TerminalDetach(terminalPtr)
+     Terminal *terminalPtr;      /* Info about terminal widget. */
+{
+  Emulator *emuPtr = terminalPtr->attached;
+
+  if (emuPtr == NULL) {
+    return;
+  }
+  TeeResume(terminalPtr);
+  emuPtr->node->clientData = NULL;
+  emuPtr->attached = NULL;
+  terminalPtr->attached = NULL;
+  terminalPtr->node = terminalPtr->ownNode;
+  terminalPtr->ownNode = NULL;
+  terminalPtr->matchLine = -1;
+  if (terminalPtr->node != NULL) {
+    terminalPtr->node->clientData = terminalPtr;
+  }
+
+  if (terminalPtr->winPtr != NULL) {
+    TerminalReshape(terminalPtr);
+    TerminalPostRedisplay(terminalPtr);
+    if (terminalPtr->node != NULL) {
+      Tk_DoWhenIdle(TerminalYScrollCommand, (ClientData) terminalPtr);
+    }
+  }
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * Ckemulator_Init --
+ *
+ *      This procedure adds the "emulator" command to an interpreter
+ *      without a Ck main window, such as a tclsh that does "load
+ *      libck8.6.so Ckemulator".  Emulators never draw, so curses
+ *      isn't started and no terminal is needed.
+ *
+ * Results:
+ *      A standard Tcl result.
+ *
+ * Side effects:
+ *      The "emulator" command is created.  Without any main window
+ *      in the process, the names of the system colors are set up.
+ *
+ *--------------------------------------------------------------
+ */
+
+int
+Ckemulator_Init(interp)
+    Tcl_Interp *interp;         /* Interpreter to add the command to. */
+{
+    extern CkMainInfo *ckMainInfo;
+    CkWindow *mainPtr = Ck_MainWindow(interp);
+
+    if (mainPtr == NULL) {
+        Tcl_ResetResult(interp);
+        if (ckMainInfo == NULL) {
+            Ck_InitColor();
+        }
+    }
+    Tcl_CreateCommand(interp, "emulator", Ck_EmulatorCmd,
+            (ClientData) mainPtr, (Tcl_CmdDeleteProc *) NULL);
+    return TCL_OK;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * Ck_EmulatorCmd --
+ *
+ *      This procedure is invoked to process the "emulator" Tcl
+ *      command, which creates a headless terminal emulator.  See
+ *      the user documentation for details on what it does.
+ *
+ * Results:
+ *      A standard Tcl result.
+ *
+ * Side effects:
+ *      A new command is created to feed the emulator and query
+ *      its screen.
+ *
+ *--------------------------------------------------------------
+ */
+
+int
+Ck_EmulatorCmd(clientData, interp, argc, argv)
+    ClientData clientData;      /* Main window associated with
+                                 * interpreter, NULL if it has
+                                 * none. */
+    Tcl_Interp *interp;         /* Current interpreter. */
+    int argc;                   /* Number of arguments. */
+    char **argv;                /* Argument strings. */
+{
+    Emulator *emuPtr;
+    Tcl_CmdInfo info;
+
+    if (argc < 2) {
+        Tcl_AppendResult(interp, "wrong # args: should be \"",
+                argv[0], " name ?options?\"", (char *) NULL);
+        return TCL_ERROR;
+    }
+    if (Tcl_GetCommandInfo(interp, argv[1], &info)) {
+        Tcl_AppendResult(interp, "command \"", argv[1],
+                "\" already exists", (char *) NULL);
+        return TCL_ERROR;
+    }
+
+    emuPtr = (Emulator *) ckalloc(sizeof (Emulator));
+    emuPtr->winPtr = (CkWindow *) clientData;
+    emuPtr->interp = interp;
+    emuPtr->fg = emuPtr->bg = 0;
+    emuPtr->width = emuPtr->height = 0;
+    emuPtr->scrollback = emuPtr->scrollbackBudget = 0;
+    emuPtr->readBudget = 0;
+    emuPtr->exec = NULL;
+    emuPtr->term = NULL;
+    emuPtr->node = NULL;
+    emuPtr->attached = NULL;
+    emuPtr->cmd = Tcl_CreateCommand(interp, argv[1], EmulatorCmd,
+            (ClientData) emuPtr, EmulatorDeletedProc);
+
+    if (ConfigureEmulator(interp, emuPtr, argc-2, argv+2, 0) != TCL_OK) {
+        Tcl_DeleteCommandFromToken(interp, emuPtr->cmd);
+        return TCL_ERROR;
+    }
+    Tcl_SetResult(interp, argv[1], TCL_VOLATILE);
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ConfigureEmulator --
+ *
+ *      This procedure is called to process an argv/argc list, plus
+ *      the option database, in order to configure (or reconfigure)
+ *      an emulator.
+ *
+ * Results:
+ *      A standard Tcl result.
+ *
+ * Side effects:
+ *      The screens are created the first time, resized or recolored
+ *      afterwards; the scrollback limits apply to the next lines
+ *      scrolled off the primary screen.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+ConfigureEmulator(interp, emuPtr, argc, argv, flags)
+     Tcl_Interp *interp;         /* Used for error reporting. */
+     Emulator *emuPtr;           /* Information about emulator. */
+     int argc;                   /* Number of valid entries in argv. */
+     char **argv;                /* Arguments. */
+     int flags;                  /* Flags to pass to Ck_ConfigureWidget. */
+{
+    int width = emuPtr->width, height = emuPtr->height;
+    int readBudget = emuPtr->readBudget;
+    NODE *n;
+
+    if (Ck_ConfigureWidget(interp, emuPtr->winPtr, emulatorConfigSpecs,
+            argc, argv, (char *) emuPtr, flags) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (emuPtr->width < 2 || emuPtr->height < 2) {
+        char buf[2 * TCL_INTEGER_SPACE + 1];
+
+        sprintf(buf, "%dx%d", emuPtr->width, emuPtr->height);
+        Tcl_AppendResult(interp, "bad size \"", buf,
+                "\": must be at least 2x2", (char *) NULL);
+        emuPtr->width = width;
+        emuPtr->height = height;
+        return TCL_ERROR;
+    }
+    if (emuPtr->readBudget <= 0) {
+        char buf[TCL_INTEGER_SPACE];
+
+        sprintf(buf, "%d", emuPtr->readBudget);
+        Tcl_AppendResult(interp, "bad read budget \"", buf,
+                "\": must be positive", (char *) NULL);
+        emuPtr->readBudget = readBudget;
+        return TCL_ERROR;
+    }
+
+    n = emuPtr->node;
+    if (n == NULL) {
+        n = emuPtr->node = vtnewemu(emuPtr->height, emuPtr->width,
+                emuPtr->fg, emuPtr->bg);
+        if (n == NULL) {
+            Tcl_AppendResult(interp, "can't create the emulator screens",
+                    (char *) NULL);
+            return TCL_ERROR;
+        }
+        if ((emuPtr->exec != NULL) && (emuPtr->exec[0] != '\0')) {
+            int nargs;
+            char **args;
+            bool ok;
+
+            if (Tcl_SplitList(interp, emuPtr->exec, &nargs, &args)
+                    != TCL_OK) {
+                return TCL_ERROR;
+            }
+            ok = (nargs > 0) && vtspawn(n, (emuPtr->term != NULL)?
+                    emuPtr->term : DEFAULT_TERMINAL, nargs, args);
+            ckfree((char *) args);
+            if (!ok) {
+                Tcl_AppendResult(interp, "couldn't run \"", emuPtr->exec,
+                        "\" on a pty", (char *) NULL);
+                return TCL_ERROR;
+            }
+            Tcl_CreateFileHandler(n->pt, TCL_READABLE, EmulatorPtyProc,
+                    (ClientData) emuPtr);
+        }
+    } else {
+        n->pri.wfg = n->alt.wfg = emuPtr->fg;
+        n->pri.wbg = n->alt.wbg = emuPtr->bg;
+        reshape(n, emuPtr->height, emuPtr->width);
+    }
+    n->scrollback = emuPtr->scrollback;
+    n->budget = emuPtr->scrollbackBudget;
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EmulatorPtyProc --
+ *
+ *      This procedure is invoked when the pty of an emulator running
+ *      a program is readable.  A detached emulator only runs its
+ *      parser, an attached one gives the output to its terminal.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The screens are updated, an attached terminal is redisplayed.
+ *      When the program exits, <<Exited>> is sent to the terminal.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+EmulatorPtyProc(clientData, flags)
+     ClientData clientData;       /* Information about emulator. */
+     int flags;                   /* Flags descibing what happened to file */
+{
+  Emulator *emuPtr = (Emulator *) clientData;
+  Terminal *terminalPtr = emuPtr->attached;
+  NODE *n = emuPtr->node;
+  size_t len;
+  bool eof;
+
+  if ( !(flags & TCL_READABLE) ) {
+    return;
+  }
+  len = vtptyread( n, (size_t) ((terminalPtr != NULL)?
+			       TeeRoom( terminalPtr, terminalPtr->readBudget)
+			       : emuPtr->readBudget),
+		 &eof);
+  if (len > 0 && terminalPtr != NULL) {
+    TerminalOutput( terminalPtr, n->iobuf, (int) len);
+  }
+  else if (len > 0) {
+    vtwrite(&n->vp, n->iobuf, len);
+  }
+
+  if (eof) {
+    vthangup( n );
+    if (terminalPtr != NULL) {
+      Ck_QueueVirtualEvent(terminalPtr->winPtr, Ck_GetUid("<Exited>"), NULL);
+    }
+  }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EmulatorCell --
+ *
+ *      Describe the cell at a row and column of the active screen
+ *      of an emulator.
+ *
+ * Results:
+ *      A list of the characters in the cell, its attributes, and
+ *      its foreground and background colors.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Tcl_Obj *
+EmulatorCell(n, row, col)
+     NODE *n;                    /* Emulator's node. */
+     int row, col;               /* Cell on the screen. */
+{
+    CELL *c = CELLAT(n->s, row, col);
+    char buf[TCL_UTF_MAX * (CCHARW_MAX + 1) + 1], *name;
+    Tcl_Obj *resultObj = Tcl_NewListObj(0, NULL);
+    short color[2];
+    int i, len = 0;
+
+    for (i = 0; i < CCHARW_MAX && c->ch[i]; i++) {
+        len += Tcl_UniCharToUtf((sizeof(Tcl_UniChar) < sizeof(wchar_t)
+                && c->ch[i] > 0xffff)? 0xfffd : (int) c->ch[i], buf + len);
+    }
+    Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewStringObj(buf, len));
+
+    name = Ck_NameOfAttr(c->attr);
+    Tcl_ListObjAppendElement(NULL, resultObj, Tcl_NewStringObj(name, -1));
+    ckfree(name);
+
+    color[0] = c->fg;
+    color[1] = c->bg;
+    for (i = 0; i < 2; i++) {
+        name = (color[i] < 0)? "default" : Ck_NameOfColor(color[i]);
+        Tcl_ListObjAppendElement(NULL, resultObj, (name != NULL)?
+                Tcl_NewStringObj(name, -1) : Tcl_NewIntObj(color[i]));
+    }
+    return resultObj;
+}
+
+/*
+ *--------------------------------------------------------------
+ *
+ * EmulatorCmd --
+ *
+ *      This procedure is invoked to process the Tcl command
+ *      that corresponds to an emulator.  See the user
+ *      documentation for details on what it does.
+ *
+ * Results:
+ *      A standard Tcl result.
+ *
+ * Side effects:
+ *      See the user documentation.
+ *
+ *--------------------------------------------------------------
+ */
+
+static int
+EmulatorCmd(clientData, interp, argc, argv)
+    ClientData clientData;      /* Information about emulator. */
+    Tcl_Interp *interp;         /* Current interpreter. */
+    int argc;                   /* Number of arguments. */
+    char **argv;                /* Argument strings. */
+{
+    Emulator *emuPtr = (Emulator *) clientData;
+    NODE *n = emuPtr->node;
+    int length, row, col;
+    char c;
+
+    /* a terminal it is attached to may have resized it */
+    emuPtr->width = n->w;
+    emuPtr->height = n->h;
+
+    if (argc < 2) {
+        Tcl_AppendResult(interp, "wrong # args: should be \"",
+                argv[0], " option ?arg arg ...?\"", (char *) NULL);
+        return TCL_ERROR;
+    }
+    c = argv[1][0];
+    length = strlen(argv[1]);
+    if ((c == 'c') && (strncmp(argv[1], "cell", length) == 0)
+	&& (length >= 2)) {
+        if (argc != 4) {
+            Tcl_AppendResult(interp, "wrong # args: should be \"",
+                    argv[0], " cell row column\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+        if ((Tcl_GetInt(interp, argv[2], &row) != TCL_OK)
+                || (Tcl_GetInt(interp, argv[3], &col) != TCL_OK)) {
+            return TCL_ERROR;
+        }
+        if (row < 0 || row >= n->h || col < 0 || col >= n->w) {
+            Tcl_AppendResult(interp, "cell \"", argv[2], " ", argv[3],
+                    "\" is off the screen", (char *) NULL);
+            return TCL_ERROR;
+        }
+        Tcl_SetObjResult(interp, EmulatorCell(n, row, col));
+    }
+    else if ((c == 'c') && (strncmp(argv[1], "cget", length) == 0)
+	&& (length >= 2)) {
+        if (argc != 3) {
+            Tcl_AppendResult(interp, "wrong # args: should be \"",
+                    argv[0], " cget option\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+        return Ck_ConfigureValue(interp, emuPtr->winPtr, emulatorConfigSpecs,
+                (char *) emuPtr, argv[2], 0);
+    }
+    else if ((c == 'c') && (strncmp(argv[1], "configure", length) == 0)
+	&& (length >= 2)) {
+        if (argc == 2) {
+            return Ck_ConfigureInfo(interp, emuPtr->winPtr,
+                    emulatorConfigSpecs, (char *) emuPtr, (char *) NULL, 0);
+        } else if (argc == 3) {
+            return Ck_ConfigureInfo(interp, emuPtr->winPtr,
+                    emulatorConfigSpecs, (char *) emuPtr, argv[2], 0);
+        }
+        return ConfigureEmulator(interp, emuPtr, argc-2, argv+2,
+                CK_CONFIG_ARGV_ONLY);
+    }
+    else if ((c == 'c') && (strncmp(argv[1], "cursor", length) == 0)
+	&& (length >= 2)) {
+        char buf[2 * TCL_INTEGER_SPACE + 1];
+
+        if (argc != 2) {
+            Tcl_AppendResult(interp, "wrong # args: should be \"",
+                    argv[0], " cursor\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+        sprintf(buf, "%d %d", n->s->cy, n->s->cx);
+        Tcl_SetResult(interp, buf, TCL_VOLATILE);
+    }
+    else if ((c == 'd') && (strncmp(argv[1], "destroy", length) == 0)) {
+        if (argc != 2) {
+            Tcl_AppendResult(interp, "wrong # args: should be \"",
+                    argv[0], " destroy\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+        Tcl_DeleteCommandFromToken(interp, emuPtr->cmd);
+    }
+    else if ((c == 'f') && (strncmp(argv[1], "feed", length) == 0)) {
+        Tcl_DString data, replies;
+
+        if (argc != 3) {
+            Tcl_AppendResult(interp, "wrong # args: should be \"",
+                    argv[0], " feed data\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+
+        /*
+         * The data is given to the parser in the system encoding, as
+         * a program would write it: the UTF-8 of Tcl strings encodes
+         * NUL as two bytes.  What the emulator answers (device
+         * attributes, cursor position reports...) is the result,
+         * there is no host to write it to.
+         */
+
+        Tcl_UtfToExternalDString(NULL, argv[2], -1, &data);
+        Tcl_DStringInit(&replies);
+        n->replies = &replies;
+        vtwrite(&n->vp, Tcl_DStringValue(&data), Tcl_DStringLength(&data));
+        n->replies = NULL;
+        Tcl_DStringFree(&data);
+        Tcl_DStringResult(interp, &replies);
+        if (emuPtr->attached != NULL) {
+            TerminalPostRedisplay(emuPtr->attached);
+        }
+    }
+    else if ((c == 'l') && (strncmp(argv[1], "line", length) == 0)) {
+        LTEXT t = {NULL, NULL, 0, 0};
+        Tcl_DString ds;
+        int line;
+
+        if (argc != 3) {
+            Tcl_AppendResult(interp, "wrong # args: should be \"",
+                    argv[0], " line row\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+        if (Tcl_GetInt(interp, argv[2], &row) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        line = HISTLINES(n) + row;
+        if (line < 0 || row >= n->h) {
+            Tcl_AppendResult(interp, "no line \"", argv[2], "\"",
+                    (char *) NULL);
+            return TCL_ERROR;
+        }
+        if (!vtlinetext(n, line, &t)) {
+            free(t.chars);
+            free(t.cols);
+            Tcl_AppendResult(interp, "out of memory", (char *) NULL);
+            return TCL_ERROR;
+        }
+        Tcl_DStringInit(&ds);
+        Tcl_UniCharToUtfDString(t.chars, t.len, &ds);
+        Tcl_DStringResult(interp, &ds);
+        free(t.chars);
+        free(t.cols);
+    }
+    else if ((c == 'p') && (strncmp(argv[1], "pid", length) == 0)) {
+        if (argc != 2) {
+            Tcl_AppendResult(interp, "wrong # args: should be \"",
+                    argv[0], " pid\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+        if (n->pid > 0) {
+            Tcl_SetObjResult(interp, Tcl_NewIntObj((int) n->pid));
+        }
+    }
+    else if ((c == 'r') && (strncmp(argv[1], "reset", length) == 0)) {
+        if (argc != 2) {
+            Tcl_AppendResult(interp, "wrong # args: should be \"",
+                    argv[0], " reset\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+        vtreset(n);
+        if (emuPtr->attached != NULL) {
+            TerminalPostRedisplay(emuPtr->attached);
+        }
+    }
+    else if ((c == 's') && (strncmp(argv[1], "saved", length) == 0)
+	&& (length >= 2)) {
+        if (argc != 2) {
+            Tcl_AppendResult(interp, "wrong # args: should be \"",
+                    argv[0], " saved\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+        Tcl_SetObjResult(interp, Tcl_NewIntObj(HISTLINES(n)));
+    }
+    else if ((c == 's') && (strncmp(argv[1], "send", length) == 0)
+	&& (length >= 2)) {
+        if (argc != 3) {
+            Tcl_AppendResult(interp, "wrong # args: should be \"",
+                    argv[0], " send data\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+        if (n->pt < 0) {
+            Tcl_AppendResult(interp, "emulator \"", argv[0],
+                    "\" runs no program", (char *) NULL);
+            return TCL_ERROR;
+        }
+        SENDN(n, argv[2], strlen(argv[2]));
+    }
+    else if ((c == 's') && (strncmp(argv[1], "screen", length) == 0)
+	&& (length >= 2)) {
+        if (argc != 2) {
+            Tcl_AppendResult(interp, "wrong # args: should be \"",
+                    argv[0], " screen\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+        Tcl_SetResult(interp, (n->s == &n->alt)? "alternate" : "primary",
+                TCL_STATIC);
+    }
+    else {
+        Tcl_AppendResult(interp, "bad option \"", argv[1],
+                "\": must be cell, cget, configure, cursor, destroy, ",
+                "feed, line, pid, reset, saved, screen, or send",
+                (char *) NULL);
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EmulatorDeletedProc --
+ *
+ *      This procedure is invoked when an emulator's command is
+ *      deleted, either by its destroy option or by renaming or
+ *      deleting the command.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The emulator's screens and saved lines are freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+EmulatorDeletedProc(clientData)
+    ClientData clientData;      /* Information about emulator. */
+{
+    Emulator *emuPtr = (Emulator *) clientData;
+
+    if (emuPtr->attached != NULL) {
+        TerminalDetach(emuPtr->attached);
+    }
+    if (emuPtr->node != NULL) {
+        vthangup(emuPtr->node);
+        vtfreenode(emuPtr->node);
+    }
+    Ck_FreeOptions(emulatorConfigSpecs, (char *) emuPtr, 0);
+    ckfree((char *) emuPtr);
+}
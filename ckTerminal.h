@@ -0,0 +1,321 @@
+/*
+ * ckTerminal.h --
+ *
+ *	Declarations shared among the files that implement terminal
+ *	widgets and emulators: the escape sequence parser, the screens
+ *	kept in memory cell by cell and the lines saved off them.
+ *
+ * Copyright (c) 2019 VCA
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ */
+
+#ifndef _CKTERMINAL_H
+#define _CKTERMINAL_H
+
+#ifndef _CK
+#include "ck.h"
+#endif
+
+/* Copyright 2017 - 2019 Rob King <jking@deadpixi.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <sys/types.h>
+#include <wchar.h>
+
+
+/**** CONFIGURATION
+ * VTPARSER_BAD_CHAR is the character that will be displayed when
+ * an application sends an invalid multibyte sequence to the terminal.
+ */
+#ifndef VTPARSER_BAD_CHAR
+#ifdef __STDC_ISO_10646__
+#define VTPARSER_BAD_CHAR ((wchar_t)0xfffd)
+#else
+#define VTPARSER_BAD_CHAR L'?'
+#endif
+#endif
+
+/**** DATA TYPES */
+#define MAXPARAM    16
+#define MAXCALLBACK 128
+#define MAXOSC      100
+#define MAXBUF      100
+#define MAXRUN      256
+
+typedef struct VTPARSER VTPARSER;
+typedef struct STATE STATE;
+typedef void (*VTCALLBACK)(VTPARSER *v, void *p, wchar_t w, wchar_t iw,
+                           int argc, int *argv, const wchar_t *osc);
+
+struct VTPARSER {
+  STATE *s;
+  int narg;
+  int nosc;
+  int args[MAXPARAM];
+  int inter;
+  wchar_t oscbuf[MAXOSC + 1];
+  mbstate_t ms;
+  void *p;
+  VTCALLBACK print;
+  VTCALLBACK printrun;   /* optional, gets argc chars of text in osc */
+  VTCALLBACK osc;
+  VTCALLBACK cons[MAXCALLBACK];
+  VTCALLBACK escs[MAXCALLBACK];
+  VTCALLBACK csis[MAXCALLBACK];
+};
+
+typedef enum
+  {
+   VTPARSER_CONTROL,
+   VTPARSER_ESCAPE,
+   VTPARSER_CSI,
+   VTPARSER_OSC,
+   VTPARSER_PRINT,
+   VTPARSER_PRINTRUN
+  } VtEvent;
+
+/**** FUNCTIONS */
+VTCALLBACK
+vtonevent(VTPARSER *vp, VtEvent t, wchar_t w, VTCALLBACK cb);
+
+void
+vtwrite(VTPARSER *vp, const char *s, size_t n);
+
+/* The path for the wide-character curses library. */
+#ifndef NCURSESW_INCLUDE_H
+#if defined(__APPLE__) || !defined(__linux__) || defined(__FreeBSD__)
+#define NCURSESW_INCLUDE_H <curses.h>
+#else
+#define NCURSESW_INCLUDE_H <ncursesw/curses.h>
+#endif
+#endif
+#include NCURSESW_INCLUDE_H
+
+
+#define MIN(x, y) ((x) < (y)? (x) : (y))
+#define HISTROWS(n) ((n)->s == &(n)->pri? (n)->hist.rows : 0)
+#define MAX(x, y) ((x) > (y)? (x) : (y))
+
+
+/*** DATA TYPES */
+
+/*
+ * A cell of a screen. The right half of a double width character is a
+ * cell of its own, with no character.
+ */
+typedef struct CELL CELL;
+struct CELL {
+  wchar_t ch[CCHARW_MAX]; /* character followed by combining characters,
+			   * ch[0] is 0 in the right half of a double
+			   * width character */
+  attr_t attr;            /* video attributes, without color */
+  short fg, bg;           /* colors, -1 for the default ones */
+};
+
+/*
+ * The screens are kept in memory, as arrays of cells; the terminal
+ * widget an emulator is attached to only draws them.
+ */
+typedef struct SCRN SCRN;
+struct SCRN {
+  int sy;        /* saved cursor y position */
+  int sx;        /* saved cursor x position */
+  int vis;
+  int off;        /* Offset of the view, counted in lines from the
+		   * oldest saved line (see HIST) */
+  int cy, cx;     /* cursor position */
+  int top, bot;   /* scrolling region, rows top to bot */
+  int rows, cols; /* size of the screen */
+  CELL *cells;    /* rows * cols cells, row after row */
+  bool *dirty;    /* rows changed since they were drawn */
+  short wbg;      /* window background */
+  short wfg;      /* window foreground */
+  short fg;       /* current foreground color */
+  short bg;       /* current background color */
+  short sfg;      /* saved foreground */
+  short sbg;      /* saved background */
+  bool insert;
+  bool oxenl;     /* saved xenl */
+  bool xenl;
+  bool saved;     /* if true saved cursor done */
+  attr_t attr;    /* current attributes */
+  attr_t sattr;   /* saved attributes */
+};
+
+/*
+ * Lines scrolled off the top of the primary screen are encoded once
+ * into a HLINE: the characters of the line
+ * grouped in runs sharing the same attributes and colors, without
+ * the trailing blanks. Runs made only of ASCII characters store one
+ * byte per character. Rows joined by autowrap are saved as a single
+ * logical line, which is wrapped again at the current width when
+ * displayed.
+ */
+typedef struct HRUN HRUN;
+struct HRUN {
+  attr_t attr;          /* video attributes of the run */
+  short fg, bg;         /* colors of the run */
+  unsigned short len;   /* number of characters in the run */
+  unsigned short wide;  /* characters stored as wchar_t, not bytes */
+};
+
+typedef struct HLINE HLINE;
+struct HLINE {
+  int size;             /* number of bytes allocated for the line */
+  int cols;             /* width of the line in cells */
+  int wides;            /* number of double width characters */
+  int nruns;            /* number of runs following the header */
+  unsigned long chars;  /* characters of the line folded to lower case,
+			 * one bit per hashed code: a line missing a bit
+			 * of the pattern is not searched */
+  HRUN fill;            /* attributes and colors of the trailing blanks */
+};
+
+typedef struct HIST HIST;
+struct HIST {
+  HLINE **lines;        /* ring of saved lines, allocated on first use */
+  int space;            /* number of slots in lines */
+  int first;            /* slot of the oldest line */
+  int count;            /* number of saved lines */
+  size_t bytes;         /* memory used by the saved lines */
+  bool open;            /* newest line continues on the screen */
+  int width;            /* width the following counts are for */
+  int rows;             /* number of rows taken by the saved lines */
+  int cline, crow;      /* a line and its first row, kept to find
+			 * the line shown on a given row quickly */
+  long base;            /* lines dropped since the terminal started,
+			 * search line numbers do not change when the
+			 * oldest lines are dropped */
+};
+
+/*
+ * The text of a line as it is searched: its characters and the cell
+ * column of each of them, cols[len] being the column after the last.
+ */
+typedef struct LTEXT LTEXT;
+struct LTEXT {
+  Tcl_UniChar *chars;   /* characters of the line */
+  int *cols;            /* column of each character */
+  int len;              /* number of characters */
+  int space;            /* number of characters allocated */
+};
+
+#define LINEROWS(l, w) ((l)->wides? vtlinerows(l, w) : \
+			(l)->cols <= (w)? 1 : ((l)->cols + (w) - 1) / (w))
+#define MAXLINECOLS 32768 /* longer logical lines are split */
+#define LONGBITS (8 * sizeof(unsigned long))
+#define CHARBIT(c) \
+  (1UL << ((((unsigned int) towlower(c) * 2654435761U) >> 24) % LONGBITS))
+#define HISTLINES(n) ((n)->s == &(n)->pri? (n)->hist.count : 0)
+
+/*
+ * Values of the wrap flags of the rows of the primary screen. A row
+ * is PADDED when a double width character that did not fit at its
+ * end was moved to the next row, leaving its last cell blank.
+ */
+#define WRAPPED 1
+#define PADDED  2
+
+typedef struct NODE NODE;
+struct NODE {
+  int h;        /* height of terminal */
+  int w;        /* width of terminal */
+  int pt;       /* Pseudo-TTY bound to subprocess (i.e. shell) */
+  pid_t pid;    /* subprocess, -1 if none */
+  int modes;    /* mouse reporting and bracketed paste asked for by
+		 * the subprocess, see MOUSE_REPORT and BRACKETED_PASTE */
+  int ntabs;    /* number of tabs */
+  bool *tabs;   /* dynamically allocated tab stops array */
+  bool pnm;
+  bool decom;
+  bool am;
+  bool lnm;
+  wchar_t repc;  /* char to repeat */
+  SCRN pri;      /* primary screen */
+  SCRN alt;      /* alternate screen */
+  SCRN *s;       /* active screen , points to pri or alt member */
+  wchar_t *g0, *g1, *g2, *g3, *gc, *gs, *sgc, *sgs;
+  VTPARSER vp;   /* used to parse input stream from bound pseudo-TTY */
+  HIST hist;     /* lines scrolled off the primary screen */
+  char *wrapped; /* rows of the primary screen continued by autowrap,
+		  * WRAPPED or PADDED */
+  int nwrapped;  /* number of entries in wrapped */
+
+  char *iobuf;         /* buffer for character input, grows up to
+			* the read budget of the terminal */
+  size_t iosize;       /* allocated size of iobuf */
+  bool cmd;            /* true if in command mode */
+
+  int scrollback;       /* most lines kept in hist, 0 for none */
+  int budget;           /* most bytes kept in hist, 0 for no limit */
+  Tcl_DString *replies; /* when not NULL, collects what the emulator
+			 * answers instead of writing it to pt */
+  
+  void *clientData;    /* pointer to extra data */
+};
+
+/*
+ * Modes asked for by the program on the pty, kept in the modes of
+ * its node: mouse reporting and bracketed paste.
+ */
+
+#define MOUSE_REPORT_1000      128  /* if set mouse buttons events are forwarded */
+#define MOUSE_REPORT_1001      256  /* unsupported mouse mode */
+#define MOUSE_REPORT_1002      512  /* if set mouse motion & buttons events are forwarded */
+#define MOUSE_REPORT_1003      (MOUSE_REPORT_1000 | MOUSE_REPORT_1002)
+#define BRACKETED_PASTE       1024  /* if set pasted text is sent enclosed in ESC[200~ ESC[201~ */
+
+#define MOUSE_REPORT (MOUSE_REPORT_1000 | MOUSE_REPORT_1002 | MOUSE_REPORT_1003)
+
+#define CELLAT(s, y, x) ((s)->cells + (y) * (s)->cols + (x))
+
+/*
+ * What the emulator answers goes to the pty of the node, or to its
+ * replies when they are collected.
+ */
+
+#define SENDN(n, s, c)						\
+  ((n)->replies? (void) Tcl_DStringAppend((n)->replies, s, c)	\
+   : (void) vtsafewrite((n)->pt, s, c))
+#define SEND(n, s) SENDN(n, s, strlen(s))
+
+/*
+ * Procedures shared by the terminal widget and the emulator, the
+ * first one is implemented in ckTerminal.c, the others in ckTermEmu.c.
+ */
+
+void   vtfixcursor(NODE *n);
+
+NODE * vtnewemu(int h, int w, int fg, int bg);
+void   vtfreenode(NODE *n);
+void   vtreset(NODE *n);
+void   vtreshape(NODE *n, int h, int w);
+bool   vtspawn(NODE *n, const char *term, int argc, char **argv);
+size_t vtptyread(NODE *n, size_t budget, bool *eof);
+void   vthangup(NODE *n);
+int    vtsafewrite(int fd, const char *b, size_t n);
+
+HLINE *vthistline(NODE *n, int i);
+int    vthistfind(NODE *n, int row, int *seg);
+int    vthistrow(NODE *n, int line);
+void   vthistrewrap(NODE *n);
+int    vtlinepos(HLINE *l, int w, int col);
+int    vtlinerows(HLINE *l, int w);
+bool   vtlinetext(NODE *n, int i, LTEXT *t);
+
+#endif /* _CKTERMINAL_H */
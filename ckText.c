@@ -27,6 +27,9 @@
 static Ck_ConfigSpec configSpecs[] = {
     {CK_CONFIG_ATTR, "-attributes", "attributes", "Attributes",
 	DEF_TEXT_ATTR, Ck_Offset(CkText, attr), 0},
+    {CK_CONFIG_BOOLEAN, "-autoseparators", "autoSeparators",
+	"AutoSeparators", DEF_TEXT_AUTO_SEPARATORS,
+	Ck_Offset(CkText, autoSeparators), 0},
     {CK_CONFIG_COLOR, "-background", "background", "Background",
 	DEF_TEXT_BG_COLOR, Ck_Offset(CkText, bg), CK_CONFIG_COLOR_ONLY},
     {CK_CONFIG_COLOR, "-background", "background", "Background",
@@ -39,6 +42,10 @@ static Ck_ConfigSpec configSpecs[] = {
 	DEF_TEXT_FG, Ck_Offset(CkText, fg), 0},
     {CK_CONFIG_COORD, "-height", "height", "Height",
 	DEF_TEXT_HEIGHT, Ck_Offset(CkText, height), 0},
+    {CK_CONFIG_INT, "-maxlines", "maxLines", "MaxLines",
+	DEF_TEXT_MAX_LINES, Ck_Offset(CkText, maxLines), 0},
+    {CK_CONFIG_INT, "-maxundo", "maxUndo", "MaxUndo",
+	DEF_TEXT_MAX_UNDO, Ck_Offset(CkText, maxUndo), 0},
     {CK_CONFIG_ATTR, "-selectattributes", "selectAttributes",
         "SelectAttributes", DEF_TEXT_SELECT_ATTR_COLOR,
         Ck_Offset(CkText, selAttr), CK_CONFIG_COLOR_ONLY},
@@ -64,6 +71,8 @@ static Ck_ConfigSpec configSpecs[] = {
     {CK_CONFIG_STRING, "-takefocus", "takeFocus", "TakeFocus",
 	DEF_TEXT_TAKE_FOCUS, Ck_Offset(CkText, takeFocus),
 	CK_CONFIG_NULL_OK},
+    {CK_CONFIG_BOOLEAN, "-undo", "undo", "Undo",
+	DEF_TEXT_UNDO, Ck_Offset(CkText, undo), 0},
     {CK_CONFIG_COORD, "-width", "width", "Width",
 	DEF_TEXT_WIDTH, Ck_Offset(CkText, width), 0},
     {CK_CONFIG_UID, "-wrap", "wrap", "Wrap",
@@ -95,25 +104,158 @@ Ck_Uid ckTextWordUid = NULL;
 
 int ckTextDebug = 0;
 
+/*
+ * Number of characters read from a channel at a time by the "load"
+ * and "append" widget commands:
+ */
+
+#define APPEND_CHUNK 65536
+
+/*
+ * Most chunks read at a time from a channel appended as its data
+ * arrives, so that a producer faster than the widget can't keep the
+ * event loop from serving anything else:
+ */
+
+#define TAIL_CHUNKS 4
+
+/*
+ * A record of the undo or redo list of a text widget.  Positions are
+ * kept as line numbers and byte offsets, which stay right as long as
+ * the edits are undone and redone in order.
+ */
+
+typedef struct CkTextEdit {
+    int type;			/* EDIT_INSERT, EDIT_DELETE or
+				 * EDIT_SEPARATOR, which ends a group of
+				 * edits undone together. */
+    struct CkTextEdit *nextPtr;	/* Older record in the undo list, next
+				 * record to redo in the redo list. */
+    struct CkTextEdit *prevPtr;	/* Newer record in the undo list. */
+    int line1, byte1;		/* Where the characters start. */
+    int line2, byte2;		/* Where they end when in the text. */
+    int length;			/* Number of bytes in chars. */
+    int space;			/* Number of bytes allocated for chars. */
+    char *chars;		/* Characters inserted or deleted, null
+				 * terminated.  Malloc-ed, may be NULL. */
+} CkTextEdit;
+
+#define EDIT_SEPARATOR	0
+#define EDIT_INSERT	1
+#define EDIT_DELETE	2
+
+/*
+ * The state of a "search" widget command, and the matches found in
+ * a line or range of text before they are reported:
+ */
+
+typedef struct TextSearch {
+    int backwards;		/* Non-zero means search backwards. */
+    int all;			/* Non-zero means report all matches. */
+    int searchWholeText;	/* Zero means stop at stopIndex. */
+    CkTextIndex stopIndex;	/* Where the search stops. */
+    Tcl_Obj *resultObj;		/* List of the indices of the matches. */
+    Tcl_Obj *countObj;		/* List of their lengths in characters. */
+} TextSearch;
+
+typedef struct SearchMatch {
+    int first;			/* Byte offset of the match. */
+    int length;			/* Its length in bytes. */
+} SearchMatch;
+
+typedef struct SearchLine {
+    CkTextLine *linePtr;	/* Line of a range searched as a whole. */
+    int start;			/* Offset of its characters in the range. */
+    int skipped;		/* Bytes of them before the range. */
+} SearchLine;
+
+/*
+ * Position in a string kept to convert between the character offsets
+ * of the regular expression engine and byte offsets:
+ */
+
+typedef struct UtfCursor {
+    char *string;		/* String converted. */
+    int byteIndex;		/* Byte offset of the position. */
+    int charIndex;		/* Character offset of the position. */
+} UtfCursor;
+
 /*
  * Forward declarations for procedures defined later in this file:
  */
 
+static int		AppendChannel _ANSI_ARGS_((CkText *textPtr,
+			    Tcl_Channel chan, int maxLines, int maxChunks));
+static void		AppendChars _ANSI_ARGS_((CkText *textPtr,
+			    char *string, int maxLines));
 static int		ConfigureText _ANSI_ARGS_((Tcl_Interp *interp,
 			    CkText *textPtr, int argc, char **argv, int flags));
 static int		DeleteChars _ANSI_ARGS_((CkText *textPtr,
-			    char *index1String, char *index2String));
+			    char *index1String, char *index2String,
+			    CkTextIndex *indexPtr1, CkTextIndex *indexPtr2));
 static void		DestroyText _ANSI_ARGS_((ClientData clientData));
+static void		EditAddChars _ANSI_ARGS_((CkText *textPtr,
+			    CkTextEdit *editPtr, int offset, char *string,
+			    int length));
+static void		EditDropOldest _ANSI_ARGS_((CkText *textPtr));
+static void		EditEnd _ANSI_ARGS_((int line, int byteIndex,
+			    char *string, int length, int *line2Ptr,
+			    int *byte2Ptr));
+static void		EditFree _ANSI_ARGS_((CkText *textPtr,
+			    CkTextEdit *editPtr));
+static int		EditGetChars _ANSI_ARGS_((CkTextIndex *index1Ptr,
+			    CkTextIndex *index2Ptr, Tcl_DString *dsPtr));
+static void		EditLimit _ANSI_ARGS_((CkText *textPtr));
+static void		EditModified _ANSI_ARGS_((CkText *textPtr,
+			    int modified));
+static CkTextEdit *	EditNew _ANSI_ARGS_((CkText *textPtr, int type));
+static CkTextEdit *	EditPop _ANSI_ARGS_((CkText *textPtr));
+static void		EditPush _ANSI_ARGS_((CkText *textPtr,
+			    CkTextEdit *editPtr));
+static void		EditRecord _ANSI_ARGS_((CkText *textPtr, int type,
+			    int line, int byteIndex, char *string,
+			    int length));
+static int		EditReplay _ANSI_ARGS_((CkText *textPtr, int undo));
+static void		EditReset _ANSI_ARGS_((CkText *textPtr));
+static void		EditSeparator _ANSI_ARGS_((CkText *textPtr));
+static int		EndVisible _ANSI_ARGS_((CkText *textPtr));
 static void		InsertChars _ANSI_ARGS_((CkText *textPtr,
 			    CkTextIndex *indexPtr, char *string));
+static void		SeeEnd _ANSI_ARGS_((CkText *textPtr));
+static int		SearchFound _ANSI_ARGS_((TextSearch *searchPtr,
+			    CkTextIndex *indexPtr, int numChars));
+static int		SearchLineIndex _ANSI_ARGS_((CkTextLine *linePtr,
+			    int textIndex));
+static int		SearchRange _ANSI_ARGS_((CkText *textPtr,
+			    Tcl_Interp *interp, TextSearch *searchPtr,
+			    Tcl_RegExp regexp, CkTextIndex *fromPtr,
+			    CkTextIndex *toPtr, CkTextIndex *limitPtr));
+static int		SearchRangeLine _ANSI_ARGS_((SearchLine *lines,
+			    int lastLine, int byteIndex));
+static void		StartTail _ANSI_ARGS_((CkText *textPtr,
+			    Tcl_Channel chan, int maxLines));
+static void		StopTail _ANSI_ARGS_((CkText *textPtr));
+static void		TailClosedProc _ANSI_ARGS_((ClientData clientData));
+static void		TailProc _ANSI_ARGS_((ClientData clientData,
+			    int mask));
 static void		TextCmdDeletedProc _ANSI_ARGS_((
 			    ClientData clientData));
+static int		TextEditCmd _ANSI_ARGS_((CkText *textPtr,
+			    Tcl_Interp *interp, int argc, char **argv));
 static void		TextEventProc _ANSI_ARGS_((ClientData clientData,
 			    CkEvent *eventPtr));
+static int		TextLoadCmd _ANSI_ARGS_((CkText *textPtr,
+			    Tcl_Interp *interp, int argc, char **argv));
 static int		TextSearchCmd _ANSI_ARGS_((CkText *textPtr,
 			    Tcl_Interp *interp, int argc, char **argv));
 static int		TextWidgetCmd _ANSI_ARGS_((ClientData clientData,
 			    Tcl_Interp *interp, int argc, char **argv));
+static void		TrimText _ANSI_ARGS_((CkText *textPtr,
+			    int maxLines));
+static int		UtfCursorToByte _ANSI_ARGS_((UtfCursor *cursorPtr,
+			    int charIndex));
+static int		UtfCursorToChar _ANSI_ARGS_((UtfCursor *cursorPtr,
+			    int byteIndex));
 
 /*
  *--------------------------------------------------------------
@@ -212,6 +354,17 @@ Ck_TextCmd(clientData, interp, argc, argv)
     textPtr->pickEvent.type = -1;
     textPtr->numCurTags = 0;
     textPtr->curTagArrayPtr = NULL;
+    textPtr->maxLines = 0;
+    textPtr->tailChannel = NULL;
+    textPtr->tailMaxLines = 0;
+    textPtr->undo = 0;
+    textPtr->maxUndo = 0;
+    textPtr->autoSeparators = 1;
+    textPtr->undoPtr = NULL;
+    textPtr->oldestUndoPtr = NULL;
+    textPtr->redoPtr = NULL;
+    textPtr->undoSize = 0;
+    textPtr->modified = 0;
     textPtr->takeFocus = NULL;
     textPtr->xScrollCmd = NULL;
     textPtr->yScrollCmd = NULL;
@@ -281,7 +434,9 @@ TextWidgetCmd(clientData, interp, argc, argv)
     Ck_Preserve((ClientData) textPtr);
     c = argv[1][0];
     length = strlen(argv[1]);
-    if ((c == 'b') && (strncmp(argv[1], "bbox", length) == 0)) {
+    if ((c == 'a') && (strncmp(argv[1], "append", length) == 0)) {
+	result = TextLoadCmd(textPtr, interp, argc, argv);
+    } else if ((c == 'b') && (strncmp(argv[1], "bbox", length) == 0)) {
 	int x, y, width, height;
 
 	if (argc != 3) {
@@ -394,7 +549,8 @@ TextWidgetCmd(clientData, interp, argc, argv)
 	}
 	if (textPtr->state == ckTextNormalUid) {
 	    result = DeleteChars(textPtr, argv[2],
-		    (argc == 4) ? argv[3] : (char *) NULL);
+		    (argc == 4) ? argv[3] : (char *) NULL,
+		    (CkTextIndex *) NULL, (CkTextIndex *) NULL);
 	}
     } else if ((c == 'd') && (strncmp(argv[1], "dlineinfo", length) == 0)
 	    && (length >= 2)) {
@@ -415,6 +571,8 @@ TextWidgetCmd(clientData, interp, argc, argv)
 	    sprintf(buf, "%d %d %d %d %d", x, y, width, height, base);
 	    Tcl_SetObjResult( interp, Tcl_NewStringObj( buf, -1));
 	}
+    } else if ((c == 'e') && (strncmp(argv[1], "edit", length) == 0)) {
+	result = TextEditCmd(textPtr, interp, argc, argv);
     } else if ((c == 'g') && (strncmp(argv[1], "get", length) == 0)) {
 	if ((argc != 3) && (argc != 4)) {
 	    Tcl_AppendResult(interp, "wrong # args: should be \"",
@@ -461,7 +619,11 @@ TextWidgetCmd(clientData, interp, argc, argv)
 			(char *) NULL);
 		segPtr->body.chars[last] = savedChar;
 	    }
+#if CK_USE_UTF
+	    CkTextIndexForwBytes(&index1, last-offset, &index1);
+#else
 	    CkTextIndexForwChars(&index1, last-offset, &index1);
+#endif
 	}
     } else if ((c == 'i') && (strncmp(argv[1], "index", length) == 0)
 	    && (length >= 3)) {
@@ -523,7 +685,10 @@ TextWidgetCmd(clientData, interp, argc, argv)
 		    index1 = index2;
 		}
 	    }
+	    TrimText(textPtr, textPtr->maxLines);
 	}
+    } else if ((c == 'l') && (strncmp(argv[1], "load", length) == 0)) {
+	result = TextLoadCmd(textPtr, interp, argc, argv);
     } else if ((c == 'm') && (strncmp(argv[1], "mark", length) == 0)) {
 	result = CkTextMarkCmd(textPtr, interp, argc, argv);
     } else if ((c == 's') && (strcmp(argv[1], "search") == 0)
@@ -544,9 +709,9 @@ TextWidgetCmd(clientData, interp, argc, argv)
 	result = CkTextYviewCmd(textPtr, interp, argc, argv);
     } else {
 	Tcl_AppendResult(interp, "bad option \"", argv[1],
-		"\":  must be bbox, cget, compare, configure, debug, delete, ",
-		"dlineinfo, get, index, insert, mark, scan, search, see, ",
-		"tag, window, xview, or yview",
+		"\":  must be append, bbox, cget, compare, configure, debug, ",
+		"delete, dlineinfo, edit, get, index, insert, load, mark, ",
+		"scan, search, see, tag, window, xview, or yview",
 		(char *) NULL);
 	result = TCL_ERROR;
     }
@@ -593,6 +758,7 @@ DestroyText(clientData)
 
     CkTextFreeDInfo(textPtr);
     CkBTreeDestroy(textPtr->tree);
+    EditReset(textPtr);
     for (hPtr = Tcl_FirstHashEntry(&textPtr->tagTable, &search);
 	    hPtr != NULL; hPtr = Tcl_NextHashEntry(&search)) {
 	tagPtr = (CkTextTag *) Tcl_GetHashValue(hPtr);
@@ -668,6 +834,11 @@ ConfigureText(interp, textPtr, argc, argv, flags)
 	textPtr->state = ckTextNormalUid;
 	return TCL_ERROR;
     }
+    if ((textPtr->state == ckTextNormalUid)
+	    && (textPtr->tailChannel != NULL)) {
+	Tcl_CreateChannelHandler(textPtr->tailChannel, TCL_READABLE,
+		TailProc, (ClientData) textPtr);
+    }
 
     if ((textPtr->wrapMode != ckTextCharUid)
 	    && (textPtr->wrapMode != ckTextNoneUid)
@@ -748,6 +919,8 @@ ConfigureText(interp, textPtr, argc, argv, flags)
     Ck_GeometryRequest(textPtr->winPtr, textPtr->width, textPtr->height);
 
     CkTextRelayoutWindow(textPtr);
+    TrimText(textPtr, textPtr->maxLines);
+    EditLimit(textPtr);
     return TCL_OK;
 }
 
@@ -788,6 +961,7 @@ TextEventProc(clientData, eventPtr)
 	}
 	CkTextRedrawRegion(textPtr, 0, 0, winPtr->width, winPtr->height);
     } else if (eventPtr->type == CK_EV_DESTROY) {
+	StopTail(textPtr);
         if (textPtr->winPtr != NULL) {
             textPtr->winPtr = NULL;
             Tcl_DeleteCommand(textPtr->interp,
@@ -889,6 +1063,16 @@ InsertChars(textPtr, indexPtr, string)
 	CkTextMakeIndex(textPtr->tree, lineIndex, 1000000, indexPtr);
 #endif
     }
+    if (*string == '\0') {
+	return;
+    }
+    if (!(textPtr->flags & EDIT_SUSPENDED)) {
+	if (textPtr->undo) {
+	    EditRecord(textPtr, EDIT_INSERT, lineIndex, indexPtr->charIndex,
+		    string, (int) strlen(string));
+	}
+	EditModified(textPtr, 1);
+    }
 
     /*
      * Notify the display module that lines are about to change, then do
@@ -924,14 +1108,20 @@ InsertChars(textPtr, indexPtr, string)
  */
 
 static int
-DeleteChars(textPtr, index1String, index2String)
+DeleteChars(textPtr, index1String, index2String, indexPtr1, indexPtr2)
     CkText *textPtr;		/* Overall information about text widget. */
     char *index1String;		/* String describing location of first
-				 * character to delete. */
+				 * character to delete.  NULL means use
+				 * *indexPtr1 instead. */
     char *index2String;		/* String describing location of last
-				 * character to delete.  NULL means just
-				 * delete the one character given by
-				 * index1String. */
+				 * character to delete.  NULL means use
+				 * *indexPtr2 instead, or just delete the
+				 * one character given by the first index
+				 * if indexPtr2 is NULL too. */
+    CkTextIndex *indexPtr1;	/* Index of first character to delete,
+				 * used if index1String is NULL. */
+    CkTextIndex *indexPtr2;	/* Index just after the last character to
+				 * delete, used if index2String is NULL. */
 {
     int line1, line2, line, charIndex, resetView;
     CkTextIndex index1, index2;
@@ -940,15 +1130,21 @@ DeleteChars(textPtr, index1String, index2String)
      * Parse the starting and stopping indices.
      */
 
-    if (CkTextGetIndex(textPtr->interp, textPtr, index1String, &index1)
-	    != TCL_OK) {
-	return TCL_ERROR;
+    if (index1String != NULL) {
+	if (CkTextGetIndex(textPtr->interp, textPtr, index1String, &index1)
+		!= TCL_OK) {
+	    return TCL_ERROR;
+	}
+    } else {
+	index1 = *indexPtr1;
     }
     if (index2String != NULL) {
 	if (CkTextGetIndex(textPtr->interp, textPtr, index2String, &index2)
 		!= TCL_OK) {
 	    return TCL_ERROR;
 	}
+    } else if (indexPtr2 != NULL) {
+	index2 = *indexPtr2;
     } else {
 	index2 = index1;
 	CkTextIndexForwChars(&index2, 1, &index2);
@@ -997,6 +1193,38 @@ DeleteChars(textPtr, index1String, index2String)
 	}
     }
 
+    /*
+     * Backing up may have left nothing to delete, as when only the
+     * final newline was asked for:  then the text isn't modified.
+     */
+
+    if (CkTextIndexCmp(&index1, &index2) >= 0) {
+	return TCL_OK;
+    }
+
+    /*
+     * Record the characters deleted so that the deletion can be undone.
+     * A range holding other segments than characters, such as embedded
+     * windows, can't be put back from the record, so the lists are
+     * emptied rather than left out of step with the text.
+     */
+
+    if (!(textPtr->flags & EDIT_SUSPENDED)) {
+	if (textPtr->undo) {
+	    Tcl_DString chars;
+
+	    Tcl_DStringInit(&chars);
+	    if (EditGetChars(&index1, &index2, &chars)) {
+		EditRecord(textPtr, EDIT_DELETE, line1, index1.charIndex,
+			Tcl_DStringValue(&chars), Tcl_DStringLength(&chars));
+	    } else {
+		EditReset(textPtr);
+	    }
+	    Tcl_DStringFree(&chars);
+	}
+	EditModified(textPtr, 1);
+    }
+
     /*
      * Tell the display what's about to happen so it can discard
      * obsolete display information, then do the deletion.  Also,
@@ -1066,10 +1294,11 @@ DeleteChars(textPtr, index1String, index2String)
 /*
  *----------------------------------------------------------------------
  *
- * TextSearchCmd --
+ * TextEditCmd --
  *
- *	This procedure is invoked to process the "search" widget command
- *	for text widgets.  See the user documentation for details on what
+ *	This procedure is invoked to process the "edit" widget command
+ *	for text widgets, which manages the undo and redo lists and the
+ *	modified flag.  See the user documentation for details on what
  *	it does.
  *
  * Results:
@@ -1082,205 +1311,1447 @@ DeleteChars(textPtr, index1String, index2String)
  */
 
 static int
-TextSearchCmd(textPtr, interp, argc, argv)
+TextEditCmd(textPtr, interp, argc, argv)
     CkText *textPtr;		/* Information about text widget. */
     Tcl_Interp *interp;		/* Current interpreter. */
     int argc;			/* Number of arguments. */
     char **argv;		/* Argument strings. */
 {
-    int backwards, exact, c, i, argsLeft, noCase, leftToScan;
+    int c, modified;
     size_t length;
-    int numLines, startingLine, startingChar, lineNum, firstChar, lastChar;
-    int code, matchLength, matchChar, passes, stopLine, searchWholeText;
-    int patLength;
-    char *arg, *pattern, *varName, *p, *startOfLine;
-    char buffer[20];
-    CkTextIndex index, stopIndex;
-    Tcl_DString line, patDString;
-    CkTextSegment *segPtr;
-    CkTextLine *linePtr;
-    char buf[256];
-    Tcl_RegExp regexp = NULL;		/* Initialization needed only to
-					 * prevent compiler warning. */
 
-    /*
-     * Parse switches and other arguments.
-     */
-
-    exact = 1;
-    backwards = 0;
-    noCase = 0;
-    varName = NULL;
-    for (i = 2; i < argc; i++) {
-	arg = argv[i];
-	if (arg[0] != '-') {
-	    break;
-	}
-	length = strlen(arg);
-	if (length < 2) {
-	    badSwitch:
-	    Tcl_AppendResult(interp, "bad switch \"", arg,
-		    "\": must be -forward, -backward, -exact, -regexp, ",
-		    "-nocase, -count, or --", (char *) NULL);
+    if (argc < 3) {
+	Tcl_AppendResult(interp, "wrong # args: should be \"",
+		argv[0], " edit option ?arg arg ...?\"", (char *) NULL);
+	return TCL_ERROR;
+    }
+    c = argv[2][0];
+    length = strlen(argv[2]);
+    if ((c == 'm') && (strncmp(argv[2], "modified", length) == 0)) {
+	if (argc > 4) {
+	    Tcl_AppendResult(interp, "wrong # args: should be \"",
+		    argv[0], " edit modified ?boolean?\"", (char *) NULL);
 	    return TCL_ERROR;
 	}
-	c = arg[1];
-	if ((c == 'b') && (strncmp(argv[i], "-backwards", length) == 0)) {
-	    backwards = 1;
-	} else if ((c == 'c') && (strncmp(argv[i], "-count", length) == 0)) {
-	    if (i >= (argc-1)) {
-	      Tcl_SetObjResult( interp, Tcl_NewStringObj( "no value given for \"-count\" option", -1));
-		return TCL_ERROR;
-	    }
-	    i++;
-	    varName = argv[i];
-	} else if ((c == 'e') && (strncmp(argv[i], "-exact", length) == 0)) {
-	    exact = 1;
-	} else if ((c == 'f') && (strncmp(argv[i], "-forwards", length) == 0)) {
-	    backwards = 0;
-	} else if ((c == 'n') && (strncmp(argv[i], "-nocase", length) == 0)) {
-	    noCase = 1;
-	} else if ((c == 'r') && (strncmp(argv[i], "-regexp", length) == 0)) {
-	    exact = 0;
-	} else if ((c == '-') && (strncmp(argv[i], "--", length) == 0)) {
-	    i++;
-	    break;
-	} else {
-	    goto badSwitch;
+	if (argc == 3) {
+	    Tcl_SetObjResult(interp, Tcl_NewBooleanObj(textPtr->modified));
+	    return TCL_OK;
+	}
+	if (Tcl_GetBoolean(interp, argv[3], &modified) != TCL_OK) {
+	    return TCL_ERROR;
 	}
+	EditModified(textPtr, modified);
+	return TCL_OK;
     }
-    argsLeft = argc - (i+2);
-    if ((argsLeft != 0) && (argsLeft != 1)) {
+    if (argc != 3) {
 	Tcl_AppendResult(interp, "wrong # args: should be \"",
-		argv[0], " search ?switches? pattern index ?stopIndex?",
+		argv[0], " edit ", argv[2], "\"", (char *) NULL);
+	return TCL_ERROR;
+    }
+    if ((c == 'r') && (strncmp(argv[2], "redo", length) == 0)
+	    && (length >= 3)) {
+	if ((textPtr->state == ckTextNormalUid)
+		&& (EditReplay(textPtr, 0) == 0)) {
+	    Tcl_AppendResult(interp, "nothing to redo", (char *) NULL);
+	    return TCL_ERROR;
+	}
+    } else if ((c == 'r') && (strncmp(argv[2], "reset", length) == 0)
+	    && (length >= 3)) {
+	EditReset(textPtr);
+    } else if ((c == 's') && (strncmp(argv[2], "separator", length) == 0)) {
+	EditSeparator(textPtr);
+    } else if ((c == 'u') && (strncmp(argv[2], "undo", length) == 0)) {
+	if ((textPtr->state == ckTextNormalUid)
+		&& (EditReplay(textPtr, 1) == 0)) {
+	    Tcl_AppendResult(interp, "nothing to undo", (char *) NULL);
+	    return TCL_ERROR;
+	}
+    } else {
+	Tcl_AppendResult(interp, "bad edit option \"", argv[2],
+		"\": must be modified, redo, reset, separator, or undo",
 		(char *) NULL);
 	return TCL_ERROR;
     }
-    pattern = argv[i];
+    return TCL_OK;
+}
 
-    /*
-     * Convert the pattern to lower-case if we're supposed to ignore case.
-     */
+/*
+ *----------------------------------------------------------------------
+ *
+ * EditRecord --
+ *
+ *	Records an insertion or a deletion in the undo list of a text
+ *	widget.  An edit next to the previous one of the same kind, as
+ *	when typing or erasing characters, extends its record.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The redo list is emptied and the oldest records may be dropped
+ *	to obey the -maxundo option.
+ *
+ *----------------------------------------------------------------------
+ */
 
-    if (noCase) {
-	Tcl_DStringInit(&patDString);
-	Tcl_DStringAppend(&patDString, pattern, -1);
-	pattern = Tcl_DStringValue(&patDString);
-#if CK_USE_UTF
-	Tcl_UtfToLower(pattern);
-#else
-	for (p = pattern; *p != 0; p++) {
-	    if (isupper((unsigned char) *p)) {
-		*p = tolower((unsigned char) *p);
-	    }
-	}
-#endif
-    }
+static void
+EditRecord(textPtr, type, line, byteIndex, string, length)
+    CkText *textPtr;		/* Overall information about text widget. */
+    int type;			/* EDIT_INSERT or EDIT_DELETE. */
+    int line, byteIndex;	/* Where the characters start. */
+    char *string;		/* Characters inserted or deleted. */
+    int length;			/* Number of bytes in string. */
+{
+    CkTextEdit *editPtr;
+    int line2, byte2;
 
-    if (CkTextGetIndex(interp, textPtr, argv[i+1], &index) != TCL_OK) {
-	return TCL_ERROR;
+    while (textPtr->redoPtr != NULL) {
+	editPtr = textPtr->redoPtr;
+	textPtr->redoPtr = editPtr->nextPtr;
+	EditFree(textPtr, editPtr);
     }
-    numLines = CkBTreeNumLines(textPtr->tree);
-    startingLine = CkBTreeLineIndex(index.linePtr);
-    startingChar = index.charIndex;
-    if (startingLine >= numLines) {
-	if (backwards) {
-	    startingLine = CkBTreeNumLines(textPtr->tree) - 1;
-	    startingChar = CkBTreeCharsInLine(CkBTreeFindLine(textPtr->tree,
-		    startingLine));
-	} else {
-	    startingLine = 0;
-	    startingChar = 0;
+    EditEnd(line, byteIndex, string, length, &line2, &byte2);
+    editPtr = textPtr->undoPtr;
+    if ((editPtr != NULL) && (editPtr->type == type)) {
+	if ((type == EDIT_INSERT) && (line == editPtr->line2)
+		&& (byteIndex == editPtr->byte2)) {
+	    EditAddChars(textPtr, editPtr, editPtr->length, string, length);
+	    editPtr->line2 = line2;
+	    editPtr->byte2 = byte2;
+	    goto done;
 	}
-    }
-    if (argsLeft == 1) {
-	if (CkTextGetIndex(interp, textPtr, argv[i+2], &stopIndex) != TCL_OK) {
-	    return TCL_ERROR;
+	if ((type == EDIT_DELETE) && (line == editPtr->line1)
+		&& (byteIndex == editPtr->byte1)) {
+	    EditAddChars(textPtr, editPtr, editPtr->length, string, length);
+	    EditEnd(editPtr->line2, editPtr->byte2, string, length,
+		    &editPtr->line2, &editPtr->byte2);
+	    goto done;
 	}
-	stopLine = CkBTreeLineIndex(stopIndex.linePtr);
-	if (!backwards && (stopLine == numLines)) {
-	    stopLine = numLines-1;
+	if ((type == EDIT_DELETE) && (line2 == editPtr->line1)
+		&& (byte2 == editPtr->byte1)) {
+	    EditAddChars(textPtr, editPtr, 0, string, length);
+	    editPtr->line1 = line;
+	    editPtr->byte1 = byteIndex;
+	    goto done;
 	}
-	searchWholeText = 0;
-    } else {
-	stopLine = 0;
-	searchWholeText = 1;
     }
+    if (textPtr->autoSeparators) {
+	EditSeparator(textPtr);
+    }
+    editPtr = EditNew(textPtr, type);
+    EditPush(textPtr, editPtr);
+    editPtr->line1 = line;
+    editPtr->byte1 = byteIndex;
+    editPtr->line2 = line2;
+    editPtr->byte2 = byte2;
+    EditAddChars(textPtr, editPtr, 0, string, length);
+
+done:
+    EditLimit(textPtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EditReplay --
+ *
+ *	Undoes the most recent group of edits of a text widget, the
+ *	ones since the last separator, or redoes the last group undone.
+ *
+ * Results:
+ *	Returns 0 if there was nothing to undo or redo, 1 otherwise.
+ *
+ * Side effects:
+ *	The text is modified, the records move to the other list and
+ *	the insertion cursor is put where the last change was made.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+EditReplay(textPtr, undo)
+    CkText *textPtr;		/* Overall information about text widget. */
+    int undo;			/* Non-zero means undo, zero means redo. */
+{
+    CkTextEdit *editPtr;
+    CkTextIndex index1, index2;
 
     /*
-     * Scan through all of the lines of the text circularly, starting
-     * at the given index.
+     * Undone groups are separated in the redo list, and redone ones
+     * in the undo list, by separators that are dropped when met on
+     * the way back.
      */
 
-    matchLength = patLength = 0;	/* Only needed to prevent compiler
-					 * warnings. */
-    if (exact) {
-	patLength = strlen(pattern);
+    if (undo) {
+	while ((textPtr->undoPtr != NULL)
+		&& (textPtr->undoPtr->type == EDIT_SEPARATOR)) {
+	    EditFree(textPtr, EditPop(textPtr));
+	}
+	if (textPtr->undoPtr == NULL) {
+	    return 0;
+	}
+	if (textPtr->redoPtr != NULL) {
+	    editPtr = EditNew(textPtr, EDIT_SEPARATOR);
+	    editPtr->nextPtr = textPtr->redoPtr;
+	    textPtr->redoPtr = editPtr;
+	}
     } else {
-	regexp = Tcl_RegExpCompile(interp, pattern);
-	if (regexp == NULL) {
-	    return TCL_ERROR;
+	while ((textPtr->redoPtr != NULL)
+		&& (textPtr->redoPtr->type == EDIT_SEPARATOR)) {
+	    editPtr = textPtr->redoPtr;
+	    textPtr->redoPtr = editPtr->nextPtr;
+	    EditFree(textPtr, editPtr);
+	}
+	if (textPtr->redoPtr == NULL) {
+	    return 0;
 	}
+	EditSeparator(textPtr);
     }
-    lineNum = startingLine;
-    code = TCL_OK;
-    Tcl_DStringInit(&line);
-    for (passes = 0; passes < 2; ) {
-	if (lineNum >= numLines) {
-	    /*
-	     * Don't search the dummy last line of the text.
-	     */
 
-	    goto nextLine;
+    textPtr->flags |= EDIT_SUSPENDED;
+    while (1) {
+	if (undo) {
+	    editPtr = textPtr->undoPtr;
+	} else {
+	    editPtr = textPtr->redoPtr;
 	}
-
-	/*
-	 * Extract the text from the line.  If we're doing regular
-	 * expression matching, drop the newline from the line, so
-	 * that "$" can be used to match the end of the line.
-	 */
-
-	linePtr = CkBTreeFindLine(textPtr->tree, lineNum);
-	for (segPtr = linePtr->segPtr; segPtr != NULL;
-		segPtr = segPtr->nextPtr) {
-	    if (segPtr->typePtr != &ckTextCharType) {
-		continue;
-	    }
-	    Tcl_DStringAppend(&line, segPtr->body.chars, segPtr->size);
+	if ((editPtr == NULL) || (editPtr->type == EDIT_SEPARATOR)) {
+	    break;
 	}
-	if (!exact) {
-	    Tcl_DStringSetLength(&line, Tcl_DStringLength(&line)-1);
+	if (undo) {
+	    EditPop(textPtr);
+	    editPtr->nextPtr = textPtr->redoPtr;
+	    textPtr->redoPtr = editPtr;
+	} else {
+	    textPtr->redoPtr = editPtr->nextPtr;
+	    EditPush(textPtr, editPtr);
 	}
-	startOfLine = Tcl_DStringValue(&line);
-
-	/*
-	 * If we're ignoring case, convert the line to lower case.
-	 */
 
-	if (noCase) {
 #if CK_USE_UTF
-	    Tcl_DStringSetLength(&line,
-		Tcl_UtfToLower(Tcl_DStringValue(&line)));
+	CkTextMakeByteIndex(textPtr->tree, editPtr->line1, editPtr->byte1,
+		&index1);
+	CkTextMakeByteIndex(textPtr->tree, editPtr->line2, editPtr->byte2,
+		&index2);
 #else
-	    for (p = Tcl_DStringValue(&line); *p != 0; p++) {
-		if (isupper((unsigned char) *p)) {
-		    *p = tolower((unsigned char) *p);
-		}
-	    }
+	CkTextMakeIndex(textPtr->tree, editPtr->line1, editPtr->byte1,
+		&index1);
+	CkTextMakeIndex(textPtr->tree, editPtr->line2, editPtr->byte2,
+		&index2);
+#endif
+	if ((editPtr->type == EDIT_INSERT) == (undo != 0)) {
+	    DeleteChars(textPtr, (char *) NULL, (char *) NULL,
+		    &index1, &index2);
+	} else {
+	    InsertChars(textPtr, &index1, editPtr->chars);
+#if CK_USE_UTF
+	    CkTextMakeByteIndex(textPtr->tree, editPtr->line2,
+		    editPtr->byte2, &index1);
+#else
+	    CkTextMakeIndex(textPtr->tree, editPtr->line2,
+		    editPtr->byte2, &index1);
 #endif
 	}
+    }
+    textPtr->flags &= ~EDIT_SUSPENDED;
+    EditModified(textPtr, 1);
+    if (!undo) {
+	EditSeparator(textPtr);
+    }
+    CkTextSetMark(textPtr, "insert", &index1);
+    CkTextSetYView(textPtr, &index1, 1);
+    return 1;
+}
 
-	/*
-	 * Check for matches within the current line.  If so, and if we're
-	 * searching backwards, repeat the search to find the last match
-	 * in the line.
-	 */
-
-	matchChar = -1;
-	firstChar = 0;
-	lastChar = INT_MAX;
-	if (lineNum == startingLine) {
-	    int indexInDString;
+/*
+ *----------------------------------------------------------------------
+ *
+ * EditSeparator --
+ *
+ *	Ends the group of edits undone together by the next "edit undo"
+ *	widget command.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	A separator is pushed on the undo list, unless it is empty or
+ *	already ends with one.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+EditSeparator(textPtr)
+    CkText *textPtr;		/* Overall information about text widget. */
+{
+    if ((textPtr->undoPtr != NULL)
+	    && (textPtr->undoPtr->type != EDIT_SEPARATOR)) {
+	EditPush(textPtr, EditNew(textPtr, EDIT_SEPARATOR));
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EditLimit --
+ *
+ *	Drops the oldest groups of edits from the undo list of a text
+ *	widget until the records use no more memory than allowed by the
+ *	-maxundo option.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Memory is freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+EditLimit(textPtr)
+    CkText *textPtr;		/* Overall information about text widget. */
+{
+    if (textPtr->maxUndo <= 0) {
+	return;
+    }
+    while ((textPtr->undoSize > textPtr->maxUndo)
+	    && (textPtr->oldestUndoPtr != NULL)) {
+	do {
+	    EditDropOldest(textPtr);
+	} while ((textPtr->oldestUndoPtr != NULL)
+		&& (textPtr->oldestUndoPtr->type != EDIT_SEPARATOR));
+	while ((textPtr->oldestUndoPtr != NULL)
+		&& (textPtr->oldestUndoPtr->type == EDIT_SEPARATOR)) {
+	    EditDropOldest(textPtr);
+	}
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EditReset --
+ *
+ *	Empties the undo and redo lists of a text widget.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Memory is freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+EditReset(textPtr)
+    CkText *textPtr;		/* Overall information about text widget. */
+{
+    CkTextEdit *editPtr;
+
+    while (textPtr->undoPtr != NULL) {
+	EditFree(textPtr, EditPop(textPtr));
+    }
+    while (textPtr->redoPtr != NULL) {
+	editPtr = textPtr->redoPtr;
+	textPtr->redoPtr = editPtr->nextPtr;
+	EditFree(textPtr, editPtr);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EditModified --
+ *
+ *	Sets the modified flag of a text widget.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	A <<Modified>> virtual event is queued if the flag changes.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+EditModified(textPtr, modified)
+    CkText *textPtr;		/* Overall information about text widget. */
+    int modified;		/* New value of the flag. */
+{
+    modified = (modified != 0);
+    if (textPtr->modified != modified) {
+	textPtr->modified = modified;
+	Ck_QueueVirtualEvent(textPtr->winPtr, Ck_GetUid("<Modified>"), NULL);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EditNew, EditFree, EditPush, EditPop, EditDropOldest --
+ *
+ *	Allocate and free a record, push or pop a record on the undo
+ *	list and drop its oldest record:  the list is linked both ways
+ *	so that this is cheap.
+ *
+ * Results:
+ *	EditNew and EditPop return the record.
+ *
+ * Side effects:
+ *	The size of the records is kept in textPtr->undoSize.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static CkTextEdit *
+EditNew(textPtr, type)
+    CkText *textPtr;		/* Overall information about text widget. */
+    int type;			/* Type of the record. */
+{
+    CkTextEdit *editPtr;
+
+    editPtr = (CkTextEdit *) ckalloc(sizeof (CkTextEdit));
+    editPtr->type = type;
+    editPtr->line1 = editPtr->byte1 = 0;
+    editPtr->line2 = editPtr->byte2 = 0;
+    editPtr->length = editPtr->space = 0;
+    editPtr->chars = NULL;
+    textPtr->undoSize += sizeof (CkTextEdit);
+    return editPtr;
+}
+
+static void
+EditFree(textPtr, editPtr)
+    CkText *textPtr;		/* Overall information about text widget. */
+    CkTextEdit *editPtr;	/* Record, in no list anymore. */
+{
+    textPtr->undoSize -= sizeof (CkTextEdit) + editPtr->space;
+    if (editPtr->chars != NULL) {
+	ckfree(editPtr->chars);
+    }
+    ckfree((char *) editPtr);
+}
+
+static void
+EditPush(textPtr, editPtr)
+    CkText *textPtr;		/* Overall information about text widget. */
+    CkTextEdit *editPtr;	/* Record, in no list. */
+{
+    editPtr->prevPtr = NULL;
+    editPtr->nextPtr = textPtr->undoPtr;
+    if (textPtr->undoPtr != NULL) {
+	textPtr->undoPtr->prevPtr = editPtr;
+    } else {
+	textPtr->oldestUndoPtr = editPtr;
+    }
+    textPtr->undoPtr = editPtr;
+}
+
+static CkTextEdit *
+EditPop(textPtr)
+    CkText *textPtr;		/* Overall information about text widget,
+				 * whose undo list isn't empty. */
+{
+    CkTextEdit *editPtr = textPtr->undoPtr;
+
+    textPtr->undoPtr = editPtr->nextPtr;
+    if (textPtr->undoPtr != NULL) {
+	textPtr->undoPtr->prevPtr = NULL;
+    } else {
+	textPtr->oldestUndoPtr = NULL;
+    }
+    return editPtr;
+}
+
+static void
+EditDropOldest(textPtr)
+    CkText *textPtr;		/* Overall information about text widget,
+				 * whose undo list isn't empty. */
+{
+    CkTextEdit *editPtr = textPtr->oldestUndoPtr;
+
+    textPtr->oldestUndoPtr = editPtr->prevPtr;
+    if (textPtr->oldestUndoPtr != NULL) {
+	textPtr->oldestUndoPtr->nextPtr = NULL;
+    } else {
+	textPtr->undoPtr = NULL;
+    }
+    EditFree(textPtr, editPtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EditAddChars --
+ *
+ *	Adds characters to a record, at its beginning or its end.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The characters of the record may be reallocated;  their space
+ *	grows by doubling, so that adding characters one at a time
+ *	at the end costs a constant time each.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+EditAddChars(textPtr, editPtr, offset, string, length)
+    CkText *textPtr;		/* Overall information about text widget. */
+    CkTextEdit *editPtr;	/* Record to extend. */
+    int offset;			/* 0 or editPtr->length. */
+    char *string;		/* Characters to add. */
+    int length;			/* Number of bytes in string. */
+{
+    char *chars;
+    int space;
+
+    if (editPtr->length + length + 1 > editPtr->space) {
+	space = 2 * editPtr->space;
+	if (space < editPtr->length + length + 1) {
+	    space = editPtr->length + length + 1;
+	}
+	chars = ckalloc((unsigned) space);
+	if (editPtr->chars != NULL) {
+	    memcpy(chars, editPtr->chars, (size_t) editPtr->length);
+	    ckfree(editPtr->chars);
+	}
+	textPtr->undoSize += space - editPtr->space;
+	editPtr->chars = chars;
+	editPtr->space = space;
+    }
+    if (offset < editPtr->length) {
+	memmove(editPtr->chars + offset + length, editPtr->chars + offset,
+		(size_t) (editPtr->length - offset));
+    }
+    memcpy(editPtr->chars + offset, string, (size_t) length);
+    editPtr->length += length;
+    editPtr->chars[editPtr->length] = '\0';
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EditEnd --
+ *
+ *	Computes where characters inserted at a given position end.
+ *
+ * Results:
+ *	The line and byte offset of the end are stored at *line2Ptr
+ *	and *byte2Ptr.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+EditEnd(line, byteIndex, string, length, line2Ptr, byte2Ptr)
+    int line, byteIndex;	/* Where the characters start. */
+    char *string;		/* Characters. */
+    int length;			/* Number of bytes in string. */
+    int *line2Ptr, *byte2Ptr;	/* Where to store the end. */
+{
+    char *p, *end = string + length;
+
+    while ((p = memchr(string, '\n', (size_t) (end - string))) != NULL) {
+	line++;
+	byteIndex = 0;
+	string = p + 1;
+    }
+    *line2Ptr = line;
+    *byte2Ptr = byteIndex + (end - string);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EditGetChars --
+ *
+ *	Appends the characters of a range of a text to a dynamic
+ *	string, going through the segments of each line once.
+ *
+ * Results:
+ *	Returns 1 if the range holds nothing but characters, 0 if it
+ *	also holds segments that take room in the text, such as
+ *	embedded windows, which can't be recorded as characters.
+ *
+ * Side effects:
+ *	The characters are appended to *dsPtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+EditGetChars(index1Ptr, index2Ptr, dsPtr)
+    CkTextIndex *index1Ptr;	/* First character of the range. */
+    CkTextIndex *index2Ptr;	/* Character just after the range. */
+    Tcl_DString *dsPtr;		/* Where to append the characters. */
+{
+    CkTextLine *linePtr;
+    CkTextSegment *segPtr;
+    int start, first, last, onlyChars = 1;
+
+    linePtr = index1Ptr->linePtr;
+    while (1) {
+	for (start = 0, segPtr = linePtr->segPtr; segPtr != NULL;
+		start += segPtr->size, segPtr = segPtr->nextPtr) {
+	    first = 0;
+	    if (linePtr == index1Ptr->linePtr) {
+		first = index1Ptr->charIndex - start;
+		if (first < 0) {
+		    first = 0;
+		}
+	    }
+	    last = segPtr->size;
+	    if ((linePtr == index2Ptr->linePtr)
+		    && (index2Ptr->charIndex - start < last)) {
+		last = index2Ptr->charIndex - start;
+	    }
+	    if (last <= first) {
+		continue;
+	    }
+	    if (segPtr->typePtr != &ckTextCharType) {
+		onlyChars = 0;
+		continue;
+	    }
+	    Tcl_DStringAppend(dsPtr, segPtr->body.chars + first, last - first);
+	}
+	if (linePtr == index2Ptr->linePtr) {
+	    break;
+	}
+	linePtr = CkBTreeNextLine(linePtr);
+    }
+    return onlyChars;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TextLoadCmd --
+ *
+ *	This procedure is invoked to process the "load" and "append"
+ *	widget commands for text widgets, which replace the text or add
+ *	to its end a string, the contents of a file or the data read
+ *	from a channel.  See the user documentation for details on what
+ *	they do.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	See the user documentation.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+TextLoadCmd(textPtr, interp, argc, argv)
+    CkText *textPtr;		/* Information about text widget. */
+    Tcl_Interp *interp;		/* Current interpreter. */
+    int argc;			/* Number of arguments. */
+    char **argv;		/* Argument strings. */
+{
+    int i, load, mode, maxLines, follow, code;
+    size_t length;
+    char *fileName, *chanName, *string;
+    Tcl_Channel chan;
+    CkTextIndex index;
+
+    load = (argv[1][0] == 'l');
+    fileName = chanName = string = NULL;
+    maxLines = 0;
+
+    /*
+     * Every switch takes a value, so a last argument starting with
+     * "-" is the string.
+     */
+
+    for (i = 2; (i < argc - 1) && (argv[i][0] == '-'); i += 2) {
+	length = strlen(argv[i]);
+	if (strcmp(argv[i], "--") == 0) {
+	    i++;
+	    break;
+	}
+	if ((length >= 2) && (strncmp(argv[i], "-channel", length) == 0)) {
+	    chanName = argv[i+1];
+	} else if ((length >= 2) && (strncmp(argv[i], "-file", length) == 0)) {
+	    fileName = argv[i+1];
+	} else if ((length >= 2)
+		&& (strncmp(argv[i], "-maxlines", length) == 0)) {
+	    if (Tcl_GetInt(interp, argv[i+1], &maxLines) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	} else {
+	    Tcl_AppendResult(interp, "bad switch \"", argv[i],
+		    "\": must be -channel, -file, -maxlines, or --",
+		    (char *) NULL);
+	    return TCL_ERROR;
+	}
+    }
+    if (i < argc) {
+	string = argv[i++];
+    }
+    if ((i != argc) || ((fileName != NULL) + (chanName != NULL)
+	    + (string != NULL) != 1)) {
+	Tcl_AppendResult(interp, "wrong # args: should be \"", argv[0], " ",
+		argv[1], " ?-maxlines count? -channel channelId|-file fileName",
+		"|string\"", (char *) NULL);
+	return TCL_ERROR;
+    }
+
+    chan = NULL;
+    if (fileName != NULL) {
+	chan = Tcl_OpenFileChannel(interp, fileName, "r", 0);
+	if (chan == NULL) {
+	    return TCL_ERROR;
+	}
+    } else if ((chanName != NULL) && (*chanName != '\0')) {
+	chan = Tcl_GetChannel(interp, chanName, &mode);
+	if (chan == NULL) {
+	    return TCL_ERROR;
+	}
+	if (!(mode & TCL_READABLE)) {
+	    Tcl_AppendResult(interp, "channel \"", chanName,
+		    "\" wasn't opened for reading", (char *) NULL);
+	    return TCL_ERROR;
+	}
+    }
+
+    /*
+     * Appending from a channel replaces the one tailed, if any, and
+     * reads it without blocking from now on.  As with "insert", a
+     * disabled text isn't modified:  a channel is only remembered,
+     * to be read once the widget is enabled.
+     */
+
+    if (!load && (chanName != NULL)) {
+	StopTail(textPtr);
+	if ((chan != NULL) && (Tcl_SetChannelOption(interp, chan,
+		"-blocking", "0") != TCL_OK)) {
+	    return TCL_ERROR;
+	}
+    }
+    if (textPtr->state != ckTextNormalUid) {
+	if (fileName != NULL) {
+	    Tcl_Close((Tcl_Interp *) NULL, chan);
+	} else if (!load && (chan != NULL)) {
+	    StartTail(textPtr, chan, maxLines);
+	}
+	return TCL_OK;
+    }
+
+    follow = !load && EndVisible(textPtr);
+    if (load) {
+	EditReset(textPtr);
+	textPtr->flags |= EDIT_SUSPENDED;
+	DeleteChars(textPtr, "1.0", "end", (CkTextIndex *) NULL,
+		(CkTextIndex *) NULL);
+    }
+    code = TCL_OK;
+    if (string != NULL) {
+	AppendChars(textPtr, string, maxLines);
+    } else if (chan != NULL) {
+	code = AppendChannel(textPtr, chan, maxLines,
+		load ? 0 : TAIL_CHUNKS);
+    }
+    if (fileName != NULL) {
+	Tcl_Close((Tcl_Interp *) NULL, chan);
+    } else if (!load && (chan != NULL) && (code == TCL_OK)
+	    && !Tcl_Eof(chan)) {
+	StartTail(textPtr, chan, maxLines);
+    }
+
+    /*
+     * A loaded text is shown from its beginning.  Otherwise, if the
+     * end of the text was visible, it is kept visible.
+     */
+
+    if (load) {
+	textPtr->flags &= ~EDIT_SUSPENDED;
+	EditModified(textPtr, 0);
+#if CK_USE_UTF
+	CkTextMakeByteIndex(textPtr->tree, 0, 0, &index);
+#else
+	CkTextMakeIndex(textPtr->tree, 0, 0, &index);
+#endif
+	CkTextSetMark(textPtr, "insert", &index);
+	CkTextSetYView(textPtr, &index, 0);
+    } else if (follow) {
+	SeeEnd(textPtr);
+    }
+    return code;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AppendChars --
+ *
+ *	Adds characters at the end of the text, then deletes lines from
+ *	its beginning if there are too many.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The text is modified.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+AppendChars(textPtr, string, maxLines)
+    CkText *textPtr;		/* Overall information about text widget. */
+    char *string;		/* Null-terminated string to add. */
+    int maxLines;		/* Number of complete lines to keep, 0 or
+				 * less means no limit. */
+{
+    CkTextIndex index;
+
+#if CK_USE_UTF
+    CkTextMakeByteIndex(textPtr->tree, CkBTreeNumLines(textPtr->tree), 0,
+	    &index);
+#else
+    CkTextMakeIndex(textPtr->tree, CkBTreeNumLines(textPtr->tree), 0,
+	    &index);
+#endif
+    InsertChars(textPtr, &index, string);
+    if ((textPtr->maxLines > 0)
+	    && ((maxLines <= 0) || (textPtr->maxLines < maxLines))) {
+	maxLines = textPtr->maxLines;
+    }
+    TrimText(textPtr, maxLines);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TrimText --
+ *
+ *	Deletes lines from the beginning of a text widget when it has
+ *	too many.  To make the cost of trimming small for each line
+ *	added, lines are deleted in batches:  a sixteenth of the limit
+ *	more than needed goes at once.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The text is modified.  Marks in the deleted lines move to the
+ *	beginning of the text, tag ranges are cut and the view keeps
+ *	its position unless its top line is deleted.  The undo and redo
+ *	lists are emptied.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+TrimText(textPtr, maxLines)
+    CkText *textPtr;		/* Overall information about text widget. */
+    int maxLines;		/* Number of complete lines to keep, 0 or
+				 * less means no limit. */
+{
+    CkTextIndex index1, index2;
+    int count, resetView;
+
+    /*
+     * The line after the last newline isn't complete, even when empty.
+     */
+
+    count = CkBTreeNumLines(textPtr->tree) - 1 - maxLines;
+    if ((maxLines <= 0) || (count <= 0)) {
+	return;
+    }
+    count += maxLines / 16;
+
+    /*
+     * Only the lines displayed need to be laid out again, which is
+     * none of them if the view is below the lines deleted.
+     */
+
+#if CK_USE_UTF
+    CkTextMakeByteIndex(textPtr->tree, 0, 0, &index1);
+    CkTextMakeByteIndex(textPtr->tree, count, 0, &index2);
+#else
+    CkTextMakeIndex(textPtr->tree, 0, 0, &index1);
+    CkTextMakeIndex(textPtr->tree, count, 0, &index2);
+#endif
+    CkTextChanged(textPtr, &index1, &index2);
+    resetView = (CkBTreeLineIndex(textPtr->topIndex.linePtr) < count);
+    CkBTreeTrimLines(textPtr->tree, count);
+    EditReset(textPtr);
+    if (resetView) {
+#if CK_USE_UTF
+	CkTextMakeByteIndex(textPtr->tree, 0, 0, &index1);
+#else
+	CkTextMakeIndex(textPtr->tree, 0, 0, &index1);
+#endif
+	CkTextSetYView(textPtr, &index1, 0);
+    }
+
+    /*
+     * Invalidate any selection retrievals in progress.
+     */
+
+    textPtr->abortSelections = 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AppendChannel --
+ *
+ *	Reads a channel until its end, until no more data is available
+ *	without blocking or until maxChunks chunks were read, adding the
+ *	data to the end of the text a chunk at a time.
+ *
+ * Results:
+ *	A standard Tcl result, with an error message in textPtr->interp
+ *	if reading fails.
+ *
+ * Side effects:
+ *	The text is modified.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+AppendChannel(textPtr, chan, maxLines, maxChunks)
+    CkText *textPtr;		/* Overall information about text widget. */
+    Tcl_Channel chan;		/* Channel to read. */
+    int maxLines;		/* Number of complete lines to keep, 0 or
+				 * less means no limit. */
+    int maxChunks;		/* Most chunks to read, 0 or less means
+				 * no limit. */
+{
+    Tcl_Obj *objPtr;
+    int numChars, chunks, code = TCL_OK;
+
+    objPtr = Tcl_NewObj();
+    Tcl_IncrRefCount(objPtr);
+    for (chunks = 0; (maxChunks <= 0) || (chunks < maxChunks); chunks++) {
+	numChars = Tcl_ReadChars(chan, objPtr, APPEND_CHUNK, 0);
+	if (numChars < 0) {
+	    Tcl_ResetResult(textPtr->interp);
+	    Tcl_AppendResult(textPtr->interp, "error reading \"",
+		    Tcl_GetChannelName(chan), "\": ",
+		    Tcl_PosixError(textPtr->interp), (char *) NULL);
+	    code = TCL_ERROR;
+	    break;
+	}
+	if (numChars == 0) {
+	    break;
+	}
+	AppendChars(textPtr, Tcl_GetString(objPtr), maxLines);
+    }
+    Tcl_DecrRefCount(objPtr);
+    return code;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TailProc --
+ *
+ *	This procedure is invoked by the notifier when the channel
+ *	tailed by a text widget becomes readable.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	Up to TAIL_CHUNKS chunks of the data available are added to
+ *	the text;  the rest, if any, is read when the notifier calls
+ *	again.  The channel stops being tailed at its end or if reading
+ *	it fails, and isn't watched while the widget is disabled.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+TailProc(clientData, mask)
+    ClientData clientData;	/* Information about text widget. */
+    int mask;			/* Not used. */
+{
+    CkText *textPtr = (CkText *) clientData;
+    Tcl_Channel chan = textPtr->tailChannel;
+    int follow;
+
+    /*
+     * The channel isn't read while the widget is disabled, its data
+     * waits until ConfigureText enables it again.
+     */
+
+    if (textPtr->state != ckTextNormalUid) {
+	Tcl_DeleteChannelHandler(chan, TailProc, (ClientData) textPtr);
+	return;
+    }
+    follow = EndVisible(textPtr);
+    if (AppendChannel(textPtr, chan, textPtr->tailMaxLines, TAIL_CHUNKS)
+	    != TCL_OK) {
+	StopTail(textPtr);
+	Tk_BackgroundError(textPtr->interp);
+    } else if (Tcl_Eof(chan)) {
+	StopTail(textPtr);
+    }
+    if (follow) {
+	SeeEnd(textPtr);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TailClosedProc --
+ *
+ *	This procedure is invoked when the channel tailed by a text
+ *	widget is closed.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The channel is forgotten, its handlers are deleted by Tcl.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+TailClosedProc(clientData)
+    ClientData clientData;	/* Information about text widget. */
+{
+    CkText *textPtr = (CkText *) clientData;
+
+    textPtr->tailChannel = NULL;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * StartTail --
+ *
+ *	Starts appending the data read from a channel to a text widget
+ *	as it arrives.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	A close handler is created for the channel, and a channel
+ *	handler too unless the widget is disabled, in which case
+ *	ConfigureText creates it when the widget is enabled.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+StartTail(textPtr, chan, maxLines)
+    CkText *textPtr;		/* Overall information about text widget. */
+    Tcl_Channel chan;		/* Channel to read, non-blocking. */
+    int maxLines;		/* Number of complete lines to keep, 0 or
+				 * less means no limit. */
+{
+    textPtr->tailChannel = chan;
+    textPtr->tailMaxLines = maxLines;
+    if (textPtr->state == ckTextNormalUid) {
+	Tcl_CreateChannelHandler(chan, TCL_READABLE, TailProc,
+		(ClientData) textPtr);
+    }
+    Tcl_CreateCloseHandler(chan, TailClosedProc, (ClientData) textPtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * StopTail --
+ *
+ *	Stops appending the data read from a channel to a text widget.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The handlers of the channel are deleted.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+StopTail(textPtr)
+    CkText *textPtr;		/* Overall information about text widget. */
+{
+    if (textPtr->tailChannel != NULL) {
+	Tcl_DeleteChannelHandler(textPtr->tailChannel, TailProc,
+		(ClientData) textPtr);
+	Tcl_DeleteCloseHandler(textPtr->tailChannel, TailClosedProc,
+		(ClientData) textPtr);
+	textPtr->tailChannel = NULL;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * EndVisible, SeeEnd --
+ *
+ *	Tell whether the last character of the text is visible in the
+ *	window, and scroll the view to make it visible.
+ *
+ * Results:
+ *	EndVisible returns 1 if the last character is visible, 0
+ *	otherwise.
+ *
+ * Side effects:
+ *	SeeEnd changes the view.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+EndVisible(textPtr)
+    CkText *textPtr;		/* Overall information about text widget. */
+{
+    CkTextIndex index;
+    int x, y, width, height;
+
+    if ((textPtr->winPtr == NULL) || !(textPtr->winPtr->flags & CK_MAPPED)) {
+	return 0;
+    }
+#if CK_USE_UTF
+    CkTextMakeByteIndex(textPtr->tree, CkBTreeNumLines(textPtr->tree) - 1,
+	    0, &index);
+#else
+    CkTextMakeIndex(textPtr->tree, CkBTreeNumLines(textPtr->tree) - 1,
+	    0, &index);
+#endif
+    return CkTextCharBbox(textPtr, &index, &x, &y, &width, &height) == 0;
+}
+
+static void
+SeeEnd(textPtr)
+    CkText *textPtr;		/* Overall information about text widget. */
+{
+    CkTextIndex index;
+
+#if CK_USE_UTF
+    CkTextMakeByteIndex(textPtr->tree, CkBTreeNumLines(textPtr->tree) - 1,
+	    0, &index);
+#else
+    CkTextMakeIndex(textPtr->tree, CkBTreeNumLines(textPtr->tree) - 1,
+	    0, &index);
+#endif
+    CkTextSetYView(textPtr, &index, 1);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * TextSearchCmd --
+ *
+ *	This procedure is invoked to process the "search" widget command
+ *	for text widgets.  See the user documentation for details on what
+ *	it does.
+ *
+ * Results:
+ *	A standard Tcl result.
+ *
+ * Side effects:
+ *	See the user documentation.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+TextSearchCmd(textPtr, interp, argc, argv)
+    CkText *textPtr;		/* Information about text widget. */
+    Tcl_Interp *interp;		/* Current interpreter. */
+    int argc;			/* Number of arguments. */
+    char **argv;		/* Argument strings. */
+{
+    int exact, c, i, k, argsLeft, noCase, noLineStop, leftToScan;
+    size_t length;
+    int numLines, startingLine, startingChar, lineNum, firstChar, lastChar;
+    int code, passes, stopLine, lineLength, numMatches, spaceMatches;
+    int patLength;
+    char *arg, *pattern, *varName, *p, *startOfLine;
+    CkTextIndex index;
+    Tcl_DString line, patDString;
+    CkTextSegment *segPtr, *charSegPtr;
+    CkTextLine *linePtr;
+    Tcl_Obj *patObj = NULL, *lineObj = NULL, *countObj;
+    Tcl_RegExp regexp = NULL;		/* Initialization needed only to
+					 * prevent compiler warning. */
+    TextSearch search;
+    SearchMatch *matches;
+    UtfCursor cursor;
+
+    /*
+     * Parse switches and other arguments.
+     */
+
+    exact = 1;
+    search.backwards = 0;
+    search.all = 0;
+    noCase = 0;
+    noLineStop = 0;
+    varName = NULL;
+    for (i = 2; i < argc; i++) {
+	arg = argv[i];
+	if (arg[0] != '-') {
+	    break;
+	}
+	length = strlen(arg);
+	if (length < 2) {
+	    badSwitch:
+	    Tcl_AppendResult(interp, "bad switch \"", arg,
+		    "\": must be -forward, -backward, -exact, -regexp, ",
+		    "-nocase, -nolinestop, -all, -count, or --",
+		    (char *) NULL);
+	    return TCL_ERROR;
+	}
+	c = arg[1];
+	if ((c == 'a') && (strncmp(argv[i], "-all", length) == 0)) {
+	    search.all = 1;
+	} else if ((c == 'b') && (strncmp(argv[i], "-backwards", length) == 0)) {
+	    search.backwards = 1;
+	} else if ((c == 'c') && (strncmp(argv[i], "-count", length) == 0)) {
+	    if (i >= (argc-1)) {
+	      Tcl_SetObjResult( interp, Tcl_NewStringObj( "no value given for \"-count\" option", -1));
+		return TCL_ERROR;
+	    }
+	    i++;
+	    varName = argv[i];
+	} else if ((c == 'e') && (strncmp(argv[i], "-exact", length) == 0)) {
+	    exact = 1;
+	} else if ((c == 'f') && (strncmp(argv[i], "-forwards", length) == 0)) {
+	    search.backwards = 0;
+	} else if ((c == 'n') && (strncmp(argv[i], "-nocase", length) == 0)) {
+	    noCase = 1;
+	} else if ((c == 'n') && (length > 3)
+		&& (strncmp(argv[i], "-nolinestop", length) == 0)) {
+	    noLineStop = 1;
+	} else if ((c == 'r') && (strncmp(argv[i], "-regexp", length) == 0)) {
+	    exact = 0;
+	} else if ((c == '-') && (strncmp(argv[i], "--", length) == 0)) {
+	    i++;
+	    break;
+	} else {
+	    goto badSwitch;
+	}
+    }
+    argsLeft = argc - (i+2);
+    if ((argsLeft != 0) && (argsLeft != 1)) {
+	Tcl_AppendResult(interp, "wrong # args: should be \"",
+		argv[0], " search ?switches? pattern index ?stopIndex?",
+		(char *) NULL);
+	return TCL_ERROR;
+    }
+    pattern = argv[i];
+
+    /*
+     * Convert the pattern to lower-case if we're supposed to ignore
+     * case in an exact search.  Regular expressions are compiled to
+     * ignore case instead.
+     */
+
+    if (noCase && exact) {
+	Tcl_DStringInit(&patDString);
+	Tcl_DStringAppend(&patDString, pattern, -1);
+	pattern = Tcl_DStringValue(&patDString);
+#if CK_USE_UTF
+	Tcl_UtfToLower(pattern);
+#else
+	for (p = pattern; *p != 0; p++) {
+	    if (isupper((unsigned char) *p)) {
+		*p = tolower((unsigned char) *p);
+	    }
+	}
+#endif
+    }
+
+    code = TCL_ERROR;
+    if (CkTextGetIndex(interp, textPtr, argv[i+1], &index) != TCL_OK) {
+	goto freePattern;
+    }
+    numLines = CkBTreeNumLines(textPtr->tree);
+    startingLine = CkBTreeLineIndex(index.linePtr);
+    startingChar = index.charIndex;
+    if (startingLine >= numLines) {
+	if (search.backwards) {
+	    startingLine = CkBTreeNumLines(textPtr->tree) - 1;
+	    startingChar = 0;
+	    for (segPtr = CkBTreeFindLine(textPtr->tree, startingLine)->segPtr;
+		    segPtr != NULL; segPtr = segPtr->nextPtr) {
+		startingChar += segPtr->size;
+	    }
+	} else {
+	    startingLine = 0;
+	    startingChar = 0;
+	}
+    }
+    if (argsLeft == 1) {
+	if (CkTextGetIndex(interp, textPtr, argv[i+2], &search.stopIndex)
+		!= TCL_OK) {
+	    goto freePattern;
+	}
+	stopLine = CkBTreeLineIndex(search.stopIndex.linePtr);
+	if (!search.backwards && (stopLine == numLines)) {
+	    stopLine = numLines-1;
+	}
+	search.searchWholeText = 0;
+    } else {
+	stopLine = 0;
+	search.searchWholeText = 1;
+    }
+
+    patLength = 0;
+    if (exact) {
+	patLength = strlen(pattern);
+    } else {
+	patObj = Tcl_NewStringObj(pattern, -1);
+	Tcl_IncrRefCount(patObj);
+	regexp = Tcl_GetRegExpFromObj(interp, patObj, TCL_REG_ADVANCED
+		| (noCase ? TCL_REG_NOCASE : 0)
+		| (noLineStop ? TCL_REG_NLANCH : 0));
+	if (regexp == NULL) {
+	    goto freePattern;
+	}
+    }
+    search.resultObj = Tcl_NewObj();
+    search.countObj = Tcl_NewObj();
+    Tcl_IncrRefCount(search.resultObj);
+    Tcl_IncrRefCount(search.countObj);
+    code = TCL_OK;
+
+    /*
+     * With -nolinestop a regular expression may match newlines, so the
+     * text is searched as a whole rather than line by line.  Matches
+     * only have to start before the starting or stop index, so ranges
+     * always go on to the end of the text, and those starting past the
+     * index are dropped.
+     */
+
+    if (!exact && noLineStop) {
+	CkTextIndex startIndex, firstIndex, lastIndex;
+
+	CkTextMakeByteIndex(textPtr->tree, startingLine, startingChar,
+		&startIndex);
+	CkTextMakeByteIndex(textPtr->tree, 0, 0, &firstIndex);
+	CkTextMakeByteIndex(textPtr->tree, numLines, 0, &lastIndex);
+	if (!search.backwards) {
+	    code = SearchRange(textPtr, interp, &search, regexp, &startIndex,
+		    &lastIndex, (CkTextIndex *) NULL);
+	    if ((code == TCL_OK) && search.searchWholeText) {
+		code = SearchRange(textPtr, interp, &search, regexp,
+			&firstIndex, &lastIndex, &startIndex);
+	    }
+	} else {
+	    code = SearchRange(textPtr, interp, &search, regexp,
+		    search.searchWholeText ? &firstIndex : &search.stopIndex,
+		    &lastIndex, &startIndex);
+	    if ((code == TCL_OK) && search.searchWholeText) {
+		code = SearchRange(textPtr, interp, &search, regexp,
+			&startIndex, &lastIndex, (CkTextIndex *) NULL);
+	    }
+	}
+	if (code == TCL_BREAK) {
+	    code = TCL_OK;
+	}
+	goto done;
+    }
+
+    /*
+     * Scan through all of the lines of the text circularly, starting
+     * at the given index.
+     */
+
+    lineNum = startingLine;
+    spaceMatches = 16;
+    matches = (SearchMatch *) ckalloc(spaceMatches * sizeof(SearchMatch));
+    Tcl_DStringInit(&line);
+    if (!exact) {
+	lineObj = Tcl_NewObj();
+	Tcl_IncrRefCount(lineObj);
+    }
+    for (passes = 0; passes < 2; ) {
+	if (lineNum >= numLines) {
+	    /*
+	     * Don't search the dummy last line of the text.
+	     */
+
+	    goto nextLine;
+	}
+
+	/*
+	 * Get the text of the line.  When it is all in one segment, as
+	 * it is unless the line has tags or embedded windows, it is
+	 * searched in place;  otherwise it is extracted from the
+	 * character segments.  If we're doing regular expression
+	 * matching, drop the newline from the line, so that "$" can be
+	 * used to match the end of the line.
+	 */
+
+	linePtr = CkBTreeFindLine(textPtr->tree, lineNum);
+	charSegPtr = NULL;
+	for (segPtr = linePtr->segPtr; segPtr != NULL;
+		segPtr = segPtr->nextPtr) {
+	    if (segPtr->typePtr == &ckTextCharType) {
+		if (charSegPtr != NULL) {
+		    break;
+		}
+		charSegPtr = segPtr;
+	    }
+	}
+	if ((segPtr == NULL) && (charSegPtr != NULL) && !(noCase && exact)) {
+	    startOfLine = charSegPtr->body.chars;
+	    lineLength = charSegPtr->size;
+	} else {
+	    Tcl_DStringSetLength(&line, 0);
+	    for (segPtr = linePtr->segPtr; segPtr != NULL;
+		    segPtr = segPtr->nextPtr) {
+		if (segPtr->typePtr != &ckTextCharType) {
+		    continue;
+		}
+		Tcl_DStringAppend(&line, segPtr->body.chars, segPtr->size);
+	    }
+
+	    /*
+	     * If we're ignoring case, convert the line to lower case.
+	     */
+
+	    if (noCase && exact) {
+#if CK_USE_UTF
+		Tcl_DStringSetLength(&line,
+		    Tcl_UtfToLower(Tcl_DStringValue(&line)));
+#else
+		for (p = Tcl_DStringValue(&line); *p != 0; p++) {
+		    if (isupper((unsigned char) *p)) {
+			*p = tolower((unsigned char) *p);
+		    }
+		}
+#endif
+	    }
+	    startOfLine = Tcl_DStringValue(&line);
+	    lineLength = Tcl_DStringLength(&line);
+	}
+	if (!exact) {
+	    lineLength--;
+	    Tcl_SetStringObj(lineObj, startOfLine, lineLength);
+	    cursor.string = startOfLine;
+	    cursor.byteIndex = cursor.charIndex = 0;
+	}
+
+	firstChar = 0;
+	lastChar = INT_MAX;
+	if (lineNum == startingLine) {
+	    int indexInDString;
 
 	    /*
 	     * The starting line is tricky: the first time we see it
@@ -1302,13 +2773,13 @@ TextSearchCmd(textPtr, interp, argc, argv)
 	    }
 
 	    passes++;
-	    if ((passes == 1) ^ backwards) {
+	    if ((passes == 1) ^ search.backwards) {
 		/*
 		 * Only use the last part of the line.
 		 */
 
 		firstChar = indexInDString;
-		if (firstChar >= Tcl_DStringLength(&line)) {
+		if (firstChar >= lineLength) {
 		    goto nextLine;
 		}
 	    } else {
@@ -1319,7 +2790,20 @@ TextSearchCmd(textPtr, interp, argc, argv)
 		lastChar = indexInDString;
 	    }
 	}
-	do {
+
+	/*
+	 * Check for matches within the current line.  A forward search
+	 * stops at the first one, a backward search goes on through the
+	 * overlapping ones to find the last one.  With -all all of them
+	 * are collected, without overlaps.  An exact pattern is matched
+	 * against the line with its newline, so an empty match can't be
+	 * past it;  a regular expression is matched against the line
+	 * without it, so an empty match may be at its very end.
+	 */
+
+	numMatches = 0;
+	while ((firstChar < lineLength)
+		|| (!exact && (firstChar == lineLength))) {
 	    int thisLength;
 #if CK_USE_UTF
 	    Tcl_UniChar ch;
@@ -1333,104 +2817,84 @@ TextSearchCmd(textPtr, interp, argc, argv)
 		i = p - startOfLine;
 		thisLength = patLength;
 	    } else {
-		char *start, *end;
-		int match;
+		Tcl_RegExpInfo info;
+		int offset, match;
 
-		match = Tcl_RegExpExec(interp, regexp,
-			startOfLine + firstChar, startOfLine);
+		offset = UtfCursorToChar(&cursor, firstChar);
+		match = Tcl_RegExpExecObj(interp, regexp, lineObj, offset, 1,
+			(offset > 0) ? TCL_REG_NOTBOL : 0);
 		if (match < 0) {
 		    code = TCL_ERROR;
-		    goto done;
+		    goto freeLine;
 		}
 		if (!match) {
 		    break;
 		}
-		Tcl_RegExpRange(regexp, 0, &start, &end);
-		i = start - startOfLine;
-		thisLength = end - start;
+		Tcl_RegExpGetInfo(regexp, &info);
+		i = UtfCursorToByte(&cursor, offset + info.matches[0].start);
+		thisLength = UtfCursorToByte(&cursor,
+			offset + info.matches[0].end) - i;
 	    }
 	    if (i >= lastChar) {
 		break;
 	    }
-	    matchChar = i;
-	    matchLength = thisLength;
+	    if (numMatches == spaceMatches) {
+		spaceMatches *= 2;
+		matches = (SearchMatch *) ckrealloc((char *) matches,
+			spaceMatches * sizeof(SearchMatch));
+	    }
+	    matches[numMatches].first = i;
+	    matches[numMatches].length = thisLength;
+	    numMatches++;
+	    if (!search.backwards && !search.all) {
+		break;
+	    }
+	    if (search.all && (thisLength > 0)) {
+		firstChar = i + thisLength;
+	    } else if (i < lineLength) {
 #if CK_USE_UTF
-	    firstChar = i + Tcl_UtfToUniChar(startOfLine + matchChar, &ch);
+		firstChar = i + Tcl_UtfToUniChar(startOfLine + i, &ch);
 #else
-	    firstChar = matchChar+1;
+		firstChar = i + 1;
 #endif
-	} while (backwards);
+	    } else {
+		break;
+	    }
+	}
 
 	/*
-	 * If we found a match then we're done.  Make sure that
-	 * the match occurred before the stopping index, if one was
-	 * specified.
+	 * Report the matches in the order of the search.  The index
+	 * information returned by the regular expression parser only
+	 * considers textual information:  it doesn't account for
+	 * embedded windows or any other non-textual info, so both the
+	 * index and the count of each match are adjusted for them.
 	 */
 
-	if (matchChar >= 0) {
-#if CK_USE_UTF
-	    int numChars;
-	   
-	    numChars = Tcl_NumUtfChars(startOfLine + matchChar,
-		matchLength);
-#endif
-	    
-	    /*
-	     * The index information returned by the regular expression
-	     * parser only considers textual information:  it doesn't
-	     * account for embedded windows or any other non-textual info.
-	     * Scan through the line's segments again to adjust both
-	     * matchChar and matchCount.
-	     */
+	for (k = 0; k < numMatches; k++) {
+	    SearchMatch *matchPtr;
+	    int matchChar, numChars, last;
 
-	    for (segPtr = linePtr->segPtr, leftToScan = matchChar;
-		    leftToScan >= 0; segPtr = segPtr->nextPtr) {
-		if (segPtr->typePtr != &ckTextCharType) {
-		    matchChar += segPtr->size;
-		    continue;
-		}
-		leftToScan -= segPtr->size;
-	    }
-	    for (leftToScan += matchLength; leftToScan > 0;
-		    segPtr = segPtr->nextPtr) {
-		if (segPtr->typePtr != &ckTextCharType) {
+	    matchPtr = &matches[search.backwards ? numMatches - 1 - k : k];
+	    matchChar = SearchLineIndex(linePtr, matchPtr->first);
 #if CK_USE_UTF
-		    numChars += segPtr->size;
+	    numChars = Tcl_NumUtfChars(startOfLine + matchPtr->first,
+		matchPtr->length);
 #else
-		    matchLength += segPtr->size;
+	    numChars = matchPtr->length;
 #endif
-		    continue;
-		}
-		leftToScan -= segPtr->size;
+	    if (matchPtr->length > 0) {
+		last = matchPtr->first + matchPtr->length - 1;
+		numChars += SearchLineIndex(linePtr, last) - last
+			- (matchChar - matchPtr->first);
 	    }
 #if CK_USE_UTF
 	    CkTextMakeByteIndex(textPtr->tree, lineNum, matchChar, &index);
 #else
 	    CkTextMakeIndex(textPtr->tree, lineNum, matchChar, &index);
 #endif
-	    if (!searchWholeText) {
-		if (!backwards && (CkTextIndexCmp(&index, &stopIndex) >= 0)) {
-		    goto done;
-		}
-		if (backwards && (CkTextIndexCmp(&index, &stopIndex) < 0)) {
-		    goto done;
-		}
-	    }
-	    if (varName != NULL) {
-#if CK_USE_UTF
-		sprintf(buffer, "%d", numChars);
-#else
-		sprintf(buffer, "%d", matchLength);
-#endif
-		if (Tcl_SetVar(interp, varName, buffer, TCL_LEAVE_ERR_MSG)
-			== NULL) {
-		    code = TCL_ERROR;
-		    goto done;
-		}
+	    if (SearchFound(&search, &index, numChars) != TCL_OK) {
+		goto freeLine;
 	    }
-	    CkTextPrintIndex(&index, buf);
-	    Tcl_SetObjResult( interp, Tcl_NewStringObj( buf, -1));
-	    goto done;
 	}
 
 	/*
@@ -1438,9 +2902,9 @@ TextSearchCmd(textPtr, interp, argc, argv)
 	 */
 
 	nextLine:
-	if (backwards) {
+	if (search.backwards) {
 	    lineNum--;
-	    if (!searchWholeText) {
+	    if (!search.searchWholeText) {
 		if (lineNum < stopLine) {
 		    break;
 		}
@@ -1449,7 +2913,7 @@ TextSearchCmd(textPtr, interp, argc, argv)
 	    }
 	} else {
 	    lineNum++;
-	    if (!searchWholeText) {
+	    if (!search.searchWholeText) {
 		if (lineNum > stopLine) {
 		    break;
 		}
@@ -1457,15 +2921,425 @@ TextSearchCmd(textPtr, interp, argc, argv)
 		lineNum = 0;
 	    }
 	}
-	Tcl_DStringSetLength(&line, 0);
     }
-    done:
+    freeLine:
     Tcl_DStringFree(&line);
-    if (noCase) {
+    ckfree((char *) matches);
+    if (lineObj != NULL) {
+	Tcl_DecrRefCount(lineObj);
+    }
+
+    /*
+     * With -all the result is the list of the matches and the count
+     * variable gets the list of their lengths.  Otherwise the result
+     * is the match found, if any, and the variable gets its length.
+     */
+
+    done:
+    if (code == TCL_OK) {
+	countObj = NULL;
+	if (search.all) {
+	    Tcl_SetObjResult(interp, search.resultObj);
+	    countObj = search.countObj;
+	} else {
+	    Tcl_Obj *objPtr = NULL;
+
+	    Tcl_ListObjIndex(NULL, search.resultObj, 0, &objPtr);
+	    if (objPtr != NULL) {
+		Tcl_SetObjResult(interp, objPtr);
+		Tcl_ListObjIndex(NULL, search.countObj, 0, &countObj);
+	    }
+	}
+	if ((varName != NULL) && (countObj != NULL)
+		&& (Tcl_SetVar2Ex(interp, varName, NULL, countObj,
+		TCL_LEAVE_ERR_MSG) == NULL)) {
+	    code = TCL_ERROR;
+	}
+    }
+    Tcl_DecrRefCount(search.resultObj);
+    Tcl_DecrRefCount(search.countObj);
+
+    freePattern:
+    if (patObj != NULL) {
+	Tcl_DecrRefCount(patObj);
+    }
+    if (noCase && exact) {
 	Tcl_DStringFree(&patDString);
     }
     return code;
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SearchRange --
+ *
+ *	Searches the text between two indices with a regular expression
+ *	as a single string, so that matches may span lines.  This is
+ *	used for the -nolinestop switch of the "search" widget command.
+ *
+ * Results:
+ *	A standard Tcl result, TCL_BREAK once the search is over.
+ *
+ * Side effects:
+ *	The matches are passed to SearchFound in the order of the search.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SearchRange(textPtr, interp, searchPtr, regexp, fromPtr, toPtr, limitPtr)
+    CkText *textPtr;		/* Information about text widget. */
+    Tcl_Interp *interp;		/* Current interpreter. */
+    TextSearch *searchPtr;	/* Search in progress. */
+    Tcl_RegExp regexp;		/* Compiled pattern. */
+    CkTextIndex *fromPtr;	/* First character to search. */
+    CkTextIndex *toPtr;		/* Character just after the last one to
+				 * search. */
+    CkTextIndex *limitPtr;	/* If not NULL, matches starting there or
+				 * after it are dropped. */
+{
+    int fromLine, numLines, lastLine, cut, numRangeChars, notBol, notEol;
+    int numMatches, spaceMatches, offset, flags, j, k, n, code;
+    char *string;
+    Tcl_DString text;
+    Tcl_Obj *textObj;
+    CkTextSegment *segPtr;
+    CkTextLine *linePtr;
+    CkTextIndex index;
+    SearchMatch *matches;
+    SearchLine *lines;
+    UtfCursor cursor;
+
+    if (CkTextIndexCmp(fromPtr, toPtr) >= 0) {
+	return TCL_OK;
+    }
+
+    /*
+     * Gather the text of the range, remembering where each line starts
+     * in it.  The range either stops at an index or goes on to the end
+     * of the text, whose last newline is left out as in line by line
+     * searches.
+     */
+
+    fromLine = CkBTreeLineIndex(fromPtr->linePtr);
+    lastLine = CkBTreeLineIndex(toPtr->linePtr);
+    numLines = CkBTreeNumLines(textPtr->tree);
+    if (lastLine >= numLines) {
+	lastLine = numLines - 1;
+	cut = INT_MAX;
+    } else {
+	cut = toPtr->charIndex;
+    }
+    lastLine -= fromLine;
+    lines = (SearchLine *) ckalloc((lastLine + 1) * sizeof(SearchLine));
+    Tcl_DStringInit(&text);
+    linePtr = fromPtr->linePtr;
+    for (j = 0; j <= lastLine; j++) {
+	int first, last, pos, from, to;
+
+	first = (j == 0) ? fromPtr->charIndex : 0;
+	last = (j == lastLine) ? cut : INT_MAX;
+	lines[j].linePtr = linePtr;
+	lines[j].start = Tcl_DStringLength(&text);
+	lines[j].skipped = 0;
+	for (segPtr = linePtr->segPtr, pos = 0;
+		(segPtr != NULL) && (pos < last);
+		pos += segPtr->size, segPtr = segPtr->nextPtr) {
+	    if (segPtr->typePtr != &ckTextCharType) {
+		continue;
+	    }
+	    from = (first > pos) ? first - pos : 0;
+	    if (from > segPtr->size) {
+		from = segPtr->size;
+	    }
+	    to = (last - pos < segPtr->size) ? last - pos : segPtr->size;
+	    lines[j].skipped += from;
+	    if (to > from) {
+		Tcl_DStringAppend(&text, segPtr->body.chars + from, to - from);
+	    }
+	}
+	linePtr = CkBTreeNextLine(linePtr);
+    }
+    if (cut == INT_MAX) {
+	Tcl_DStringSetLength(&text, Tcl_DStringLength(&text) - 1);
+    }
+    string = Tcl_DStringValue(&text);
+
+    /*
+     * Find the matches as in TextSearchCmd, in increasing order.  "^"
+     * only matches at the beginning of the range if it is also the
+     * beginning of a line, and "$" at its end if it is the end of one.
+     */
+
+    textObj = Tcl_NewStringObj(string, Tcl_DStringLength(&text));
+    Tcl_IncrRefCount(textObj);
+    numRangeChars = Tcl_GetCharLength(textObj);
+    notBol = (fromPtr->charIndex > 0);
+    notEol = (cut != INT_MAX) && (cut > 0);
+    cursor.string = string;
+    cursor.byteIndex = cursor.charIndex = 0;
+    spaceMatches = 16;
+    matches = (SearchMatch *) ckalloc(spaceMatches * sizeof(SearchMatch));
+    numMatches = 0;
+    offset = 0;
+    code = TCL_OK;
+    while (offset <= numRangeChars) {
+	Tcl_RegExpInfo info;
+	int match, start, end;
+
+	flags = notEol ? TCL_REG_NOTEOL : 0;
+	if ((offset > 0) ? (Tcl_GetUniChar(textObj, offset - 1) != '\n')
+		: notBol) {
+	    flags |= TCL_REG_NOTBOL;
+	}
+	match = Tcl_RegExpExecObj(interp, regexp, textObj, offset, 1, flags);
+	if (match < 0) {
+	    code = TCL_ERROR;
+	    goto done;
+	}
+	if (!match) {
+	    break;
+	}
+	Tcl_RegExpGetInfo(regexp, &info);
+	start = offset + info.matches[0].start;
+	end = offset + info.matches[0].end;
+	if (numMatches == spaceMatches) {
+	    spaceMatches *= 2;
+	    matches = (SearchMatch *) ckrealloc((char *) matches,
+		    spaceMatches * sizeof(SearchMatch));
+	}
+	matches[numMatches].first = UtfCursorToByte(&cursor, start);
+	matches[numMatches].length = UtfCursorToByte(&cursor, end)
+		- matches[numMatches].first;
+	numMatches++;
+	if (!searchPtr->backwards && !searchPtr->all) {
+	    break;
+	}
+	offset = (searchPtr->all && (end > start)) ? end : start + 1;
+    }
+
+    /*
+     * Turn the matches into indices.  The count of a match spanning
+     * lines includes the embedded windows in all of them.
+     */
+
+    for (k = 0; k < numMatches; k++) {
+	SearchMatch *matchPtr;
+	int matchChar, numChars;
+
+	matchPtr = &matches[searchPtr->backwards ? numMatches - 1 - k : k];
+	j = SearchRangeLine(lines, lastLine, matchPtr->first);
+	n = matchPtr->first - lines[j].start + lines[j].skipped;
+	matchChar = SearchLineIndex(lines[j].linePtr, n);
+	CkTextMakeByteIndex(textPtr->tree, fromLine + j, matchChar, &index);
+	if ((limitPtr != NULL) && (CkTextIndexCmp(&index, limitPtr) >= 0)) {
+	    continue;
+	}
+	numChars = Tcl_NumUtfChars(string + matchPtr->first,
+		matchPtr->length);
+	if (matchPtr->length > 0) {
+	    int lastByte = matchPtr->first + matchPtr->length - 1;
+
+	    numChars -= matchChar - n;
+	    for (; (j < lastLine) && (lines[j + 1].start <= lastByte); j++) {
+		n = lines[j + 1].start - lines[j].start + lines[j].skipped - 1;
+		numChars += SearchLineIndex(lines[j].linePtr, n) - n;
+	    }
+	    n = lastByte - lines[j].start + lines[j].skipped;
+	    numChars += SearchLineIndex(lines[j].linePtr, n) - n;
+	}
+	code = SearchFound(searchPtr, &index, numChars);
+	if (code != TCL_OK) {
+	    break;
+	}
+    }
+
+    done:
+    ckfree((char *) matches);
+    Tcl_DecrRefCount(textObj);
+    Tcl_DStringFree(&text);
+    ckfree((char *) lines);
+    return code;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SearchRangeLine --
+ *
+ *	Finds the line of the text gathered by SearchRange that holds
+ *	a given byte.
+ *
+ * Results:
+ *	The position of the line in the array.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SearchRangeLine(lines, lastLine, byteIndex)
+    SearchLine *lines;		/* Lines of the range. */
+    int lastLine;		/* Position of the last one. */
+    int byteIndex;		/* Offset in the text of the range. */
+{
+    int lo = 0, hi = lastLine, mid;
+
+    while (lo < hi) {
+	mid = (lo + hi + 1) / 2;
+	if (lines[mid].start <= byteIndex) {
+	    lo = mid;
+	} else {
+	    hi = mid - 1;
+	}
+    }
+    return lo;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SearchLineIndex --
+ *
+ *	Converts an offset in the characters of a line, as searched, to
+ *	an offset in the line, which also counts embedded windows and
+ *	any other non-textual segments.
+ *
+ * Results:
+ *	The byte index in the line.
+ *
+ * Side effects:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SearchLineIndex(linePtr, textIndex)
+    CkTextLine *linePtr;	/* Line searched. */
+    int textIndex;		/* Offset in its characters. */
+{
+    CkTextSegment *segPtr;
+    int index = textIndex;
+
+    for (segPtr = linePtr->segPtr; segPtr != NULL;
+	    segPtr = segPtr->nextPtr) {
+	if (segPtr->typePtr != &ckTextCharType) {
+	    index += segPtr->size;
+	    continue;
+	}
+	if (textIndex < segPtr->size) {
+	    break;
+	}
+	textIndex -= segPtr->size;
+    }
+    return index;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SearchFound --
+ *
+ *	Records a match of the "search" widget command, unless it lies
+ *	beyond the stop index.
+ *
+ * Results:
+ *	TCL_OK if the search goes on, TCL_BREAK if it is over.
+ *
+ * Side effects:
+ *	The index and count of the match are appended to the lists of
+ *	the search.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+SearchFound(searchPtr, indexPtr, numChars)
+    TextSearch *searchPtr;	/* Search in progress. */
+    CkTextIndex *indexPtr;	/* Where the match starts. */
+    int numChars;		/* Its length in characters. */
+{
+    char buf[200];
+
+    if (!searchPtr->searchWholeText) {
+	if (!searchPtr->backwards
+		&& (CkTextIndexCmp(indexPtr, &searchPtr->stopIndex) >= 0)) {
+	    return TCL_BREAK;
+	}
+	if (searchPtr->backwards
+		&& (CkTextIndexCmp(indexPtr, &searchPtr->stopIndex) < 0)) {
+	    return TCL_BREAK;
+	}
+    }
+    CkTextPrintIndex(indexPtr, buf);
+    Tcl_ListObjAppendElement(NULL, searchPtr->resultObj,
+	    Tcl_NewStringObj(buf, -1));
+    Tcl_ListObjAppendElement(NULL, searchPtr->countObj,
+	    Tcl_NewIntObj(numChars));
+    return searchPtr->all ? TCL_OK : TCL_BREAK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * UtfCursorToChar, UtfCursorToByte --
+ *
+ *	Convert between byte and character offsets in a string, moving
+ *	from the last position converted so that successive matches in
+ *	a line are converted in linear time.
+ *
+ * Results:
+ *	The character, respectively byte, offset.
+ *
+ * Side effects:
+ *	The cursor is moved to the position.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+UtfCursorToChar(cursorPtr, byteIndex)
+    UtfCursor *cursorPtr;	/* Position last converted. */
+    int byteIndex;		/* Byte offset to convert. */
+{
+    char *string = cursorPtr->string;
+
+    while (cursorPtr->byteIndex < byteIndex) {
+	cursorPtr->byteIndex = Tcl_UtfNext(string + cursorPtr->byteIndex)
+		- string;
+	cursorPtr->charIndex++;
+    }
+    while (cursorPtr->byteIndex > byteIndex) {
+	cursorPtr->byteIndex = Tcl_UtfPrev(string + cursorPtr->byteIndex,
+		string) - string;
+	cursorPtr->charIndex--;
+    }
+    return cursorPtr->charIndex;
+}
+
+static int
+UtfCursorToByte(cursorPtr, charIndex)
+    UtfCursor *cursorPtr;	/* Position last converted. */
+    int charIndex;		/* Character offset to convert. */
+{
+    char *string = cursorPtr->string;
+
+    while (cursorPtr->charIndex < charIndex) {
+	cursorPtr->byteIndex = Tcl_UtfNext(string + cursorPtr->byteIndex)
+		- string;
+	cursorPtr->charIndex++;
+    }
+    while (cursorPtr->charIndex > charIndex) {
+	cursorPtr->byteIndex = Tcl_UtfPrev(string + cursorPtr->byteIndex,
+		string) - string;
+	cursorPtr->charIndex--;
+    }
+    return cursorPtr->byteIndex;
+}
 
 /*
  *----------------------------------------------------------------------
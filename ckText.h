@@ -452,6 +452,37 @@ typedef struct CkText {
     CkTextTag **curTagArrayPtr;	/* Pointer to array of tags for current
 				 * mark, or NULL if none. */
 
+    /*
+     * Information used to limit the size of the text and by the
+     * "append" widget command:
+     */
+
+    int maxLines;		/* Value of -maxlines option:  number of
+				 * complete lines kept, 0 means no limit. */
+    Tcl_Channel tailChannel;	/* Channel whose data is appended to the
+				 * text as it arrives, or NULL. */
+    int tailMaxLines;		/* Number of lines kept when appending
+				 * from tailChannel, 0 means no limit. */
+
+    /*
+     * Information used for undo and redo:
+     */
+
+    int undo;			/* Value of -undo option:  non-zero means
+				 * insertions and deletions are recorded. */
+    int maxUndo;		/* Value of -maxundo option:  number of
+				 * bytes the records may use, 0 means no
+				 * limit. */
+    int autoSeparators;		/* Value of -autoseparators option. */
+    struct CkTextEdit *undoPtr;	/* Most recent edit recorded, or NULL. */
+    struct CkTextEdit *oldestUndoPtr;
+				/* Oldest edit recorded, or NULL. */
+    struct CkTextEdit *redoPtr;	/* Last edit undone, or NULL. */
+    int undoSize;		/* Number of bytes used by the records of
+				 * both lists. */
+    int modified;		/* Non-zero means the text was changed
+				 * since the flag was last reset. */
+
     /*
      * Miscellaneous additional information:
      */
@@ -478,6 +509,9 @@ typedef struct CkText {
  *				focus.
  * UPDATE_SCROLLBARS:		Non-zero means scrollbar(s) should be updated
  *				during next redisplay operation.
+ * EDIT_SUSPENDED:		Non-zero means insertions and deletions
+ *				aren't recorded for undo, because edits are
+ *				being undone or redone or the text loaded.
  */
 
 #define GOT_SELECTION		1
@@ -485,6 +519,7 @@ typedef struct CkText {
 #define GOT_FOCUS		4
 #define UPDATE_SCROLLBARS	0x10
 #define NEED_REPICK		0x20
+#define EDIT_SUSPENDED		0x40
 
 /*
  * Records of the following type define segment types in terms of
@@ -604,6 +639,8 @@ extern void		CkBTreeStartSearch _ANSI_ARGS_((CkTextIndex *index1Ptr,
 extern void		CkBTreeTag _ANSI_ARGS_((CkTextIndex *index1Ptr,
 			    CkTextIndex *index2Ptr, CkTextTag *tagPtr,
 			    int add));
+extern void		CkBTreeTrimLines _ANSI_ARGS_((CkTextBTree tree,
+			    int count));
 extern void		CkBTreeUnlinkSegment _ANSI_ARGS_((CkTextBTree tree,
 			    CkTextSegment *segPtr, CkTextLine *linePtr));
 extern void		CkTextBindProc _ANSI_ARGS_((ClientData clientData,
@@ -65,6 +65,14 @@ typedef struct Node {
 #define MAX_CHILDREN 12
 #define MIN_CHILDREN 6
 
+/*
+ * Number of children of the nodes a node with too many children is
+ * split into, between MIN_CHILDREN and MAX_CHILDREN so that the new
+ * nodes can both grow and shrink a little before being rebalanced.
+ */
+
+#define SPLIT_CHILDREN 9
+
 /*
  * The data structure below defines an entire B-tree.
  */
@@ -791,6 +799,138 @@ CkBTreeDeleteChars(index1Ptr, index2Ptr)
     }
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * CkBTreeTrimLines --
+ *
+ *	Delete the first lines of a B-tree, as CkBTreeDeleteChars would
+ *	from the beginning of the text to the beginning of a line, but
+ *	without walking the deleted lines one at a time through the
+ *	tree:  whole subtrees are cut off its left edge, so that
+ *	trimming the oldest lines of a text that keeps growing costs
+ *	little more than freeing them.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The lines are deleted.  Marks and toggles in them are moved to
+ *	the beginning of the first line left, as for other deletions.
+ *	Indices referring to deleted lines must not be used anymore.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+CkBTreeTrimLines(tree, count)
+    CkTextBTree tree;			/* Tree to trim. */
+    int count;				/* Number of lines to delete.  The
+					 * last line of the text is always
+					 * kept. */
+{
+    BTree *treePtr = (BTree *) tree;
+    CkTextSegment *segPtr, *nextPtr, *leftPtr, **leftTailPtr;
+    CkTextSegment *rightPtr, **rightTailPtr;
+    CkTextLine *linePtr;
+    Node *nodePtr, *childPtr;
+    int i, left;
+
+    if (count > CkBTreeNumLines(tree) - 1) {
+	count = CkBTreeNumLines(tree) - 1;
+    }
+    if (count <= 0) {
+	return;
+    }
+
+    /*
+     * Give the segments of the lines a chance to go away while the
+     * tree is intact:  characters are freed, while marks and toggles
+     * refuse to die, toggles leaving the node counts.  The survivors
+     * all end up at the same place, so they are kept in two lists
+     * to put those with left gravity first.
+     */
+
+    leftPtr = rightPtr = NULL;
+    leftTailPtr = &leftPtr;
+    rightTailPtr = &rightPtr;
+    linePtr = CkBTreeFindLine(tree, 0);
+    for (i = 0; i < count; i++) {
+	for (segPtr = linePtr->segPtr; segPtr != NULL; segPtr = nextPtr) {
+	    nextPtr = segPtr->nextPtr;
+	    if ((*segPtr->typePtr->deleteProc)(segPtr, linePtr, 0) == 0) {
+		continue;
+	    }
+	    if (segPtr->typePtr->leftGravity) {
+		*leftTailPtr = segPtr;
+		leftTailPtr = &segPtr->nextPtr;
+	    } else {
+		*rightTailPtr = segPtr;
+		rightTailPtr = &segPtr->nextPtr;
+	    }
+	}
+	linePtr->segPtr = NULL;
+	linePtr = CkBTreeNextLine(linePtr);
+    }
+
+    /*
+     * Go down the left edge of the tree, dropping the children that
+     * only hold deleted lines, then the deleted lines left in the
+     * bottom node.
+     */
+
+    nodePtr = treePtr->rootPtr;
+    left = count;
+    while (1) {
+	nodePtr->numLines -= left;
+	if (nodePtr->level == 0) {
+	    break;
+	}
+	while (left >= (childPtr = nodePtr->children.nodePtr)->numLines) {
+	    nodePtr->children.nodePtr = childPtr->nextPtr;
+	    nodePtr->numChildren--;
+	    left -= childPtr->numLines;
+	    DestroyNode(childPtr);
+	}
+	nodePtr = childPtr;
+    }
+    for ( ; left > 0; left--) {
+	linePtr = nodePtr->children.linePtr;
+	nodePtr->children.linePtr = linePtr->nextPtr;
+	nodePtr->numChildren--;
+	ckfree((char *) linePtr);
+    }
+
+    /*
+     * Move the surviving segments to the first line left, sorted
+     * along with the empty segments at its beginning, where they
+     * get back into the node counts, and rebalance the left edge.
+     */
+
+    linePtr = nodePtr->children.linePtr;
+    if ((leftPtr != NULL) || (rightPtr != NULL)) {
+	for (segPtr = linePtr->segPtr; (segPtr != NULL)
+		&& (segPtr->size == 0); segPtr = nextPtr) {
+	    nextPtr = segPtr->nextPtr;
+	    if (segPtr->typePtr->leftGravity) {
+		*leftTailPtr = segPtr;
+		leftTailPtr = &segPtr->nextPtr;
+	    } else {
+		*rightTailPtr = segPtr;
+		rightTailPtr = &segPtr->nextPtr;
+	    }
+	}
+	*rightTailPtr = segPtr;
+	*leftTailPtr = rightPtr;
+	linePtr->segPtr = leftPtr;
+	CleanupLine(linePtr);
+    }
+    Rebalance(treePtr, nodePtr);
+    if (ckBTreeDebug) {
+	CkBTreeCheck(tree);
+    }
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -2049,53 +2189,57 @@ Rebalance(treePtr, nodePtr)
     for ( ; nodePtr != NULL; nodePtr = nodePtr->parentPtr) {
 	register Node *newPtr, *childPtr;
 	register CkTextLine *linePtr;
-	int i;
+	int i, numPieces, numChildren, pieceSize;
 
 	/*
 	 * Check to see if the node has too many children.  If it does,
-	 * then split off all but the first MIN_CHILDREN into a separate
-	 * node following the original one.  Then repeat until the
-	 * node has a decent size.
+	 * then split it into as many nodes of about SPLIT_CHILDREN
+	 * children as needed, all at once.  When many lines are inserted
+	 * at one place this builds the tree bottom up in a single pass,
+	 * instead of splitting off MIN_CHILDREN children at a time and
+	 * leaving nodes that are as small as allowed.
 	 */
 
 	if (nodePtr->numChildren > MAX_CHILDREN) {
-	    while (1) {
-		/*
-		 * If the node being split is the root node, then make a
-		 * new root node above it first.
-		 */
-    
-		if (nodePtr->parentPtr == NULL) {
-		    newPtr = (Node *) ckalloc(sizeof(Node));
-		    newPtr->parentPtr = NULL;
-		    newPtr->nextPtr = NULL;
-		    newPtr->summaryPtr = NULL;
-		    newPtr->level = nodePtr->level + 1;
-		    newPtr->children.nodePtr = nodePtr;
-		    newPtr->numChildren = 1;
-		    newPtr->numLines = nodePtr->numLines;
-		    RecomputeNodeCounts(newPtr);
-		    treePtr->rootPtr = newPtr;
-		}
+	    /*
+	     * If the node being split is the root node, then make a
+	     * new root node above it first.
+	     */
+
+	    if (nodePtr->parentPtr == NULL) {
+		newPtr = (Node *) ckalloc(sizeof(Node));
+		newPtr->parentPtr = NULL;
+		newPtr->nextPtr = NULL;
+		newPtr->summaryPtr = NULL;
+		newPtr->level = nodePtr->level + 1;
+		newPtr->children.nodePtr = nodePtr;
+		newPtr->numChildren = 1;
+		newPtr->numLines = nodePtr->numLines;
+		RecomputeNodeCounts(newPtr);
+		treePtr->rootPtr = newPtr;
+	    }
+	    numChildren = nodePtr->numChildren;
+	    numPieces = (numChildren + SPLIT_CHILDREN - 1) / SPLIT_CHILDREN;
+	    for (i = 1; i < numPieces; i++) {
+		pieceSize = numChildren / numPieces
+			+ ((i <= numChildren % numPieces) ? 1 : 0);
 		newPtr = (Node *) ckalloc(sizeof(Node));
 		newPtr->parentPtr = nodePtr->parentPtr;
 		newPtr->nextPtr = nodePtr->nextPtr;
 		nodePtr->nextPtr = newPtr;
 		newPtr->summaryPtr = NULL;
 		newPtr->level = nodePtr->level;
-		newPtr->numChildren = nodePtr->numChildren - MIN_CHILDREN;
+		newPtr->numChildren = nodePtr->numChildren - pieceSize;
 		if (nodePtr->level == 0) {
-		    for (i = MIN_CHILDREN-1,
-			    linePtr = nodePtr->children.linePtr;
-			    i > 0; i--, linePtr = linePtr->nextPtr) {
+		    for (linePtr = nodePtr->children.linePtr;
+			    --pieceSize > 0; linePtr = linePtr->nextPtr) {
 			/* Empty loop body. */
 		    }
 		    newPtr->children.linePtr = linePtr->nextPtr;
 		    linePtr->nextPtr = NULL;
 		} else {
-		    for (i = MIN_CHILDREN-1,
-			    childPtr = nodePtr->children.nodePtr;
-			    i > 0; i--, childPtr = childPtr->nextPtr) {
+		    for (childPtr = nodePtr->children.nodePtr;
+			    --pieceSize > 0; childPtr = childPtr->nextPtr) {
 			/* Empty loop body. */
 		    }
 		    newPtr->children.nodePtr = childPtr->nextPtr;
@@ -2104,11 +2248,8 @@ Rebalance(treePtr, nodePtr)
 		RecomputeNodeCounts(nodePtr);
 		nodePtr->parentPtr->numChildren++;
 		nodePtr = newPtr;
-		if (nodePtr->numChildren <= MAX_CHILDREN) {
-		    RecomputeNodeCounts(nodePtr);
-		    break;
-		}
 	    }
+	    RecomputeNodeCounts(nodePtr);
 	}
 
 	while (nodePtr->numChildren < MIN_CHILDREN) {
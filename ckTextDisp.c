@@ -100,6 +100,11 @@ typedef struct DLine {
 				 * (b) can have gaps where DLine's have been
 				 * deleted because they're out of date. */
     int flags;			/* Various flag bits:  see below for values. */
+    struct DLine *newerPtr;	/* Next more recently cached DLine.  This
+				 * field and the next one are only used
+				 * while the DLine is in
+				 * dInfoPtr->dLineCache. */
+    struct DLine *olderPtr;	/* Next less recently cached DLine. */
 } DLine;
 
 /*
@@ -191,8 +196,27 @@ typedef struct DInfo {
 				 * could dump core. */
     int flags;			/* Various flag values:  see below for
 				 * definitions. */
+
+    /*
+     * Information used to keep display lines that were removed from
+     * the window without being out of date, so that they needn't be
+     * layed out again when they come back into view:
+     */
+
+    Tcl_HashTable dLineCache;	/* Maps from a CkTextLine to the list of
+				 * its cached DLines, linked by nextPtr. */
+    DLine *newestPtr;		/* Most recently cached DLine. */
+    DLine *oldestPtr;		/* Least recently cached DLine, the first
+				 * one to be freed when the cache is full. */
+    int numCached;		/* Number of DLines in the cache. */
 } DInfo;
 
+/*
+ * Maximum number of DLines kept in dInfoPtr->dLineCache.
+ */
+
+#define DLINE_CACHE_SIZE	256
+
 /*
  * In CkTextDispChunk structures for character segments, the clientData
  * field points to one of the following structures:
@@ -244,6 +268,8 @@ static int linesRedrawn;	/* Number of calls to DisplayDLine. */
 static void		AdjustForTab _ANSI_ARGS_((CkText *textPtr,
 			    CkTextTabArray *tabArrayPtr, int index,
 			    CkTextDispChunk *chunkPtr));
+static void		CacheDLines _ANSI_ARGS_((CkText *textPtr,
+			    DLine *firstPtr, DLine *lastPtr, int unlink));
 static void		CharBboxProc _ANSI_ARGS_((CkTextDispChunk *chunkPtr,
 			    int index, int y, int lineHeight, int baseline,
 			    int *xPtr, int *yPtr, int *widthPtr,
@@ -262,8 +288,14 @@ static DLine *		FindDLine _ANSI_ARGS_((DLine *dlPtr,
 			    CkTextIndex *indexPtr));
 static void		FreeDLines _ANSI_ARGS_((CkText *textPtr,
 			    DLine *firstPtr, DLine *lastPtr, int unlink));
+static void		FreeCachedDLine _ANSI_ARGS_((CkText *textPtr,
+			    DLine *dlPtr));
 static void		FreeStyle _ANSI_ARGS_((CkText *textPtr,
 			    Style *stylePtr));
+static DLine *		GetCachedDLine _ANSI_ARGS_((CkText *textPtr,
+			    CkTextIndex *indexPtr));
+static DLine *		GetDLine _ANSI_ARGS_((CkText *textPtr,
+			    CkTextIndex *indexPtr));
 static Style *		GetStyle _ANSI_ARGS_((CkText *textPtr,
 			    CkTextIndex *indexPtr));
 static void		GetXView _ANSI_ARGS_((Tcl_Interp *interp,
@@ -275,6 +307,12 @@ static DLine *		LayoutDLine _ANSI_ARGS_((CkText *textPtr,
 static void		MeasureUp _ANSI_ARGS_((CkText *textPtr,
 			    CkTextIndex *srcPtr, int distance,
 			    CkTextIndex *dstPtr));
+static DLine *		PeekDLine _ANSI_ARGS_((CkText *textPtr,
+			    CkTextIndex *indexPtr));
+static void		PurgeDLineCache _ANSI_ARGS_((CkText *textPtr,
+			    CkTextIndex *index1Ptr, CkTextIndex *index2Ptr));
+static void		UncacheDLine _ANSI_ARGS_((CkText *textPtr,
+			    DLine *dlPtr));
 static void		UpdateDisplayInfo _ANSI_ARGS_((CkText *textPtr));
 static void		ScrollByLines _ANSI_ARGS_((CkText *textPtr,
 			    int offset));
@@ -319,6 +357,10 @@ CkTextCreateDInfo(textPtr)
     dInfoPtr->yScrollLast = -1;
     dInfoPtr->dLinesInvalidated = 0;
     dInfoPtr->flags = DINFO_OUT_OF_DATE;
+    Tcl_InitHashTable(&dInfoPtr->dLineCache, TCL_ONE_WORD_KEYS);
+    dInfoPtr->newestPtr = NULL;
+    dInfoPtr->oldestPtr = NULL;
+    dInfoPtr->numCached = 0;
     textPtr->dInfoPtr = dInfoPtr;
 }
 
@@ -353,6 +395,8 @@ CkTextFreeDInfo(textPtr)
      */
 
     FreeDLines(textPtr, dInfoPtr->dLinePtr, (DLine *) NULL, 1);
+    PurgeDLineCache(textPtr, (CkTextIndex *) NULL, (CkTextIndex *) NULL);
+    Tcl_DeleteHashTable(&dInfoPtr->dLineCache);
     Tcl_DeleteHashTable(&dInfoPtr->styleTable);
     if (dInfoPtr->flags & REDRAW_PENDING) {
 	Tk_CancelIdleCall(DisplayText, (ClientData) textPtr);
@@ -900,7 +944,7 @@ UpdateDisplayInfo(textPtr)
     index = textPtr->topIndex;
     dlPtr = FindDLine(dInfoPtr->dLinePtr, &index);
     if ((dlPtr != NULL) && (dlPtr != dInfoPtr->dLinePtr)) {
-	FreeDLines(textPtr, dInfoPtr->dLinePtr, dlPtr, 1);
+	CacheDLines(textPtr, dInfoPtr->dLinePtr, dlPtr, 1);
     }
 
     /*
@@ -951,21 +995,24 @@ UpdateDisplayInfo(textPtr)
 	     */
 
 	    makeNewDLine:
-	    if (ckTextDebug) {
-		char string[TK_POS_CHARS];
+	    newPtr = GetCachedDLine(textPtr, &index);
+	    if (newPtr == NULL) {
+		if (ckTextDebug) {
+		    char string[TK_POS_CHARS];
 
-		/*
-		 * Debugging is enabled, so keep a log of all the lines
-		 * that were re-layed out.  The test suite uses this
-		 * information.
-		 */
+		    /*
+		     * Debugging is enabled, so keep a log of all the lines
+		     * that were re-layed out.  The test suite uses this
+		     * information.
+		     */
 
-		CkTextPrintIndex(&index, string);
-		Tcl_SetVar2(textPtr->interp, "ck_textRelayout", (char *) NULL,
-			string,
-			TCL_GLOBAL_ONLY|TCL_APPEND_VALUE|TCL_LIST_ELEMENT);
+		    CkTextPrintIndex(&index, string);
+		    Tcl_SetVar2(textPtr->interp, "ck_textRelayout",
+			    (char *) NULL, string,
+			    TCL_GLOBAL_ONLY|TCL_APPEND_VALUE|TCL_LIST_ELEMENT);
+		}
+		newPtr = LayoutDLine(textPtr, &index);
 	    }
-	    newPtr = LayoutDLine(textPtr, &index);
 	    if (prevPtr == NULL) {
 		dInfoPtr->dLinePtr = newPtr;
 	    } else {
@@ -995,8 +1042,13 @@ UpdateDisplayInfo(textPtr)
 	     */
 
 	    newPtr = dlPtr->nextPtr;
-	    FreeDLines(textPtr, dlPtr, newPtr, 0);
+	    CacheDLines(textPtr, dlPtr, newPtr, 0);
 	    dlPtr = newPtr;
+	    if (prevPtr == NULL) {
+		dInfoPtr->dLinePtr = newPtr;
+	    } else {
+		prevPtr->nextPtr = newPtr;
+	    }
 	    continue;
 	}
 
@@ -1029,7 +1081,7 @@ UpdateDisplayInfo(textPtr)
 		nextPtr = nextPtr->nextPtr;
 	    }
 	    if (nextPtr != dlPtr) {
-		FreeDLines(textPtr, dlPtr, nextPtr, 0);
+		CacheDLines(textPtr, dlPtr, nextPtr, 0);
 		prevPtr->nextPtr = nextPtr;
 		dlPtr = nextPtr;
 	    }
@@ -1051,7 +1103,7 @@ UpdateDisplayInfo(textPtr)
      * Delete any DLine structures that don't fit on the screen.
      */
 
-    FreeDLines(textPtr, dlPtr, (DLine *) NULL, 1);
+    CacheDLines(textPtr, dlPtr, (DLine *) NULL, 1);
 
     /*
      *--------------------------------------------------------------
@@ -1085,7 +1137,7 @@ UpdateDisplayInfo(textPtr)
 	    index.charIndex = 0;
 	    lowestPtr = NULL;
 	    do {
-		dlPtr = LayoutDLine(textPtr, &index);
+		dlPtr = GetDLine(textPtr, &index);
 		dlPtr->nextPtr = lowestPtr;
 		lowestPtr = dlPtr;
 #if CK_USE_UTF
@@ -1124,7 +1176,7 @@ UpdateDisplayInfo(textPtr)
 			    TCL_GLOBAL_ONLY|TCL_APPEND_VALUE|TCL_LIST_ELEMENT);
 		}
 	    }
-	    FreeDLines(textPtr, lowestPtr, (DLine *) NULL, 0);
+	    CacheDLines(textPtr, lowestPtr, (DLine *) NULL, 0);
 	    charsToCount = INT_MAX;
 	}
 
@@ -1275,6 +1327,322 @@ FreeDLines(textPtr, firstPtr, lastPtr, unlink)
     textPtr->dInfoPtr->dLinesInvalidated = 1;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * CacheDLines --
+ *
+ *	This procedure is called instead of FreeDLines for DLine
+ *	structures that are still correct but aren't needed anymore,
+ *	for example because they were scrolled out of the window.  They
+ *	are kept in dInfoPtr->dLineCache so that GetDLine can hand them
+ *	out again without laying them out.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The DLines are added to the cache.  The least recently cached
+ *	DLines are freed if the cache gets too big.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CacheDLines(textPtr, firstPtr, lastPtr, unlink)
+    CkText *textPtr;			/* Information about overall text
+					 * widget. */
+    register DLine *firstPtr;		/* Pointer to first DLine to cache. */
+    DLine *lastPtr;			/* Pointer to DLine just after last
+					 * one to cache (NULL means everything
+					 * starting with firstPtr). */
+    int unlink;				/* 1 means DLines are currently linked
+					 * into the list rooted at
+					 * textPtr->dInfoPtr->dLinePtr and
+					 * they have to be unlinked.  0 means
+					 * just cache without unlinking. */
+{
+    register DInfo *dInfoPtr = textPtr->dInfoPtr;
+    register DLine *dlPtr;
+    DLine *nextDLinePtr;
+    Tcl_HashEntry *hPtr;
+    int new;
+
+    if (unlink) {
+	if (dInfoPtr->dLinePtr == firstPtr) {
+	    dInfoPtr->dLinePtr = lastPtr;
+	} else {
+	    register DLine *prevPtr;
+	    for (prevPtr = dInfoPtr->dLinePtr;
+		    prevPtr->nextPtr != firstPtr; prevPtr = prevPtr->nextPtr) {
+		/* Empty loop body. */
+	    }
+	    prevPtr->nextPtr = lastPtr;
+	}
+    }
+    while (firstPtr != lastPtr) {
+	nextDLinePtr = firstPtr->nextPtr;
+
+	/*
+	 * Replace any cached copy of the same display line.
+	 */
+
+	hPtr = Tcl_FindHashEntry(&dInfoPtr->dLineCache,
+		(char *) firstPtr->index.linePtr);
+	if (hPtr != NULL) {
+	    for (dlPtr = (DLine *) Tcl_GetHashValue(hPtr); dlPtr != NULL;
+		    dlPtr = dlPtr->nextPtr) {
+		if (dlPtr->index.charIndex == firstPtr->index.charIndex) {
+		    FreeCachedDLine(textPtr, dlPtr);
+		    break;
+		}
+	    }
+	}
+	hPtr = Tcl_CreateHashEntry(&dInfoPtr->dLineCache,
+		(char *) firstPtr->index.linePtr, &new);
+	firstPtr->nextPtr = new ? NULL : (DLine *) Tcl_GetHashValue(hPtr);
+	Tcl_SetHashValue(hPtr, (ClientData) firstPtr);
+	firstPtr->newerPtr = NULL;
+	firstPtr->olderPtr = dInfoPtr->newestPtr;
+	if (dInfoPtr->newestPtr != NULL) {
+	    dInfoPtr->newestPtr->newerPtr = firstPtr;
+	} else {
+	    dInfoPtr->oldestPtr = firstPtr;
+	}
+	dInfoPtr->newestPtr = firstPtr;
+	dInfoPtr->numCached++;
+	firstPtr = nextDLinePtr;
+    }
+    while (dInfoPtr->numCached > DLINE_CACHE_SIZE) {
+	FreeCachedDLine(textPtr, dInfoPtr->oldestPtr);
+    }
+    dInfoPtr->dLinesInvalidated = 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * UncacheDLine, FreeCachedDLine --
+ *
+ *	Remove one DLine from dInfoPtr->dLineCache.  UncacheDLine
+ *	leaves it to the caller, FreeCachedDLine frees it.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The cache shrinks by one DLine.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+UncacheDLine(textPtr, dlPtr)
+    CkText *textPtr;			/* Information about overall text
+					 * widget. */
+    register DLine *dlPtr;		/* DLine in the cache. */
+{
+    register DInfo *dInfoPtr = textPtr->dInfoPtr;
+    register DLine *prevPtr;
+    Tcl_HashEntry *hPtr;
+
+    hPtr = Tcl_FindHashEntry(&dInfoPtr->dLineCache,
+	    (char *) dlPtr->index.linePtr);
+    prevPtr = (DLine *) Tcl_GetHashValue(hPtr);
+    if (prevPtr == dlPtr) {
+	if (dlPtr->nextPtr == NULL) {
+	    Tcl_DeleteHashEntry(hPtr);
+	} else {
+	    Tcl_SetHashValue(hPtr, (ClientData) dlPtr->nextPtr);
+	}
+    } else {
+	while (prevPtr->nextPtr != dlPtr) {
+	    prevPtr = prevPtr->nextPtr;
+	}
+	prevPtr->nextPtr = dlPtr->nextPtr;
+    }
+    if (dlPtr->newerPtr != NULL) {
+	dlPtr->newerPtr->olderPtr = dlPtr->olderPtr;
+    } else {
+	dInfoPtr->newestPtr = dlPtr->olderPtr;
+    }
+    if (dlPtr->olderPtr != NULL) {
+	dlPtr->olderPtr->newerPtr = dlPtr->newerPtr;
+    } else {
+	dInfoPtr->oldestPtr = dlPtr->newerPtr;
+    }
+    dlPtr->nextPtr = NULL;
+    dInfoPtr->numCached--;
+}
+
+static void
+FreeCachedDLine(textPtr, dlPtr)
+    CkText *textPtr;			/* Information about overall text
+					 * widget. */
+    DLine *dlPtr;			/* DLine in the cache. */
+{
+    UncacheDLine(textPtr, dlPtr);
+    FreeDLines(textPtr, dlPtr, (DLine *) NULL, 0);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PurgeDLineCache --
+ *
+ *	This procedure is called when the display of a range of
+ *	characters changes, to throw away the cached DLines of the
+ *	text lines in the range.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	DLines get freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PurgeDLineCache(textPtr, index1Ptr, index2Ptr)
+    CkText *textPtr;		/* Widget record for text widget. */
+    CkTextIndex *index1Ptr;	/* First character of the range.  NULL
+				 * means beginning of text. */
+    CkTextIndex *index2Ptr;	/* Last character of the range.  NULL
+				 * means end of text. */
+{
+    register DInfo *dInfoPtr = textPtr->dInfoPtr;
+    register DLine *dlPtr;
+    DLine *newerPtr;
+    Tcl_HashEntry *hPtr;
+    int line1, line2, lineNum;
+
+    if (dInfoPtr->numCached == 0) {
+	return;
+    }
+    if ((index1Ptr == NULL) && (index2Ptr == NULL)) {
+	while (dInfoPtr->oldestPtr != NULL) {
+	    FreeCachedDLine(textPtr, dInfoPtr->oldestPtr);
+	}
+	return;
+    }
+    if ((index1Ptr != NULL) && (index2Ptr != NULL)
+	    && (index1Ptr->linePtr == index2Ptr->linePtr)) {
+	while ((hPtr = Tcl_FindHashEntry(&dInfoPtr->dLineCache,
+		(char *) index1Ptr->linePtr)) != NULL) {
+	    FreeCachedDLine(textPtr, (DLine *) Tcl_GetHashValue(hPtr));
+	}
+	return;
+    }
+    line1 = (index1Ptr == NULL) ? 0 : CkBTreeLineIndex(index1Ptr->linePtr);
+    line2 = (index2Ptr == NULL) ? INT_MAX
+	    : CkBTreeLineIndex(index2Ptr->linePtr);
+    for (dlPtr = dInfoPtr->oldestPtr; dlPtr != NULL; dlPtr = newerPtr) {
+	newerPtr = dlPtr->newerPtr;
+	lineNum = CkBTreeLineIndex(dlPtr->index.linePtr);
+	if ((lineNum >= line1) && (lineNum <= line2)) {
+	    FreeCachedDLine(textPtr, dlPtr);
+	}
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetDLine --
+ *
+ *	Returns the DLine structure for the display line starting at
+ *	a given index, taking it from dInfoPtr->dLineCache if possible.
+ *	GetDLine lays out a new one if the index isn't in the cache,
+ *	GetCachedDLine just returns NULL.
+ *
+ * Results:
+ *	The return value is a pointer to a DLine structure which
+ *	belongs to the caller, with its nextPtr field NULL.
+ *
+ * Side effects:
+ *	The DLine is removed from the cache or storage is allocated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static DLine *
+GetCachedDLine(textPtr, indexPtr)
+    CkText *textPtr;		/* Overall information about text widget. */
+    CkTextIndex *indexPtr;	/* Beginning of the display line. */
+{
+    register DLine *dlPtr;
+    Tcl_HashEntry *hPtr;
+
+    hPtr = Tcl_FindHashEntry(&textPtr->dInfoPtr->dLineCache,
+	    (char *) indexPtr->linePtr);
+    if (hPtr == NULL) {
+	return NULL;
+    }
+    for (dlPtr = (DLine *) Tcl_GetHashValue(hPtr); dlPtr != NULL;
+	    dlPtr = dlPtr->nextPtr) {
+	if (dlPtr->index.charIndex == indexPtr->charIndex) {
+	    UncacheDLine(textPtr, dlPtr);
+	    dlPtr->oldY = -1;
+	    dlPtr->flags = NEW_LAYOUT;
+	    return dlPtr;
+	}
+    }
+    return NULL;
+}
+
+static DLine *
+GetDLine(textPtr, indexPtr)
+    CkText *textPtr;		/* Overall information about text widget. */
+    CkTextIndex *indexPtr;	/* Beginning of the display line. */
+{
+    DLine *dlPtr;
+
+    dlPtr = GetCachedDLine(textPtr, indexPtr);
+    if (dlPtr == NULL) {
+	dlPtr = LayoutDLine(textPtr, indexPtr);
+    }
+    return dlPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PeekDLine --
+ *
+ *	Returns a DLine structure for the display line starting at
+ *	a given index, for callers which only need to measure it.  The
+ *	line displayed in the window is used if there is one, otherwise
+ *	the DLine comes from GetDLine and goes to the cache.
+ *
+ * Results:
+ *	The return value is a pointer to a DLine structure which is
+ *	owned by the display or the cache.  It may be freed by the next
+ *	call to a procedure of this file, so it must not be kept.
+ *
+ * Side effects:
+ *	A DLine may be layed out and cached.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static DLine *
+PeekDLine(textPtr, indexPtr)
+    CkText *textPtr;		/* Overall information about text widget. */
+    CkTextIndex *indexPtr;	/* Beginning of the display line. */
+{
+    DLine *dlPtr;
+
+    dlPtr = FindDLine(textPtr->dInfoPtr->dLinePtr, indexPtr);
+    if ((dlPtr != NULL) && (dlPtr->index.linePtr == indexPtr->linePtr)
+	    && (dlPtr->index.charIndex == indexPtr->charIndex)) {
+	return dlPtr;
+    }
+    dlPtr = GetDLine(textPtr, indexPtr);
+    CacheDLines(textPtr, dlPtr, (DLine *) NULL, 0);
+    return dlPtr;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1689,6 +2057,13 @@ CkTextChanged(textPtr, index1Ptr, index2Ptr)
     }
     dInfoPtr->flags |= REDRAW_PENDING|DINFO_OUT_OF_DATE|REPICK_NEEDED;
 
+    /*
+     * Cached DLines of the text lines in the range are out of date
+     * too, even those that aren't in the window.
+     */
+
+    PurgeDLineCache(textPtr, index1Ptr, index2Ptr);
+
     /*
      * Find the DLines corresponding to index1Ptr and index2Ptr.  There
      * is one tricky thing here, which is that we have to relayout in
@@ -1757,6 +2132,13 @@ CkTextRedrawTag(textPtr, index1Ptr, index2Ptr, tagPtr, withTag)
     DInfo *dInfoPtr = textPtr->dInfoPtr;
     CkTextIndex endOfText, *endIndexPtr;
 
+    /*
+     * The cached DLines aren't on the screen, so all those in the
+     * range have to go.
+     */
+
+    PurgeDLineCache(textPtr, index1Ptr, index2Ptr);
+
     /*
      * Round up the starting position if it's before the first line
      * visible on the screen (we only care about what's on the screen).
@@ -1911,11 +2293,13 @@ CkTextRelayoutWindow(textPtr)
     dInfoPtr->flags |= REDRAW_PENDING|DINFO_OUT_OF_DATE|REPICK_NEEDED;
 
     /*
-     * Throw away all the current layout information.
+     * Throw away all the current layout information, including the
+     * cached DLines.
      */
 
     FreeDLines(textPtr, dInfoPtr->dLinePtr, (DLine *) NULL, 1);
     dInfoPtr->dLinePtr = NULL;
+    PurgeDLineCache(textPtr, (CkTextIndex *) NULL, (CkTextIndex *) NULL);
 
     /*
      * Recompute some overall things for the layout.  Even if the
@@ -2136,7 +2520,7 @@ MeasureUp(textPtr, srcPtr, distance, dstPtr)
 	index.charIndex = 0;
 	lowestPtr = NULL;
 	do {
-	    dlPtr = LayoutDLine(textPtr, &index);
+	    dlPtr = GetDLine(textPtr, &index);
 	    dlPtr->nextPtr = lowestPtr;
 	    lowestPtr = dlPtr;
 #if CK_USE_UTF
@@ -2168,7 +2552,7 @@ MeasureUp(textPtr, srcPtr, distance, dstPtr)
 	 * for the next display line to lay out.
 	 */
 
-	FreeDLines(textPtr, lowestPtr, (DLine *) NULL, 0);
+	CacheDLines(textPtr, lowestPtr, (DLine *) NULL, 0);
 	if (distance < 0) {
 	    return;
 	}
@@ -2421,7 +2805,7 @@ ScrollByLines(textPtr, offset)
 	    index.charIndex = 0;
 	    lowestPtr = NULL;
 	    do {
-		dlPtr = LayoutDLine(textPtr, &index);
+		dlPtr = GetDLine(textPtr, &index);
 		dlPtr->nextPtr = lowestPtr;
 		lowestPtr = dlPtr;
 #if CK_USE_UTF
@@ -2446,7 +2830,7 @@ ScrollByLines(textPtr, offset)
 	     * for the next display line to lay out.
 	     */
     
-	    FreeDLines(textPtr, lowestPtr, (DLine *) NULL, 0);
+	    CacheDLines(textPtr, lowestPtr, (DLine *) NULL, 0);
 	    if (offset >= 0) {
 		goto scheduleUpdate;
 	    }
@@ -2471,8 +2855,7 @@ ScrollByLines(textPtr, offset)
 	lastLinePtr = CkBTreeFindLine(textPtr->tree,
 		CkBTreeNumLines(textPtr->tree));
 	for (i = 0; i < offset; i++) {
-	    dlPtr = LayoutDLine(textPtr, &textPtr->topIndex);
-	    dlPtr->nextPtr = NULL;
+	    dlPtr = PeekDLine(textPtr, &textPtr->topIndex);
 #if CK_USE_UTF
 	    if (dlPtr->length == 0 && dlPtr->height == 0) {
 		offset++;
@@ -2481,7 +2864,6 @@ ScrollByLines(textPtr, offset)
 #else
 	    CkTextIndexForwChars(&textPtr->topIndex, dlPtr->count, &new);
 #endif
-	    FreeDLines(textPtr, dlPtr, (DLine *) NULL, 0);
 	    if (new.linePtr == lastLinePtr) {
 		break;
 	    }
@@ -2651,8 +3033,7 @@ CkTextYviewCmd(textPtr, interp, argc, argv)
 		lastLinePtr = CkBTreeFindLine(textPtr->tree,
 			CkBTreeNumLines(textPtr->tree));
 		do {
-		    dlPtr = LayoutDLine(textPtr, &textPtr->topIndex);
-		    dlPtr->nextPtr = NULL;
+		    dlPtr = PeekDLine(textPtr, &textPtr->topIndex);
 #if CK_USE_UTF
 		    CkTextIndexForwBytes(&textPtr->topIndex, dlPtr->count,
 			    &new);
@@ -2661,7 +3042,6 @@ CkTextYviewCmd(textPtr, interp, argc, argv)
 			    &new);
 #endif
 		    pixels -= dlPtr->height;
-		    FreeDLines(textPtr, dlPtr, (DLine *) NULL, 0);
 		    if (new.linePtr == lastLinePtr) {
 			break;
 		    }
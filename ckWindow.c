@@ -16,6 +16,10 @@
 #include "gpm.h"
 #endif
 
+#ifndef __WIN32__
+#include <sys/ioctl.h>
+#endif
+
 /*
  * Main information.
  */
@@ -150,6 +154,7 @@ CkCmd commands[] =
     {"toplevel",	Ck_FrameCmd},
     {"tree",		Ck_TreeCmd},
     {"terminal",        Ck_TerminalCmd},
+    {"emulator",        Ck_EmulatorCmd},
     {"progress",        Ck_ProgressCmd},
     {"playcard",        Ck_PlaycardCmd},
     {"spinbox",         Ck_SpinboxCmd},
@@ -166,9 +171,20 @@ static void	UnlinkWindow _ANSI_ARGS_((CkWindow *winPtr));
 static void	UnlinkToplevel _ANSI_ARGS_((CkWindow *winPtr));
 static void     ChangeToplevelFocus _ANSI_ARGS_((CkWindow *winPtr));
 static void	DoRefresh _ANSI_ARGS_((ClientData clientData));
+static double	RefreshTime _ANSI_ARGS_((void));
+static void	AdaptRefreshDelay _ANSI_ARGS_((CkMainInfo *mainPtr,
+			double cost, int cells));
 static void	RefreshToplevels _ANSI_ARGS_((CkWindow *winPtr));
 static void	RefreshThem _ANSI_ARGS_((CkWindow *winPtr));
+static void	RefreshWindow _ANSI_ARGS_((CkWindow *winPtr));
+static void	DamageArea _ANSI_ARGS_((CkMainInfo *mainPtr, int x, int y,
+			int width, int height));
+static void	DamageWindow _ANSI_ARGS_((CkWindow *winPtr));
+static int	IsOccluded _ANSI_ARGS_((CkWindow *topPtr, int x, int y,
+			int width));
+static int	IsHidden _ANSI_ARGS_((CkWindow *topPtr));
 static void     UpdateHWCursor _ANSI_ARGS_((CkMainInfo *mainPtr));
+static void     MoveHWCursor _ANSI_ARGS_((CkWindow *winPtr));
 static CkWindow *GetWindowXY _ANSI_ARGS_((CkWindow *winPtr, int *xPtr,
 			int *yPtr));
 static int	DeadAppCmdObj _ANSI_ARGS_((ClientData clientData,
@@ -261,6 +277,59 @@ void CkpEndMouse()
   fflush(stdout);
 }
 
+
+/*
+ *--------------------------------------------------------------
+ *
+ * CkpStartPaste --
+ *
+ *	Called to turn on bracketed paste mode of the terminal
+ *
+ * Results:
+ *	Nothing
+ *
+ * Side effects:
+ *	Pasted text is reported enclosed in ESC[200~ and ESC[201~
+ *	which is decoded by CkHandleInput.
+ *
+ *--------------------------------------------------------------
+ */
+
+void CkpStartPaste()
+{
+#ifndef __WIN32__
+  fflush(stdout);
+  fputs("\033[?2004h", stdout);
+  fflush(stdout);
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------
+ *
+ * CkpEndPaste --
+ *
+ *	Called to turn off bracketed paste mode of the terminal
+ *
+ * Results:
+ *	Nothing
+ *
+ * Side effects:
+ *	None
+ *
+ *--------------------------------------------------------------
+ */
+
+void CkpEndPaste()
+{
+#ifndef __WIN32__
+  fflush(stdout);
+  fputs("\033[?2004l", stdout);
+  fflush(stdout);
+#endif
+}
+
 
 /*
  *--------------------------------------------------------------
@@ -537,6 +606,11 @@ Ck_CreateMainWindow(interp, className)
     mainPtr->refreshDelay = 0;
     mainPtr->lastRefresh = 0;
     mainPtr->refreshTimer = NULL;
+    mainPtr->updateCost = 0;
+    mainPtr->updateXmit = 0;
+    mainPtr->damageRows = 0;
+    mainPtr->damageLeft = NULL;
+    mainPtr->damageRight = NULL;
     mainPtr->flags = 0;
     ckMainInfo = mainPtr;
     winPtr->mainPtr = mainPtr;
@@ -679,6 +753,7 @@ Ck_CreateMainWindow(interp, className)
 	mainPtr->flags |= CK_HAS_MOUSE | CK_MOUSE_XTERM;
 	CkpStartMouse();
     }
+    CkpStartPaste();
 #endif	/* __WIN32__ */
 
 #ifdef HAVE_GPM
@@ -1082,6 +1157,7 @@ Ck_DestroyWindow(winPtr)
 	Ck_HandleEvent(winPtr->mainPtr, (CkEvent *) &event);
     }
     if (winPtr->window != NULL) {
+	DamageWindow(winPtr);
 	delwin(winPtr->window);
 	winPtr->window = NULL;
     }
@@ -1146,6 +1222,7 @@ Ck_DestroyWindow(winPtr)
 		}
 	    }
 
+	    CkpEndPaste();
 	    curs_set(1);
 	    if (mainPtr->flags & CK_NOCLR_ON_EXIT) {
 		wattrset(stdscr, A_NORMAL);
@@ -1159,6 +1236,10 @@ Ck_DestroyWindow(winPtr)
 		Tcl_FreeEncoding(mainPtr->isoEncoding);
 	    }
 #endif
+	    if (mainPtr->damageLeft != NULL) {
+		ckfree((char *) mainPtr->damageLeft);
+		ckfree((char *) mainPtr->damageRight);
+	    }
 	    ckfree((char *) mainPtr);
 	    ckMainInfo = NULL;
 	    goto done;
@@ -1378,6 +1459,7 @@ Ck_MoveWindow(winPtr, x, y)
 	newy = 0;
     }
 
+    DamageWindow(winPtr);
     mvwin(winPtr->window, newy, newx);
 
     for (childPtr = winPtr->childList;
@@ -1474,6 +1556,7 @@ Ck_ResizeWindow(winPtr, width, height)
 	winPtr->flags |= CK_MAPPED;
 	evMap++;
     } else {
+	DamageWindow(winPtr);
         delwin(winPtr->window);
     }
     winPtr->window = new;
@@ -1539,6 +1622,7 @@ Ck_UnmapWindow(winPtr)
     if (!(winPtr->flags & CK_MAPPED))
 	return;
     winPtr->flags &= ~CK_MAPPED;
+    DamageWindow(winPtr);
     delwin(winPtr->window);
     winPtr->window = NULL;
     Ck_EventuallyRefresh(winPtr);
@@ -1873,6 +1957,7 @@ Ck_RestackWindow(winPtr, aboveBelow, otherPtr)
     }
 
 done:
+    DamageWindow(winPtr);
     Ck_EventuallyRefresh(winPtr);
     return TCL_OK;
 }
@@ -1983,7 +2068,9 @@ ChangeToplevelFocus(winPtr)
  *
  * Ck_EventuallyRefresh --
  *
- *	Dispatch refresh of entire screen.
+ *	Dispatch refresh of the screen. Only windows whose lines
+ *	have been changed by drawing into them, or which overlap
+ *	screen areas damaged by other windows, are refreshed.
  *
  * Results:
  *	None.
@@ -2010,6 +2097,9 @@ Ck_EventuallyRefresh(winPtr)
  *	TCP buffering.
  *	Therefore the refreshDelay may be used in order to limit updates
  *	to happen not more often than 1000/refreshDelay times per second.
+ *	Refreshes requested while the delay is running are coalesced
+ *	into a single one when the delay expires. With CK_REFRESH_AUTO
+ *	set, refreshDelay is derived from the measured update cost.
  *
  * Results:
  *	None.
@@ -2022,6 +2112,8 @@ DoRefresh(clientData)
     ClientData clientData;
 {
     CkMainInfo *mainPtr = (CkMainInfo *) clientData;
+    double t0;
+    int cells;
 
     if (mainPtr->flags & CK_REFRESH_TIMER) {
 	Tk_DeleteTimerHandler(mainPtr->refreshTimer);
@@ -2032,13 +2124,9 @@ DoRefresh(clientData)
 	return;
     }
     mainPtr->refreshCount = 0;
-    if (mainPtr->refreshDelay > 0) {
-	Tcl_Time tv;
-	double t0;
-	extern void TclpGetTime _ANSI_ARGS_((Tcl_Time *timePtr));
-
-	TclpGetTime(&tv);
-	t0 = (tv.sec + 0.000001 * tv.usec) * 1000;
+    t0 = 0;
+    if (mainPtr->refreshDelay > 0 || (mainPtr->flags & CK_REFRESH_AUTO)) {
+	t0 = RefreshTime();
 	if (t0 - mainPtr->lastRefresh < mainPtr->refreshDelay) {
 	    mainPtr->refreshTimer = Tk_CreateTimerHandler(
 		mainPtr->refreshDelay - (int) (t0 - mainPtr->lastRefresh),
@@ -2048,10 +2136,131 @@ DoRefresh(clientData)
 	}
 	mainPtr->lastRefresh = t0;
     }
+    cells = Ck_UpdateScreen(mainPtr);
+    if (mainPtr->flags & CK_REFRESH_AUTO)
+	AdaptRefreshDelay(mainPtr, RefreshTime() - t0, cells);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ck_UpdateScreen --
+ *
+ *	Synchronously copy the changed and damaged windows to the
+ *	screen, as done by the idle refresh handler. Widgets which
+ *	must show their output immediately (e.g. the terminal)
+ *	call this after drawing, so that the damage information
+ *	is consumed and windows stacked above them are repainted.
+ *
+ * Results:
+ *	The number of screen cells which were damaged.
+ *
+ * Side effects:
+ *	The screen is updated and the damage information cleared.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+Ck_UpdateScreen(mainPtr)
+    CkMainInfo *mainPtr;
+{
+    int i, cells;
+
     curs_set(0);
     RefreshToplevels(mainPtr->topLevPtr);
-    UpdateHWCursor(ckMainInfo);
+    UpdateHWCursor(mainPtr);
     doupdate();
+    CkColorPairsShown();
+    cells = 0;
+    for (i = 0; i < mainPtr->damageRows; i++) {
+	if (mainPtr->damageLeft[i] < mainPtr->damageRight[i])
+	    cells += mainPtr->damageRight[i] - mainPtr->damageLeft[i];
+    }
+    if (mainPtr->damageRows > 0) {
+	memset(mainPtr->damageLeft, 0, mainPtr->damageRows * sizeof (int));
+	memset(mainPtr->damageRight, 0, mainPtr->damageRows * sizeof (int));
+    }
+    return cells;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RefreshTime --
+ *
+ *	Return current time for refresh delay computations.
+ *
+ * Results:
+ *	Time in milliseconds.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static double
+RefreshTime()
+{
+    Tcl_Time tv;
+    extern void TclpGetTime _ANSI_ARGS_((Tcl_Time *timePtr));
+
+    TclpGetTime(&tv);
+    return (tv.sec + 0.000001 * tv.usec) * 1000;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AdaptRefreshDelay --
+ *
+ *	Compute a new refreshDelay from the time spent in the last
+ *	screen update and the amount of output still waiting to be
+ *	sent to the terminal (estimated from the number of screen
+ *	cells updated where the output queue can't be inquired).
+ *	Both are averaged; the output is turned into a transmission
+ *	time using the terminal's baud rate. The delay
+ *	is kept large enough that the terminal (and the link to it)
+ *	can keep up, but below CK_MAX_REFRESH_DELAY in order to
+ *	stay interactive.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The refreshDelay of the main window is modified.
+ *
+ *----------------------------------------------------------------------
+ */
+
+#define CK_MIN_REFRESH_DELAY	10
+#define CK_MAX_REFRESH_DELAY	500
+
+static void
+AdaptRefreshDelay(mainPtr, cost, cells)
+    CkMainInfo *mainPtr;
+    double cost;		/* Milliseconds spent in last update. */
+    int cells;			/* Number of screen cells updated. */
+{
+    int baud = baudrate(), bytes = cells;
+    double xmit, delay;
+
+#ifdef TIOCOUTQ
+    if (ioctl(1, TIOCOUTQ, &bytes) != 0)
+	bytes = cells;
+#endif
+
+    /*
+     * Assume ten bits per byte.
+     */
+
+    xmit = (baud > 0) ? bytes * 10000.0 / baud : 0;
+    mainPtr->updateCost = 0.5 * mainPtr->updateCost + 0.5 * cost;
+    mainPtr->updateXmit = 0.5 * mainPtr->updateXmit + 0.5 * xmit;
+    delay = 2 * mainPtr->updateCost + mainPtr->updateXmit;
+    if (delay < CK_MIN_REFRESH_DELAY)
+	delay = CK_MIN_REFRESH_DELAY;
+    else if (delay > CK_MAX_REFRESH_DELAY)
+	delay = CK_MAX_REFRESH_DELAY;
+    mainPtr->refreshDelay = (int) (delay + 0.5);
 }
 
 /*
@@ -2060,6 +2269,8 @@ DoRefresh(clientData)
  * RefreshToplevels --
  *
  *	Recursively refresh all toplevel windows starting at winPtr.
+ *	Toplevels completely covered by toplevels stacked above
+ *	them are skipped together with their children.
  *
  * Results:
  *	None.
@@ -2073,9 +2284,8 @@ RefreshToplevels(winPtr)
 {
     if (winPtr->topLevPtr != NULL)
 	RefreshToplevels(winPtr->topLevPtr);
-    if (winPtr->window != NULL) {
-	touchwin(winPtr->window);
-	wnoutrefresh(winPtr->window);
+    if (winPtr->window != NULL && !IsHidden(winPtr)) {
+	RefreshWindow(winPtr);
 	if (winPtr->childList != NULL)
 	    RefreshThem(winPtr->childList);
     }
@@ -2102,13 +2312,235 @@ RefreshThem(winPtr)
         RefreshThem(winPtr->nextPtr);
     if (winPtr->flags & CK_TOPLEVEL)
 	return;
-    if (winPtr->window != NULL) {
-	touchwin(winPtr->window);
-	wnoutrefresh(winPtr->window);
-    }
+    if (winPtr->window != NULL)
+	RefreshWindow(winPtr);
     if (winPtr->childList != NULL)
         RefreshThem(winPtr->childList);
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RefreshWindow --
+ *
+ *	Copy the changed lines of a curses window to the virtual
+ *	screen. Lines of the window lying in screen areas damaged
+ *	by windows below it are copied too. The copied lines are
+ *	recorded as damaged, so that windows stacked above will be
+ *	copied over them later on. Windows must be processed bottom
+ *	to top, as done by DoRefresh. Lines completely covered by
+ *	toplevels stacked above are not copied; they'll be repainted
+ *	from the damage recorded when the covering toplevel goes away.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The damage information of the main window is updated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RefreshWindow(winPtr)
+    CkWindow *winPtr;
+{
+    CkMainInfo *mainPtr = winPtr->mainPtr;
+    CkWindow *topPtr;
+    WINDOW *window = winPtr->window;
+    int x, y, width, height, row, line, touched = 0;
+
+    if (window == NULL)
+	return;
+    for (topPtr = winPtr; topPtr->parentPtr != NULL &&
+	 !(topPtr->flags & CK_TOPLEVEL); topPtr = topPtr->parentPtr) {
+	/* Empty loop body. */
+    }
+    if (topPtr == mainPtr->topLevPtr)
+	topPtr = NULL;
+    getbegyx(window, y, x);
+    getmaxyx(window, height, width);
+    DamageArea(mainPtr, 0, 0, 0, y + height);
+    for (row = 0; row < height; row++) {
+	line = y + row;
+	if (topPtr != NULL && IsOccluded(topPtr, x, line, width)) {
+	    wtouchln(window, row, 1, 0);
+	    continue;
+	}
+	if (!is_linetouched(window, row)) {
+	    if (line < 0 ||
+		mainPtr->damageLeft[line] >= mainPtr->damageRight[line] ||
+		mainPtr->damageLeft[line] >= x + width ||
+		mainPtr->damageRight[line] <= x)
+		continue;
+	    touchline(window, row, 1);
+	}
+	touched++;
+	if (line >= 0)
+	    DamageArea(mainPtr, x, line, width, 1);
+    }
+    if (touched)
+	wnoutrefresh(window);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * IsOccluded --
+ *
+ *	Check if a span of a screen line is completely covered by
+ *	the toplevels stacked above a given toplevel.
+ *
+ * Results:
+ *	1 if the span is covered, 0 otherwise.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+IsOccluded(topPtr, x, y, width)
+    CkWindow *topPtr;		/* Toplevel the span belongs to. */
+    int x, y;			/* Screen coordinates of span. */
+    int width;			/* Width of span. */
+{
+    CkWindow *wPtr;
+    int wx, wy, wwidth, wheight, found, right = x + width;
+
+    do {
+	found = 0;
+	for (wPtr = topPtr->mainPtr->topLevPtr; wPtr != NULL &&
+	     wPtr != topPtr; wPtr = wPtr->topLevPtr) {
+	    if (wPtr->window == NULL)
+		continue;
+	    getbegyx(wPtr->window, wy, wx);
+	    getmaxyx(wPtr->window, wheight, wwidth);
+	    if (y >= wy && y < wy + wheight &&
+		x >= wx && x < wx + wwidth) {
+		x = wx + wwidth;
+		found = 1;
+	    }
+	}
+    } while (found && x < right);
+    return x >= right;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * IsHidden --
+ *
+ *	Check if a toplevel is completely covered by the toplevels
+ *	stacked above it.
+ *
+ * Results:
+ *	1 if the toplevel is hidden, 0 otherwise.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+IsHidden(topPtr)
+    CkWindow *topPtr;
+{
+    int x, y, width, height, row;
+
+    if (topPtr == topPtr->mainPtr->topLevPtr)
+	return 0;
+    getbegyx(topPtr->window, y, x);
+    getmaxyx(topPtr->window, height, width);
+    for (row = 0; row < height; row++) {
+	if (!IsOccluded(topPtr, x, y + row, width))
+	    return 0;
+    }
+    return 1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DamageArea --
+ *
+ *	Record that an area of the screen must be repainted on the
+ *	next refresh. The damage arrays grow as needed, thus an
+ *	empty area may be used to make room for height lines.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The damage information of the main window is updated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+DamageArea(mainPtr, x, y, width, height)
+    CkMainInfo *mainPtr;
+    int x, y;			/* Screen coordinates of area. */
+    int width, height;		/* Dimensions of area. */
+{
+    int i, rows;
+
+    if (y < 0) {
+	height += y;
+	y = 0;
+    }
+    if (y + height > mainPtr->damageRows) {
+	rows = y + height;
+	if (rows < mainPtr->maxHeight)
+	    rows = mainPtr->maxHeight;
+	mainPtr->damageLeft = (int *) ckrealloc((char *) mainPtr->damageLeft,
+	    rows * sizeof (int));
+	mainPtr->damageRight = (int *) ckrealloc((char *) mainPtr->damageRight,
+	    rows * sizeof (int));
+	for (i = mainPtr->damageRows; i < rows; i++)
+	    mainPtr->damageLeft[i] = mainPtr->damageRight[i] = 0;
+	mainPtr->damageRows = rows;
+    }
+    if (width <= 0)
+	return;
+    for (i = y; i < y + height; i++) {
+	if (mainPtr->damageLeft[i] >= mainPtr->damageRight[i]) {
+	    mainPtr->damageLeft[i] = x;
+	    mainPtr->damageRight[i] = x + width;
+	    continue;
+	}
+	if (x < mainPtr->damageLeft[i])
+	    mainPtr->damageLeft[i] = x;
+	if (x + width > mainPtr->damageRight[i])
+	    mainPtr->damageRight[i] = x + width;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DamageWindow --
+ *
+ *	Record the screen area covered by a window as damaged, e.g.
+ *	since the window is about to be moved, restacked or unmapped.
+ *
+ * Results:
+ *	None.
+ *
+ * Side effects:
+ *	The damage information of the main window is updated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+DamageWindow(winPtr)
+    CkWindow *winPtr;
+{
+    int x, y, width, height;
+
+    if (winPtr->window == NULL)
+	return;
+    getbegyx(winPtr->window, y, x);
+    getmaxyx(winPtr->window, height, width);
+    DamageArea(winPtr->mainPtr, x, y, width, height);
+}
 
 /*
  *----------------------------------------------------------------------
@@ -2135,7 +2567,7 @@ UpdateHWCursor(mainPtr)
 invisible:
 	curs_set(0);
 	if (mainPtr->focusPtr != NULL && mainPtr->focusPtr->window != NULL)
-	    wnoutrefresh(mainPtr->focusPtr->window);
+	    MoveHWCursor(mainPtr->focusPtr);
         return;
     }
 
@@ -2170,7 +2602,34 @@ invisible:
 	    y >= wPtr->y && y < wPtr->y + wPtr->height)
 	    goto invisible;
     curs_set(1);
-    wnoutrefresh(mainPtr->focusPtr->window);
+    MoveHWCursor(mainPtr->focusPtr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * MoveHWCursor --
+ *
+ *	Place the cursor of the curses virtual screen at the cursor
+ *	position of the given window. Unlike wnoutrefresh() this
+ *	doesn't copy any changed lines of the window, which could
+ *	overwrite windows stacked above it.
+ *
+ * Results:
+ *	None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+MoveHWCursor(winPtr)
+    CkWindow *winPtr;
+{
+    int x, y, bx, by;
+
+    getbegyx(winPtr->window, by, bx);
+    getyx(winPtr->window, y, x);
+    setsyx(by + y, bx + x);
 }
 
 /*
@@ -2425,6 +2884,7 @@ ExecCmd(clientData, interp, argc, argv)
     	curs_set(1);
 	nodelay(stdscr, FALSE);
 	CkpEndMouse();
+	CkpEndPaste();
         endwin();
 #ifdef SIGINT
 #ifdef HAVE_SIGACTION
@@ -2456,6 +2916,7 @@ ExecCmd(clientData, interp, argc, argv)
         argv[1] = savedargv1;
 	nodelay(stdscr, TRUE);
 	CkpStartMouse();
+	CkpStartPaste();
         Ck_EventuallyRefresh(redirInfo->mainPtr->winPtr);
     }
     return result;
@@ -2791,6 +3252,10 @@ CkEvtSetup(clientData, flags)
       && (ckMainInfo->flags & CK_RESIZING)) {
     time.usec = 0; 
   }
+  /* input left over by a handler which entered a nested event loop */
+  if (CkInputPending()) {
+    time.usec = 0;
+  }
   Tcl_SetMaxBlockTime (&time);
 }
 
@@ -2807,4 +3272,5 @@ CkEvtCheck(clientData, flags)
     /* queue event */
     Ck_QueueFullResizeEvent(ckMainInfo->winPtr);
   }
+  CkQueueInput();
 }
@@ -70,12 +70,27 @@
 #define DEF_TERMINAL_TAKE_FOCUS             "0"
 #define DEF_TERMINAL_WIDTH                  "80"
 #define DEF_TERMINAL_SCROLLBACK             "1000"
+#define DEF_TERMINAL_SCROLLBACK_BUDGET      "4194304"
 #define DEF_TERMINAL_EXEC                   NULL
 #define DEF_TERMINAL_TERM                   "xterm"
 #define DEF_TERMINAL_REDISPLAY              "line"
+#define DEF_TERMINAL_PTY                    "1"
+#define DEF_TERMINAL_READBUDGET             "65536"
+#define DEF_TERMINAL_TEEBUFFER              "1048576"
+#define DEF_TERMINAL_TEEPOLICY              "block"
 #define DEF_TERMINAL_COMMANDKEY             "b"
 #define DEF_TERMINAL_BANNER                 NULL
 
+#define DEF_EMULATOR_BG                     "black"
+#define DEF_EMULATOR_FG                     "white"
+#define DEF_EMULATOR_HEIGHT                 "24"
+#define DEF_EMULATOR_WIDTH                  "80"
+#define DEF_EMULATOR_SCROLLBACK             "1000"
+#define DEF_EMULATOR_SCROLLBACK_BUDGET      "4194304"
+#define DEF_EMULATOR_READBUDGET             "65536"
+#define DEF_EMULATOR_EXEC                   NULL
+#define DEF_EMULATOR_TERM                   "xterm"
+
 #define DEF_BUTTON_ACTIVE_ATTR_COLOR     "normal"
 #define DEF_BUTTON_ACTIVE_ATTR_MONO      "reverse"
 #define DEF_BUTTON_ACTIVE_BG_COLOR       "white"
@@ -141,6 +156,8 @@
 #define DEF_LISTBOX_ACTIVE_FG_MONO       "white"
 #define DEF_LISTBOX_BG_COLOR             "black"
 #define DEF_LISTBOX_BG_MONO              "black"
+#define DEF_LISTBOX_COUNT                "0"
+#define DEF_LISTBOX_DATA_COMMAND         NULL
 #define DEF_LISTBOX_FG                   "white"
 #define DEF_LISTBOX_ATTR                 "normal"
 #define DEF_LISTBOX_HEIGHT               "10"
@@ -188,10 +205,13 @@
 
 
 #define DEF_TEXT_ATTR                    "normal"
+#define DEF_TEXT_AUTO_SEPARATORS         "1"
 #define DEF_TEXT_BG_COLOR                "black"
 #define DEF_TEXT_BG_MONO                 "black"
 #define DEF_TEXT_FG                      "white"
 #define DEF_TEXT_HEIGHT                  "10"
+#define DEF_TEXT_MAX_LINES               "0"
+#define DEF_TEXT_MAX_UNDO                "0"
 #define DEF_TEXT_SELECT_ATTR_COLOR       "normal"
 #define DEF_TEXT_SELECT_ATTR_MONO        "reverse"
 #define DEF_TEXT_SELECT_BG_COLOR         "white"
@@ -201,6 +221,7 @@
 #define DEF_TEXT_STATE                   "normal"
 #define DEF_TEXT_TABS                    ""
 #define DEF_TEXT_TAKE_FOCUS              "1"
+#define DEF_TEXT_UNDO                    "0"
 #define DEF_TEXT_WIDTH                   "40"
 #define DEF_TEXT_WRAP                    "char"
 #define DEF_TEXT_XSCROLL_COMMAND         NULL
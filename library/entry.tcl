@@ -45,6 +45,9 @@ bind Entry <Select> {
 bind Entry <KeyPress> {
     ckEntryInsert %W %A
 }
+bind Entry <<Paste>> {
+    ckEntryInsert %W %A
+}
 bind Entry <Control> {# nothing}
 bind Entry <Escape> {# nothing}
 bind Entry <Return> {# nothing}
@@ -76,6 +76,9 @@ bind Text <BackSpace> {
 bind Text <KeyPress> {
     ckTextInsert %W %A
 }
+bind Text <<Paste>> {
+    ckTextInsert %W %A
+}
 bind Text <Button-1> {
     if [ckFocusOK %W] {
         ckTextSetCursor %W @%x,%y
@@ -92,6 +95,10 @@ bind Text <Control> {# nothing}
 
 bind Text <Control-x> {focus [ck_focusNext %W]}
 
+bind Text <Control-z> {
+    catch {%W edit undo}
+}
+
 bind Text <Control-a> {
     ckTextSetCursor %W {insert linestart}
 }
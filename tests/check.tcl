@@ -0,0 +1,40 @@
+# check.tcl --
+#
+#	Procedures shared by the regression tests.  A test sources this
+#	file, calls "check" for each condition it verifies, and ends with
+#	"finish".
+#
+#	The results go to stderr: curses owns stdout while the script
+#	runs, and a terminal with an alternate screen throws away what
+#	was written there.  "make test" collects them in tests.log.
+
+set failed 0
+set results {}
+
+# check --
+#
+#	Records whether the expression cond, evaluated in the caller's
+#	context, is true.
+
+proc check {what cond} {
+    global failed results
+    if {[uplevel 1 [list expr $cond]]} {
+	set status ok
+    } else {
+	set status FAILED
+	set failed 1
+    }
+    lappend results "$status: $what"
+}
+
+# finish --
+#
+#	Writes the results and exits with status 1 if a check failed.
+
+proc finish {} {
+    global failed results
+    foreach r $results {
+	puts stderr $r
+    }
+    exit $failed
+}
@@ -0,0 +1,88 @@
+# colorpairs.tcl --
+#
+#	Regression test for the color pair cache of Ck_GetPair: pairs are
+#	found again by their colors, a pair still displayed is never
+#	redefined, and pairs no longer displayed are.
+#
+#	Run by "make test", or with "cwsh tests/colorpairs.tcl 2>log" on
+#	a color terminal.  The results are written to stderr and the
+#	script exits with status 1 if a check fails.
+
+source [file join [file dirname [info script]] check.tcl]
+proc stats {} {
+    update
+    array set s [curses colorpairs]
+    return [array get s]
+}
+
+set colors 8
+foreach n {16 256} {
+    if {![catch {label .probe -fg @[expr {$n - 1}]}]} {
+	set colors $n
+    }
+    catch {destroy .probe}
+}
+array set s [stats]
+set size $s(size)
+if {$colors < 2 || $size < 2} {
+    puts "skipped: the terminal has no colors"
+    exit 0
+}
+
+# fill the pairs with labels shown side by side, one combination each
+set combos {}
+for {set fg 0} {$fg < $colors && [llength $combos] < 2 * ($size + 10)} {incr fg} {
+    for {set bg 0} {$bg < $colors && [llength $combos] < 2 * ($size + 10)} {incr bg} {
+	lappend combos $fg $bg
+    }
+}
+set i 0
+foreach {fg bg} [lrange $combos 0 [expr {2 * ($size - 4) - 1}]] {
+    label .l$i -text x -fg @$fg -bg @$bg
+    place .l$i -x [expr {$i % 40}] -y [expr {$i / 40}]
+    incr i
+}
+array set s [stats]
+check "pairs allocated for each combination" {$s(used) >= $size - 4}
+check "no eviction while pairs remain" {$s(evictions) == 0}
+
+# the same colors find the same pairs
+set misses $s(misses)
+.l0 configure -attributes bold
+array set s [stats]
+check "lookup of a known combination is a hit" {$s(misses) == $misses}
+
+# more combinations than pairs while all are displayed: the new ones
+# get the default colors, with at most one scan of the screen per update
+set scans $s(scans)
+set first $i
+foreach {fg bg} [lrange $combos [expr {2 * ($size - 4)}] end] {
+    label .l$i -text x -fg @$fg -bg @$bg
+    place .l$i -x [expr {$i % 40}] -y [expr {$i / 40}]
+    incr i
+}
+array set s [stats]
+check "all pairs in use" {$s(used) == $size}
+check "displayed pairs are not redefined" {$s(evictions) == 0}
+check "lookups beyond the pairs get the default colors" {$s(forced) > 0}
+check "one scan for all the lookups of an update" {$s(scans) - $scans == 1}
+
+# the labels shown longest, which aren't drawn again, keep their pairs
+set misses $s(misses)
+for {set k 0} {$k < $first} {incr k} { .l$k configure -text y }
+array set s [stats]
+check "displayed labels keep their pairs" {$s(misses) == $misses}
+
+# pairs of labels gone are redefined for the labels without one
+for {set k 0} {$k < 10} {incr k} { destroy .l$k }
+update
+for {set k $first} {$k < $i} {incr k} { .l$k configure -text z }
+array set s [stats]
+check "pairs no longer displayed are redefined" \
+    {$s(evictions) > 0 && $s(evictions) <= 10}
+set misses $s(misses)
+for {set k 10} {$k < $first} {incr k} { .l$k configure -text x }
+array set s [stats]
+check "the other labels still keep their pairs" {$s(misses) == $misses}
+
+finish
@@ -0,0 +1,54 @@
+# emulator.tcl --
+#
+#	Regression test for the screens of the emulator command: they are
+#	kept in memory, cell by cell, whether or not a terminal shows them,
+#	and what is fed to them is given to the parser as a program would
+#	write it.
+#
+#	Run by "make test", or with "cwsh tests/emulator.tcl 2>log" in a
+#	UTF-8 locale, or without a terminal with "tclsh tests/emulator.tcl
+#	libck8.6.so" when Ck is built as a shared library.  The results
+#	are written to stderr and the script exits with status 1 if a
+#	check fails.
+
+source [file join [file dirname [info script]] check.tcl]
+
+# without a Ck main window the emulator is loaded on its own
+if {[info commands emulator] eq ""} {
+    load [lindex $argv 0] Ckemulator
+}
+
+emulator e -width 10 -height 3 -scrollback 100
+
+# NUL is a control character, not the two bytes of Tcl's UTF-8
+e feed "a\0bé"
+check "NUL not printed" {[e line 0] eq "abé"}
+
+# colors are kept as they were asked for
+e feed "\033\[H\033\[2J\033\[1;31mR\033\[0;38;5;200;44mX\033\[0m"
+check "attributes and color of a cell" {[e cell 0 0] eq "R bold red default"}
+check "color beyond the first eight" {[e cell 0 1] eq "X normal 200 blue"}
+
+# a double width character cut in two is blanked whole
+e feed "\033\[H\033\[2J中文x"
+check "double width characters take two cells" \
+    {[lindex [e cell 0 0] 0] eq "中" && [lindex [e cell 0 2] 0] eq "文"}
+e feed "\033\[1;2H\033\[P"
+check "deleting half of a character blanks it" {[e line 0] eq " 文x"}
+e feed "\033\[1;3H\033\[X"
+check "erasing half of a character blanks it" {[e line 0] eq "   x"}
+
+# cursor and scrolling region
+e feed "\033\[H\033\[2J1\r\n2\r\n3\033\[2;3r\033\[3;1H\n4"
+check "scrolling region" {[e line 0] eq "1" && [e line 1] eq "3"
+    && [e line 2] eq "4" && [e saved] == 0}
+check "cursor position" {[e cursor] eq "2 1"}
+e feed "\033\[r\033c"
+
+# a blank line scrolled off is saved
+e feed "\r\n\r\n\r\nx"
+check "blank saved line" {[e saved] == 1 && [e line -1] eq ""}
+
+e destroy
+
+finish
@@ -0,0 +1,80 @@
+# reflow.tcl --
+#
+#	Regression test for the scrollback of the terminal widget: lines
+#	joined by autowrap are saved whole and wrapped again at the width
+#	of the terminal, erasing the screen ends the line that went on
+#	on its first row, and double width characters are never split.
+#
+#	Run by "make test", or with "cwsh tests/reflow.tcl 2>log" in a
+#	UTF-8 locale.  The results are written to stderr and the script
+#	exits with status 1 if a check fails.
+
+source [file join [file dirname [info script]] check.tcl]
+
+# rows taken by the saved lines of the terminal showing the emulator
+proc rows {width} {
+    .t configure -width $width
+    update
+    set first [lindex [.t yview] 0]
+    set height [.t cget -height]
+    return [expr {round($first * $height / (1.0 - $first))}]
+}
+
+terminal .t -pty 0 -width 10 -height 3
+pack .t
+update
+
+# a line wrapped by the terminal is saved as one line
+emulator e -width 10 -height 3 -scrollback 100
+e feed "[string repeat a 25]\r\nx\r\ny\r\nz"
+check "wrapped rows saved as one line" {[e saved] == 1}
+check "saved line has all its text" {[e line -1] eq [string repeat a 25]}
+.t attach e
+check "saved line takes 3 rows at width 10" {[rows 10] == 3}
+check "saved line takes 5 rows at width 5" {[rows 5] == 5}
+check "saved line takes 1 row at width 30" {[rows 30] == 1}
+.t detach
+e destroy
+
+# a double width character that does not fit moves to the next row
+emulator e -width 10 -height 3 -scrollback 100
+e feed "123456789中\r\nx\r\ny\r\nz"
+check "padded rows saved as one line" {[e saved] == 1}
+check "padding blank not saved" {[e line -1] eq "123456789中"}
+.t attach e
+check "wide character moves to the next row at width 10" {[rows 10] == 2}
+check "wide character fits at width 11" {[rows 11] == 1}
+check "wide character moves to the next row at width 5" {[rows 5] == 3}
+check "wide character starts a row at width 9" {[rows 9] == 2}
+.t detach
+e destroy
+
+# erasing the screen ends the line going on on its first row
+foreach {how seq} {
+    "ED 2" "\033\[2J\033\[H"
+    "ED 0" "\033\[H\033\[J"
+    "EL 0" "\033\[H\033\[K"
+    "clear" "\033\[H\033\[2J"
+    "reset" "\033c"
+} {
+    emulator e -width 10 -height 3 -scrollback 100
+    e feed "[string repeat A 10]BBB\r\n\r\n"
+    e feed $seq
+    e feed "q\r\nr\r\ns\r\nt"
+    check "$how: erased row not joined to the saved line" \
+	{[e saved] == 2 && [e line -2] eq [string repeat A 10]
+	     && [e line -1] eq "q"}
+    e destroy
+}
+
+# resizing ends it as well
+emulator e -width 10 -height 3 -scrollback 100
+e feed "[string repeat A 10]BBB\r\n\r\n"
+e configure -width 12
+e feed "\r\n"
+check "resize: row not joined to the saved line" \
+    {[e saved] == 2 && [e line -2] eq [string repeat A 10]
+	 && [e line -1] eq "BBB"}
+e destroy
+
+finish
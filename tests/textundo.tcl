@@ -0,0 +1,71 @@
+# textundo.tcl --
+#
+#	Regression test for the undo and redo lists of the text widget:
+#	edits are undone and redone by groups, a deletion that removes
+#	nothing leaves the lists and the modified flag alone, and the
+#	text holds nothing the lists can't put back.
+#
+#	Run by "make test", or with "cwsh tests/textundo.tcl 2>log" in a
+#	UTF-8 locale.  The results are written to stderr and the script
+#	exits with status 1 if a check fails.
+
+source [file join [file dirname [info script]] check.tcl]
+
+text .t -undo 1 -width 20 -height 5
+pack .t
+update
+
+# typed characters are one group, a jump starts another
+foreach c {a b c} {
+    .t insert insert $c
+}
+.t insert 1.0 "é\nx"
+check "text inserted" {[.t get 1.0 end-1c] eq "é\nxabc"}
+.t edit undo
+check "undo of the last group" {[.t get 1.0 end-1c] eq "abc"}
+.t edit undo
+check "undo of the typed characters" {[.t get 1.0 end-1c] eq ""}
+check "nothing more to undo" {[catch {.t edit undo} msg] && $msg eq "nothing to undo"}
+.t edit redo
+.t edit redo
+check "redo of both groups" {[.t get 1.0 end-1c] eq "é\nxabc"}
+
+# deletions are put back as they were
+.t delete 1.0 2.2
+check "deletion" {[.t get 1.0 end-1c] eq "bc"}
+.t edit undo
+check "undo of a deletion across lines" {[.t get 1.0 end-1c] eq "é\nxabc"}
+.t edit redo
+check "redo of a deletion" {[.t get 1.0 end-1c] eq "bc"}
+
+# a new edit empties the redo list
+.t edit undo
+.t insert end "z"
+check "redo list emptied by an edit" \
+    {[catch {.t edit redo} msg] && $msg eq "nothing to redo"}
+
+# deleting nothing isn't an edit
+.t edit reset
+.t edit modified 0
+.t delete end-1c
+.t delete 1.0 1.0
+.t delete 2.0 1.0
+check "zero-length deletes leave the flag alone" {![.t edit modified]}
+check "zero-length deletes aren't recorded" {[catch {.t edit undo}]}
+check "zero-length deletes leave the text alone" \
+    {[.t get 1.0 end-1c] eq "é\nxabcz"}
+.t delete 1.0 end
+check "deleting all keeps the last newline" {[.t get 1.0 end] eq "\n"}
+check "deleting all is an edit" {[.t edit modified]}
+.t edit undo
+check "undo of deleting all" {[.t get 1.0 end-1c] eq "é\nxabcz"}
+
+# embedded windows aren't supported, so the text holds only characters
+button .t.b -text b
+check "no embedded windows" {[catch {.t window create end -window .t.b}]}
+.t edit redo
+check "lists untouched by the refused window" {[.t get 1.0 end-1c] eq ""}
+
+destroy .t
+
+finish
@@ -0,0 +1,245 @@
+/*
+ * vtbench.c --
+ *
+ *	Micro-benchmark for the escape sequence parser of the terminal
+ *	widget.  Output captures are fed through vtwrite with callbacks
+ *	that do nothing, so only the decoding and the dispatch through
+ *	the state tables are measured.  The result is printed in MB/s.
+ *
+ *	The parser is declared in ckTerminal.h and linked from the Ck
+ *	library.  Build the driver in the build directory after "make"
+ *	with the compiler flags of the Makefile, e.g.
+ *
+ *	    cc -O2 $(CC_SWITCHES) -o vtbench tests/vtbench.c \
+ *		libck8.6.a -ltcl8.6 -lncursesw -lutil -lm
+ *
+ *	Run with "vtbench ?-n rounds? ?file ...?".  Captures of real
+ *	sessions (e.g. "script -q -c vttest vttest.log") can be given as
+ *	files; without files, a vttest-like and an htop-like stream are
+ *	generated.
+ *
+ * Copyright (c) 2019 VCA
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ */
+
+#include "../ckPort.h"
+#include "../ck.h"
+#include "../ckTerminal.h"
+
+#include <locale.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+typedef struct Capture {
+    const char *name;
+    char *data;
+    size_t size;
+    size_t space;
+} Capture;
+
+static int nEvents = 0;
+
+static void
+count(VTPARSER *v, void *p, wchar_t w, wchar_t iw, int argc, int *argv,
+      const wchar_t *osc)
+{
+    (void) v; (void) p; (void) w; (void) iw;
+    (void) argc; (void) argv; (void) osc;
+    nEvents++;
+}
+
+static void
+append(Capture *c, const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    for (;;) {
+	va_start(ap, fmt);
+	len = vsnprintf(c->data + c->size, c->space - c->size, fmt, ap);
+	va_end(ap);
+	if (len >= 0 && c->size + len < c->space) {
+	    break;
+	}
+	c->space = c->space ? 2 * c->space : 65536;
+	c->data = realloc(c->data, c->space);
+	if (c->data == NULL) {
+	    perror("vtbench");
+	    exit(1);
+	}
+    }
+    c->size += len;
+}
+
+/*
+ * A vttest-like stream: screen alignment, scroll regions, cursor
+ * movement, tab stops, line drawing characters and character sets.
+ */
+
+static void
+MakeVttest(Capture *c)
+{
+    int i, j;
+
+    c->name = "vttest";
+    while (c->size < 4 * 1024 * 1024) {
+	append(c, "\033[2J\033[H\033#8\033[9;10H\033[1J\033[18;60H\033[0J");
+	append(c, "\033[1;24r\033[24;1H");
+	for (i = 0; i < 24; i++) {
+	    append(c, "\033[%d;%dH*\033[%d;%dH+\033D", i + 1, 1, i + 1, 80);
+	}
+	append(c, "\033[3g\033[1;1H");
+	for (i = 0; i < 10; i++) {
+	    append(c, "\033[%dC\033H", 3);
+	}
+	append(c, "\033(0lqqqqqqqqqqqqqqqqqqqqqqqqqqk\r\n");
+	for (i = 0; i < 8; i++) {
+	    append(c, "x\033[26Cx\r\n");
+	}
+	append(c, "mqqqqqqqqqqqqqqqqqqqqqqqqqqj\033(B\r\n");
+	for (j = 0; j < 6; j++) {
+	    append(c, "\033[%d;%dr\033[%d;1H", j + 2, 20 - j, 20 - j);
+	    for (i = 0; i < 20; i++) {
+		append(c, "Scrolled line %d of region %d\r\n", i, j);
+	    }
+	    append(c, "\033M\033M\033[2L\033[3M\033[4P\033[2@\033[5X");
+	}
+	append(c, "\033[r\033[?6h\033[?6l\033[?7l%s\033[?7h\r\n",
+		"The quick brown fox jumps over the lazy dog 0123456789");
+	append(c, "\033[1mBold\033[0m \033[4mUnderline\033[0m "
+		"\033[5mBlink\033[0m \033[7mReverse\033[0m\r\n");
+	append(c, "\0337\033[10;10H\033[6n\0338\033]0;vttest\007");
+    }
+}
+
+/*
+ * An htop-like stream: a full screen of short colored fields placed
+ * with absolute cursor addressing, redrawn over and over.
+ */
+
+static void
+MakeHtop(Capture *c)
+{
+    int frame = 0, i, j;
+
+    c->name = "htop";
+    while (c->size < 4 * 1024 * 1024) {
+	append(c, "\033[?25l\033[H");
+	for (i = 0; i < 4; i++) {
+	    append(c, "\033[%d;3H\033[1m\033[36m%d\033[0m\033[1m[", i + 1, i);
+	    for (j = 0; j < 30; j++) {
+		append(c, "\033[%dm|", (i + j + frame) % 3 ? 32 : 31);
+	    }
+	    append(c, "\033[37m%5.1f%%\033[0m\033[1m]\033[0m\033[K",
+		    (double) ((i * 17 + frame * 7) % 1000) / 10.0);
+	}
+	append(c, "\033[6;1H\033[30;42m    PID USER      PRI  NI  VIRT   RES"
+		"   SHR S CPU%% MEM%%   TIME+  Command\033[K\033[0m");
+	for (i = 0; i < 17; i++) {
+	    append(c, "\033[%d;1H%s%7d \033[39muser%-5d \033[0m %3d %3d "
+		    "\033[36m%5dM \033[0m%5dM %5dM S \033[1m%4.1f\033[0m "
+		    "%4.1f %3d:%02d.%02d \033[32m/usr/bin/process-%d\033[0m"
+		    "\033[K", i + 7, i == frame % 17 ? "\033[30;46m" : "",
+		    1000 + i * 37, i % 3, 20, 0, 100 + i, 50 + i, 10 + i,
+		    (double) ((frame + i) % 100) / 10.0, (double) i / 10.0,
+		    i, (frame + i) % 60, frame % 100, i);
+	}
+	append(c, "\033[24;1HF1\033[30;46mHelp  \033[0mF2\033[30;46mSetup \033[0m"
+		"F3\033[30;46mSearch\033[0mF10\033[30;46mQuit\033[0m\033[?25h");
+	frame++;
+    }
+}
+
+static void
+ReadCapture(Capture *c, const char *name)
+{
+    FILE *f = fopen(name, "rb");
+    size_t got;
+
+    if (f == NULL) {
+	perror(name);
+	exit(1);
+    }
+    c->name = name;
+    do {
+	if (c->size == c->space) {
+	    c->space = c->space ? 2 * c->space : 65536;
+	    c->data = realloc(c->data, c->space);
+	    if (c->data == NULL) {
+		perror("vtbench");
+		exit(1);
+	    }
+	}
+	got = fread(c->data + c->size, 1, c->space - c->size, f);
+	c->size += got;
+    } while (got > 0);
+    fclose(f);
+}
+
+static void
+Run(Capture *c, int rounds)
+{
+    VTPARSER vp;
+    Tcl_Time t0, t1;
+    double secs;
+    int i;
+    wchar_t w;
+
+    memset(&vp, 0, sizeof(vp));
+    for (w = 0; w < MAXCALLBACK; w++) {
+	vtonevent(&vp, VTPARSER_CONTROL, w, count);
+	vtonevent(&vp, VTPARSER_ESCAPE, w, count);
+	vtonevent(&vp, VTPARSER_CSI, w, count);
+    }
+    vtonevent(&vp, VTPARSER_PRINT, 0, count);
+    vtonevent(&vp, VTPARSER_PRINTRUN, 0, count);
+    vtonevent(&vp, VTPARSER_OSC, 0, count);
+
+    nEvents = 0;
+    Tcl_GetTime(&t0);
+    for (i = 0; i < rounds; i++) {
+	vtwrite(&vp, c->data, c->size);
+    }
+    Tcl_GetTime(&t1);
+    secs = (t1.sec - t0.sec) + (t1.usec - t0.usec) / 1e6;
+    printf("%-12s %8.1f MB/s  (%lu bytes x %d, %d events)\n", c->name,
+	    (double) c->size * rounds / secs / (1024 * 1024),
+	    (unsigned long) c->size, rounds, nEvents);
+}
+
+int
+main(int argc, char **argv)
+{
+    Capture c;
+    int rounds = 20, i = 1;
+
+    setlocale(LC_CTYPE, "");
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+	rounds = atoi(argv[2]);
+	if (rounds <= 0) {
+	    fprintf(stderr, "vtbench: bad number of rounds \"%s\"\n", argv[2]);
+	    return 1;
+	}
+	i = 3;
+    }
+    if (i < argc) {
+	for (; i < argc; i++) {
+	    memset(&c, 0, sizeof(c));
+	    ReadCapture(&c, argv[i]);
+	    Run(&c, rounds);
+	    free(c.data);
+	}
+	return 0;
+    }
+    memset(&c, 0, sizeof(c));
+    MakeVttest(&c);
+    Run(&c, rounds);
+    free(c.data);
+    memset(&c, 0, sizeof(c));
+    MakeHtop(&c);
+    Run(&c, rounds);
+    free(c.data);
+    return 0;
+}